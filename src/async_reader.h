@@ -0,0 +1,479 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include "job_pool.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <cerrno>
+#define ASYNC_READER_IO_URING 1
+#endif
+
+// Batched file reader. Reads are queued with ReadFile and issued together by Flush with
+// up to QueueDepth of them in flight. On Linux they go through io_uring (open, read and close are
+// all ring operations, so a batch of small files costs a handful of syscalls); elsewhere, or if
+// the kernel refuses io_uring or lacks one of those operations, a pool of threads does blocking
+// pread calls instead. Each finished
+// read is handed to the shared JobPool as its own job, so decoding starts while other reads are
+// still in flight
+class AsyncReader
+{
+public:
+    typedef std::function<void(std::vector<unsigned char>&& data, bool ok)> Callback;
+
+    struct ReaderStats
+    {
+        int Reads = 0;
+        uint64_t Bytes = 0;
+        int Syscalls = 0;       // io_uring_enter calls, or open/fstat/pread/close calls on the Linux fallback
+    };
+    ReaderStats Stats;
+
+    explicit AsyncReader(unsigned int queueDepth = 64, bool allowIoUring = true)
+        : queueDepth(queueDepth < 1 ? 1 : queueDepth)
+    {
+#ifdef ASYNC_READER_IO_URING
+        if (allowIoUring)
+            setupRing();
+#endif
+        if (!UsesIoUring())
+            ioPool.reset(new JobPool(this->queueDepth < 32 ? this->queueDepth : 32));
+    }
+
+    ~AsyncReader()
+    {
+        Flush();
+#ifdef ASYNC_READER_IO_URING
+        if (ringFd >= 0)
+            closeRing();
+#endif
+    }
+
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+
+    bool UsesIoUring() const
+    {
+#ifdef ASYNC_READER_IO_URING
+        return ringFd >= 0;
+#else
+        return false;
+#endif
+    }
+
+    // reads a whole file
+    void ReadFile(const std::string& path, Callback done)
+    {
+        Request request;
+        request.path = path;
+        request.done = std::move(done);
+        queued.push_back(std::move(request));
+    }
+
+    // issues every queued read and returns once all of them and their callbacks have finished
+    void Flush()
+    {
+        if (!queued.empty())
+        {
+#ifdef ASYNC_READER_IO_URING
+            if (ringFd >= 0)
+                flushRing();
+            else
+#endif
+                flushPool();
+        }
+        std::unique_lock<std::mutex> lock(callbackMutex);
+        callbacksDone.wait(lock, [this] { return callbacksPending == 0; });
+    }
+
+private:
+    enum Request_State { OPENING, READING, CLOSING };
+
+    struct Request
+    {
+        std::string path;
+        int fd = -1;
+        size_t size = 0;                // known once fstat has run on the fallback, 0 means read to end of file
+        size_t received = 0;
+        std::vector<unsigned char> data;
+        Callback done;
+        Request_State state = OPENING;
+        bool ok = true;
+    };
+
+    unsigned int queueDepth;
+    std::deque<Request> queued;
+    std::unique_ptr<JobPool> ioPool;
+    std::mutex callbackMutex;
+    std::condition_variable callbacksDone;
+    int callbacksPending = 0;
+
+    // hands the finished read to a decoder job
+    void complete(Request& request)
+    {
+        Stats.Reads++;
+        Stats.Bytes += request.received;
+        request.data.resize(request.received);
+        {
+            std::lock_guard<std::mutex> lock(callbackMutex);
+            callbacksPending++;
+        }
+        auto data = std::make_shared<std::vector<unsigned char>>(std::move(request.data));
+        Callback done = std::move(request.done);
+        bool ok = request.ok;
+        JobPool::Instance().Submit([this, data, done, ok]()
+        {
+            done(std::move(*data), ok);
+            std::lock_guard<std::mutex> lock(callbackMutex);
+            if (--callbacksPending == 0)
+                callbacksDone.notify_all();
+        });
+    }
+
+    void flushPool()
+    {
+        std::atomic<int> syscalls{ 0 };
+        std::mutex statsMutex;
+        std::vector<std::shared_ptr<Request>> requests;
+        for (Request& request : queued)
+            requests.push_back(std::make_shared<Request>(std::move(request)));
+        queued.clear();
+
+        int remaining = (int)requests.size();
+        std::mutex doneMutex;
+        std::condition_variable allRead;
+        for (std::shared_ptr<Request>& request : requests)
+        {
+            ioPool->Submit([this, request, &syscalls, &statsMutex, &remaining, &doneMutex, &allRead]()
+            {
+                readBlocking(*request, syscalls);
+                {
+                    std::lock_guard<std::mutex> lock(statsMutex);
+                    complete(*request);
+                }
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--remaining == 0)
+                    allRead.notify_all();
+            });
+        }
+        std::unique_lock<std::mutex> lock(doneMutex);
+        allRead.wait(lock, [&] { return remaining == 0; });
+        Stats.Syscalls += syscalls.load();
+    }
+
+    static void readBlocking(Request& request, std::atomic<int>& syscalls)
+    {
+#ifdef __linux__
+        int fd = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        syscalls += 2;
+        if (fd < 0 || fstat(fd, &info) != 0)
+        {
+            request.ok = false;
+            if (fd >= 0)
+                close(fd);
+            return;
+        }
+        request.size = (size_t)info.st_size;
+        request.data.resize(request.size);
+        while (request.received < request.size)
+        {
+            ssize_t got = pread(fd, request.data.data() + request.received, request.size - request.received, (off_t)request.received);
+            syscalls++;
+            if (got <= 0)
+                break;
+            request.received += (size_t)got;
+        }
+        request.ok = request.received == request.size;
+        close(fd);
+        syscalls++;
+#else
+        std::ifstream in(request.path, std::ios::binary | std::ios::ate);
+        if (!in)
+        {
+            request.ok = false;
+            return;
+        }
+        request.data.resize((size_t)in.tellg());
+        in.seekg(0);
+        in.read((char*)request.data.data(), request.data.size());
+        request.received = (size_t)in.gcount();
+        request.ok = request.received == request.data.size();
+#endif
+    }
+
+#ifdef ASYNC_READER_IO_URING
+    static const size_t INITIAL_READ_SIZE = 64 * 1024;   // whole-file reads grow from here
+
+    int ringFd = -1;
+    void* sqRing = NULL;
+    void* cqRing = NULL;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    io_uring_sqe* sqes = NULL;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    io_uring_cqe* cqes;
+    unsigned int ringEntries = 0;
+
+    void setupRing()
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = (int)syscall(__NR_io_uring_setup, queueDepth, &params);
+        if (ringFd < 0)
+            return;
+        if (!supportsOperations())
+        {
+            closeRing();
+            return;
+        }
+        int fd = ringFd;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+        sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing :
+            mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            closeRing();
+            return;
+        }
+
+        char* sq = (char*)sqRing;
+        sqHead = (unsigned*)(sq + params.sq_off.head);
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        char* cq = (char*)cqRing;
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        ringEntries = params.sq_entries;
+    }
+
+    // openat, read and close all have to be ring operations (Linux 5.6 on); older kernels lack the
+    // probe as well
+    bool supportsOperations() const
+    {
+        const unsigned int probedOps = 256;
+        std::vector<unsigned char> storage(sizeof(io_uring_probe) + probedOps * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = (io_uring_probe*)storage.data();
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, probedOps) < 0)
+            return false;
+        for (int op : { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE })
+        {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+        return true;
+    }
+
+    void closeRing()
+    {
+        if (sqRing && sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (cqRing && cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqes && (void*)sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        sqRing = cqRing = NULL;
+        sqes = NULL;
+        close(ringFd);
+        ringFd = -1;
+    }
+
+    void pushSqe(Request* request)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = (uint64_t)(uintptr_t)request;
+        switch (request->state)
+        {
+        case OPENING:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)request->path.c_str();
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            break;
+        case READING:
+        {
+            if (request->data.size() == request->received)
+                request->data.resize(request->data.empty() ? INITIAL_READ_SIZE : request->data.size() * 2);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = request->fd;
+            sqe->addr = (uint64_t)(uintptr_t)(request->data.data() + request->received);
+            sqe->len = (unsigned)(request->data.size() - request->received);
+            sqe->off = request->received;
+            break;
+        }
+        case CLOSING:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = request->fd;
+            break;
+        }
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    void flushRing()
+    {
+        // requests live in a deque so their addresses stay put while the kernel holds them
+        std::deque<Request> active;
+        std::vector<Request*> ready;
+        unsigned int inFlight = 0;          // taken by the kernel, not completed yet
+        unsigned int unsubmitted = 0;       // in the submission queue, not taken yet
+        bool failed = false;                // the ring refused work; what is left goes to the pool
+        const unsigned int depth = queueDepth < ringEntries ? queueDepth : ringEntries;
+
+        while (inFlight > 0 || (!failed && (!queued.empty() || !ready.empty() || unsubmitted > 0)))
+        {
+            while (!failed && inFlight + unsubmitted < depth && (!ready.empty() || !queued.empty()))
+            {
+                Request* request;
+                if (!ready.empty())
+                {
+                    request = ready.back();
+                    ready.pop_back();
+                }
+                else
+                {
+                    active.push_back(std::move(queued.front()));
+                    queued.pop_front();
+                    request = &active.back();
+                    request->state = OPENING;
+                }
+                pushSqe(request);
+                unsubmitted++;
+            }
+
+            // the kernel may take only some of the queue (or none, EAGAIN/EBUSY while it is short
+            // of memory or completions back up), and the rest goes again on the next pass
+            int submitted = (int)syscall(__NR_io_uring_enter, ringFd, failed ? 0 : unsubmitted, inFlight > 0 || unsubmitted > 0 ? 1 : 0,
+                                         IORING_ENTER_GETEVENTS, NULL, 0);
+            Stats.Syscalls++;
+            if (submitted >= 0 && !failed)
+            {
+                unsubmitted -= (unsigned int)submitted;
+                inFlight += (unsigned int)submitted;
+            }
+            else if (submitted < 0 && errno != EINTR && !failed &&
+                     ((errno != EAGAIN && errno != EBUSY) || inFlight == 0))
+            {
+                std::cout << "ERROR::ASYNC_READER::IO_URING_ENTER: " << strerror(errno) << std::endl;
+                failed = true;
+                withdrawUnsubmitted(unsubmitted, ready);
+                unsubmitted = 0;
+            }
+            else if (submitted < 0 && failed && errno != EINTR)
+                sched_yield();                                              // completions still arrive on return to user space
+
+            unsigned head = *cqHead;
+            while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            {
+                io_uring_cqe* cqe = &cqes[head & *cqMask];
+                Request* request = (Request*)(uintptr_t)cqe->user_data;
+                int result = cqe->res;
+                head++;
+                inFlight--;
+
+                if (request->state == OPENING)
+                {
+                    if (result < 0)
+                    {
+                        request->ok = false;
+                        complete(*request);
+                        continue;
+                    }
+                    request->fd = result;
+                    request->state = READING;
+                    ready.push_back(request);
+                }
+                else if (request->state == READING)
+                {
+                    if (result > 0)
+                        request->received += (size_t)result;
+                    // a short read means end of file; a full buffer grows and reads again
+                    if (result > 0 && request->received == request->data.size())
+                    {
+                        ready.push_back(request);
+                        continue;
+                    }
+                    request->ok = result >= 0;
+                    complete(*request);
+                    request->state = CLOSING;                                   // close on the ring too
+                    ready.push_back(request);
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+
+        if (failed)
+        {
+            // nothing of these is with the kernel any more: files it opened are closed here, reads
+            // start over on the pool, and the ring is not used again
+            for (Request* request : ready)
+            {
+                if (request->fd >= 0)
+                {
+                    close(request->fd);
+                    Stats.Syscalls++;
+                }
+                if (request->state == CLOSING)
+                    continue;
+                request->fd = -1;
+                request->received = 0;
+                request->data.clear();
+                queued.push_back(std::move(*request));
+            }
+            closeRing();
+            ioPool.reset(new JobPool(queueDepth < 32 ? queueDepth : 32));
+            if (!queued.empty())
+                flushPool();
+        }
+    }
+
+    // takes back the entries the kernel has not consumed, newest first, and puts their requests
+    // with the ones waiting for a slot
+    void withdrawUnsubmitted(unsigned int count, std::vector<Request*>& ready)
+    {
+        unsigned tail = *sqTail;
+        for (unsigned int i = 1; i <= count; i++)
+            ready.push_back((Request*)(uintptr_t)sqes[(tail - i) & *sqMask].user_data);
+        __atomic_store_n(sqTail, tail - count, __ATOMIC_RELEASE);
+    }
+#endif
+};
+
+#endif
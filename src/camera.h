@@ -4,6 +4,7 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 // Defines several possible options for camera movement
 enum Camera_Movement {
@@ -21,43 +22,114 @@ const float PITCH = 0.0f;
 const float SPEED = 5.0f;
 const float SENSITIVITY = 0.01f;
 const float ZOOM = 80.0f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
 const float GRAVITY = -9.8f;
 const float JUMP_STRENGTH = 4.5f;
 
-// Camera class that processes input and calculates matrices for OpenGL
+// Camera class that processes input and calculates matrices for OpenGL. Orientation is a
+// quaternion rebuilt from yaw and pitch once per frame (UpdateOrientation), however many mouse
+// events arrived; the view, projection and view-projection matrices are cached and rebuilt only
+// when the orientation, zoom or viewport changed since they were last asked for. Position is a
+// double world position and the view matrix only rotates: what is drawn is placed relative to
+// the eye first (CameraRelative in world_origin.h), so it stays steady far from the origin
 class Camera
 {
 public:
-    glm::vec3 Position;
+    glm::dvec3 Position;
+    glm::dvec3 PreviousPosition;    // Position at the start of the current simulation step
     glm::vec3 Front;
     glm::vec3 Up;
     glm::vec3 Right;
     glm::vec3 WorldUp;
+    glm::quat Orientation;
     float Yaw;
     float Pitch;
     float MovementSpeed;
     float MouseSensitivity;
     float Zoom;
+    float Aspect = 16.0f / 9.0f;   // of the framebuffer, set through SetViewport
+    int ViewportWidth = 0;
+    int ViewportHeight = 0;
+    float Near = NEAR_PLANE;
+    float Far = FAR_PLANE;
 
     // Physics properties
     float velocityY = 0.0f; // Vertical velocity
     bool isJumping = false; // Jumping state
 
     // Constructor
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH)
+    Camera(glm::dvec3 position = glm::dvec3(0.0, 0.0, 0.0), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH)
         : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
     {
         Position = position;
+        PreviousPosition = position;
         WorldUp = up;
         Yaw = yaw;
         Pitch = pitch;
         updateCameraVectors();
     }
 
-    // Returns view matrix
-    glm::mat4 GetViewMatrix()
+    // Returns view matrix of the camera-relative space, where the eye is at zero
+    const glm::mat4& GetViewMatrix() const
     {
-        return glm::lookAt(Position, Position + Front, Up);
+        if (viewDirty)
+        {
+            // inverse of the camera's rotation; no lookAt cross products needed
+            view = glm::mat4_cast(glm::conjugate(Orientation));
+            viewDirty = false;
+            viewProjectionDirty = true;
+        }
+        return view;
+    }
+
+    const glm::mat4& GetProjectionMatrix() const
+    {
+        if (Zoom != projectionZoom || Aspect != projectionAspect || Near != projectionNear || Far != projectionFar)
+        {
+            projection = glm::perspective(glm::radians(Zoom), Aspect, Near, Far);
+            projectionZoom = Zoom;
+            projectionAspect = Aspect;
+            projectionNear = Near;
+            projectionFar = Far;
+            viewProjectionDirty = true;
+        }
+        return projection;
+    }
+
+    const glm::mat4& GetViewProjectionMatrix() const
+    {
+        GetViewMatrix();
+        GetProjectionMatrix();
+        if (viewProjectionDirty)
+        {
+            viewProjection = projection * view;
+            viewProjectionDirty = false;
+        }
+        return viewProjection;
+    }
+
+    // Framebuffer size in pixels; a minimized window reports 0 and keeps the last aspect
+    void SetViewport(int width, int height)
+    {
+        if (width > 0 && height > 0)
+        {
+            Aspect = (float)width / (float)height;
+            ViewportWidth = width;
+            ViewportHeight = height;
+        }
+    }
+
+    // Call before each fixed simulation step
+    void BeginStep()
+    {
+        PreviousPosition = Position;
+    }
+
+    // Position to draw from, alpha of the way from the previous step to the current one
+    glm::dvec3 RenderPosition(float alpha) const
+    {
+        return glm::mix(PreviousPosition, Position, (double)alpha);
     }
 
     // Processes keyboard input
@@ -70,19 +142,19 @@ public:
         switch (direction)
         {
         case FORWARD:
-            Position += moveDirection * velocity;
+            Position += glm::dvec3(moveDirection * velocity);
             break;
         case BACKWARD:
-            Position -= moveDirection * velocity;
+            Position -= glm::dvec3(moveDirection * velocity);
             break;
         case LEFT:
-            Position -= Right * velocity;
+            Position -= glm::dvec3(Right * velocity);
             break;
         case RIGHT:
-            Position += Right * velocity;
+            Position += glm::dvec3(Right * velocity);
             break;
         case SPRINT:
-            Position += moveDirection * velocity * 1.1f;
+            Position += glm::dvec3(moveDirection * velocity * 1.1f);
             break;
         case JUMP:
             if (!isJumping) // Only jump if on the ground
@@ -94,34 +166,52 @@ public:
         }
     }
 
-    // Apply physics updates (gravity & jumping)
+    // Apply physics updates (gravity & jumping); anything above the ground falls, so walking off
+    // something the camera landed on drops it
     void UpdatePhysics(float deltaTime)
     {
-        if (isJumping)
+        if (isJumping || Position.y > 0.0)
         {
             velocityY += GRAVITY * deltaTime; // Apply gravity
             Position.y += velocityY * deltaTime; // Update vertical position
 
             // Collision with ground (reset state)
-            if (Position.y <= 0.0f)
+            if (Position.y <= 0.0)
             {
-                Position.y = 0.0f;
+                Position.y = 0.0;
                 velocityY = 0.0f;
                 isJumping = false;
             }
         }
     }
 
-    // Processes mouse movement
+    // Collision stopped the vertical motion: landed on something or hit a ceiling
+    void StopVertical()
+    {
+        if (velocityY <= 0.0f)
+            isJumping = false;
+        velocityY = 0.0f;
+    }
+
+    // Processes mouse movement; only adds up the offsets, UpdateOrientation applies them
     void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
     {
-        xoffset *= MouseSensitivity;
-        yoffset *= MouseSensitivity;
+        pendingYaw += xoffset * MouseSensitivity;
+        pendingPitch += yoffset * MouseSensitivity;
+        pendingConstrain = constrainPitch;
+    }
 
-        Yaw += xoffset;
-        Pitch += yoffset;
+    // Applies the mouse movement since the last call; once per frame
+    void UpdateOrientation()
+    {
+        if (pendingYaw == 0.0f && pendingPitch == 0.0f)
+            return;
+        Yaw += pendingYaw;
+        Pitch += pendingPitch;
+        pendingYaw = 0.0f;
+        pendingPitch = 0.0f;
 
-        if (constrainPitch)
+        if (pendingConstrain)
         {
             if (Pitch > 89.0f) Pitch = 89.0f;
             if (Pitch < -89.0f) Pitch = -89.0f;
@@ -130,6 +220,16 @@ public:
         updateCameraVectors();
     }
 
+    // Sets yaw and pitch outright, dropping mouse movement not applied yet; for scripted moves
+    void SetOrientation(float yaw, float pitch)
+    {
+        Yaw = yaw;
+        Pitch = pitch;
+        pendingYaw = 0.0f;
+        pendingPitch = 0.0f;
+        updateCameraVectors();
+    }
+
     // Processes scroll wheel input
     void ProcessMouseScroll(float yoffset)
     {
@@ -139,16 +239,30 @@ public:
     }
 
 private:
-    // Updates the camera vectors
+    float pendingYaw = 0.0f;
+    float pendingPitch = 0.0f;
+    bool pendingConstrain = true;
+
+    // cached matrices and what they were built from
+    mutable glm::mat4 view = glm::mat4(1.0f);
+    mutable glm::mat4 projection = glm::mat4(1.0f);
+    mutable glm::mat4 viewProjection = glm::mat4(1.0f);
+    mutable float projectionZoom = 0.0f;
+    mutable float projectionAspect = 0.0f;
+    mutable float projectionNear = 0.0f;
+    mutable float projectionFar = 0.0f;
+    mutable bool viewDirty = true;
+    mutable bool viewProjectionDirty = true;
+
+    // Updates the orientation and the camera vectors from yaw and pitch. Yaw turns about the world
+    // up axis and pitch about the camera's right; yaw -90 looks down -Z like the old Euler setup
     void updateCameraVectors()
     {
-        glm::vec3 front;
-        front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        front.y = sin(glm::radians(Pitch));
-        front.z = sin(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        Front = glm::normalize(front);
-        Right = glm::normalize(glm::cross(Front, WorldUp));
-        Up = glm::normalize(glm::cross(Right, Front));
+        Orientation = glm::angleAxis(glm::radians(-Yaw - 90.0f), WorldUp) * glm::angleAxis(glm::radians(Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
+        Front = Orientation * glm::vec3(0.0f, 0.0f, -1.0f);
+        Right = Orientation * glm::vec3(1.0f, 0.0f, 0.0f);
+        Up = Orientation * glm::vec3(0.0f, 1.0f, 0.0f);
+        viewDirty = true;
     }
 };
 
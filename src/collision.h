@@ -0,0 +1,453 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+struct Aabb
+{
+    glm::vec3 Min = glm::vec3(0.0f);
+    glm::vec3 Max = glm::vec3(0.0f);
+
+    glm::vec3 Center() const { return (Min + Max) * 0.5f; }
+    glm::vec3 HalfExtents() const { return (Max - Min) * 0.5f; }
+
+    bool Overlaps(const Aabb& other) const
+    {
+        return Min.x < other.Max.x && Max.x > other.Min.x && Min.y < other.Max.y && Max.y > other.Min.y && Min.z < other.Max.z && Max.z > other.Min.z;
+    }
+
+    static Aabb FromCenter(const glm::vec3& center, const glm::vec3& halfExtents)
+    {
+        return { center - halfExtents, center + halfExtents };
+    }
+};
+
+// Earliest contact of a box moving by delta with a static box, as a fraction of delta in [0, 1],
+// and the face normal of target that was hit. The moving box shrinks to a point and target grows
+// by its half extents (their Minkowski sum), which turns the sweep into a ray against a box.
+// A box already sunk into target by more than a centimetre is let through, so it can always get
+// out; less than that counts as touching, which absorbs rounding after a slide
+inline bool SweepAabb(const Aabb& moving, const glm::vec3& delta, const Aabb& target, float& time, glm::vec3& normal)
+{
+    glm::vec3 origin = moving.Center();
+    glm::vec3 extents = moving.HalfExtents();
+    glm::vec3 low = target.Min - extents, high = target.Max + extents;
+    float enter = -INFINITY, exit = INFINITY;
+    int axis = -1;
+    for (int i = 0; i < 3; i++)
+    {
+        if (delta[i] == 0.0f)
+        {
+            if (origin[i] <= low[i] || origin[i] >= high[i])
+                return false;
+            continue;
+        }
+        float inverse = 1.0f / delta[i];
+        float near = (low[i] - origin[i]) * inverse, far = (high[i] - origin[i]) * inverse;
+        if (near > far)
+            std::swap(near, far);
+        if (near > enter)
+        {
+            enter = near;
+            axis = i;
+        }
+        exit = std::min(exit, far);
+    }
+    if (axis < 0 || enter >= exit || enter > 1.0f || exit <= 0.0f)
+        return false;
+    if (enter < 0.0f && -enter * std::fabs(delta[axis]) > 0.01f)
+        return false;
+    normal = glm::vec3(0.0f);
+    normal[axis] = delta[axis] > 0.0f ? -1.0f : 1.0f;
+    time = std::max(enter, 0.0f);
+    return true;
+}
+
+// Boxes bucketed into a uniform grid of CellSize cubes, with the cells kept in a hash table so
+// the world has no bounds and empty space costs nothing. A query only looks at the cells its box
+// covers, so its cost depends on how crowded that neighbourhood is and not on how many boxes the
+// world holds. The table is one open-addressed array pointing into one array of box ids, rebuilt
+// on the first query after boxes were added or removed; that suits level geometry, which rarely
+// changes. A box that moves leaves that table (its entries are skipped) for a second one whose
+// cells each keep a list of ids, which Move updates in place: only the cells the box left or
+// entered are touched, so things that move every step cost the same in a world of any size.
+// Queries mark boxes they have seen to skip duplicates, so they are not safe to run from several
+// threads at once
+class CollisionWorld
+{
+public:
+    float CellSize;
+
+    explicit CollisionWorld(float cellSize = 2.0f) : CellSize(cellSize) {}
+
+    // returns the id of the box
+    int Add(const Aabb& box)
+    {
+        boxes.push_back(box);
+        stamps.push_back(0);
+        alive.push_back(1);
+        moving.push_back(0);
+        dirty = true;
+        return (int)boxes.size() - 1;
+    }
+
+    void Move(int id, const Aabb& box)
+    {
+        if (dirty || !alive[id])
+        {
+            // the next rebuild places it anyway
+            boxes[id] = box;
+            return;
+        }
+        glm::ivec3 oldLow = cellOf(boxes[id].Min), oldHigh = cellOf(boxes[id].Max);
+        glm::ivec3 newLow = cellOf(box.Min), newHigh = cellOf(box.Max);
+        boxes[id] = box;
+        if (!moving[id])
+        {
+            // from now on it is only found through the moving cells
+            moving[id] = 1;
+            forEachCell(newLow, newHigh, [&](uint64_t cellKey) { insertMoving(cellKey, id); });
+            return;
+        }
+        if (oldLow == newLow && oldHigh == newHigh)
+            return;
+        auto inside = [](const glm::ivec3& cell, const glm::ivec3& low, const glm::ivec3& high)
+        {
+            return glm::all(glm::greaterThanEqual(cell, low)) && glm::all(glm::lessThanEqual(cell, high));
+        };
+        for (int x = oldLow.x; x <= oldHigh.x; x++)
+            for (int y = oldLow.y; y <= oldHigh.y; y++)
+                for (int z = oldLow.z; z <= oldHigh.z; z++)
+                    if (!inside(glm::ivec3(x, y, z), newLow, newHigh))
+                        eraseMoving(key(x, y, z), id);
+        for (int x = newLow.x; x <= newHigh.x; x++)
+            for (int y = newLow.y; y <= newHigh.y; y++)
+                for (int z = newLow.z; z <= newHigh.z; z++)
+                    if (!inside(glm::ivec3(x, y, z), oldLow, oldHigh))
+                        insertMoving(key(x, y, z), id);
+    }
+
+    void Remove(int id)
+    {
+        alive[id] = 0;
+        dirty = true;
+    }
+
+    // the coordinates moved by shift (WorldOrigin rebased)
+    void ShiftOrigin(const glm::vec3& shift)
+    {
+        for (Aabb& box : boxes)
+        {
+            box.Min -= shift;
+            box.Max -= shift;
+        }
+        dirty = true;
+    }
+
+    const Aabb& Box(int id) const { return boxes[id]; }
+    size_t Count() const { return boxes.size(); }
+
+    // ids of the boxes whose cells overlap region, each once; callers do the exact test
+    void Query(const Aabb& region, std::vector<int>& out)
+    {
+        if (dirty)
+            rebuild();
+        out.clear();
+        if (++stamp == 0)
+        {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            stamp = 1;
+        }
+        glm::ivec3 low = cellOf(region.Min), high = cellOf(region.Max);
+        for (int x = low.x; x <= high.x; x++)
+            for (int y = low.y; y <= high.y; y++)
+                for (int z = low.z; z <= high.z; z++)
+                {
+                    uint64_t cellKey = key(x, y, z);
+                    if (const Cell* cell = find(cellKey))
+                    {
+                        for (int i = cell->First; i < cell->First + cell->Count; i++)
+                        {
+                            int id = cellIds[i];
+                            if (stamps[id] == stamp || moving[id])
+                                continue;
+                            stamps[id] = stamp;
+                            out.push_back(id);
+                        }
+                    }
+                    if (movingCount == 0)
+                        continue;
+                    if (const MovingCell* cell = findMoving(cellKey))
+                    {
+                        for (int id : cell->Ids)
+                        {
+                            if (stamps[id] == stamp)
+                                continue;
+                            stamps[id] = stamp;
+                            out.push_back(id);
+                        }
+                    }
+                }
+    }
+
+    // earliest hit of box moving by delta against any box in the world
+    bool Sweep(const Aabb& box, const glm::vec3& delta, float& time, glm::vec3& normal)
+    {
+        Aabb swept = { glm::min(box.Min, box.Min + delta), glm::max(box.Max, box.Max + delta) };
+        Query(swept, candidates);
+        bool hit = false;
+        time = 1.0f;
+        for (int id : candidates)
+        {
+            float t;
+            glm::vec3 n;
+            if (SweepAabb(box, delta, boxes[id], t, n) && (!hit || t < time))
+            {
+                time = t;
+                normal = n;
+                hit = true;
+            }
+        }
+        return hit;
+    }
+
+private:
+    struct Cell
+    {
+        uint64_t Key;
+        int First;                  // into cellIds
+        int Count;                  // 0 for an empty slot
+    };
+
+    // a cell of moved boxes; empty slots have no ids
+    struct MovingCell
+    {
+        uint64_t Key = 0;
+        std::vector<int> Ids;
+    };
+
+    std::vector<Aabb> boxes;
+    std::vector<uint32_t> stamps;
+    std::vector<char> alive;
+    std::vector<char> moving;       // moved since the last rebuild, so in movingTable instead
+    std::vector<Cell> table;
+    std::vector<int> cellIds;
+    std::vector<MovingCell> movingTable;
+    size_t movingCount = 0;         // cells in use in movingTable
+    std::vector<int> candidates;
+    uint32_t stamp = 0;
+    bool dirty = false;
+
+    glm::ivec3 cellOf(const glm::vec3& point) const
+    {
+        return glm::ivec3(glm::floor(point / CellSize));
+    }
+
+    // 21 bits per axis, enough for a million cells each way
+    static uint64_t key(int x, int y, int z)
+    {
+        return ((uint64_t)(x & 0x1FFFFF) << 42) | ((uint64_t)(y & 0x1FFFFF) << 21) | (uint64_t)(z & 0x1FFFFF);
+    }
+
+    size_t slotOf(uint64_t cellKey) const
+    {
+        return (size_t)((cellKey * 0x9E3779B97F4A7C15ull) >> 32) & (table.size() - 1);
+    }
+
+    const Cell* find(uint64_t cellKey) const
+    {
+        if (table.empty())
+            return NULL;
+        for (size_t slot = slotOf(cellKey); table[slot].Count > 0; slot = (slot + 1) & (table.size() - 1))
+        {
+            if (table[slot].Key == cellKey)
+                return &table[slot];
+        }
+        return NULL;
+    }
+
+    template <typename F>
+    static void forEachCell(const glm::ivec3& low, const glm::ivec3& high, const F& body)
+    {
+        for (int x = low.x; x <= high.x; x++)
+            for (int y = low.y; y <= high.y; y++)
+                for (int z = low.z; z <= high.z; z++)
+                    body(key(x, y, z));
+    }
+
+    size_t movingSlotOf(uint64_t cellKey) const
+    {
+        return (size_t)((cellKey * 0x9E3779B97F4A7C15ull) >> 32) & (movingTable.size() - 1);
+    }
+
+    MovingCell* findMoving(uint64_t cellKey)
+    {
+        if (movingTable.empty())
+            return NULL;
+        for (size_t slot = movingSlotOf(cellKey); !movingTable[slot].Ids.empty(); slot = (slot + 1) & (movingTable.size() - 1))
+        {
+            if (movingTable[slot].Key == cellKey)
+                return &movingTable[slot];
+        }
+        return NULL;
+    }
+
+    void insertMoving(uint64_t cellKey, int id)
+    {
+        if (MovingCell* cell = findMoving(cellKey))
+        {
+            cell->Ids.push_back(id);
+            return;
+        }
+        if ((movingCount + 1) * 2 > movingTable.size())
+        {
+            // twice the size, at least half of it free
+            std::vector<MovingCell> old;
+            old.swap(movingTable);
+            movingTable.resize(std::max<size_t>(64, old.size() * 2));
+            for (MovingCell& cell : old)
+            {
+                if (!cell.Ids.empty())
+                    place(std::move(cell));
+            }
+        }
+        MovingCell cell;
+        cell.Key = cellKey;
+        cell.Ids.push_back(id);
+        place(std::move(cell));
+        movingCount++;
+    }
+
+    void place(MovingCell&& cell)
+    {
+        size_t slot = movingSlotOf(cell.Key);
+        while (!movingTable[slot].Ids.empty())
+            slot = (slot + 1) & (movingTable.size() - 1);
+        movingTable[slot] = std::move(cell);
+    }
+
+    // an emptied cell is taken out, moving later entries of its probe run back into the gap, so
+    // cells a box passed through do not pile up
+    void eraseMoving(uint64_t cellKey, int id)
+    {
+        MovingCell* cell = findMoving(cellKey);
+        if (!cell)
+            return;
+        std::vector<int>& ids = cell->Ids;
+        ids.erase(std::find(ids.begin(), ids.end(), id));
+        if (!ids.empty())
+            return;
+        size_t mask = movingTable.size() - 1, hole = (size_t)(cell - movingTable.data());
+        for (size_t next = (hole + 1) & mask; !movingTable[next].Ids.empty(); next = (next + 1) & mask)
+        {
+            // an entry can fill the hole if the hole lies between its home slot and where it is
+            size_t home = movingSlotOf(movingTable[next].Key);
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                movingTable[hole] = std::move(movingTable[next]);
+                movingTable[next].Ids.clear();
+                hole = next;
+            }
+        }
+        movingCount--;
+    }
+
+    // every (cell, box) pair sorted by cell, so each cell's ids end up next to each other. The
+    // moved boxes go back in with the others
+    void rebuild()
+    {
+        std::fill(moving.begin(), moving.end(), 0);
+        movingTable.clear();
+        movingCount = 0;
+        std::vector<std::pair<uint64_t, int>> entries;
+        entries.reserve(boxes.size() * 4);
+        for (int id = 0; id < (int)boxes.size(); id++)
+        {
+            if (!alive[id])
+                continue;
+            glm::ivec3 low = cellOf(boxes[id].Min), high = cellOf(boxes[id].Max);
+            for (int x = low.x; x <= high.x; x++)
+                for (int y = low.y; y <= high.y; y++)
+                    for (int z = low.z; z <= high.z; z++)
+                        entries.push_back({ key(x, y, z), id });
+        }
+        std::sort(entries.begin(), entries.end());
+
+        size_t unique = 0;
+        for (size_t i = 0; i < entries.size(); i++)
+            unique += i == 0 || entries[i].first != entries[i - 1].first;
+        size_t capacity = 16;
+        while (capacity < unique * 2)
+            capacity *= 2;
+        table.assign(capacity, Cell{ 0, 0, 0 });
+        cellIds.resize(entries.size());
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            cellIds[i] = entries[i].second;
+            if (i > 0 && entries[i].first == entries[i - 1].first)
+                continue;
+            size_t slot = slotOf(entries[i].first);
+            while (table[slot].Count > 0)
+                slot = (slot + 1) & (capacity - 1);
+            size_t end = i;
+            while (end < entries.size() && entries[end].first == entries[i].first)
+                end++;
+            table[slot] = { entries[i].first, (int)i, (int)(end - i) };
+        }
+        dirty = false;
+    }
+};
+
+// Box-shaped character that slides along what it runs into. Each move sweeps the box, stops it
+// just short of the first contact and keeps the part of the motion along the surface, a few times
+// over so corners work
+class CharacterController
+{
+public:
+    glm::vec3 HalfExtents;
+    glm::vec3 Offset;               // from the tracked position (the camera's eye) to the box center
+    float Skin = 0.001f;            // gap kept from surfaces so the next sweep does not start inside
+    int MaxSlides = 4;
+    bool Grounded = false;          // the last move was stopped from below
+    bool HitCeiling = false;
+
+    CharacterController(const glm::vec3& halfExtents = glm::vec3(0.3f, 0.8f, 0.3f), const glm::vec3& offset = glm::vec3(0.0f, -0.7f, 0.0f))
+        : HalfExtents(halfExtents), Offset(offset) {}
+
+    // where position ends up when it tries to move to target
+    glm::vec3 Move(CollisionWorld& world, const glm::vec3& position, const glm::vec3& target)
+    {
+        Grounded = false;
+        HitCeiling = false;
+        glm::vec3 current = position;
+        glm::vec3 remaining = target - position;
+        for (int slide = 0; slide < MaxSlides; slide++)
+        {
+            float length = glm::length(remaining);
+            if (length < 1e-6f)
+                break;
+            float time;
+            glm::vec3 normal;
+            Aabb box = Aabb::FromCenter(current + Offset, HalfExtents);
+            if (!world.Sweep(box, remaining, time, normal))
+            {
+                current += remaining;
+                break;
+            }
+            float safe = std::max(0.0f, time - Skin / length);
+            current += remaining * safe;
+            remaining *= 1.0f - safe;
+            remaining -= normal * glm::dot(remaining, normal);
+            Grounded |= normal.y > 0.7f;
+            HitCeiling |= normal.y < -0.7f;
+        }
+        return current;
+    }
+};
+
+#endif
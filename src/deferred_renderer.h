@@ -0,0 +1,399 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "shader_cache.h"
+#include "gpu_timer.h"
+#include "light_cluster_buffers.h"
+#include "shadow_cascades.h"
+#include "point_shadows.h"
+#include "ssao.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// Sizes and traffic of the last deferred frame. The traffic is an estimate from the samples that
+// got past the depth and stencil tests, each counted once at the full size of what it reads and
+// writes, with no caches or framebuffer compression
+struct DeferredStats
+{
+    int Width = 0;                  // drawn this frame
+    int Height = 0;
+    uint64_t GBufferBytes = 0;      // albedo, normal, depth and stencil, as allocated
+    uint64_t TargetBytes = 0;       // the light target the lights add up in, as allocated
+    int Lights = 0;                 // in view
+    int Draws = 0;                  // of the lighting passes
+    uint64_t GeometrySamples = 0;   // written by the geometry pass, overdraw included
+    uint64_t LightSamples = 0;      // of the lighting passes, stencil marking included
+    uint64_t Bytes = 0;             // moved through the G-buffer and the light target
+};
+
+// Deferred shading, the alternative to clustered forward. The geometry pass only writes what
+// lighting needs per pixel into a compact G-buffer (shaders/gbuffer.txt), 12 bytes a pixel with
+// depth and stencil. The lights are then added up one of two ways:
+//  - tiled: one fullscreen pass walks the light lists of LightClusters per pixel, like the forward
+//    shaders do, but only once per pixel whatever the overdraw;
+//  - as volumes: each light shades just the pixels inside its sphere, which the stencil finds in
+//    two draws of a mesh around it.
+// The two draws of a volume:
+//  - the marking draw runs the depth test on both sides of the sphere and counts back faces
+//    behind the scene up and front faces behind it down, so only pixels with a surface inside
+//    the sphere are left non-zero; the camera being inside the sphere needs no special case;
+//  - the shading draw draws back faces where the stencil is set, adds the light into the light
+//    target and zeroes the stencil on the way for the next light.
+// The top stencil bit marks pixels the geometry pass covered, which is where the ambient goes;
+// the sky is drawn into the light target first and is left alone everywhere else.
+//
+// A frame: Begin, draw the sky, BeginGeometry, draw the lit opaque scene with the GBUFFER
+// shaders, EndGeometry, DrawLights, draw whatever is not lit (it still has the scene's depth),
+// End, which copies the light target to the window
+class DeferredRenderer
+{
+public:
+    DeferredStats Stats;
+    // lights relative to the eye, filled before DrawLights
+    std::vector<ClusterLight> Lights;
+
+    DeferredRenderer()
+        : fullscreenShaders("shaders/fullscreenvshader.txt", "shaders/deferredfshader.txt"),
+          lightShaders("shaders/lightvolumevshader.txt", "shaders/lightvolumefshader.txt"),
+          geometrySamples(GL_SAMPLES_PASSED), lightSamples(GL_SAMPLES_PASSED)
+    {
+        fullscreenShaders.Request(0);
+        fullscreenShaders.Request(SHADER_CLUSTERED_LIGHTS);
+        fullscreenShaders.Request(SHADER_SHADOWS);
+        fullscreenShaders.Request(SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS);
+        fullscreenShaders.Request(SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS | SHADER_POINT_SHADOWS);
+        fullscreenShaders.Request(SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS | SHADER_POINT_SHADOWS | SHADER_SSAO);
+        lightShaders.Request(0);
+        lightShaders.Request(SHADER_POINT_SHADOWS);
+        glGenVertexArrays(1, &emptyVAO);
+        createSphere();
+    }
+
+    ~DeferredRenderer()
+    {
+        release();
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteVertexArrays(1, &sphereVAO);
+        glDeleteBuffers(2, sphereBuffers);
+    }
+
+    DeferredRenderer(const DeferredRenderer&) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+    void Reload(const std::string& path)
+    {
+        fullscreenShaders.Reload(path);
+        lightShaders.Reload(path);
+    }
+
+    bool IsReady()
+    {
+        return fullscreenShaders.IsReady() && lightShaders.IsReady();
+    }
+
+    // binds the G-buffer and clears it and the light target for a viewport of width x height.
+    // They are allocated at targetWidth x targetHeight (the window's size under dynamic
+    // resolution, width x height without) and only made again when that changes; the frame is
+    // drawn into their corner and the viewport is left as it is. Draws go to the light target
+    // until BeginGeometry, for the sky
+    void Begin(int width, int height, const glm::vec3& clearColor, int targetWidth = 0, int targetHeight = 0)
+    {
+        targetWidth = std::max(width, targetWidth);
+        targetHeight = std::max(height, targetHeight);
+        if (targetWidth != allocatedWidth || targetHeight != allocatedHeight)
+            resize(targetWidth, targetHeight);
+        Stats.Width = width;
+        Stats.Height = height;
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        const GLenum all[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, all);
+        const float clearLight[4] = { clearColor.r, clearColor.g, clearColor.b, 1.0f };
+        const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        // only the part drawn; nothing reads past it
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, 0, width, height);
+        glClearBufferfv(GL_COLOR, 0, clearLight);
+        glClearBufferfv(GL_COLOR, 1, zero);
+        glClearBufferfv(GL_COLOR, 2, zero);
+        glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+        glDisable(GL_SCISSOR_TEST);
+        glDrawBuffers(1, all);
+    }
+
+    // what is drawn from here to EndGeometry fills the G-buffer and marks its pixels as covered
+    void BeginGeometry()
+    {
+        const GLenum gBuffer[3] = { GL_NONE, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, gBuffer);
+        glEnable(GL_STENCIL_TEST);
+        glStencilMask(0xFF);
+        glStencilFunc(GL_ALWAYS, COVERED, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+        geometrySamples.Begin();
+    }
+
+    void EndGeometry()
+    {
+        geometrySamples.End();
+        glDisable(GL_STENCIL_TEST);
+        const GLenum light[1] = { GL_COLOR_ATTACHMENT0 };
+        glDrawBuffers(1, light);
+    }
+
+    // the ambient of ambientColor, then the lights: those of clusters in the same fullscreen pass
+    // when given, every light in Lights as a volume otherwise. The sun of shadows goes into the
+    // fullscreen pass too, and lights with a ShadowSlot are shadowed from pointShadows. The
+    // ambient is occluded by ssao when given. view and
+    // projection are the camera-relative ones the scene was drawn with. Leaves the light target
+    // bound, with the scene's depth and the depth test on
+    void DrawLights(const glm::vec3& ambientColor, const glm::mat4& view, const glm::mat4& projection, const LightClusterBuffers* clusters = NULL,
+                    const ShadowCascades* shadows = NULL, const PointShadows* pointShadows = NULL, const Ssao* ssao = NULL)
+    {
+        Stats.Lights = clusters ? clusters->Stats.Lights : 0;
+        Stats.Draws = 0;
+        unsigned int pointShadowKey = pointShadows ? SHADER_POINT_SHADOWS : 0;
+        Shader& fullscreenShader = fullscreenShaders.Get((clusters ? SHADER_CLUSTERED_LIGHTS | pointShadowKey : 0) | (shadows ? SHADER_SHADOWS : 0) | (ssao ? SHADER_SSAO : 0));
+        Shader& lightShader = lightShaders.Get(pointShadowKey);
+        if (!lightShader.IsReady() || !fullscreenShader.use())
+            return;
+        glm::mat4 viewProjection = projection * view;
+        glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+        glm::vec3 color = ambientColor;
+        bindGBuffer(fullscreenShader, inverseViewProjection);
+        fullscreenShader.setVec3("lightColor", color);
+        if (clusters)
+            clusters->Bind(fullscreenShader, Stats.Width, Stats.Height);
+        if (shadows)
+            shadows->Bind(fullscreenShader);
+        if (clusters && pointShadows)
+            pointShadows->Bind(fullscreenShader);
+        if (ssao)
+            ssao->Bind(fullscreenShader);
+
+        glDepthMask(GL_FALSE);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_STENCIL_TEST);
+        glStencilMask(0x00);
+        glStencilFunc(GL_EQUAL, COVERED, COVERED);
+        lightSamples.Begin();
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        Stats.Draws++;
+        if (clusters)
+        {
+            lightSamples.End();
+            glBindVertexArray(0);
+            glDisable(GL_STENCIL_TEST);
+            glStencilMask(0xFF);
+            glEnable(GL_DEPTH_TEST);
+            glDepthMask(GL_TRUE);
+            glActiveTexture(GL_TEXTURE0);
+            return;
+        }
+
+        lightShader.use();
+        bindGBuffer(lightShader, inverseViewProjection);
+        lightShader.setMat4("viewProjection", viewProjection);
+        if (pointShadows)
+            pointShadows->Bind(lightShader);
+        // volumes past the far plane still have to cover what is in front of it
+        glEnable(GL_DEPTH_CLAMP);
+        glStencilMask(VOLUME);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glBindVertexArray(sphereVAO);
+        for (const ClusterLight& light : Lights)
+        {
+            lightShader.setVec4("lightSphere", light.Position.x, light.Position.y, light.Position.z, light.Radius);
+            lightShader.setVec3("lightColor", light.Color.r, light.Color.g, light.Color.b);
+            lightShader.setInt("shadowSlot", light.ShadowSlot);
+
+            // mark: depth failures of back faces up, of front faces down
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glEnable(GL_DEPTH_TEST);
+            glDisable(GL_CULL_FACE);
+            glDisable(GL_BLEND);
+            glStencilFunc(GL_ALWAYS, 0, 0);
+            glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+            glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+            glDrawElements(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_SHORT, NULL);
+
+            // shade what was marked, and unmark it
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDisable(GL_DEPTH_TEST);
+            glEnable(GL_CULL_FACE);
+            glCullFace(GL_FRONT);
+            glEnable(GL_BLEND);
+            glStencilFunc(GL_NOTEQUAL, 0, VOLUME);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+            glDrawElements(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_SHORT, NULL);
+            Stats.Draws += 2;
+            Stats.Lights++;
+        }
+        lightSamples.End();
+        glBindVertexArray(0);
+
+        glCullFace(GL_BACK);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_BLEND);
+        glDisable(GL_DEPTH_CLAMP);
+        glDisable(GL_STENCIL_TEST);
+        glStencilMask(0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // copies the part of the light target drawn to the same corner of target, the window by
+    // default, and goes back to drawing there
+    void End(unsigned int target = 0)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glBlitFramebuffer(0, 0, Stats.Width, Stats.Height, 0, 0, Stats.Width, Stats.Height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+        // per sample: the geometry pass tests depth and writes G-buffer, depth and stencil; the
+        // lighting passes read depth, stencil and the G-buffer and add into the light target. The
+        // copy reads the light target once
+        Stats.GeometrySamples = geometrySamples.Result();
+        Stats.LightSamples = lightSamples.Result();
+        uint64_t pixels = (uint64_t)Stats.Width * Stats.Height;
+        Stats.Bytes = Stats.GeometrySamples * (4 + GBUFFER_PIXEL_BYTES) + Stats.LightSamples * (GBUFFER_PIXEL_BYTES + 2 * TARGET_PIXEL_BYTES)
+                    + pixels * TARGET_PIXEL_BYTES;
+    }
+
+private:
+    static const int COVERED = 0x80;            // stencil bit of pixels the geometry pass drew
+    static const int VOLUME = 0x7F;             // stencil bits the light volumes count in
+    static const int GBUFFER_PIXEL_BYTES = 12;  // RGBA8 + RG16 + DEPTH24_STENCIL8
+    static const int TARGET_PIXEL_BYTES = 8;    // RGBA16F
+    // texture units of the G-buffer when lighting; nothing else is bound then
+    static const int ALBEDO_UNIT = 0;
+    static const int NORMAL_UNIT = 1;
+    static const int DEPTH_UNIT = 2;
+
+    ShaderCache fullscreenShaders;
+    ShaderCache lightShaders;
+    GpuQuery geometrySamples;
+    GpuQuery lightSamples;
+    unsigned int framebuffer = 0;
+    unsigned int textures[4] = { 0, 0, 0, 0 };  // light target, albedo, normal, depth and stencil
+    unsigned int emptyVAO = 0;
+    unsigned int sphereVAO = 0;
+    unsigned int sphereBuffers[2] = { 0, 0 };
+    int sphereIndexCount = 0;
+    int allocatedWidth = 0;
+    int allocatedHeight = 0;
+
+    void bindGBuffer(Shader& shader, const glm::mat4& inverseViewProjection)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + ALBEDO_UNIT + i);
+            glBindTexture(GL_TEXTURE_2D, textures[1 + i]);
+        }
+        shader.setInt("gAlbedo", ALBEDO_UNIT);
+        shader.setInt("gNormal", NORMAL_UNIT);
+        shader.setInt("gDepth", DEPTH_UNIT);
+        glm::mat4 inverse = inverseViewProjection;
+        shader.setMat4("inverseViewProjection", inverse);
+        shader.setVec2("viewportSize", (float)Stats.Width, (float)Stats.Height);
+    }
+
+    void resize(int width, int height)
+    {
+        release();
+        allocatedWidth = width;
+        allocatedHeight = height;
+        Stats.GBufferBytes = (uint64_t)width * height * GBUFFER_PIXEL_BYTES;
+        Stats.TargetBytes = (uint64_t)width * height * TARGET_PIXEL_BYTES;
+
+        struct Format { GLenum internal, format, type, attachment; };
+        static const Format formats[4] = {
+            { GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0 },
+            { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT1 },
+            { GL_RG16, GL_RG, GL_UNSIGNED_SHORT, GL_COLOR_ATTACHMENT2 },
+            { GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_DEPTH_STENCIL_ATTACHMENT }
+        };
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glGenTextures(4, textures);
+        for (int i = 0; i < 4; i++)
+        {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, formats[i].internal, width, height, 0, formats[i].format, formats[i].type, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, formats[i].attachment, GL_TEXTURE_2D, textures[i], 0);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DEFERRED::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void release()
+    {
+        if (!framebuffer)
+            return;
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(4, textures);
+        framebuffer = 0;
+    }
+
+    // a latitude-longitude sphere pushed out far enough that its flat faces stay outside the
+    // unit sphere, so a light volume never cuts off any of the light
+    void createSphere()
+    {
+        const int SEGMENTS = 16, RINGS = 8;
+        float scale = 1.0f / (std::cos(glm::pi<float>() / SEGMENTS) * std::cos(glm::pi<float>() / (2 * RINGS)));
+        std::vector<glm::vec3> vertices;
+        std::vector<unsigned short> indices;
+        for (int ring = 0; ring <= RINGS; ring++)
+        {
+            float theta = glm::pi<float>() * ring / RINGS;
+            for (int segment = 0; segment <= SEGMENTS; segment++)
+            {
+                float phi = 2.0f * glm::pi<float>() * segment / SEGMENTS;
+                vertices.push_back(scale * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), -std::sin(theta) * std::sin(phi)));
+            }
+        }
+        // counter-clockwise seen from outside
+        for (int ring = 0; ring < RINGS; ring++)
+        {
+            for (int segment = 0; segment < SEGMENTS; segment++)
+            {
+                unsigned short a = (unsigned short)(ring * (SEGMENTS + 1) + segment), b = (unsigned short)(a + SEGMENTS + 1);
+                unsigned short quad[6] = { a, b, (unsigned short)(b + 1), a, (unsigned short)(b + 1), (unsigned short)(a + 1) };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+        sphereIndexCount = (int)indices.size();
+
+        glGenVertexArrays(1, &sphereVAO);
+        glGenBuffers(2, sphereBuffers);
+        glBindVertexArray(sphereVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, sphereBuffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereBuffers[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
+
+#endif
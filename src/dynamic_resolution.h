@@ -0,0 +1,190 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+
+#include "shader_cache.h"
+#include "gpu_timer.h"
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// Scale and GPU frame time of the last frame
+struct DynamicResolutionStats
+{
+    float Scale = 1.0f;                 // of the window's width and height the scene is drawn at
+    int Width = 0;                      // the scene is drawn at
+    int Height = 0;
+    double FrameMilliseconds = -1.0;    // GPU time of a whole frame, a few frames late
+};
+
+// Draws the scene into a target of its own at a fraction (Scale) of the window's size and
+// upscales it to the window with a sharpening pass. Each frame the scale moves towards the one
+// that would make the GPU time of a frame BudgetMilliseconds: the time is taken to go with the
+// pixel count, the square of the scale, so that scale is scale * sqrt(budget / time). The time
+// comes from timestamps a few frames old, so the scale only goes part of the way there each
+// frame and stays put within a few percent of the budget. It moves in whole steps of the window.
+// Targets sized after the scene (the G-buffer, the occlusion) are allocated at the window's size
+// too, and the scene is drawn into their corner, so a new scale never reallocates anything.
+//
+// A frame: Begin, draw the scene at Stats.Width x Stats.Height (the viewport is set), End. The
+// window is bound at its own size after End, for whatever is drawn on top at native resolution
+class DynamicResolution
+{
+public:
+    bool Enabled = true;                // the scene is drawn at MaxScale without
+    double BudgetMilliseconds = 16.0;
+    float MinScale = 0.5f;
+    float MaxScale = 1.0f;              // at most 1, the target is the window's size
+    float Sharpness = 0.5f;             // 0 to 1
+    DynamicResolutionStats Stats;
+
+    DynamicResolution()
+        : upscaleShaders("shaders/fullscreenvshader.txt", "shaders/upscalefshader.txt")
+    {
+        upscaleShaders.Request(0);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~DynamicResolution()
+    {
+        release();
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    DynamicResolution(const DynamicResolution&) = delete;
+    DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+    void Reload(const std::string& path)
+    {
+        upscaleShaders.Reload(path);
+    }
+
+    // picks this frame's scale, starts timing the frame and binds the scene target with a
+    // viewport of Stats.Width x Stats.Height
+    void Begin(int windowWidth, int windowHeight)
+    {
+        windowWidth = std::max(1, windowWidth);
+        windowHeight = std::max(1, windowHeight);
+        if (windowWidth != targetWidth || windowHeight != targetHeight)
+            resize(windowWidth, windowHeight);
+        frameTimer.Begin();
+
+        float maxScale = std::max(0.1f, std::min(MaxScale, 1.0f));
+        float minScale = std::max(0.1f, std::min(MinScale, maxScale));
+        Stats.FrameMilliseconds = frameTimer.Milliseconds();
+        if (!Enabled)
+            scale = maxScale;
+        else if (frameTimer.Count() != measuredCount && Stats.FrameMilliseconds > 0.0)
+        {
+            measuredCount = frameTimer.Count();
+            double ratio = BudgetMilliseconds / Stats.FrameMilliseconds;
+            if (std::fabs(ratio - 1.0) > DEADBAND)
+                scale += ((float)(scale * std::sqrt(ratio)) - scale) * RESPONSE;
+        }
+        scale = std::max(minScale, std::min(scale, maxScale));
+
+        Stats.Scale = std::max(minScale, std::min(std::round(scale * SCALE_STEPS) / SCALE_STEPS, maxScale));
+        Stats.Width = std::max(1, (int)std::lround(windowWidth * Stats.Scale));
+        Stats.Height = std::max(1, (int)std::lround(windowHeight * Stats.Scale));
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, Stats.Width, Stats.Height);
+    }
+
+    // the scene target, for passes that finish into a framebuffer of their choice
+    unsigned int Framebuffer() const
+    {
+        return framebuffer;
+    }
+
+    // upscales the scene to the window, sharpened, or copies it when it is the window's size, and
+    // ends the frame's timing
+    void End()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, targetWidth, targetHeight);
+        Shader& upscaleShader = upscaleShaders.Get(0);
+        bool scaled = Stats.Width != targetWidth || Stats.Height != targetHeight;
+        if (scaled && upscaleShader.use())
+        {
+            glDisable(GL_DEPTH_TEST);
+            glDepthMask(GL_FALSE);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, colorTexture);
+            upscaleShader.setInt("scene", 0);
+            upscaleShader.setVec2("sceneSize", (float)Stats.Width, (float)Stats.Height);
+            upscaleShader.setVec2("windowSize", (float)targetWidth, (float)targetHeight);
+            upscaleShader.setFloat("sharpness", std::max(0.0f, std::min(Sharpness, 1.0f)));
+            glBindVertexArray(emptyVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glBindVertexArray(0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glEnable(GL_DEPTH_TEST);
+            glDepthMask(GL_TRUE);
+        }
+        else
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+            glBlitFramebuffer(0, 0, Stats.Width, Stats.Height, 0, 0, targetWidth, targetHeight, GL_COLOR_BUFFER_BIT, scaled ? GL_LINEAR : GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        frameTimer.End();
+    }
+
+private:
+    static constexpr float SCALE_STEPS = 32.0f;    // per whole window
+    static constexpr double DEADBAND = 0.05;       // of the budget, either way
+    static constexpr float RESPONSE = 0.15f;       // of the way to the wanted scale per frame
+
+    ShaderCache upscaleShaders;
+    GpuSpanTimer frameTimer;
+    unsigned int framebuffer = 0;
+    unsigned int colorTexture = 0;
+    unsigned int depthStencil = 0;
+    unsigned int emptyVAO = 0;
+    int targetWidth = 0;
+    int targetHeight = 0;
+    float scale = 1.0f;
+    uint64_t measuredCount = 0;
+
+    void resize(int width, int height)
+    {
+        release();
+        targetWidth = width;
+        targetHeight = height;
+        glGenTextures(1, &colorTexture);
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        // the upscale filters between texels
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenRenderbuffers(1, &depthStencil);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DYNAMIC_RESOLUTION::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void release()
+    {
+        if (!framebuffer)
+            return;
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &colorTexture);
+        glDeleteRenderbuffers(1, &depthStencil);
+        framebuffer = colorTexture = depthStencil = 0;
+    }
+};
+
+#endif
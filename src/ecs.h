@@ -0,0 +1,495 @@
+#ifndef ECS_H
+#define ECS_H
+
+#include "job_pool.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <functional>
+#include <unordered_map>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+// Archetype based entity component system. Entities with the same set of component types share
+// an archetype, which stores them in fixed-size chunks; inside a chunk every component type is one
+// contiguous array, so a query walks plain arrays a chunk at a time and its loops vectorize.
+// Adding or removing a component moves the entity to another archetype; while queries run such
+// structural changes go through the world's command buffer and are applied by Playback.
+// Components have to be trivially copyable, they are moved around with memcpy
+
+typedef uint64_t ComponentMask;
+const int ECS_MAX_COMPONENTS = 64;
+const size_t ECS_CHUNK_BYTES = 16 * 1024;
+const size_t ECS_ARRAY_ALIGNMENT = 64;  // every component array starts on a cache line
+
+struct Entity
+{
+    uint32_t Index = UINT32_MAX;
+    uint32_t Generation = 0;
+
+    bool operator==(const Entity& other) const { return Index == other.Index && Generation == other.Generation; }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+struct ComponentInfo
+{
+    size_t Size;
+    size_t Alignment;
+};
+
+// by component id. Room for every id is reserved up front, so registering a type never moves the
+// infos jobs are reading
+inline std::vector<ComponentInfo>& ComponentInfos()
+{
+    static std::vector<ComponentInfo> infos = []()
+    {
+        std::vector<ComponentInfo> reserved;
+        reserved.reserve(ECS_MAX_COMPONENTS);
+        return reserved;
+    }();
+    return infos;
+}
+
+inline std::mutex& ComponentRegistryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+// small dense id per component type, handed out on first use. Queries run as jobs can be the
+// first to use a type, so two types may register at once from different threads
+template <typename T>
+int ComponentId()
+{
+    static_assert(std::is_trivially_copyable<T>::value, "components are moved with memcpy and have to be trivially copyable");
+    static const int id = []()
+    {
+        std::lock_guard<std::mutex> lock(ComponentRegistryMutex());
+        std::vector<ComponentInfo>& infos = ComponentInfos();
+        if ((int)infos.size() == ECS_MAX_COMPONENTS)
+        {
+            std::cout << "ERROR::ECS::TOO_MANY_COMPONENT_TYPES" << std::endl;
+            return ECS_MAX_COMPONENTS - 1;
+        }
+        infos.push_back({ sizeof(T), alignof(T) });
+        return (int)infos.size() - 1;
+    }();
+    return id;
+}
+
+template <typename... Ts>
+ComponentMask ComponentMaskOf()
+{
+    ComponentMask mask = 0;
+    int ids[] = { 0, ComponentId<Ts>()... };
+    for (size_t i = 1; i < sizeof(ids) / sizeof(ids[0]); i++)
+        mask |= 1ull << ids[i];
+    return mask;
+}
+
+struct EcsChunk
+{
+    unsigned char* Data = NULL;
+    int Count = 0;
+
+    explicit EcsChunk(size_t bytes)
+    {
+        Data = (unsigned char*)::operator new(bytes, std::align_val_t(ECS_ARRAY_ALIGNMENT));
+    }
+    ~EcsChunk()
+    {
+        ::operator delete(Data, std::align_val_t(ECS_ARRAY_ALIGNMENT));
+    }
+    EcsChunk(const EcsChunk&) = delete;
+    EcsChunk& operator=(const EcsChunk&) = delete;
+};
+
+// All entities with exactly one set of component types. Only the last chunk is ever partly
+// filled: removing an entity moves the archetype's last entity into its row
+class Archetype
+{
+public:
+    ComponentMask Mask;
+    int Capacity = 0;                       // entities per chunk
+    size_t ChunkBytes = ECS_CHUNK_BYTES;
+    std::vector<std::unique_ptr<EcsChunk>> Chunks;
+
+    explicit Archetype(ComponentMask mask)
+        : Mask(mask)
+    {
+        offsets.assign(ECS_MAX_COMPONENTS, -1);
+        size_t perEntity = sizeof(Entity);
+        for (int id = 0; id < ECS_MAX_COMPONENTS; id++)
+        {
+            if (mask & (1ull << id))
+            {
+                ids.push_back(id);
+                perEntity += ComponentInfos()[id].Size;
+            }
+        }
+        // the largest capacity whose aligned arrays still fit in a chunk. An entity too big for one
+        // gets chunks of its own size, one entity each
+        for (Capacity = std::max(1, (int)(ECS_CHUNK_BYTES / perEntity)); Capacity > 1 && layout(Capacity) > ECS_CHUNK_BYTES; Capacity--)
+        {
+        }
+        ChunkBytes = std::max(ECS_CHUNK_BYTES, layout(Capacity));
+    }
+
+    bool Has(int id) const { return offsets[id] >= 0; }
+
+    Entity* Entities(EcsChunk& chunk) const { return (Entity*)chunk.Data; }
+
+    void* Component(EcsChunk& chunk, int id, int row) const
+    {
+        return chunk.Data + offsets[id] + (size_t)row * ComponentInfos()[id].Size;
+    }
+
+    template <typename T>
+    T* Array(EcsChunk& chunk) const
+    {
+        return (T*)(chunk.Data + offsets[ComponentId<T>()]);
+    }
+
+    const std::vector<int>& ComponentIds() const { return ids; }
+
+    size_t Count() const
+    {
+        return Chunks.empty() ? 0 : (Chunks.size() - 1) * Capacity + Chunks.back()->Count;
+    }
+
+private:
+    std::vector<int> offsets;               // by component id, -1 when not in the archetype
+    std::vector<int> ids;
+
+    size_t layout(int capacity)
+    {
+        size_t at = sizeof(Entity) * capacity;
+        for (int id : ids)
+        {
+            at = (at + ECS_ARRAY_ALIGNMENT - 1) / ECS_ARRAY_ALIGNMENT * ECS_ARRAY_ALIGNMENT;
+            offsets[id] = (int)at;
+            at += ComponentInfos()[id].Size * capacity;
+        }
+        return at;
+    }
+};
+
+class EcsWorld;
+
+// Structural changes recorded while queries run, applied in order by EcsWorld::Playback. Safe
+// to record into from several jobs at once
+class CommandBuffer
+{
+public:
+    template <typename... Ts>
+    void Create(const Ts&... components);
+
+    void Destroy(Entity entity);
+
+    template <typename T>
+    void Add(Entity entity, const T& component);
+
+    template <typename T>
+    void Remove(Entity entity);
+
+    size_t Count() const { return commands.size(); }
+
+private:
+    friend class EcsWorld;
+    std::mutex mutex;
+    std::vector<std::function<void(EcsWorld&)>> commands;
+
+    void record(std::function<void(EcsWorld&)> command)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(std::move(command));
+    }
+};
+
+class EcsWorld
+{
+public:
+    CommandBuffer Commands;
+
+    EcsWorld() = default;
+    EcsWorld(const EcsWorld&) = delete;
+    EcsWorld& operator=(const EcsWorld&) = delete;
+
+    template <typename... Ts>
+    Entity Create(const Ts&... components)
+    {
+        if (!structuralChangeAllowed())
+            return Entity();
+        Entity entity = allocateEntity();
+        Archetype& archetype = archetypeFor(ComponentMaskOf<Ts...>());
+        place(entity, archetype);
+        int dummy[] = { 0, (*get<Ts>(entity) = components, 0)... };
+        (void)dummy;
+        return entity;
+    }
+
+    void Destroy(Entity entity)
+    {
+        if (!IsAlive(entity) || !structuralChangeAllowed())
+            return;
+        unplace(entity);
+        Record& record = records[entity.Index];
+        record.archetype = NULL;
+        record.generation++;
+        freeIndices.push_back(entity.Index);
+        alive--;
+    }
+
+    bool IsAlive(Entity entity) const
+    {
+        return entity.Index < records.size() && records[entity.Index].generation == entity.Generation && records[entity.Index].archetype;
+    }
+
+    template <typename T>
+    bool Has(Entity entity) const
+    {
+        return IsAlive(entity) && records[entity.Index].archetype->Has(ComponentId<T>());
+    }
+
+    // NULL when the entity is gone or has no such component
+    template <typename T>
+    T* Get(Entity entity)
+    {
+        return Has<T>(entity) ? get<T>(entity) : NULL;
+    }
+
+    // adds the component, or overwrites it when the entity already has one
+    template <typename T>
+    void Add(Entity entity, const T& component)
+    {
+        if (!IsAlive(entity))
+            return;
+        if (!Has<T>(entity))
+        {
+            if (!structuralChangeAllowed())
+                return;
+            move(entity, records[entity.Index].archetype->Mask | (1ull << ComponentId<T>()));
+        }
+        *get<T>(entity) = component;
+    }
+
+    template <typename T>
+    void Remove(Entity entity)
+    {
+        if (!Has<T>(entity) || !structuralChangeAllowed())
+            return;
+        move(entity, records[entity.Index].archetype->Mask & ~(1ull << ComponentId<T>()));
+    }
+
+    // applies what systems recorded into Commands
+    void Playback()
+    {
+        std::vector<std::function<void(EcsWorld&)>> commands;
+        {
+            std::lock_guard<std::mutex> lock(Commands.mutex);
+            commands.swap(Commands.commands);
+        }
+        for (std::function<void(EcsWorld&)>& command : commands)
+            command(*this);
+    }
+
+    size_t Count() const { return alive; }
+    size_t ArchetypeCount() const { return archetypes.size(); }
+
+    // body(count, entities, Ts* arrays...) once per chunk holding all of Ts
+    template <typename... Ts, typename F>
+    void ForEachChunk(F&& body)
+    {
+        ComponentMask mask = ComponentMaskOf<Ts...>();
+        iterating++;
+        for (Archetype* archetype : archetypes)
+        {
+            if ((archetype->Mask & mask) != mask)
+                continue;
+            for (std::unique_ptr<EcsChunk>& chunk : archetype->Chunks)
+                body(chunk->Count, archetype->Entities(*chunk), archetype->template Array<Ts>(*chunk)...);
+        }
+        iterating--;
+    }
+
+    // body(entity, Ts&...) for every entity holding all of Ts
+    template <typename... Ts, typename F>
+    void ForEach(F&& body)
+    {
+        ForEachChunk<Ts...>([&body](int count, Entity* entities, Ts*... arrays)
+        {
+            for (int i = 0; i < count; i++)
+                body(entities[i], arrays[i]...);
+        });
+    }
+
+    // ForEachChunk with the chunks spread over the JobPool; returns once all are done. The body
+    // must only write the chunk it is given and record structural changes into Commands
+    template <typename... Ts, typename F>
+    void ParallelForEachChunk(F&& body)
+    {
+        ComponentMask mask = ComponentMaskOf<Ts...>();
+        std::vector<std::pair<Archetype*, EcsChunk*>> chunks;
+        for (Archetype* archetype : archetypes)
+        {
+            if ((archetype->Mask & mask) != mask)
+                continue;
+            for (std::unique_ptr<EcsChunk>& chunk : archetype->Chunks)
+                chunks.push_back({ archetype, chunk.get() });
+        }
+        iterating++;
+        JobPool::Instance().ParallelFor((int)chunks.size(), [&chunks, &body](int i)
+        {
+            Archetype* archetype = chunks[i].first;
+            EcsChunk& chunk = *chunks[i].second;
+            body(chunk.Count, archetype->Entities(chunk), archetype->template Array<Ts>(chunk)...);
+        });
+        iterating--;
+    }
+
+private:
+    struct Record
+    {
+        Archetype* archetype = NULL;
+        int chunk = 0;
+        int row = 0;
+        uint32_t generation = 0;
+    };
+
+    std::vector<Record> records;
+    std::vector<uint32_t> freeIndices;
+    std::unordered_map<ComponentMask, std::unique_ptr<Archetype>> archetypesByMask;
+    std::vector<Archetype*> archetypes;
+    size_t alive = 0;
+    int iterating = 0;
+
+    bool structuralChangeAllowed() const
+    {
+        if (iterating == 0)
+            return true;
+        std::cout << "ERROR::ECS::STRUCTURAL_CHANGE_DURING_QUERY: record it into Commands instead" << std::endl;
+        return false;
+    }
+
+    template <typename T>
+    T* get(Entity entity)
+    {
+        const Record& record = records[entity.Index];
+        return (T*)record.archetype->Component(*record.archetype->Chunks[record.chunk], ComponentId<T>(), record.row);
+    }
+
+    Entity allocateEntity()
+    {
+        Entity entity;
+        if (!freeIndices.empty())
+        {
+            entity.Index = freeIndices.back();
+            freeIndices.pop_back();
+        }
+        else
+        {
+            entity.Index = (uint32_t)records.size();
+            records.push_back(Record());
+        }
+        entity.Generation = records[entity.Index].generation;
+        alive++;
+        return entity;
+    }
+
+    Archetype& archetypeFor(ComponentMask mask)
+    {
+        std::unique_ptr<Archetype>& archetype = archetypesByMask[mask];
+        if (!archetype)
+        {
+            archetype = std::make_unique<Archetype>(mask);
+            archetypes.push_back(archetype.get());
+        }
+        return *archetype;
+    }
+
+    // appends a row for the entity; its components are left for the caller to fill
+    void place(Entity entity, Archetype& archetype)
+    {
+        if (archetype.Chunks.empty() || archetype.Chunks.back()->Count == archetype.Capacity)
+            archetype.Chunks.push_back(std::make_unique<EcsChunk>(archetype.ChunkBytes));
+        EcsChunk& chunk = *archetype.Chunks.back();
+        Record& record = records[entity.Index];
+        record.archetype = &archetype;
+        record.chunk = (int)archetype.Chunks.size() - 1;
+        record.row = chunk.Count++;
+        archetype.Entities(chunk)[record.row] = entity;
+    }
+
+    // takes the entity's row out, filling it with the archetype's last entity
+    void unplace(Entity entity)
+    {
+        Record& record = records[entity.Index];
+        Archetype& archetype = *record.archetype;
+        EcsChunk& chunk = *archetype.Chunks[record.chunk];
+        EcsChunk& last = *archetype.Chunks.back();
+        int lastRow = last.Count - 1;
+        if (&chunk != &last || record.row != lastRow)
+        {
+            Entity moved = archetype.Entities(last)[lastRow];
+            archetype.Entities(chunk)[record.row] = moved;
+            for (int id : archetype.ComponentIds())
+                memcpy(archetype.Component(chunk, id, record.row), archetype.Component(last, id, lastRow), ComponentInfos()[id].Size);
+            records[moved.Index].chunk = record.chunk;
+            records[moved.Index].row = record.row;
+        }
+        if (--last.Count == 0)
+            archetype.Chunks.pop_back();
+    }
+
+    void move(Entity entity, ComponentMask mask)
+    {
+        Record from = records[entity.Index];
+        Archetype& target = archetypeFor(mask);
+        place(entity, target);
+        Record& to = records[entity.Index];
+        EcsChunk& source = *from.archetype->Chunks[from.chunk];
+        EcsChunk& destination = *target.Chunks[to.chunk];
+        for (int id : target.ComponentIds())
+        {
+            if (from.archetype->Has(id))
+                memcpy(target.Component(destination, id, to.row), from.archetype->Component(source, id, from.row), ComponentInfos()[id].Size);
+        }
+        // unplace works on the record, so point it back at the old row for the removal
+        Record placed = to;
+        to = from;
+        unplace(entity);
+        records[entity.Index].archetype = placed.archetype;
+        records[entity.Index].chunk = placed.chunk;
+        records[entity.Index].row = placed.row;
+    }
+};
+
+template <typename... Ts>
+void CommandBuffer::Create(const Ts&... components)
+{
+    record([=](EcsWorld& world) { world.Create(components...); });
+}
+
+inline void CommandBuffer::Destroy(Entity entity)
+{
+    record([=](EcsWorld& world) { world.Destroy(entity); });
+}
+
+template <typename T>
+void CommandBuffer::Add(Entity entity, const T& component)
+{
+    record([=](EcsWorld& world) { world.Add(entity, component); });
+}
+
+template <typename T>
+void CommandBuffer::Remove(Entity entity)
+{
+    record([=](EcsWorld& world) { world.template Remove<T>(entity); });
+}
+
+#endif
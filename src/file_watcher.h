@@ -0,0 +1,159 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Watches a directory on a background thread and collects the paths of files written in it.
+// On Linux this blocks in inotify; elsewhere it falls back to polling modification times.
+// The render loop only pays for one relaxed atomic load per frame until something changes
+class FileWatcher
+{
+public:
+    FileWatcher(const std::string& directory)
+        : directory(std::filesystem::path(directory).lexically_normal().string())
+    {
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0 || pipe(wakeFds) != 0 ||
+            inotify_add_watch(inotifyFd, this->directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            std::cout << "ERROR::FILE_WATCHER::INOTIFY_FAILED for " << directory << std::endl;
+            return;
+        }
+#endif
+        running = true;
+        thread = std::thread(&FileWatcher::run, this);
+    }
+
+    ~FileWatcher()
+    {
+        if (running)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running = false;
+            }
+#ifdef __linux__
+            char wake = 0;
+            (void)!write(wakeFds[1], &wake, 1);
+#endif
+            stopped.notify_all();
+            thread.join();
+        }
+#ifdef __linux__
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+        if (wakeFds[0] >= 0)
+        {
+            close(wakeFds[0]);
+            close(wakeFds[1]);
+        }
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // cheap enough to call every frame
+    bool HasChanges() const
+    {
+        return changed.load(std::memory_order_relaxed);
+    }
+
+    // returns the normalized paths written since the last call, each at most once
+    std::vector<std::string> TakeChanges()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> paths(pending.begin(), pending.end());
+        pending.clear();
+        changed.store(false, std::memory_order_relaxed);
+        return paths;
+    }
+
+private:
+    std::string directory;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable stopped;
+    std::set<std::string> pending;
+    std::atomic<bool> changed{ false };
+    bool running = false;
+#ifdef __linux__
+    int inotifyFd = -1;
+    int wakeFds[2] = { -1, -1 };
+#endif
+
+    void notify(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.insert((std::filesystem::path(directory) / name).lexically_normal().string());
+        changed.store(true, std::memory_order_relaxed);
+    }
+
+#ifdef __linux__
+    void run()
+    {
+        alignas(inotify_event) char buffer[4096];
+        pollfd fds[2] = { { inotifyFd, POLLIN, 0 }, { wakeFds[0], POLLIN, 0 } };
+        while (true)
+        {
+            if (poll(fds, 2, -1) < 0)
+                continue;
+            if (fds[1].revents)
+                return;
+
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char* ptr = buffer; ptr < buffer + length; )
+                {
+                    const inotify_event* event = (const inotify_event*)ptr;
+                    if (event->len > 0)
+                        notify(event->name);
+                    ptr += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+    }
+#else
+    void run()
+    {
+        std::map<std::string, std::filesystem::file_time_type> times;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running)
+        {
+            lock.unlock();
+            std::error_code error;
+            for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+            {
+                std::string name = entry.path().filename().string();
+                auto time = entry.last_write_time(error);
+                auto it = times.find(name);
+                if (it != times.end() && it->second != time)
+                    notify(name);
+                times[name] = time;
+            }
+            lock.lock();
+            stopped.wait_for(lock, std::chrono::milliseconds(250), [this] { return !running; });
+        }
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+// Result of a query (GL_TIME_ELAPSED, GL_SAMPLES_PASSED) over the commands between Begin and End.
+// Each frame uses the next of a few queries and the result is read once the GPU has got that far,
+// a few frames later, so asking for it never stalls the pipeline. Only one query of a target can
+// be running at a time
+class GpuQuery
+{
+public:
+    explicit GpuQuery(GLenum target)
+        : target(target)
+    {
+        glGenQueries(LATENCY, queries);
+    }
+
+    ~GpuQuery()
+    {
+        glDeleteQueries(LATENCY, queries);
+    }
+
+    GpuQuery(const GpuQuery&) = delete;
+    GpuQuery& operator=(const GpuQuery&) = delete;
+
+    void Begin()
+    {
+        glBeginQuery(target, queries[issued % LATENCY]);
+    }
+
+    void End()
+    {
+        glEndQuery(target);
+        issued++;
+        // collect whatever has finished, oldest first
+        while (collected < issued)
+        {
+            unsigned int query = queries[collected % LATENCY];
+            GLint available = 0;
+            // a query that is about to be reused has to be read, even if that means waiting
+            if (issued - collected < LATENCY)
+            {
+                glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    break;
+            }
+            GLuint64 value = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &value);
+            result = value;
+            hasResult = true;
+            collected++;
+        }
+    }
+
+    // the latest finished result, 0 before the first
+    uint64_t Result() const
+    {
+        return result;
+    }
+
+    bool HasResult() const
+    {
+        return hasResult;
+    }
+
+private:
+    static const int LATENCY = 4;
+    GLenum target;
+    unsigned int queries[LATENCY];
+    uint64_t issued = 0;
+    uint64_t collected = 0;
+    uint64_t result = 0;
+    bool hasResult = false;
+};
+
+// GPU time of the commands between Begin and End
+class GpuTimer : public GpuQuery
+{
+public:
+    GpuTimer()
+        : GpuQuery(GL_TIME_ELAPSED)
+    {
+    }
+
+    // the latest finished measurement, -1 before the first
+    double Milliseconds() const
+    {
+        return HasResult() ? (double)Result() * 1e-6 : -1.0;
+    }
+};
+
+// GPU time between Begin and End from a pair of timestamps. Unlike a GpuTimer, other queries may
+// run in between, so it can take a whole frame with the timers of its passes inside. Read the
+// same way, a few frames late
+class GpuSpanTimer
+{
+public:
+    GpuSpanTimer()
+    {
+        glGenQueries(2 * LATENCY, queries);
+    }
+
+    ~GpuSpanTimer()
+    {
+        glDeleteQueries(2 * LATENCY, queries);
+    }
+
+    GpuSpanTimer(const GpuSpanTimer&) = delete;
+    GpuSpanTimer& operator=(const GpuSpanTimer&) = delete;
+
+    void Begin()
+    {
+        glQueryCounter(queries[(issued % LATENCY) * 2], GL_TIMESTAMP);
+    }
+
+    void End()
+    {
+        glQueryCounter(queries[(issued % LATENCY) * 2 + 1], GL_TIMESTAMP);
+        issued++;
+        while (collected < issued)
+        {
+            unsigned int* pair = &queries[(collected % LATENCY) * 2];
+            GLint available = 0;
+            if (issued - collected < LATENCY)
+            {
+                glGetQueryObjectiv(pair[1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    break;
+            }
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(pair[0], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(pair[1], GL_QUERY_RESULT, &end);
+            result = end > begin ? end - begin : 0;
+            collected++;
+        }
+    }
+
+    // results so far; a new one arrives about once a frame
+    uint64_t Count() const
+    {
+        return collected;
+    }
+
+    // the latest finished measurement, -1 before the first
+    double Milliseconds() const
+    {
+        return collected > 0 ? (double)result * 1e-6 : -1.0;
+    }
+
+private:
+    static const int LATENCY = 4;
+    unsigned int queries[2 * LATENCY];
+    uint64_t issued = 0;
+    uint64_t collected = 0;
+    uint64_t result = 0;
+};
+
+#endif
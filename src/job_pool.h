@@ -0,0 +1,433 @@
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <functional>
+#include <condition_variable>
+
+class JobPool;
+class JobCounter;
+
+struct Job
+{
+    std::function<void()> Work;
+    JobCounter* Signal = NULL;      // decremented once Work has run
+    JobPool* Pool = NULL;
+};
+
+// Number of unfinished jobs submitted against it. Jobs can wait on a counter before they start,
+// which is how dependencies are expressed: a job submitted with after = &counter stays parked
+// until counter drops to zero. A counter has to outlive the jobs that signal it, which
+// JobPool::Wait guarantees
+class JobCounter
+{
+public:
+    JobCounter() = default;
+    JobCounter(const JobCounter&) = delete;
+
+    // jobs still parked here can never start; they are dropped as if they had run
+    ~JobCounter();
+
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    int Value() const { return value.load(); }
+    bool Done() const { return value.load() == 0; }
+
+private:
+    friend class JobPool;
+    std::atomic<int> value{ 0 };
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::vector<Job*> parked;       // jobs waiting for value to reach zero
+};
+
+// Chase-Lev deque (Chase and Lev 2005, with the C11 orderings of Le et al. 2013). The owning worker
+// pushes and pops at the bottom without locking; other threads steal from the top and only
+// contend with each other and with the owner for the last job. Every access is sequentially
+// consistent, which keeps it simple and lets ThreadSanitizer follow it. Rings that were outgrown
+// are kept until the deque goes away, since a thief may still be reading one
+class WorkStealingDeque
+{
+public:
+    WorkStealingDeque()
+    {
+        rings.emplace_back(new Ring(256));
+        ring.store(rings.back().get());
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // owner only
+    void Push(Job* job)
+    {
+        int64_t b = bottom.load();
+        int64_t t = top.load();
+        Ring* current = ring.load();
+        if (b - t >= current->Capacity)
+            current = grow(current, t, b);
+        current->Put(b, job);
+        bottom.store(b + 1);
+    }
+
+    // owner only; newest first
+    Job* Pop()
+    {
+        int64_t b = bottom.load() - 1;
+        Ring* current = ring.load();
+        bottom.store(b);
+        int64_t t = top.load();
+        if (t > b)
+        {
+            bottom.store(b + 1);
+            return NULL;
+        }
+        Job* job = current->Get(b);
+        if (t == b)
+        {
+            // the last job; a thief may be taking it at the same time
+            if (!top.compare_exchange_strong(t, t + 1))
+                job = NULL;
+            bottom.store(b + 1);
+        }
+        return job;
+    }
+
+    // any thread; oldest first. NULL when empty or when another thread won the race
+    Job* Steal()
+    {
+        int64_t t = top.load();
+        int64_t b = bottom.load();
+        if (t >= b)
+            return NULL;
+        Job* job = ring.load()->Get(t);
+        if (!top.compare_exchange_strong(t, t + 1))
+            return NULL;
+        return job;
+    }
+
+    bool Empty() const
+    {
+        return bottom.load() <= top.load();
+    }
+
+private:
+    struct Ring
+    {
+        int64_t Capacity;
+        std::unique_ptr<std::atomic<Job*>[]> Slots;
+
+        explicit Ring(int64_t capacity) : Capacity(capacity), Slots(new std::atomic<Job*>[capacity]) {}
+        Job* Get(int64_t i) const { return Slots[i & (Capacity - 1)].load(); }
+        void Put(int64_t i, Job* job) { Slots[i & (Capacity - 1)].store(job); }
+    };
+
+    std::atomic<int64_t> top{ 0 };
+    std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Ring*> ring{ NULL };
+    std::vector<std::unique_ptr<Ring>> rings;
+
+    Ring* grow(Ring* current, int64_t t, int64_t b)
+    {
+        rings.emplace_back(new Ring(current->Capacity * 2));
+        Ring* bigger = rings.back().get();
+        for (int64_t i = t; i < b; i++)
+            bigger->Put(i, current->Get(i));
+        ring.store(bigger);
+        return bigger;
+    }
+};
+
+// Fixed set of worker threads with one work-stealing deque each. Jobs a worker submits go on its
+// own deque and are run newest first, so nested work stays on the core that made it; idle workers
+// steal the oldest, which are the biggest pieces of a split range. Jobs from other threads go on a
+// shared queue. Threads that wait on a counter run jobs meanwhile instead of blocking. Used for
+// CPU work that can leave the main thread, like decompressing asset blocks and decoding images,
+// and for fanning out the frame: transforms, culling and ECS queries
+class JobPool
+{
+public:
+    // shared pool sized to the machine, leaving one core for the main thread
+    static JobPool& Instance()
+    {
+        static JobPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 1);
+        return pool;
+    }
+
+    explicit JobPool(unsigned int workerCount)
+    {
+        for (unsigned int i = 0; i < workerCount; i++)
+            deques.emplace_back(new WorkStealingDeque());
+        for (unsigned int i = 0; i < workerCount; i++)
+            workers.emplace_back(&JobPool::run, this, (int)i);
+    }
+
+    ~JobPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        // the workers drain the queues before they stop, so this only drops jobs a pool without
+        // workers was given. Dropping one can release jobs parked on its counter, which are
+        // queued here again and dropped in turn
+        while (true)
+        {
+            Job* job = NULL;
+            for (size_t i = 0; !job && i < deques.size(); i++)
+                job = deques[i]->Pop();
+            if (!job && !injected.empty())
+            {
+                job = injected.front();
+                injected.pop_front();
+            }
+            if (!job)
+                break;
+            finish(job);
+        }
+    }
+
+    JobPool(const JobPool&) = delete;
+    JobPool& operator=(const JobPool&) = delete;
+
+    unsigned int WorkerCount() const
+    {
+        return (unsigned int)workers.size();
+    }
+
+    // runs job on a worker. counter, when given, goes up now and down once the job has run; the
+    // job does not start before after reaches zero
+    void Submit(std::function<void()> job, JobCounter* counter = NULL, JobCounter* after = NULL)
+    {
+        Job* queued = new Job();
+        queued->Work = std::move(job);
+        queued->Signal = counter;
+        queued->Pool = this;
+        if (counter)
+            counter->value.fetch_add(1);
+        if (after)
+        {
+            std::lock_guard<std::mutex> lock(after->mutex);
+            if (after->value.load() > 0)
+            {
+                after->parked.push_back(queued);
+                return;
+            }
+        }
+        enqueue(queued);
+    }
+
+    // returns once counter is zero, running queued jobs on the calling thread until then
+    void Wait(JobCounter& counter)
+    {
+        int self = workerIndex();
+        int idle = 0;
+        while (counter.value.load() > 0)
+        {
+            if (Job* job = findJob(self))
+            {
+                execute(job);
+                idle = 0;
+            }
+            else if (++idle < 64)
+                std::this_thread::yield();
+            else
+            {
+                // what is left is running elsewhere
+                std::unique_lock<std::mutex> lock(counter.mutex);
+                counter.finished.wait_for(lock, std::chrono::microseconds(200), [&] { return counter.value.load() == 0; });
+            }
+        }
+        // the job that brought it to zero may still hold the lock; the caller can free the
+        // counter once this returns
+        std::lock_guard<std::mutex> lock(counter.mutex);
+    }
+
+    // runs body(i) for every i in [0, count) on the workers and the calling thread, and returns
+    // once all of them have finished. The range is halved into jobs down to grain indices (by
+    // default about eight pieces per thread), so idle workers steal big halves and split them
+    // further themselves
+    void ParallelFor(int count, const std::function<void(int)>& body, int grain = 0)
+    {
+        if (count <= 0)
+            return;
+        if (grain <= 0)
+            grain = std::max(1, count / ((int)(workers.size() + 1) * 8));
+        if (workers.empty() || count <= grain)
+        {
+            for (int i = 0; i < count; i++)
+                body(i);
+            return;
+        }
+        JobCounter counter;
+        std::function<void(int, int)> split = [&](int begin, int end)
+        {
+            while (end - begin > grain)
+            {
+                int middle = begin + (end - begin) / 2;
+                Submit([&split, middle, end]() { split(middle, end); }, &counter);
+                end = middle;
+            }
+            for (int i = begin; i < end; i++)
+                body(i);
+        };
+        split(0, count);
+        Wait(counter);
+    }
+
+private:
+    friend class JobCounter;
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkStealingDeque>> deques;
+    std::deque<Job*> injected;      // submitted from threads that are not workers of this pool
+    std::mutex injectedMutex;
+    std::atomic<int> injectedCount{ 0 };
+    std::atomic<int> pending{ 0 };  // jobs queued and not yet taken
+    std::atomic<int> sleeping{ 0 };
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    struct WorkerIdentity
+    {
+        const JobPool* pool = NULL;
+        int index = -1;
+    };
+
+    static WorkerIdentity& currentWorker()
+    {
+        static thread_local WorkerIdentity identity;
+        return identity;
+    }
+
+    // this thread's deque, or -1 on a thread the pool does not own
+    int workerIndex() const
+    {
+        const WorkerIdentity& identity = currentWorker();
+        return identity.pool == this ? identity.index : -1;
+    }
+
+    void enqueue(Job* job)
+    {
+        int self = workerIndex();
+        if (self >= 0)
+            deques[self]->Push(job);
+        else
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            injected.push_back(job);
+            injectedCount.fetch_add(1);
+        }
+        // pending goes up before sleeping is read and a worker bumps sleeping before reading
+        // pending, so either this sees the sleeper or the sleeper sees the job
+        pending.fetch_add(1);
+        if (sleeping.load() > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+            }
+            wake.notify_one();
+        }
+    }
+
+    Job* findJob(int self)
+    {
+        Job* job = NULL;
+        if (self >= 0)
+            job = deques[self]->Pop();
+        if (!job && injectedCount.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            if (!injected.empty())
+            {
+                job = injected.front();
+                injected.pop_front();
+                injectedCount.fetch_sub(1);
+            }
+        }
+        // steal, starting past our own deque so the thieves spread over the victims
+        for (size_t i = 0; !job && i < deques.size(); i++)
+        {
+            size_t victim = (self + 1 + i) % deques.size();
+            if ((int)victim != self)
+                job = deques[victim]->Steal();
+        }
+        if (job)
+            pending.fetch_sub(1);
+        return job;
+    }
+
+    void execute(Job* job)
+    {
+        job->Work();
+        finish(job);
+    }
+
+    // signals the job's counter, queues the jobs that were waiting for it to reach zero and
+    // frees the job. Jobs dropped without running go through here too, so nothing waits on their
+    // counters forever and the jobs after them still run
+    static void finish(Job* job)
+    {
+        if (JobCounter* counter = job->Signal)
+        {
+            std::vector<Job*> released;
+            {
+                std::lock_guard<std::mutex> lock(counter->mutex);
+                if (counter->value.fetch_sub(1) == 1)
+                {
+                    released.swap(counter->parked);
+                    counter->finished.notify_all();
+                }
+            }
+            for (Job* next : released)
+                next->Pool->enqueue(next);
+        }
+        delete job;
+    }
+
+    void run(int index)
+    {
+        currentWorker().pool = this;
+        currentWorker().index = index;
+        while (true)
+        {
+            if (Job* job = findJob(index))
+            {
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping.fetch_add(1);
+            wake.wait(lock, [this] { return stopping || pending.load() > 0; });
+            sleeping.fetch_sub(1);
+            if (stopping && pending.load() == 0)
+                return;
+        }
+    }
+};
+
+inline JobCounter::~JobCounter()
+{
+    if (parked.empty())
+        return;
+    // destroyed while jobs still wait on it: a caller forgot to Wait
+    std::cout << "ERROR::JOB_POOL::COUNTER_DESTROYED_WITH_PARKED_JOBS: " << parked.size() << " jobs dropped" << std::endl;
+    std::vector<Job*> dropped;
+    dropped.swap(parked);
+    for (Job* job : dropped)
+        JobPool::finish(job);
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef LIGHT_CLUSTER_BUFFERS_H
+#define LIGHT_CLUSTER_BUFFERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "light_clusters.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// texture units the cluster buffers are bound to, after the ones materials use
+const int CLUSTER_TEXTURE_UNIT = 4;
+
+// LightClusters with what Assign lists handed to the shaders. Upload sends the lights, one
+// (offset, count) per cluster and the light indices to the GPU as texture buffers. GL 3.3 has
+// those; storage buffers and compute shaders need 4.3
+class LightClusterBuffers : public LightClusters
+{
+public:
+    using LightClusters::LightClusters;
+
+    ~LightClusterBuffers()
+    {
+        if (buffers[0])
+        {
+            glDeleteTextures(3, textures);
+            glDeleteBuffers(3, buffers);
+        }
+    }
+
+    // sends the last Assign to the GPU; the buffers are made on the first call
+    void Upload()
+    {
+        if (!buffers[0])
+            create();
+        std::vector<glm::vec4> packed(std::max<size_t>(Lights.size(), 1) * 2);
+        for (size_t i = 0; i < Lights.size(); i++)
+        {
+            packed[i * 2] = glm::vec4(Lights[i].Position, Lights[i].Radius);
+            packed[i * 2 + 1] = glm::vec4(Lights[i].Color, (float)Lights[i].ShadowSlot);
+        }
+        upload(buffers[0], packed.data(), packed.size() * sizeof(glm::vec4));
+        upload(buffers[1], Grid().data(), Grid().size() * sizeof(uint32_t));
+        upload(buffers[2], Indices().data(), Indices().size() * sizeof(uint16_t));
+    }
+
+    // viewport is the size of what is rendered to, in pixels
+    void Bind(Shader& shader, int viewportWidth, int viewportHeight, int firstUnit = CLUSTER_TEXTURE_UNIT) const
+    {
+        const char* names[3] = { "clusterLights", "clusterGrid", "clusterIndices" };
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            shader.setInt(names[i], firstUnit + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        float depthScale = (float)Slices / std::log(Far / Near);
+        glm::vec3 forward = Forward();
+        shader.setVec3("clusterSize", (float)TilesX, (float)TilesY, (float)Slices);
+        shader.setVec2("clusterTileScale", (float)TilesX / (float)std::max(viewportWidth, 1), (float)TilesY / (float)std::max(viewportHeight, 1));
+        shader.setVec2("clusterDepthScale", depthScale, -std::log(Near) * depthScale);
+        shader.setVec3("clusterForward", forward.x, forward.y, forward.z);
+    }
+
+private:
+    unsigned int buffers[3] = { 0, 0, 0 };
+    unsigned int textures[3] = { 0, 0, 0 };
+
+    void create()
+    {
+        static const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        for (int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // fresh storage every frame, so the driver never waits for last frame's draws to finish
+    static void upload(unsigned int buffer, const void* data, size_t size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)std::max<size_t>(size, 16), NULL, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr)size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glm/glm.hpp>
+
+#include "job_pool.h"
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CLUSTERS_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// point light as the clusters take it, relative to the eye like everything that is drawn
+struct ClusterLight
+{
+    glm::vec3 Position;
+    float Radius;                   // where its light has faded to nothing
+    glm::vec3 Color;
+    int ShadowSlot = -1;            // of its shadow cube (point_shadows.h), -1 for none
+};
+
+// Work done by the last Assign
+struct ClusterStats
+{
+    int Lights = 0;                 // that reach the frustum
+    int References = 0;            // light indices over all clusters
+    int MaxPerCluster = 0;
+    int Dropped = 0;               // references over MaxLightsPerCluster, left out
+    double Milliseconds = 0.0;
+};
+
+// Clustered forward lighting. The view frustum is cut into TilesX x TilesY screen tiles and
+// Slices depth slices, spaced exponentially from Near to Far so the clusters (froxels) stay
+// about as deep as they are wide. Every light is listed in each cluster its sphere reaches. A lit
+// fragment finds its cluster from gl_FragCoord and its view depth and only walks that list, so
+// its cost follows the lights around it and not all of them (shaders/clustered_lights.txt).
+//
+// Assignment runs on the CPU each frame, with each light handled on its own:
+//  - the sphere is tested against the planes through the eye between tile columns and rows, four
+//    planes at a time with SSE;
+//  - its depth range is mapped to slices;
+//  - the box of clusters that results gets it, through a count, a prefix sum and a fill so the
+//    lists end up packed back to back in light order.
+// Nothing here touches GL; LightClusterBuffers (light_cluster_buffers.h) hands the result to the
+// shaders
+class LightClusters
+{
+public:
+    int TilesX;                     // up to 32 each way
+    int TilesY;
+    int Slices;
+    int MaxLightsPerCluster = 1024;
+    float Near = 0.1f;
+    float Far = 100.0f;
+    ClusterStats Stats;
+    std::vector<ClusterLight> Lights;   // filled before Assign; indices are 16 bit, so 65535 at most
+
+    LightClusters(int tilesX = 16, int tilesY = 9, int slices = 24)
+        : TilesX(std::min(tilesX, 32)), TilesY(std::min(tilesY, 32)), Slices(slices) {}
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // Lists Lights in the clusters of the frustum of view and projection (camera-relative, so the
+    // eye is at zero); spread over the JobPool once there are many lights
+    void Assign(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, JobPool& pool = JobPool::Instance())
+    {
+        auto start = std::chrono::steady_clock::now();
+        Near = nearPlane;
+        Far = farPlane;
+        int clusterCount = TilesX * TilesY * Slices;
+        forward = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+        buildPlanes(projection);
+        sliceDepths.resize(Slices + 1);
+        for (int z = 0; z <= Slices; z++)
+            sliceDepths[z] = Near * std::pow(Far / Near, (float)z / (float)Slices);
+
+        // the slices each light reaches and the tiles it covers in each of them
+        int count = (int)std::min(Lights.size(), (size_t)65535);
+        ranges.resize(count);
+        sliceTiles.resize((size_t)count * Slices);
+        auto rangeOf = [&](int i)
+        {
+            glm::vec3 center = glm::vec3(view * glm::vec4(Lights[i].Position, 1.0f));
+            ranges[i] = lightRange(center, Lights[i].Radius);
+            coverSlices(ranges[i], &sliceTiles[(size_t)i * Slices]);
+        };
+        if (count >= 256 && pool.WorkerCount() > 0)
+            pool.ParallelFor(count, rangeOf, 64);
+        else
+        {
+            for (int i = 0; i < count; i++)
+                rangeOf(i);
+        }
+
+        grid.assign(clusterCount * 2, 0);
+        Stats = ClusterStats();
+        for (int i = 0; i < count; i++)
+        {
+            const Range& range = ranges[i];
+            if (range.Z0 > range.Z1)
+                continue;
+            Stats.Lights++;
+            forEachCluster(i, [&](int cluster) { grid[cluster * 2 + 1]++; });
+        }
+        uint32_t offset = 0;
+        for (int cluster = 0; cluster < clusterCount; cluster++)
+        {
+            uint32_t listed = grid[cluster * 2 + 1];
+            Stats.MaxPerCluster = std::max(Stats.MaxPerCluster, (int)listed);
+            if (listed > (uint32_t)MaxLightsPerCluster)
+            {
+                Stats.Dropped += listed - MaxLightsPerCluster;
+                listed = MaxLightsPerCluster;
+            }
+            grid[cluster * 2] = offset;
+            grid[cluster * 2 + 1] = 0;
+            offset += listed;
+        }
+        indices.resize(offset);
+        for (int i = 0; i < count; i++)
+        {
+            const Range& range = ranges[i];
+            if (range.Z0 > range.Z1)
+                continue;
+            forEachCluster(i, [&](int cluster)
+            {
+                uint32_t& listed = grid[cluster * 2 + 1];
+                if ((int)listed < MaxLightsPerCluster)
+                    indices[grid[cluster * 2] + listed++] = (uint16_t)i;
+            });
+        }
+        Stats.References = (int)offset;
+        Stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // offset and count per cluster, and the light indices they point into, of the last Assign
+    const std::vector<uint32_t>& Grid() const { return grid; }
+    const std::vector<uint16_t>& Indices() const { return indices; }
+
+    // the camera's forward axis, which view depth is measured along
+    glm::vec3 Forward() const { return forward; }
+
+    // bytes the last Assign takes on the GPU: the lights, the grid and the indices
+    size_t Bytes() const
+    {
+        return Lights.size() * 2 * sizeof(glm::vec4) + grid.size() * sizeof(uint32_t) + indices.size() * sizeof(uint16_t);
+    }
+
+private:
+    struct Range
+    {
+        uint32_t Columns;           // bit per tile column the light reaches
+        uint32_t Rows;
+        int Z0;                     // slices, empty when Z0 > Z1
+        int Z1;
+        glm::vec3 Center;           // in view space
+        float Radius;
+    };
+
+    // tiles one light covers in one slice, Slices of them per light: bit x of Columns is set when
+    // the part of the sphere within the slice reaches tile column x, bit y of Rows for tile row y
+    struct SliceTiles
+    {
+        uint32_t Columns;
+        uint32_t Rows;
+    };
+
+    // planes through the eye between the tiles, normals pointing to higher columns (rows), padded
+    // to a multiple of four
+    alignas(16) float columnX[36];
+    alignas(16) float columnZ[36];
+    alignas(16) float rowY[36];
+    alignas(16) float rowZ[36];
+    glm::vec4 scaleOffset = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);  // P00, P11, P20, P21
+    glm::vec3 forward = glm::vec3(0.0f, 0.0f, -1.0f);
+    std::vector<Range> ranges;
+    std::vector<SliceTiles> sliceTiles; // Slices per light
+    std::vector<float> sliceDepths;
+    std::vector<uint32_t> grid;     // offset and count per cluster
+    std::vector<uint16_t> indices;
+
+    // in view space a point is right of the boundary at NDC x = s when P00 x + P20 z + s z > 0
+    // (z is negative in front of the eye); likewise for rows with P11 and P21
+    void buildPlanes(const glm::mat4& projection)
+    {
+        scaleOffset = glm::vec4(projection[0][0], projection[1][1], projection[2][0], projection[2][1]);
+        for (int j = 0; j < 36; j++)
+        {
+            float s = -1.0f + 2.0f * (float)std::min(j, TilesX) / (float)TilesX;
+            glm::vec2 column(projection[0][0], projection[2][0] + s);
+            column /= glm::length(column);
+            columnX[j] = column.x;
+            columnZ[j] = column.y;
+            float t = -1.0f + 2.0f * (float)std::min(j, TilesY) / (float)TilesY;
+            glm::vec2 row(projection[1][1], projection[2][1] + t);
+            row /= glm::length(row);
+            rowY[j] = row.x;
+            rowZ[j] = row.y;
+        }
+    }
+
+    // bit j of above: the sphere reaches past boundary j; of below: it reaches short of it. Tile
+    // j lies between boundaries j and j + 1
+    static uint32_t tilesReached(const float* planeA, const float* planeZ, int tiles, float a, float z, float radius)
+    {
+        uint64_t above = 0, below = 0;
+#ifdef CLUSTERS_SIMD_X86
+        __m128 centerA = _mm_set1_ps(a), centerZ = _mm_set1_ps(z);
+        __m128 reach = _mm_set1_ps(radius), negativeReach = _mm_set1_ps(-radius);
+        for (int j = 0; j <= tiles; j += 4)
+        {
+            __m128 distance = _mm_add_ps(_mm_mul_ps(_mm_load_ps(planeA + j), centerA), _mm_mul_ps(_mm_load_ps(planeZ + j), centerZ));
+            above |= (uint64_t)_mm_movemask_ps(_mm_cmpgt_ps(distance, negativeReach)) << j;
+            below |= (uint64_t)_mm_movemask_ps(_mm_cmplt_ps(distance, reach)) << j;
+        }
+#else
+        for (int j = 0; j <= tiles; j++)
+        {
+            float distance = planeA[j] * a + planeZ[j] * z;
+            above |= (uint64_t)(distance > -radius) << j;
+            below |= (uint64_t)(distance < radius) << j;
+        }
+#endif
+        return (uint32_t)(above & (below >> 1) & ((1ull << tiles) - 1));
+    }
+
+    Range lightRange(const glm::vec3& center, float radius) const
+    {
+        Range range = { 0, 0, 1, 0, center, radius };
+        float depth = -center.z;
+        if (depth + radius < Near || depth - radius > Far)
+            return range;
+        range.Columns = tilesReached(columnX, columnZ, TilesX, center.x, center.z, radius);
+        range.Rows = tilesReached(rowY, rowZ, TilesY, center.y, center.z, radius);
+        if (!range.Columns || !range.Rows)
+            return range;
+        float scale = (float)Slices / std::log(Far / Near);
+        range.Z0 = std::max(0, (int)std::floor(std::log(std::max(depth - radius, Near) / Near) * scale));
+        range.Z1 = std::min(Slices - 1, (int)std::floor(std::log(std::min(depth + radius, Far) / Near) * scale));
+        return range;
+    }
+
+    // tiles a box from low to high along one screen axis covers between depths near and far;
+    // scale and offset are that axis' P00 and P20 (or P11 and P21)
+    static uint32_t tilesCovered(float low, float high, float nearDepth, float farDepth, float scale, float offset, int tiles)
+    {
+        float first = scale * low / (low >= 0.0f ? farDepth : nearDepth) - offset;
+        float last = scale * high / (high >= 0.0f ? nearDepth : farDepth) - offset;
+        int from = std::max(0, (int)std::floor((first + 1.0f) * 0.5f * tiles));
+        int to = std::min(tiles - 1, (int)std::floor((last + 1.0f) * 0.5f * tiles));
+        if (from > to)
+            return 0;
+        return (uint32_t)(((2ull << to) - 1) & ~((1ull << from) - 1));
+    }
+
+    // A slice only gets the tiles that the part of the sphere within its depth range covers. That
+    // part lies in the box around the sphere's widest cross-section in the slice, which is far
+    // narrower than the whole sphere in the slices near its ends
+    void coverSlices(const Range& range, SliceTiles* tiles) const
+    {
+        float depth = -range.Center.z;
+        for (int z = range.Z0; z <= range.Z1; z++)
+        {
+            float nearDepth = std::max(sliceDepths[z], depth - range.Radius), farDepth = std::min(sliceDepths[z + 1], depth + range.Radius);
+            float closest = glm::clamp(depth, nearDepth, farDepth) - depth;
+            float reach = std::sqrt(std::max(range.Radius * range.Radius - closest * closest, 0.0f));
+            tiles[z].Columns = range.Columns & tilesCovered(range.Center.x - reach, range.Center.x + reach, nearDepth, farDepth, scaleOffset.x, scaleOffset.z, TilesX);
+            tiles[z].Rows = range.Rows & tilesCovered(range.Center.y - reach, range.Center.y + reach, nearDepth, farDepth, scaleOffset.y, scaleOffset.w, TilesY);
+        }
+    }
+
+    template <typename F>
+    void forEachCluster(int light, const F& body) const
+    {
+        const Range& range = ranges[light];
+        const SliceTiles* tiles = &sliceTiles[(size_t)light * Slices];
+        for (int z = range.Z0; z <= range.Z1; z++)
+        {
+            uint32_t columns = tiles[z].Columns, rows = tiles[z].Rows;
+            for (int y = 0; y < TilesY && rows >> y; y++)
+            {
+                if (!(rows >> y & 1))
+                    continue;
+                int rowStart = (z * TilesY + y) * TilesX;
+                for (int x = 0; x < TilesX && columns >> x; x++)
+                {
+                    if (columns >> x & 1)
+                        body(rowStart + x);
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+// Small single-file codec for the LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md).
+// Output is compatible with the reference LZ4_decompress_safe. Compression levels trade packing
+// time for ratio by searching a longer hash chain; decompression speed is the same for every level.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+const int LZ4_MIN_MATCH = 4;
+const int LZ4_LAST_LITERALS = 5;         // the last 5 bytes of a block are always literals
+const int LZ4_MF_LIMIT = 12;             // the last match has to start at least 12 bytes before the end
+const int LZ4_MAX_OFFSET = 65535;
+const int LZ4_HASH_BITS = 16;
+const int LZ4_MAX_LEVEL = 12;
+
+inline int Lz4CompressBound(int size)
+{
+    return size + size / 255 + 16;
+}
+
+namespace lz4_detail
+{
+    inline uint32_t read32(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, 4);
+        return value;
+    }
+
+    inline uint32_t hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+    }
+
+    inline uint8_t* writeLength(uint8_t* op, int length)
+    {
+        for (; length >= 255; length -= 255)
+            *op++ = 255;
+        *op++ = (uint8_t)length;
+        return op;
+    }
+
+    // literals [anchor, anchor + literals) followed by a match, or only literals when matchLength is 0
+    inline uint8_t* writeSequence(uint8_t* op, const uint8_t* oend, const uint8_t* anchor, int literals, int offset, int matchLength)
+    {
+        if (op + 1 + literals + literals / 255 + 1 + 2 + matchLength / 255 + 1 > oend)
+            return NULL;
+        uint8_t* token = op++;
+        *token = (uint8_t)((literals >= 15 ? 15 : literals) << 4);
+        if (literals >= 15)
+            op = writeLength(op, literals - 15);
+        memcpy(op, anchor, literals);
+        op += literals;
+        if (matchLength == 0)
+            return op;
+
+        *op++ = (uint8_t)(offset & 0xFF);
+        *op++ = (uint8_t)(offset >> 8);
+        int length = matchLength - LZ4_MIN_MATCH;
+        *token |= (uint8_t)(length >= 15 ? 15 : length);
+        if (length >= 15)
+            op = writeLength(op, length - 15);
+        return op;
+    }
+}
+
+// returns the compressed size, or 0 if the result does not fit in dstCapacity
+inline int Lz4Compress(const uint8_t* src, int srcSize, uint8_t* dst, int dstCapacity, int level = 1)
+{
+    using namespace lz4_detail;
+    const uint8_t* oend = dst + dstCapacity;
+    uint8_t* op = dst;
+    int anchor = 0;
+
+    if (srcSize > LZ4_MF_LIMIT)
+    {
+        if (level < 1) level = 1;
+        if (level > LZ4_MAX_LEVEL) level = LZ4_MAX_LEVEL;
+        const int attempts = 1 << (level - 1);
+        std::vector<int> head(1 << LZ4_HASH_BITS, -1);
+        std::vector<int> chain(level > 1 ? LZ4_MAX_OFFSET + 1 : 0);
+        auto insert = [&](int pos)
+        {
+            uint32_t h = hash(read32(src + pos));
+            if (level > 1)
+                chain[pos & LZ4_MAX_OFFSET] = head[h];
+            head[h] = pos;
+        };
+
+        const int matchLimit = srcSize - LZ4_LAST_LITERALS;
+        const int lastMatchStart = srcSize - LZ4_MF_LIMIT;
+        int ip = 0;
+        while (ip <= lastMatchStart)
+        {
+            uint32_t sequence = read32(src + ip);
+            int candidate = head[hash(sequence)];
+            int bestLength = 0, bestOffset = 0;
+            for (int i = 0; i < attempts && candidate >= 0 && ip - candidate <= LZ4_MAX_OFFSET; i++)
+            {
+                if (read32(src + candidate) == sequence)
+                {
+                    int length = LZ4_MIN_MATCH;
+                    while (ip + length < matchLimit && src[candidate + length] == src[ip + length])
+                        length++;
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestOffset = ip - candidate;
+                    }
+                }
+                if (level == 1)
+                    break;
+                int next = chain[candidate & LZ4_MAX_OFFSET];
+                if (next >= candidate)
+                    break;
+                candidate = next;
+            }
+            insert(ip);
+
+            if (bestLength == 0)
+            {
+                ip++;
+                continue;
+            }
+            op = writeSequence(op, oend, src + anchor, ip - anchor, bestOffset, bestLength);
+            if (!op)
+                return 0;
+            // the fast level skips indexing inside matches, the others index every position
+            int end = ip + bestLength;
+            if (level > 1)
+            {
+                for (int pos = ip + 1; pos < end && pos <= lastMatchStart; pos++)
+                    insert(pos);
+            }
+            ip = end;
+            anchor = ip;
+        }
+    }
+
+    op = lz4_detail::writeSequence(op, oend, src + anchor, srcSize - anchor, 0, 0);
+    return op ? (int)(op - dst) : 0;
+}
+
+// returns the decompressed size, or -1 if the input is malformed or does not fit in dstCapacity
+inline int Lz4Decompress(const uint8_t* src, int srcSize, uint8_t* dst, int dstCapacity)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dstCapacity;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip >= iend)
+            break;                                                  // the last sequence has no match
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+        size_t length = token & 15;
+        if (length == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > (size_t)(oend - op))
+            return -1;
+
+        const uint8_t* match = op - offset;
+        if (offset >= length)
+            memcpy(op, match, length);
+        else
+        {
+            for (size_t i = 0; i < length; i++)                     // overlapping copy repeats the pattern
+                op[i] = match[i];
+        }
+        op += length;
+    }
+    return (int)(op - dst);
+}
+
+#endif
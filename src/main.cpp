@@ -6,29 +6,57 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "shader.h"
+#include "shader_cache.h"
+#include "file_watcher.h"
+#include "vfs.h"
 #include "camera.h"
+#include "texture_streamer.h"
+#include "texture_residency.h"
+#include "virtual_texture.h"
+#include "texture_array.h"
+#include "transform_store.h"
+#include "scene_graph.h"
+#include "scene_systems.h"
+#include "sim_clock.h"
+#include "collision.h"
+#include "physics.h"
+#include "world_origin.h"
+#include "gpu_timer.h"
+#include "dynamic_resolution.h"
 #include "stb_image.h"
 #include <filesystem>
+#include <vector>
+#include <chrono>
+#include <random>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);          // define a function for dynamic window resizing
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void processInput(GLFWwindow *window);                                              // function to close window when esc is pressed
+void processInput(GLFWwindow *window, float deltaTime);                             // function to close window when esc is pressed
+uint64_t textureBudgetArgument(int argc, char** argv);                              // --texture-budget <MB>, or TEXTURE_BUDGET
 
 // camera
-Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+Camera camera(glm::dvec3(0.0, 0.0, 3.0));
 float lastX = 1200 / 2.0f;
 float lastY = 675 / 2.0f;
 bool firstMouse = true;
 
-// timing
-float deltaTime = 0.0f;	// time between current frame and last frame
-float lastFrame = 0.0f;
-
 // lighting
 glm::vec3 lightPos(0.0f, 3.0f, 0.0f);
 
-int main()
+// lighting paths G cycles through, all drawing the same scene
+enum Shading_Path {
+    SHADING_FORWARD,            // clustered forward
+    SHADING_DEFERRED_VOLUMES,   // deferred, a stencil-tested volume per light
+    SHADING_DEFERRED_TILES,     // deferred, one pass over the light clusters
+    SHADING_PATH_COUNT
+};
+const char* const SHADING_PATH_NAMES[] = { "clustered forward", "deferred, light volumes", "deferred, tiled" };
+
+// textures
+const uint64_t TEXTURE_BUDGET = 256ull * 1024 * 1024;  // GPU bytes the streamed textures may hold before the least recently used are evicted
+
+int main(int argc, char** argv)
 {
     glfwInit();                                                                     // Init glfw
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);                                  // set version of opengl to 3.3
@@ -48,6 +76,10 @@ int main()
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    // the window opens maximized, so the framebuffer is rarely the size asked for
+    int initialWidth, initialHeight;
+    glfwGetFramebufferSize(window, &initialWidth, &initialHeight);
+    camera.SetViewport(initialWidth, initialHeight);
 
 
     // tell GLFW to capture our mouse
@@ -63,9 +95,53 @@ int main()
         return -1;
     }    
 
-    Shader lightingShader("../../../src/shaders/vshader.txt", "../../../src/shaders/fshader.txt");
-    Shader skyShader("../../../src/shaders/skyvshader.txt", "../../../src/shaders/skyfshader.txt");
-    Shader lightCubeShader("../../../src/shaders/lightvshader.txt", "../../../src/shaders/lightfshader.txt");
+    // assets come from the packed archive; the source tree, when present, overrides it so
+    // edits show up without repacking
+    Vfs& vfs = Vfs::Instance();
+    if (!vfs.Mount("assets.pak"))
+        std::cout << "No assets.pak, loading loose files" << std::endl;
+    vfs.SetOverrideDirectory("../../../src");
+
+    // kick off every compile/link up front so the driver can build them in parallel; the flat
+    // light cube shader is tiny and is built first so it can stand in while the others finish
+    Shader::LoadParallelCompile((GLADloadproc)glfwGetProcAddress);
+    auto shaderStart = std::chrono::steady_clock::now();
+    Shader lightCubeShader("shaders/lightvshader.txt", "shaders/lightfshader.txt");
+    Shader skyShader("shaders/skyvshader.txt", "shaders/skyfshader.txt", true);
+    // lit objects pick a permutation of the lighting shader by feature key; only the
+    // variants requested here (the plane and the instanced walls) are ever compiled
+    ShaderCache lightingShaders("shaders/vshader.txt", "shaders/fshader.txt");
+    lightingShaders.Fallback = &lightCubeShader;
+    // materials packed into a texture array with tools/pack_textures are drawn from it with a
+    // layer and UV rect per instance instead of a texture bind each; the rest stream in
+    std::unique_ptr<TextureArray> materials;
+    if (vfs.Exists("textures/materials.tpack"))
+    {
+        materials = std::make_unique<TextureArray>("textures/materials.tpack");
+        if (!materials->IsValid())
+            materials.reset();
+    }
+    const PackedTexture* wallMaterial = materials ? materials->Find("textures/image.png") : NULL;
+    const PackedTexture* floorMaterial = materials ? materials->Find("textures/dirt.jpg") : NULL;
+    unsigned int wallKey = SHADER_INSTANCED | SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS | SHADER_POINT_SHADOWS | (wallMaterial ? SHADER_TEXTURE_ARRAY : 0);
+    // the floor is a virtual texture when one has been built with tools/make_vtex
+    bool virtualTerrain = vfs.Exists("textures/terrain.vtex");
+    unsigned int floorFeatures = virtualTerrain ? SHADER_VIRTUAL_TEXTURE : floorMaterial ? SHADER_TEXTURE_ARRAY : 0;
+    lightingShaders.Request(SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS | SHADER_POINT_SHADOWS | floorFeatures);
+    lightingShaders.Request(wallKey);
+    // with ambient occlusion, which is on from the start
+    lightingShaders.Request(SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS | SHADER_POINT_SHADOWS | SHADER_SSAO | floorFeatures);
+    lightingShaders.Request(wallKey | SHADER_SSAO);
+    // and their G-buffer variants, for switching to deferred shading
+    lightingShaders.Request(SHADER_GBUFFER | floorFeatures);
+    lightingShaders.Request(SHADER_GBUFFER | (wallKey & ~(SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS | SHADER_POINT_SHADOWS)));
+    ShaderCache feedbackShaders("shaders/vshader.txt", "shaders/vtfeedbackfshader.txt");
+    if (virtualTerrain)
+        feedbackShaders.Request(0);
+    bool shadersReady = false;
+
+    // look-dev: edited shaders are recompiled in the background and swapped in once they link
+    FileWatcher shaderWatcher("../../../src/shaders/");
 
     glEnable(GL_DEPTH_TEST); 
 
@@ -191,6 +267,100 @@ int main()
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
     glEnableVertexAttribArray(2);
 
+    // the perimeter walls never move, so their model matrices are composed once from the
+    // transform store straight into the instance buffer and the whole wall is drawn with a
+    // single instanced call
+    TransformStore walls;
+    int perimeterLength = 20; // Number of cubes on each side of the perimeter
+    float spacing = 1.0f; // Distance between the cubes
+    float offset = (perimeterLength - 1) * spacing / 2.0f; // Half the perimeter size, to center the cubes around the origin
+
+    // Loop through each side of the perimeter (top, bottom, left, right), two cubes high
+    for (int i = 0; i < perimeterLength; i++) {
+        for (float y : { -1.0f, 1.0f }) {
+            walls.Add(glm::vec3(i * spacing - offset, y, -offset));  // Top side
+            walls.Add(glm::vec3(i * spacing - offset, y, offset));   // Bottom side
+            walls.Add(glm::vec3(-offset, y, i * spacing - offset));  // Left side
+            walls.Add(glm::vec3(offset, y, i * spacing - offset));   // Right side
+        }
+    }
+
+    unsigned int wallInstanceVBO;
+    glGenBuffers(1, &wallInstanceVBO);
+    if (!walls.Upload(wallInstanceVBO, GL_STATIC_DRAW))                             // the walls never move
+        std::cout << "ERROR::TRANSFORMS::MAP_FAILED: wall instance buffer" << std::endl;
+    // per-instance model matrix, one vec4 column per attribute location (3-6)
+    for (unsigned int i = 0; i < 4; i++) {
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribDivisor(3 + i, 1);
+    }
+
+    // the walls are what the camera collides with; the floor is the camera's own ground clamp
+    CollisionWorld collision;
+    for (size_t i = 0; i < walls.Count(); i++)
+        collision.Add(Aabb::FromCenter(walls.Position(i), glm::vec3(0.5f)));
+    CharacterController controller;
+
+    // per-instance texture array layer and UV rect (locations 7-8)
+    if (wallMaterial)
+    {
+        struct WallMaterial { glm::vec4 rect; float layer; float repeat; };
+        std::vector<WallMaterial> wallMaterials(walls.Count(), { wallMaterial->Rect, (float)wallMaterial->Layer, 0.0f });
+        unsigned int wallMaterialVBO;
+        glGenBuffers(1, &wallMaterialVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, wallMaterialVBO);
+        glBufferData(GL_ARRAY_BUFFER, wallMaterials.size() * sizeof(WallMaterial), wallMaterials.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(WallMaterial), (void*)0);
+        glVertexAttribPointer(8, 2, GL_FLOAT, GL_FALSE, sizeof(WallMaterial), (void*)sizeof(glm::vec4));
+        for (unsigned int i = 7; i <= 8; i++) {
+            glEnableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 1);
+        }
+    }
+
+    // a few crates dropped in front of the camera; the floor and the walls are static bodies. The
+    // crates are drawn from the physics positions through their own instance buffer, and the
+    // camera collides with them through the collision world
+    PhysicsWorld physics;
+    physics.AddBody(glm::vec3(0.0f, -11.5f, 0.0f), glm::vec3(10.0f), 0.0f);
+    for (size_t i = 0; i < walls.Count(); i++)
+        physics.AddBody(walls.Position(i), glm::vec3(0.5f), 0.0f);
+    TransformStore crates;
+    std::vector<int> crateBodies, crateColliders;
+    for (int stack = 0; stack < 3; stack++) {
+        for (int level = 0; level < 4; level++) {
+            glm::vec3 position((stack - 1) * 2.0f + level * 0.15f, 1.0f + level * 1.2f, -4.0f + stack * 0.3f);
+            crates.Add(position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.8f));
+            crateBodies.push_back(physics.AddBody(position, glm::vec3(0.4f)));
+            crateColliders.push_back(collision.Add(physics.Box(crateBodies.back())));
+        }
+    }
+    unsigned int crateVAO, crateInstanceVBO;
+    glGenVertexArrays(1, &crateVAO);
+    glGenBuffers(1, &crateInstanceVBO);
+    glBindVertexArray(crateVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    crates.Upload(crateInstanceVBO);
+    for (unsigned int i = 0; i < 4; i++) {
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribDivisor(3 + i, 1);
+    }
+    glBindVertexArray(0);
+
+    // the lamp hangs off a rig spinning above the middle of the room; only those two nodes are
+    // ever dirty, so the scene graph update is a couple of matrix products a frame
+    SceneGraph scene;
+    int lightRig = scene.Add(-1, lightPos);
+    int lamp = scene.Add(lightRig, glm::vec3(5.0f, 0.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.5f)); // radius of the circular motion, a smaller cube
+
     // second, configure the light's VAO (VBO stays the same; the vertices are the same for the light object which is also a 3D cube)
     unsigned int lightCubeVAO;
     glGenVertexArrays(1, &lightCubeVAO);
@@ -230,34 +400,43 @@ int main()
     glEnableVertexAttribArray(2);
 
 
-    unsigned int textureCube;
-    glGenTextures(1, &textureCube);
-    glBindTexture(GL_TEXTURE_2D, textureCube);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    int width, height, nrChannels;
-    unsigned char* data = stbi_load("../../../src/textures/image.png", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-        std::cout << "Failed to load cube texture" << std::endl;
-    stbi_image_free(data);
-
     // load cube map/skybox texures
     std::vector<std::string> faces{
-    "../../../src/textures/skybox/right.png",
-    "../../../src/textures/skybox/left.png",
-    "../../../src/textures/skybox/top.png",
-    "../../../src/textures/skybox/bottom.png",
-    "../../../src/textures/skybox/front.png",
-    "../../../src/textures/skybox/back.png"
+    "textures/skybox/right.png",
+    "textures/skybox/left.png",
+    "textures/skybox/top.png",
+    "textures/skybox/bottom.png",
+    "textures/skybox/front.png",
+    "textures/skybox/back.png"
     };
 
+    // the skybox faces are read as one batch and decoded on the job pool as soon as their bytes
+    // arrive; only the uploads below stay on this thread
+    struct DecodedImage { unsigned char* data = NULL; int width = 0, height = 0, nrChannels = 0; };
+    std::vector<DecodedImage> images(faces.size());
+    vfs.ReadBatch(faces, [&images](size_t i, VfsFile& file) {
+        DecodedImage& image = images[i];
+        if (file)
+            image.data = stbi_load_from_memory(file.Data, (int)file.Size, &image.width, &image.height, &image.nrChannels, 0);
+    });
+
+    // the wall and floor textures stream in instead: the render loop starts right away with
+    // their smallest mips and they sharpen over the next frames, closest on screen first
+    TextureStreamer::LoadTextureStorage((GLADloadproc)glfwGetProcAddress);
+    TextureStreamer textureStreamer;
+    TextureResidency textureResidency(textureStreamer, textureBudgetArgument(argc, argv));
+    bool streamingDone = false;
+    StreamedTexture* cubeTexture = NULL;
+    if (!wallMaterial)
+    {
+        cubeTexture = textureStreamer.Load("textures/image.png", glm::vec3(0.0f), 14.0f);
+        glBindTexture(GL_TEXTURE_2D, cubeTexture->ID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
     unsigned int cubemapTexture;
     glGenTextures(1, &cubemapTexture);
     glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
@@ -267,176 +446,713 @@ int main()
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
     for (unsigned int i = 0; i < faces.size(); i++) {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data) {
+        DecodedImage& face = images[i];
+        if (face.data) {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
+                0, GL_RGB, face.width, face.height, 0, GL_RGB, GL_UNSIGNED_BYTE, face.data
             );
-            stbi_image_free(data);
+            stbi_image_free(face.data);
         }
         else {
             std::cout << "Failed to load skybox texture: " << faces[i] << std::endl;
-            stbi_image_free(data);
         }
     }
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); // Set texture wrapping (S direction)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); // Set texture wrapping (T direction)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    data = stbi_load("../../../src/textures/dirt.jpg", &width, &height, &nrChannels, 0);
-    if (data)
+    std::unique_ptr<VirtualTexture> terrain;
+    if (virtualTerrain)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        terrain = std::make_unique<VirtualTexture>("textures/terrain.vtex");
+        if (!terrain->IsValid())
+            terrain.reset();
     }
-    else
+    unsigned int planeKey = SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS | SHADER_POINT_SHADOWS | (terrain ? SHADER_VIRTUAL_TEXTURE : floorMaterial ? SHADER_TEXTURE_ARRAY : 0);
+
+    StreamedTexture* planeTexture = NULL;
+    if (!terrain && !floorMaterial)
     {
-        std::cout << "Failed to load texture!" << std::endl;
+        planeTexture = textureStreamer.Load("textures/dirt.jpg", glm::vec3(0.0f, -1.5f, 0.0f), 14.2f);
+        glBindTexture(GL_TEXTURE_2D, planeTexture->ID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); // Set texture wrapping (S direction)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); // Set texture wrapping (T direction)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     }
-    stbi_image_free(data);
+    vfs.PrintStats("Startup asset I/O");
+
+    // the floor, the walls and the lamp are entities; the render loop runs the systems in
+    // scene_systems.h over them. Materials bind whatever the draw samples
+    EcsWorld world;
+    Entity mainCamera = world.Create(CameraView());
+    RenderStats renderStats;
+    std::vector<std::function<void(Shader&)>> materialBinds;
+    materialBinds.push_back([&](Shader& shader) {
+        if (terrain)
+            terrain->Bind(shader, 1, 2);
+        else if (floorMaterial)
+        {
+            // the plane is not instanced, so its layer and rect are constant attribute values
+            materials->Bind(shader, 3);
+            glVertexAttrib4fv(7, glm::value_ptr(floorMaterial->Rect));
+            glVertexAttrib2f(8, (float)floorMaterial->Layer, 1.0f);                // repeats, like the dirt texture on its own
+        }
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D, planeTexture->ID);
+            textureResidency.Touch(planeTexture);
+        }
+    });
+    materialBinds.push_back([&](Shader& shader) {
+        if (wallMaterial)
+            materials->Bind(shader, 3);
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D, cubeTexture->ID);
+            textureResidency.Touch(cubeTexture);
+        }
+    });
+
+    MeshRenderer floorRenderer;
+    floorRenderer.VAO = planeVAO;
+    floorRenderer.VertexCount = 6;
+    floorRenderer.Shaders = &lightingShaders;
+    floorRenderer.ShaderKey = planeKey;
+    floorRenderer.Material = 0;
+    world.Create(floorRenderer, LocalToWorld(), LocalBounds{ glm::vec3(0.0f, -1.5f, 0.0f), 14.2f }, WorldBounds(), Visible(), ShadowCaster{ true });
+
+    MeshRenderer wallRenderer;
+    wallRenderer.VAO = cubeVAO;
+    wallRenderer.VertexCount = 36;
+    wallRenderer.InstanceCount = (int)walls.Count();
+    wallRenderer.Instances = &walls;
+    wallRenderer.Shaders = &lightingShaders;
+    wallRenderer.ShaderKey = wallKey;
+    wallRenderer.Material = 1;
+    wallRenderer.Blend = true;
+    world.Create(wallRenderer, LocalToWorld(), LocalBounds{ glm::vec3(0.0f), 14.3f }, WorldBounds(), Visible(), ShadowCaster{ true });
+
+    // the crates share the wall texture; not instanced in the texture array, so like the plane
+    // their layer and rect are constant attribute values
+    materialBinds.push_back([&](Shader& shader) {
+        if (wallMaterial)
+        {
+            materials->Bind(shader, 3);
+            glVertexAttrib4fv(7, glm::value_ptr(wallMaterial->Rect));
+            glVertexAttrib2f(8, (float)wallMaterial->Layer, 0.0f);
+        }
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D, cubeTexture->ID);
+            textureResidency.Touch(cubeTexture);
+        }
+    });
+    MeshRenderer crateRenderer;
+    crateRenderer.VAO = crateVAO;
+    crateRenderer.VertexCount = 36;
+    crateRenderer.InstanceCount = (int)crates.Count();
+    crateRenderer.Instances = &crates;
+    crateRenderer.Shaders = &lightingShaders;
+    crateRenderer.ShaderKey = wallKey;
+    crateRenderer.Material = 2;
+    Entity crateEntity = world.Create(crateRenderer, LocalToWorld(), LocalBounds{ glm::vec3(0.0f), 14.3f }, WorldBounds(), Visible(), ShadowCaster{ false });
+
+    // physics and collision work around a floating origin that follows the camera. The crates
+    // are drawn from physics positions, so their entity is anchored at the same origin
+    WorldOrigin worldOrigin;
+    worldOrigin.OnRebase([&](const glm::vec3& shift) {
+        physics.ShiftOrigin(shift);
+        collision.ShiftOrigin(shift);
+        world.Get<LocalToWorld>(crateEntity)->Origin = worldOrigin.Origin;
+    });
+
+    MeshRenderer lampRenderer;
+    lampRenderer.VAO = lightCubeVAO;
+    lampRenderer.VertexCount = 36;
+    lampRenderer.Program = &lightCubeShader;
+    lampRenderer.Lit = false;
+    // the lamp casts shadows from its light, but is no shadow caster itself
+    PointLight lampLight;
+    lampLight.CastsShadows = true;
+    world.Create(lampRenderer, LocalToWorld(), LocalBounds{ glm::vec3(0.0f), 0.87f }, WorldBounds(), Visible(), SceneNode{ lamp }, lampLight);
+
+    // a low sun with cascaded shadows. The floor and the walls never move, so with caching on
+    // they are only drawn into a cascade again when it moves; the crates are drawn every frame.
+    // C cycles the cascade count, [ and ] halve and double the resolution, K turns caching off
+    // and on and H runs the shadow benchmark
+    world.Create(DirectionalLight{ glm::normalize(glm::vec3(-0.4f, -1.0f, -0.3f)), glm::vec3(0.45f, 0.42f, 0.38f) });
+    ShadowCascades shadows;
+    // shadow cubes for the nearest point lights that cast shadows, far ones drawn less often: U
+    // turns that scheduling off and on, P runs the point shadow benchmark
+    PointShadows pointShadows;
+    // ambient occlusion at half resolution: O cycles the resolution (off, quarter, half, full), T
+    // turns temporal accumulation on and off and I runs the ambient occlusion benchmark
+    Ssao ssao;
+    // the scene is drawn at a resolution that keeps the GPU time of a frame within a budget and
+    // upscaled to the window: R turns that off and on, , and . lower and raise the budget and F
+    // flies the camera along a fixed path, once at full resolution and once scaled
+    DynamicResolution dynamicResolution;
+    bool dynamicResolutionOn = true;
+
+    // more point lights scattered over the floor, to try clustered lighting with many of them: +
+    // and - double and halve how many, L runs the light count benchmark. G switches between
+    // clustered forward and deferred shading of the same scene
+    LightClusterBuffers lightClusters;
+    DeferredRenderer deferred;
+    Shading_Path shadingPath = SHADING_FORWARD;
+    std::vector<Entity> extraLights;
+    auto setExtraLights = [&](int count) {
+        while ((int)extraLights.size() > count)
+        {
+            world.Destroy(extraLights.back());
+            extraLights.pop_back();
+        }
+        while ((int)extraLights.size() < count)
+        {
+            std::mt19937 random((unsigned int)extraLights.size());
+            std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+            PointLight light;
+            light.Color = glm::vec3(unit(random), unit(random), unit(random));
+            light.Radius = 1.5f + 2.5f * unit(random);
+            LocalToWorld placement;
+            placement.Value = glm::translate(glm::mat4(1.0f), glm::vec3(unit(random) * 20.0f - 10.0f, unit(random) * 3.0f - 1.3f, unit(random) * 20.0f - 10.0f));
+            extraLights.push_back(world.Create(placement, light));
+        }
+    };
+    GpuTimer sceneTimer;
+    GpuTimer shadowTimer;
+    GpuTimer pointShadowTimer;
+    bool previousKeys[GLFW_KEY_LAST + 1] = {};
+    auto keyPressed = [&](int key) {
+        bool down = glfwGetKey(window, key) == GLFW_PRESS;
+        bool pressed = down && !previousKeys[key];
+        previousKeys[key] = down;
+        return pressed;
+    };
+    // light count benchmark: each count from 1 to 4096 is held for a number of frames on each
+    // shading path, the first few of which let the timer catch up
+    const int SWEEP_FRAMES = 140, SWEEP_WARMUP = 20;
+    int sweepLights = 0, sweepFrame = 0, sweepSamples = 0, lightsBeforeSweep = 0;
+    double sweepGpuMs = 0.0, sweepCpuMs = 0.0, sweepClustersMs = 0.0;
+    double sweepPathMs[SHADING_PATH_COUNT] = {};
+    Shading_Path pathBeforeSweep = SHADING_FORWARD;
+    // shadow benchmark: the same number of frames with caching off, then on
+    const int SHADOW_BENCH_FRAMES = 240;
+    int shadowBenchFrame = -1, shadowBenchSamples = 0;
+    double shadowBenchMs = 0.0, shadowBenchDraws = 0.0, shadowBenchStatic = 0.0, shadowBenchRefreshed = 0.0, shadowBenchCulled = 0.0;
+    bool cachingBeforeBench = true;
+    // point shadow benchmark: 1 to POINT_BENCH_LIGHTS extra lights casting shadows, each count
+    // drawn every frame and then scheduled, the same number of frames each
+    const int POINT_BENCH_LIGHTS = 32, POINT_BENCH_FRAMES = 120;
+    int pointBenchLights = 0, pointBenchFrame = 0, pointBenchSamples = 0;
+    double pointBenchMs = 0.0, pointBenchUpdated = 0.0, pointBenchDraws = 0.0, pointBenchFaces = 0.0;
+    int maxLightsBeforeBench = 0, resolutionBeforeBench = 0;
+    auto setShadowedLights = [&](int count) {
+        setExtraLights(count);
+        for (Entity light : extraLights)
+            world.Get<PointLight>(light)->CastsShadows = count > 0;
+    };
+    // ambient occlusion benchmark: the same number of frames at each resolution
+    const int SSAO_BENCH_FRAMES = 120;
+    int ssaoBenchTier = -1, ssaoBenchFrame = 0, ssaoBenchSamples = 0;
+    double ssaoBenchMs = 0.0, ssaoBenchSceneMs = 0.0;
+    Ssao_Tier tierBeforeBench = SSAO_HALF;
+    // flythrough: a loop around the room looking across it, frame by frame so both runs see the
+    // same frames; the scale and the GPU frame time of each frame are kept for the report
+    const int FLYTHROUGH_FRAMES = 900;
+    int flythroughFrame = -1;
+    bool flythroughScaled = false;
+    std::vector<double> flythroughMs, flythroughScales;
+    auto reportFlythrough = [&]() {
+        // the first few frames let the timer catch up
+        std::vector<double> times(flythroughMs.begin() + SWEEP_WARMUP, flythroughMs.end());
+        std::vector<double> scales(flythroughScales.begin() + SWEEP_WARMUP, flythroughScales.end());
+        double mean = 0.0, spread = 0.0, meanScale = 0.0;
+        int overBudget = 0;
+        for (size_t i = 0; i < times.size(); i++)
+        {
+            mean += times[i];
+            meanScale += scales[i];
+            overBudget += times[i] > dynamicResolution.BudgetMilliseconds;
+        }
+        mean /= times.size();
+        meanScale /= scales.size();
+        for (double time : times)
+            spread += (time - mean) * (time - mean);
+        spread = std::sqrt(spread / times.size());
+        std::sort(times.begin(), times.end());
+        std::cout << "  " << (flythroughScaled ? "scaled" : "full resolution") << ": " << mean << " ms, deviation " << spread << " ms, 95th percentile "
+                  << times[times.size() * 95 / 100] << " ms, " << 100.0 * overBudget / times.size() << "% of frames over budget; scale "
+                  << meanScale << " on average, " << *std::min_element(scales.begin(), scales.end()) << " to "
+                  << *std::max_element(scales.begin(), scales.end()) << std::endl;
+        flythroughMs.clear();
+        flythroughScales.clear();
+    };
 
 
+    SimClock simClock;
+    FixedTimestep simulation(120);
+
     // the render loop
     while(!glfwWindowShouldClose(window))                                           
     {
 
-                // time calculations
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;  
+        // the mouse movement of the last frame's events, applied once
+        camera.UpdateOrientation();
+
+        // fixed-rate simulation steps for the time this frame took
+        int simulationSteps = simulation.Advance(simClock.Tick());
 
-                // inputs
-        processInput(window);
-        camera.UpdatePhysics(deltaTime);
+        if (!shadersReady && lightingShaders.IsReady() && skyShader.IsReady())
+        {
+            shadersReady = true;
+            std::cout << "Shaders ready after " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStart).count() << " ms" << std::endl;
+        }
+
+        // shader hot reload; costs one atomic load per frame while no files change
+        if (shaderWatcher.HasChanges())
+        {
+            for (const std::string& changed : shaderWatcher.TakeChanges())
+            {
+                std::string path = vfs.ToLogical(changed);
+                lightingShaders.Reload(path);
+                skyShader.Reload(path);
+                lightCubeShader.Reload(path);
+                deferred.Reload(path);
+                shadows.Reload(path);
+                pointShadows.Reload(path);
+                ssao.Reload(path);
+                dynamicResolution.Reload(path);
+            }
+        }
+
+        // inputs are sampled once per step, so the simulation only depends on what was held
+        // during each step and not on the frame rate
+        for (int step = 0; step < simulationSteps; step++)
+        {
+            physics.Step(simulation.StepSeconds());
+            for (size_t i = 0; i < crateBodies.size(); i++)
+                collision.Move(crateColliders[i], physics.Box(crateBodies[i]));
+            camera.BeginStep();
+            processInput(window, simulation.StepSeconds());
+            camera.UpdatePhysics(simulation.StepSeconds());
+            // the camera moved freely; the controller takes it back to where it could get to. Only
+            // the move goes through float, so the camera keeps its double position
+            glm::vec3 from = worldOrigin.ToLocal(camera.PreviousPosition);
+            glm::vec3 reached = controller.Move(collision, from, worldOrigin.ToLocal(camera.Position));
+            camera.Position = camera.PreviousPosition + glm::dvec3(reached - from);
+            if (controller.Grounded || (controller.HitCeiling && camera.velocityY > 0.0f))
+                camera.StopVertical();
+            worldOrigin.Update(camera.Position);
+        }
+        // everything below draws between the last two steps
+        Camera renderCamera = camera;
+        renderCamera.Position = camera.RenderPosition(simulation.Alpha());
+        for (size_t i = 0; i < crateBodies.size(); i++)
+            crates.SetPosition(i, physics.RenderPosition(crateBodies[i], simulation.Alpha()));
+        if (!crates.Upload(crateInstanceVBO))
+            std::cout << "ERROR::TRANSFORMS::MAP_FAILED: crate instance buffer" << std::endl;
+
+        if (flythroughFrame >= 0)
+        {
+            float t = (float)flythroughFrame / FLYTHROUGH_FRAMES * 2.0f * glm::pi<float>();
+            renderCamera.Position = glm::dvec3(6.5 * std::cos(t), 1.2 + 0.6 * std::sin(2.0f * t), 6.5 * std::sin(t));
+            renderCamera.SetOrientation(glm::degrees(t) + 180.0f + 25.0f * std::sin(3.0f * t), -10.0f + 8.0f * std::sin(2.0f * t));
+        }
+
+        // the scene's resolution for this frame; everything up to dynamicResolution.End is drawn
+        // at it
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        bool benchmarking = sweepLights > 0 || pointBenchLights > 0 || ssaoBenchTier >= 0 || shadowBenchFrame >= 0;
+        dynamicResolution.Enabled = flythroughFrame >= 0 ? flythroughScaled : dynamicResolutionOn && !benchmarking;
+        dynamicResolution.Begin(framebufferWidth, framebufferHeight);
+        int renderWidth = dynamicResolution.Stats.Width, renderHeight = dynamicResolution.Stats.Height;
+        renderCamera.SetViewport(renderWidth, renderHeight);
+
+        // stream texture levels within this frame's upload budget
+        textureStreamer.Update(renderCamera, (float)renderHeight);
+        if (!streamingDone && textureStreamer.Idle())
+        {
+            streamingDone = true;
+            textureStreamer.PrintStats("Texture streaming");
+            textureResidency.PrintStats("Texture residency");
+        }
+
+        // virtual texture feedback: the floor is drawn at low resolution with the page each pixel
+        // wants, and last frame's pages are requested and uploaded
+        if (terrain)
+        {
+            terrain->BeginFeedback(renderWidth, renderHeight);
+            Shader& feedbackShader = feedbackShaders.Get(0);
+            if (feedbackShader.use())
+            {
+                glm::mat4 feedbackProjection = renderCamera.GetProjectionMatrix();
+                glm::mat4 feedbackView = renderCamera.GetViewMatrix();
+                glm::mat4 feedbackModel = CameraRelative(glm::mat4(1.0f), glm::dvec3(0.0), renderCamera.Position);
+                feedbackShader.setMat4("projection", feedbackProjection);
+                feedbackShader.setMat4("view", feedbackView);
+                feedbackShader.setMat4("model", feedbackModel);
+                feedbackShader.setFloat("vtFeedbackBias", terrain->FeedbackBias());
+                terrain->Bind(feedbackShader, 1, 2);
+                glBindVertexArray(planeVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                glBindVertexArray(0);
+            }
+            terrain->EndFeedback();
+            terrain->Update();
+        }
                 // rendering 
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // the deferred path draws into its G-buffer and light target until it is done
+        glm::vec3 clearColor(0.1f, 0.1f, 0.1f);
+        bool deferredShading = shadingPath != SHADING_FORWARD;
+        if (deferredShading)
+            deferred.Begin(renderWidth, renderHeight, clearColor, framebufferWidth, framebufferHeight);
+        else
+        {
+            glClearColor(clearColor.r, clearColor.g, clearColor.b, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
        
         glDepthMask(GL_FALSE); // Disable depth writing before rendering skybox
-        skyShader.use();
-        glm::mat4 view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // Remove translation
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)1200 / (float)675, 0.1f, 1000.0f);
-        skyShader.setMat4("view", view);
-        skyShader.setMat4("projection", projection);
-        glBindVertexArray(skyboxVAO);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
+        glm::mat4 view = glm::mat4(glm::mat3(renderCamera.GetViewMatrix())); // Remove translation
+        glm::mat4 projection = renderCamera.GetProjectionMatrix();
+        if (skyShader.use()) // skip the sky until its program has linked
+        {
+            skyShader.setMat4("view", view);
+            skyShader.setMat4("projection", projection);
+            glBindVertexArray(skyboxVAO);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glBindVertexArray(0);
+        }
         glDepthMask(GL_TRUE); // Re-enable depth writing after rendering the skybox
         glDepthFunc(GL_LESS); // Restore normal depth testing
 
-        float radius = 5.0f;  // Radius of circular motion
-        float time = glfwGetTime() * 1.5f;
-        lightPos.x = cos(time) * radius;  // Circular motion in XZ plane
-        lightPos.z = sin(time) * radius;  // Circular motion in XZ plane
-
-        // render plane
-        lightingShader.use(); 
-
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f)); // scale it to make it large (adjust values as needed)
-        lightingShader.setMat4("model", model);
-        glBindTexture(GL_TEXTURE_2D, textureID); 
-        glBindVertexArray(planeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6); 
-        glBindVertexArray(0);
-
-        // cubes
-        lightingShader.use();
-        lightingShader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
-        lightingShader.setVec3("lightPos", lightPos);
-        lightingShader.setVec3("viewPos", camera.Position);
-
-        // view/projection transformations
-        projection = glm::perspective(glm::radians(camera.Zoom), (float)1200 / (float)675, 0.1f, 100.0f);
-        view = camera.GetViewMatrix();
-        lightingShader.setMat4("projection", projection);
-        lightingShader.setMat4("view", view);
-
-        // world transformation
-        model = glm::mat4(1.0f);
-        lightingShader.setMat4("model", model);
-        
-        // render the cubes
-        glEnable(GL_BLEND); // Enable blending
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // Blend using alpha channel
-        glBindVertexArray(cubeVAO);
-        glBindTexture(GL_TEXTURE_2D, textureCube);
-           
-        int perimeterLength = 20; // Number of cubes on each side of the perimeter
-        float spacing = 1.0f; // Distance between the cubes
-        float offset = (perimeterLength - 1) * spacing / 2.0f; // Half the perimeter size, to center the cubes around the origin
-
-        // Loop through each side of the perimeter (top, bottom, left, right)
-        for (int i = 0; i < perimeterLength; i++) {
-            // Top side
-            glm::vec3 posTop(i * spacing - offset, -1.0f, -offset); // Adjust position to center
-            glm::mat4 modelTop = glm::mat4(1.0f);
-            modelTop = glm::translate(modelTop, posTop);
-            lightingShader.setMat4("model", modelTop);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+        // at the same point between the last two steps as the camera; the angle is reduced in
+        // double so it stays precise after weeks of uptime
+        double time = simulation.Time() - (1.0 - simulation.Alpha()) / simulation.Rate;
+        float angle = (float)std::fmod(time * 1.5, 2.0 * glm::pi<double>());
+        scene.SetRotation(lightRig, glm::angleAxis(-angle, glm::vec3(0.0f, 1.0f, 0.0f)));  // Circular motion in XZ plane
+
+        // extra lights, shadow settings and the benchmarks
+        if (sweepLights == 0 && pointBenchLights == 0 && ssaoBenchTier < 0 && flythroughFrame < 0)
+        {
+            // both keys of a pair are polled every frame so neither keeps a stale edge
+            bool equal = keyPressed(GLFW_KEY_EQUAL), plus = keyPressed(GLFW_KEY_KP_ADD);
+            bool minus = keyPressed(GLFW_KEY_MINUS), subtract = keyPressed(GLFW_KEY_KP_SUBTRACT);
+            if (equal || plus)
+                setExtraLights(std::min(4096, std::max(1, (int)extraLights.size() * 2)));
+            if (minus || subtract)
+                setExtraLights((int)extraLights.size() / 2);
+            if (keyPressed(GLFW_KEY_G))
+            {
+                shadingPath = (Shading_Path)((shadingPath + 1) % SHADING_PATH_COUNT);
+                std::cout << "Shading: " << SHADING_PATH_NAMES[shadingPath] << std::endl;
+            }
+            if (shadowBenchFrame < 0)
+            {
+                if (keyPressed(GLFW_KEY_U))
+                {
+                    pointShadows.UpdateSchedule = !pointShadows.UpdateSchedule;
+                    std::cout << "Point shadow scheduling " << (pointShadows.UpdateSchedule ? "on" : "off") << std::endl;
+                }
+                if (keyPressed(GLFW_KEY_P))
+                {
+                    maxLightsBeforeBench = pointShadows.MaxLights;
+                    resolutionBeforeBench = pointShadows.Resolution;
+                    lightsBeforeSweep = (int)extraLights.size();
+                    pointShadows.MaxLights = POINT_BENCH_LIGHTS + 1;
+                    pointShadows.Resolution = 256;
+                    pointShadows.UpdateSchedule = false;
+                    std::cout << "Point shadow benchmark, " << pointShadows.Resolution << "x" << pointShadows.Resolution
+                              << " faces, per frame drawn every frame / scheduled:" << std::endl;
+                    pointBenchLights = 1;
+                    pointBenchFrame = 0;
+                    setShadowedLights(pointBenchLights);
+                }
+                if (keyPressed(GLFW_KEY_C))
+                {
+                    shadows.CascadeCount = shadows.CascadeCount % MAX_SHADOW_CASCADES + 1;
+                    std::cout << "Shadow cascades: " << shadows.CascadeCount << std::endl;
+                }
+                int resolution = shadows.Resolution;
+                if (keyPressed(GLFW_KEY_LEFT_BRACKET))
+                    resolution /= 2;
+                if (keyPressed(GLFW_KEY_RIGHT_BRACKET))
+                    resolution *= 2;
+                resolution = std::min(4096, std::max(512, resolution));
+                if (resolution != shadows.Resolution)
+                {
+                    shadows.Resolution = resolution;
+                    std::cout << "Shadow map resolution: " << shadows.Resolution << std::endl;
+                }
+                if (keyPressed(GLFW_KEY_K))
+                {
+                    shadows.CacheStatic = !shadows.CacheStatic;
+                    std::cout << "Static shadow caching " << (shadows.CacheStatic ? "on" : "off") << std::endl;
+                }
+                if (keyPressed(GLFW_KEY_H))
+                {
+                    std::cout << "Shadow benchmark, " << shadows.CascadeCount << " cascades of " << shadows.Resolution << "x" << shadows.Resolution
+                              << ", per frame:" << std::endl;
+                    cachingBeforeBench = shadows.CacheStatic;
+                    shadows.CacheStatic = false;
+                    shadowBenchFrame = 0;
+                }
+            }
+            if (keyPressed(GLFW_KEY_O))
+            {
+                ssao.Tier = (Ssao_Tier)((ssao.Tier + 1) % SSAO_TIER_COUNT);
+                std::cout << "Ambient occlusion: " << SSAO_TIER_NAMES[ssao.Tier] << std::endl;
+            }
+            if (keyPressed(GLFW_KEY_T))
+            {
+                ssao.Temporal = !ssao.Temporal;
+                std::cout << "Temporal ambient occlusion " << (ssao.Temporal ? "on" : "off") << std::endl;
+            }
+            if (keyPressed(GLFW_KEY_I))
+            {
+                std::cout << "Ambient occlusion benchmark, " << framebufferWidth << "x" << framebufferHeight << ", " << ssao.SampleCount
+                          << " samples, temporal " << (ssao.Temporal ? "on" : "off") << ", per frame:" << std::endl;
+                tierBeforeBench = ssao.Tier;
+                ssaoBenchTier = SSAO_OFF;
+                ssaoBenchFrame = 0;
+                ssao.Tier = SSAO_OFF;
+            }
+            if (keyPressed(GLFW_KEY_R))
+            {
+                dynamicResolutionOn = !dynamicResolutionOn;
+                std::cout << "Dynamic resolution " << (dynamicResolutionOn ? "on" : "off") << std::endl;
+            }
+            double budget = dynamicResolution.BudgetMilliseconds;
+            if (keyPressed(GLFW_KEY_COMMA))
+                budget -= 2.0;
+            if (keyPressed(GLFW_KEY_PERIOD))
+                budget += 2.0;
+            budget = std::min(100.0, std::max(4.0, budget));
+            if (budget != dynamicResolution.BudgetMilliseconds)
+            {
+                dynamicResolution.BudgetMilliseconds = budget;
+                std::cout << "Frame time budget: " << budget << " ms" << std::endl;
+            }
+            if (keyPressed(GLFW_KEY_F) && shadowBenchFrame < 0)
+            {
+                std::cout << "Flythrough, " << framebufferWidth << "x" << framebufferHeight << " window, "
+                          << dynamicResolution.BudgetMilliseconds << " ms budget, GPU time per frame:" << std::endl;
+                flythroughFrame = 0;
+                flythroughScaled = false;
+            }
+            if (keyPressed(GLFW_KEY_L))
+            {
+                std::cout << "Light count benchmark, " << framebufferWidth << "x" << framebufferHeight << ", GPU ms of the scene on each path:" << std::endl;
+                lightsBeforeSweep = (int)extraLights.size();
+                pathBeforeSweep = shadingPath;
+                shadingPath = SHADING_FORWARD;
+                sweepLights = 1;
+                sweepFrame = 0;
+                setExtraLights(sweepLights);
+            }
+        }
 
-            glm::vec3 posTop2(i * spacing - offset, 1.0f, -offset); // Adjust position to center
-            modelTop = glm::mat4(1.0f);
-            modelTop = glm::translate(modelTop, posTop2);
-            lightingShader.setMat4("model", modelTop);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-            // Bottom side
-            glm::vec3 posBottom(i * spacing - offset, -1.0f, offset); // Adjust position to center
-            glm::mat4 modelBottom = glm::mat4(1.0f);
-            modelBottom = glm::translate(modelBottom, posBottom);
-            lightingShader.setMat4("model", modelBottom);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+        // scene objects. The transform hierarchy updates on a worker while the camera does;
+        // everything after reads both
+        JobCounter transformsDone;
+        JobPool::Instance().Submit([&scene]() { scene.Update(); }, &transformsDone);
+        CameraSystem(world, renderCamera);
+        JobPool::Instance().Wait(transformsDone);
+        SceneNodeSystem(world, scene);
+        BoundsSystem(world);
+        LightSystem(world);
+        const CameraView& cameraView = *world.Get<CameraView>(mainCamera);
+        CullingSystem(world, cameraView, renderStats);
+        shadowTimer.Begin();
+        ShadowSystem(world, cameraView, shadows);
+        shadowTimer.End();
+        pointShadowTimer.Begin();
+        PointShadowSystem(world, cameraView, pointShadows);
+        pointShadowTimer.End();
+        SsaoSystem(world, cameraView, materialBinds, ssao, framebufferWidth, framebufferHeight);
+        const Ssao* occlusion = ssao.Enabled() ? &ssao : NULL;
+        // GPU time of the lit scene, which is what grows with the lights
+        if (deferredShading)
+        {
+            sceneTimer.Begin();
+            deferred.BeginGeometry();
+            RenderSystem(world, cameraView, materialBinds, renderStats, NULL, RENDER_GBUFFER);
+            deferred.EndGeometry();
+            DeferredLightingSystem(world, cameraView, deferred, shadingPath == SHADING_DEFERRED_TILES ? &lightClusters : NULL, &shadows, &pointShadows, occlusion);
+            RenderSystem(world, cameraView, materialBinds, renderStats, NULL, RENDER_UNLIT);
+            deferred.End(dynamicResolution.Framebuffer());
+            sceneTimer.End();
+        }
+        else
+        {
+            LightClusterSystem(world, cameraView, lightClusters);
+            sceneTimer.Begin();
+            RenderSystem(world, cameraView, materialBinds, renderStats, &lightClusters, RENDER_FORWARD, &shadows, &pointShadows, occlusion);
+            sceneTimer.End();
+        }
 
-            glm::vec3 posBottom2(i * spacing - offset, 1.0f, offset); // Adjust position to center
-            modelBottom = glm::mat4(1.0f);
-            modelBottom = glm::translate(modelBottom, posBottom2);
-            lightingShader.setMat4("model", modelBottom);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-            // Left side
-            glm::vec3 posLeft(-offset, -1.0f, i * spacing - offset); // Adjust position to center
-            glm::mat4 modelLeft = glm::mat4(1.0f);
-            modelLeft = glm::translate(modelLeft, posLeft);
-            lightingShader.setMat4("model", modelLeft);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+        if (shadowBenchFrame >= 0)
+        {
+            // the first few frames of each half let the timer catch up
+            if (++shadowBenchFrame % SHADOW_BENCH_FRAMES > SWEEP_WARMUP)
+            {
+                shadowBenchMs += shadowTimer.Milliseconds();
+                shadowBenchDraws += shadows.Stats.Draws;
+                shadowBenchStatic += shadows.Stats.StaticDraws;
+                shadowBenchRefreshed += shadows.Stats.CachesRefreshed;
+                shadowBenchCulled += shadows.Stats.Culled;
+                shadowBenchSamples++;
+            }
+            if (shadowBenchFrame % SHADOW_BENCH_FRAMES == 0)
+            {
+                std::cout << "  caching " << (shadows.CacheStatic ? "on" : "off") << ": " << shadowBenchMs / shadowBenchSamples << " ms, "
+                          << shadowBenchDraws / shadowBenchSamples << " draws (" << shadowBenchStatic / shadowBenchSamples << " static), "
+                          << shadowBenchRefreshed / shadowBenchSamples << " of " << shadows.Count() << " cascades refreshed, "
+                          << shadowBenchCulled / shadowBenchSamples << " culled; " << shadows.Bytes() / (1024 * 1024) << " MB of maps" << std::endl;
+                shadowBenchMs = shadowBenchDraws = shadowBenchStatic = shadowBenchRefreshed = shadowBenchCulled = 0.0;
+                shadowBenchSamples = 0;
+                if (shadows.CacheStatic)
+                {
+                    shadows.CacheStatic = cachingBeforeBench;
+                    shadowBenchFrame = -1;
+                }
+                else
+                    shadows.CacheStatic = true;
+            }
+        }
 
-            glm::vec3 posLeft2(-offset, 1.0f, i* spacing - offset); // Adjust position to center
-            modelLeft = glm::mat4(1.0f);
-            modelLeft = glm::translate(modelLeft, posLeft2);
-            lightingShader.setMat4("model", modelLeft);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-            // Right side
-            glm::vec3 posRight(offset, -1.0f, i * spacing - offset); // Adjust position to center
-            glm::mat4 modelRight = glm::mat4(1.0f);
-            modelRight = glm::translate(modelRight, posRight);
-            lightingShader.setMat4("model", modelRight);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+        if (pointBenchLights > 0)
+        {
+            if (++pointBenchFrame > SWEEP_WARMUP)
+            {
+                pointBenchMs += pointShadowTimer.Milliseconds();
+                pointBenchUpdated += pointShadows.Stats.Updated;
+                pointBenchDraws += pointShadows.Stats.Draws;
+                pointBenchFaces += pointShadows.Stats.Faces;
+                pointBenchSamples++;
+            }
+            if (pointBenchFrame == POINT_BENCH_FRAMES)
+            {
+                if (!pointShadows.UpdateSchedule)
+                    std::cout << "  " << pointBenchLights + 1 << " lights: " << pointBenchMs / pointBenchSamples << " ms, "
+                              << pointBenchDraws / pointBenchSamples << " draws for " << pointBenchFaces / pointBenchSamples << " faces";
+                else
+                    std::cout << " / " << pointBenchMs / pointBenchSamples << " ms, " << pointBenchUpdated / pointBenchSamples << " of "
+                              << pointShadows.Stats.Lights << " cubes, " << pointBenchDraws / pointBenchSamples << " draws for "
+                              << pointBenchFaces / pointBenchSamples << " faces" << std::endl;
+                pointBenchMs = pointBenchUpdated = pointBenchDraws = pointBenchFaces = 0.0;
+                pointBenchSamples = 0;
+                pointBenchFrame = 0;
+                pointShadows.UpdateSchedule = !pointShadows.UpdateSchedule;
+                if (!pointShadows.UpdateSchedule)
+                {
+                    pointBenchLights *= 2;
+                    if (pointBenchLights > POINT_BENCH_LIGHTS)
+                    {
+                        std::cout << "  " << pointShadows.Bytes() / (1024 * 1024) << " MB of cubes" << std::endl;
+                        pointBenchLights = 0;
+                        pointShadows.UpdateSchedule = true;
+                        pointShadows.MaxLights = maxLightsBeforeBench;
+                        pointShadows.Resolution = resolutionBeforeBench;
+                        setShadowedLights(0);
+                        setExtraLights(lightsBeforeSweep);
+                    }
+                    else
+                        setShadowedLights(pointBenchLights);
+                }
+            }
+        }
 
-            glm::vec3 posRight2(offset, 1.0f, i * spacing - offset); // Adjust position to center
-            modelRight = glm::mat4(1.0f);
-            modelRight = glm::translate(modelRight, posRight2);
-            lightingShader.setMat4("model", modelRight);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+        if (ssaoBenchTier >= 0)
+        {
+            if (++ssaoBenchFrame > SWEEP_WARMUP)
+            {
+                ssaoBenchMs += ssao.Enabled() ? ssao.Stats.Milliseconds : 0.0;
+                ssaoBenchSceneMs += sceneTimer.Milliseconds();
+                ssaoBenchSamples++;
+            }
+            if (ssaoBenchFrame == SSAO_BENCH_FRAMES)
+            {
+                std::cout << "  " << SSAO_TIER_NAMES[ssaoBenchTier] << ": ";
+                if (ssao.Enabled())
+                    std::cout << ssao.Stats.Width << "x" << ssao.Stats.Height << ", " << ssaoBenchMs / ssaoBenchSamples << " ms ("
+                              << ssao.Stats.Draws << " prepass draws), " << ssao.Stats.Bytes / 1024 << " KB of targets; ";
+                std::cout << "scene " << ssaoBenchSceneMs / ssaoBenchSamples << " ms" << std::endl;
+                ssaoBenchMs = ssaoBenchSceneMs = 0.0;
+                ssaoBenchSamples = 0;
+                ssaoBenchFrame = 0;
+                if (++ssaoBenchTier == SSAO_TIER_COUNT)
+                {
+                    ssaoBenchTier = -1;
+                    ssao.Tier = tierBeforeBench;
+                }
+                else
+                    ssao.Tier = (Ssao_Tier)ssaoBenchTier;
+            }
         }
-        glBindVertexArray(0);
-        glDisable(GL_BLEND);
-
-        // also draw the lamp object
-        lightCubeShader.use();
-        lightCubeShader.setMat4("projection", projection);
-        lightCubeShader.setMat4("view", view);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, lightPos);
-        model = glm::scale(model, glm::vec3(0.5f)); // a smaller cube
-        lightCubeShader.setMat4("model", model);
-
-        glBindVertexArray(lightCubeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
+
+        if (sweepLights > 0)
+        {
+            if (++sweepFrame > SWEEP_WARMUP)
+            {
+                sweepGpuMs += sceneTimer.Milliseconds();
+                sweepCpuMs += lightClusters.Stats.Milliseconds;
+                sweepSamples++;
+            }
+            if (sweepFrame == SWEEP_FRAMES)
+            {
+                sweepPathMs[shadingPath] = sweepGpuMs / sweepSamples;
+                if (shadingPath == SHADING_FORWARD)
+                    sweepClustersMs = sweepCpuMs / sweepSamples;
+                if (shadingPath == SHADING_DEFERRED_VOLUMES)
+                {
+                    const DeferredStats& stats = deferred.Stats;
+                    std::cout << "  " << extraLights.size() + 1 << " lights: forward " << sweepPathMs[SHADING_FORWARD] << " ms, clusters "
+                              << sweepClustersMs << " ms CPU, " << lightClusters.Stats.References << " references, at most "
+                              << lightClusters.Stats.MaxPerCluster << " per cluster; deferred tiled " << sweepPathMs[SHADING_DEFERRED_TILES]
+                              << " ms; light volumes " << sweepPathMs[SHADING_DEFERRED_VOLUMES] << " ms, " << stats.Draws << " lighting draws, "
+                              << stats.Bytes / (1024 * 1024) << " MB G-buffer traffic" << std::endl;
+                }
+                // forward, tiled, then volumes
+                shadingPath = shadingPath == SHADING_FORWARD ? SHADING_DEFERRED_TILES : shadingPath == SHADING_DEFERRED_TILES ? SHADING_DEFERRED_VOLUMES : SHADING_FORWARD;
+                sweepFrame = 0;
+                sweepSamples = 0;
+                sweepGpuMs = sweepCpuMs = 0.0;
+                if (shadingPath == SHADING_FORWARD)
+                {
+                    sweepLights *= 2;
+                    if (sweepLights > 4096)
+                    {
+                        sweepLights = 0;
+                        shadingPath = pathBeforeSweep;
+                        setExtraLights(lightsBeforeSweep);
+                        std::cout << "  G-buffer " << deferred.Stats.Width << "x" << deferred.Stats.Height << ": "
+                                  << deferred.Stats.GBufferBytes / (1024 * 1024) << " MB, light target "
+                                  << deferred.Stats.TargetBytes / (1024 * 1024) << " MB" << std::endl;
+                    }
+                    else
+                        setExtraLights(sweepLights);
+                }
+            }
+        }
+
+        // the scene goes to the window at its own resolution; anything drawn after this is native
+        dynamicResolution.End();
+
+        if (flythroughFrame >= 0)
+        {
+            flythroughMs.push_back(dynamicResolution.Stats.FrameMilliseconds);
+            flythroughScales.push_back(dynamicResolution.Stats.Scale);
+            if (++flythroughFrame == FLYTHROUGH_FRAMES)
+            {
+                reportFlythrough();
+                flythroughFrame = flythroughScaled ? -1 : 0;
+                flythroughScaled = !flythroughScaled;
+            }
+        }
+
+        textureResidency.Update();
 
         glfwSwapBuffers(window);
         glfwPollEvents();    
@@ -447,7 +1163,7 @@ int main()
     return 0;
 }
 
-void processInput(GLFWwindow *window)
+void processInput(GLFWwindow *window, float deltaTime)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
@@ -474,6 +1190,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
+    camera.SetViewport(width, height);
 }
 
 
@@ -505,4 +1222,16 @@ void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
-}
\ No newline at end of file
+}
+
+// --texture-budget <MB> replaces TEXTURE_BUDGET, e.g. a few MB to watch eviction and reloading
+// ----------------------------------------------------------------------------------------------
+uint64_t textureBudgetArgument(int argc, char** argv)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--texture-budget") == 0)
+            return (uint64_t)std::max(1, atoi(argv[i + 1])) * 1024 * 1024;
+    }
+    return TEXTURE_BUDGET;
+}
@@ -0,0 +1,525 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include <glm/glm.hpp>
+
+#include "job_pool.h"
+#include "collision.h"
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PHYSICS_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Work done by the last Step
+struct PhysicsStats
+{
+    int Bodies = 0;
+    int Pairs = 0;              // boxes whose intervals overlap on all three axes
+    int Contacts = 0;           // pairs the narrowphase found touching and that are not both static
+    int Swaps = 0;              // insertion sort moves keeping the sweep order, low when little moves
+    double Milliseconds = 0.0;
+};
+
+// Box overlap found by the narrowphase. The normal is the axis of least penetration, pointing
+// from A to B
+struct PhysicsContact
+{
+    int A;
+    int B;
+    int Axis;
+    float Sign;
+    float Depth;
+    float NormalImpulse;        // accumulated over the solver iterations
+    float TangentImpulse[2];
+};
+
+// Rigid boxes that fall, collide and stack, stepped at the fixed simulation rate. Bodies keep
+// their orientation: the renderer's boxes are axis aligned, and without rotation stacks settle
+// and stay put with a small iteration count. Each step:
+//  - integrates gravity into the velocities,
+//  - keeps the bodies sorted by the low end of their interval on one axis (sweep and prune). The
+//    order only changes where bodies passed each other since the last step, so an insertion
+//    sort fixes it in close to linear time; the axis is the one the bodies are most spread along,
+//  - sweeps the sorted intervals for pairs that overlap on all three axes,
+//  - finds the contacts of those pairs four at a time with SSE,
+//  - solves the contacts with sequential impulses (Coulomb friction), starting from the impulses
+//    the same pairs ended the last step with, moves the bodies and pushes out what is left of
+//    the overlaps.
+// The integration, the sweep and the narrowphase are spread over the JobPool once there are
+// enough bodies; the solver stays on one thread so the results are the same on any core count.
+// Mass 0 makes a body static
+class PhysicsWorld
+{
+public:
+    PhysicsStats Stats;
+    glm::vec3 Gravity = glm::vec3(0.0f, -9.8f, 0.0f);
+    int Iterations = 8;             // velocity solver passes
+    int PositionIterations = 3;
+    float Friction = 0.5f;
+    float Slop = 0.005f;            // overlap left alone so resting contacts stay in touch
+    int ParallelThreshold = 2048;   // bodies below which Step stays on the calling thread
+
+    explicit PhysicsWorld(JobPool& pool = JobPool::Instance()) : pool(pool) {}
+
+    int AddBody(const glm::vec3& position, const glm::vec3& halfExtents, float mass = 1.0f)
+    {
+        positions.push_back(position);
+        previous.push_back(position);
+        velocities.push_back(glm::vec3(0.0f));
+        extents.push_back(halfExtents);
+        inverseMass.push_back(mass > 0.0f ? 1.0f / mass : 0.0f);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            low[axis].push_back(position[axis] - halfExtents[axis]);
+            high[axis].push_back(position[axis] + halfExtents[axis]);
+        }
+        // new bodies go at the end of the sweep order; the next sort places them
+        order.push_back((int)order.size());
+        added++;
+        return (int)positions.size() - 1;
+    }
+
+    void SetPosition(int body, const glm::vec3& position)
+    {
+        positions[body] = position;
+        previous[body] = position;
+        updateBounds(body);
+    }
+
+    void SetVelocity(int body, const glm::vec3& velocity) { velocities[body] = velocity; }
+
+    const glm::vec3& Position(int body) const { return positions[body]; }
+    const glm::vec3& Velocity(int body) const { return velocities[body]; }
+    const glm::vec3& HalfExtents(int body) const { return extents[body]; }
+    bool IsStatic(int body) const { return inverseMass[body] == 0.0f; }
+    size_t Count() const { return positions.size(); }
+    const std::vector<PhysicsContact>& Contacts() const { return contacts; }
+
+    Aabb Box(int body) const
+    {
+        return Aabb::FromCenter(positions[body], extents[body]);
+    }
+
+    // the coordinates moved by shift (WorldOrigin rebased); every body keeps its place in the
+    // world, its velocity and its contacts
+    void ShiftOrigin(const glm::vec3& shift)
+    {
+        for (size_t i = 0; i < positions.size(); i++)
+        {
+            positions[i] -= shift;
+            previous[i] -= shift;
+            updateBounds((int)i);
+        }
+    }
+
+    // where to draw the body, alpha of the way from the previous step to the last one
+    glm::vec3 RenderPosition(int body, float alpha) const
+    {
+        return glm::mix(previous[body], positions[body], alpha);
+    }
+
+    void Step(float dt)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int count = (int)positions.size();
+        bool parallel = count >= ParallelThreshold && pool.WorkerCount() > 0;
+        int batches = parallel ? (int)(pool.WorkerCount() + 1) * 4 : 1;
+
+        forRange(parallel, count, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                previous[i] = positions[i];
+                if (inverseMass[i] > 0.0f)
+                    velocities[i] += Gravity * dt;
+            }
+        });
+
+        sortAxis();
+        findPairs(parallel, batches);
+        findContacts(parallel, batches);
+        warmStart();
+        solveVelocities();
+
+        forRange(parallel, count, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                positions[i] += velocities[i] * dt;
+                updateBounds(i);
+            }
+        });
+        solvePositions();
+        rememberContacts();
+
+        Stats.Bodies = count;
+        Stats.Pairs = (int)pairs.size();
+        Stats.Contacts = (int)contacts.size();
+        Stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    JobPool& pool;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> previous;
+    std::vector<glm::vec3> velocities;
+    std::vector<glm::vec3> extents;
+    std::vector<float> inverseMass;
+    std::vector<float> low[3];      // bounds by axis, for the sweep
+    std::vector<float> high[3];
+    std::vector<int> order;         // bodies by low[axis]
+    int axis = 0;
+    int added = 0;                  // bodies added since the last sort
+    // the bounds gathered in sweep order, so the sweep reads them front to back
+    std::vector<float> sortedLow[3];
+    std::vector<float> sortedHigh[3];
+    std::vector<char> sortedStatic;
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<PhysicsContact> contacts;
+    std::vector<std::pair<uint64_t, PhysicsContact>> lastContacts;   // by pair key, for warm starting
+    std::vector<std::vector<std::pair<int, int>>> batchPairs;
+    std::vector<std::vector<PhysicsContact>> batchContacts;
+
+    // body(begin, end) over [0, count), split into batches on the JobPool when parallel
+    template <typename F>
+    void forRange(bool parallel, int count, const F& body)
+    {
+        if (!parallel)
+        {
+            body(0, count);
+            return;
+        }
+        int batches = (int)(pool.WorkerCount() + 1) * 4;
+        pool.ParallelFor(batches, [&](int batch)
+        {
+            body((int)((int64_t)count * batch / batches), (int)((int64_t)count * (batch + 1) / batches));
+        }, 1);
+    }
+
+    void updateBounds(int i)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            low[a][i] = positions[i][a] - extents[i][a];
+            high[a][i] = positions[i][a] + extents[i][a];
+        }
+    }
+
+    // sweeps along the axis the bodies are most spread along; switching axis costs one full sort
+    void sortAxis()
+    {
+        int count = (int)positions.size();
+        Stats.Swaps = 0;
+        if (count == 0)
+            return;
+        glm::vec3 sum(0.0f), squares(0.0f);
+        for (const glm::vec3& p : positions)
+        {
+            sum += p;
+            squares += p * p;
+        }
+        glm::vec3 variance = squares / (float)count - (sum / (float)count) * (sum / (float)count);
+        int best = variance.x >= variance.y && variance.x >= variance.z ? 0 : variance.y >= variance.z ? 1 : 2;
+        // only switch for a clear winner so the order is not rebuilt back and forth. Bodies added
+        // in bulk are also placed with a full sort, which the insertion sort would be quadratic on
+        bool switchAxis = best != axis && variance[best] > variance[axis] * 1.5f;
+        if (switchAxis || added * 16 > count)
+        {
+            if (switchAxis)
+                axis = best;
+            const std::vector<float>& keys = low[axis];
+            std::sort(order.begin(), order.end(), [&keys](int a, int b) { return keys[a] < keys[b]; });
+            added = 0;
+            return;
+        }
+        added = 0;
+        const std::vector<float>& keys = low[axis];
+        for (int i = 1; i < count; i++)
+        {
+            int body = order[i];
+            float key = keys[body];
+            int j = i - 1;
+            while (j >= 0 && keys[order[j]] > key)
+            {
+                order[j + 1] = order[j];
+                j--;
+                Stats.Swaps++;
+            }
+            order[j + 1] = body;
+        }
+    }
+
+    void findPairs(bool parallel, int batches)
+    {
+        int count = (int)order.size();
+        for (int a = 0; a < 3; a++)
+        {
+            sortedLow[a].resize(count);
+            sortedHigh[a].resize(count);
+        }
+        sortedStatic.resize(count);
+        forRange(parallel, count, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                int body = order[i];
+                for (int a = 0; a < 3; a++)
+                {
+                    sortedLow[a][i] = low[a][body];
+                    sortedHigh[a][i] = high[a][body];
+                }
+                sortedStatic[i] = inverseMass[body] == 0.0f;
+            }
+        });
+
+        const float* sweepLow = sortedLow[axis].data();
+        const float* low1 = sortedLow[(axis + 1) % 3].data();
+        const float* high1 = sortedHigh[(axis + 1) % 3].data();
+        const float* low2 = sortedLow[(axis + 2) % 3].data();
+        const float* high2 = sortedHigh[(axis + 2) % 3].data();
+        batchPairs.resize(batches);
+        auto sweep = [&](int batch)
+        {
+            std::vector<std::pair<int, int>>& found = batchPairs[batch];
+            found.clear();
+            int begin = (int)((int64_t)count * batch / batches), end = (int)((int64_t)count * (batch + 1) / batches);
+            for (int i = begin; i < end; i++)
+            {
+                float reach = sortedHigh[axis][i];
+                int j = i + 1;
+#ifdef PHYSICS_SIMD_X86
+                // four candidates at a time; the ones still within reach are a prefix, since the
+                // candidates are sorted by where they start
+                __m128 reach4 = _mm_set1_ps(reach);
+                __m128 low1i = _mm_set1_ps(low1[i]), high1i = _mm_set1_ps(high1[i]);
+                __m128 low2i = _mm_set1_ps(low2[i]), high2i = _mm_set1_ps(high2[i]);
+                for (; j + 4 <= count; j += 4)
+                {
+                    __m128 within = _mm_cmple_ps(_mm_loadu_ps(sweepLow + j), reach4);
+                    int withinMask = _mm_movemask_ps(within);
+                    if (withinMask == 0)
+                        break;
+                    __m128 overlap = _mm_and_ps(within, _mm_and_ps(_mm_cmple_ps(low1i, _mm_loadu_ps(high1 + j)), _mm_cmple_ps(_mm_loadu_ps(low1 + j), high1i)));
+                    overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(low2i, _mm_loadu_ps(high2 + j)), _mm_cmple_ps(_mm_loadu_ps(low2 + j), high2i)));
+                    for (int mask = _mm_movemask_ps(overlap); mask != 0; mask &= mask - 1)
+                    {
+                        int k = j + ctz(mask);
+                        if (!(sortedStatic[i] && sortedStatic[k]))
+                            found.push_back({ std::min(order[i], order[k]), std::max(order[i], order[k]) });
+                    }
+                    if (withinMask != 0xF)
+                    {
+                        j = count;
+                        break;
+                    }
+                }
+#endif
+                for (; j < count && sweepLow[j] <= reach; j++)
+                {
+                    if (sortedStatic[i] && sortedStatic[j])
+                        continue;
+                    if (low1[i] <= high1[j] && low1[j] <= high1[i] && low2[i] <= high2[j] && low2[j] <= high2[i])
+                        found.push_back({ std::min(order[i], order[j]), std::max(order[i], order[j]) });
+                }
+            }
+        };
+        if (parallel)
+            pool.ParallelFor(batches, sweep, 1);
+        else
+            sweep(0);
+        pairs.clear();
+        for (int batch = 0; batch < (parallel ? batches : 1); batch++)
+            pairs.insert(pairs.end(), batchPairs[batch].begin(), batchPairs[batch].end());
+    }
+
+    static int ctz(int mask)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz((unsigned int)mask);
+#else
+        unsigned long index;
+        _BitScanForward(&index, (unsigned long)mask);
+        return (int)index;
+#endif
+    }
+
+    static void addContact(std::vector<PhysicsContact>& out, int a, int b, const float* overlap, const float* delta)
+    {
+        int contactAxis = overlap[0] <= overlap[1] && overlap[0] <= overlap[2] ? 0 : overlap[1] <= overlap[2] ? 1 : 2;
+        out.push_back({ a, b, contactAxis, delta[contactAxis] >= 0.0f ? 1.0f : -1.0f, overlap[contactAxis], 0.0f, { 0.0f, 0.0f } });
+    }
+
+    // overlap of each pair on every axis and the axis of least penetration; the pairs are taken
+    // four at a time, one per SSE lane
+    void findContacts(bool parallel, int batches)
+    {
+        int count = (int)pairs.size();
+        batchContacts.resize(batches);
+        auto narrow = [&](int batch)
+        {
+            std::vector<PhysicsContact>& found = batchContacts[batch];
+            found.clear();
+            int begin = (int)((int64_t)count * batch / batches), end = (int)((int64_t)count * (batch + 1) / batches);
+            int i = begin;
+#ifdef PHYSICS_SIMD_X86
+            const __m128 signMask = _mm_set1_ps(-0.0f);
+            for (; i + 4 <= end; i += 4)
+            {
+                const std::pair<int, int>* p = &pairs[i];
+                __m128 overlap[3], delta[3];
+                __m128 touching = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int a = 0; a < 3; a++)
+                {
+                    __m128 centerA = _mm_setr_ps(positions[p[0].first][a], positions[p[1].first][a], positions[p[2].first][a], positions[p[3].first][a]);
+                    __m128 centerB = _mm_setr_ps(positions[p[0].second][a], positions[p[1].second][a], positions[p[2].second][a], positions[p[3].second][a]);
+                    __m128 extentA = _mm_setr_ps(extents[p[0].first][a], extents[p[1].first][a], extents[p[2].first][a], extents[p[3].first][a]);
+                    __m128 extentB = _mm_setr_ps(extents[p[0].second][a], extents[p[1].second][a], extents[p[2].second][a], extents[p[3].second][a]);
+                    delta[a] = _mm_sub_ps(centerB, centerA);
+                    overlap[a] = _mm_sub_ps(_mm_add_ps(extentA, extentB), _mm_andnot_ps(signMask, delta[a]));
+                    touching = _mm_and_ps(touching, _mm_cmpgt_ps(overlap[a], _mm_setzero_ps()));
+                }
+                int mask = _mm_movemask_ps(touching);
+                if (mask == 0)
+                    continue;
+                alignas(16) float overlaps[3][4], deltas[3][4];
+                for (int a = 0; a < 3; a++)
+                {
+                    _mm_store_ps(overlaps[a], overlap[a]);
+                    _mm_store_ps(deltas[a], delta[a]);
+                }
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (!(mask & (1 << lane)))
+                        continue;
+                    float laneOverlap[3] = { overlaps[0][lane], overlaps[1][lane], overlaps[2][lane] };
+                    float laneDelta[3] = { deltas[0][lane], deltas[1][lane], deltas[2][lane] };
+                    addContact(found, p[lane].first, p[lane].second, laneOverlap, laneDelta);
+                }
+            }
+#endif
+            for (; i < end; i++)
+            {
+                int a = pairs[i].first, b = pairs[i].second;
+                float overlap[3], delta[3];
+                bool touching = true;
+                for (int k = 0; k < 3; k++)
+                {
+                    delta[k] = positions[b][k] - positions[a][k];
+                    overlap[k] = extents[a][k] + extents[b][k] - std::fabs(delta[k]);
+                    touching &= overlap[k] > 0.0f;
+                }
+                if (touching)
+                    addContact(found, a, b, overlap, delta);
+            }
+        };
+        if (parallel)
+            pool.ParallelFor(batches, narrow, 1);
+        else
+            narrow(0);
+        contacts.clear();
+        for (int batch = 0; batch < (parallel ? batches : 1); batch++)
+            contacts.insert(contacts.end(), batchContacts[batch].begin(), batchContacts[batch].end());
+    }
+
+    // starts each contact from the impulses it ended the last step with, which is what lets a
+    // stack converge over a few steps instead of needing many iterations in one
+    void warmStart()
+    {
+        for (PhysicsContact& contact : contacts)
+        {
+            uint64_t key = (uint64_t)contact.A << 32 | (uint32_t)contact.B;
+            auto last = std::lower_bound(lastContacts.begin(), lastContacts.end(), key, [](const std::pair<uint64_t, PhysicsContact>& entry, uint64_t k) { return entry.first < k; });
+            if (last == lastContacts.end() || last->first != key || last->second.Axis != contact.Axis || last->second.Sign != contact.Sign)
+                continue;
+            contact.NormalImpulse = last->second.NormalImpulse;
+            contact.TangentImpulse[0] = last->second.TangentImpulse[0];
+            contact.TangentImpulse[1] = last->second.TangentImpulse[1];
+            float ima = inverseMass[contact.A], imb = inverseMass[contact.B];
+            glm::vec3 impulse(0.0f);
+            impulse[contact.Axis] = contact.NormalImpulse * contact.Sign;
+            impulse[(contact.Axis + 1) % 3] = contact.TangentImpulse[0];
+            impulse[(contact.Axis + 2) % 3] = contact.TangentImpulse[1];
+            velocities[contact.A] -= impulse * ima;
+            velocities[contact.B] += impulse * imb;
+        }
+    }
+
+    void solveVelocities()
+    {
+        for (int iteration = 0; iteration < Iterations; iteration++)
+        {
+            for (PhysicsContact& contact : contacts)
+            {
+                float ima = inverseMass[contact.A], imb = inverseMass[contact.B];
+                float mass = 1.0f / (ima + imb);
+                glm::vec3& va = velocities[contact.A];
+                glm::vec3& vb = velocities[contact.B];
+
+                // only pushes apart; the accumulated impulse never goes negative
+                float approach = (vb[contact.Axis] - va[contact.Axis]) * contact.Sign;
+                float total = std::max(contact.NormalImpulse - approach * mass, 0.0f);
+                float impulse = total - contact.NormalImpulse;
+                contact.NormalImpulse = total;
+                va[contact.Axis] -= impulse * contact.Sign * ima;
+                vb[contact.Axis] += impulse * contact.Sign * imb;
+
+                // friction along the two other axes, bounded by the normal impulse
+                float limit = Friction * contact.NormalImpulse;
+                for (int t = 0; t < 2; t++)
+                {
+                    int tangent = (contact.Axis + 1 + t) % 3;
+                    float slide = vb[tangent] - va[tangent];
+                    float accumulated = glm::clamp(contact.TangentImpulse[t] - slide * mass, -limit, limit);
+                    float friction = accumulated - contact.TangentImpulse[t];
+                    contact.TangentImpulse[t] = accumulated;
+                    va[tangent] -= friction * ima;
+                    vb[tangent] += friction * imb;
+                }
+            }
+        }
+    }
+
+    void rememberContacts()
+    {
+        lastContacts.clear();
+        for (const PhysicsContact& contact : contacts)
+            lastContacts.push_back({ (uint64_t)contact.A << 32 | (uint32_t)contact.B, contact });
+        std::sort(lastContacts.begin(), lastContacts.end(), [](const std::pair<uint64_t, PhysicsContact>& a, const std::pair<uint64_t, PhysicsContact>& b) { return a.first < b.first; });
+    }
+
+    // moves overlapping bodies apart along their contact axis, from the positions after the move
+    void solvePositions()
+    {
+        for (int iteration = 0; iteration < PositionIterations; iteration++)
+        {
+            for (const PhysicsContact& contact : contacts)
+            {
+                int a = contact.A, b = contact.B, k = contact.Axis;
+                float overlap = extents[a][k] + extents[b][k] - (positions[b][k] - positions[a][k]) * contact.Sign;
+                if (overlap <= Slop)
+                    continue;
+                float ima = inverseMass[a], imb = inverseMass[b];
+                float push = (overlap - Slop) * 0.8f / (ima + imb);
+                positions[a][k] -= push * contact.Sign * ima;
+                positions[b][k] += push * contact.Sign * imb;
+            }
+        }
+        for (const PhysicsContact& contact : contacts)
+        {
+            updateBounds(contact.A);
+            updateBounds(contact.B);
+        }
+    }
+};
+
+#endif
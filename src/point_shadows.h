@@ -0,0 +1,341 @@
+#ifndef POINT_SHADOWS_H
+#define POINT_SHADOWS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader_cache.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+
+// texture unit the point light shadows are bound to, after the cascades
+const int POINT_SHADOW_TEXTURE_UNIT = 8;
+
+// a point light that wants a shadow cube. Position is relative to the eye; Update writes Slot,
+// -1 when the light is not one of the nearest MaxLights
+struct PointShadowLight
+{
+    uint64_t Id;
+    glm::vec3 Position;
+    float Radius;
+    int Slot = -1;
+};
+
+// Work of the last Update and the passes after it
+struct PointShadowStats
+{
+    int Lights = 0;                 // with a slot
+    int Updated = 0;                // cubes drawn again this frame
+    int Draws = 0;                  // caster draws, each going to every face it reaches
+    int Faces = 0;                  // faces those draws went to
+    int Culled = 0;                 // caster draws left out, out of reach of the light
+};
+
+// Shadow cubes for the nearest MaxLights point lights, six layers each of one depth texture
+// array (there are no cube map arrays in 3.3). A cube holds the distance from the light over its
+// radius, so it doesn't depend on where the eye is.
+//
+// A cube is drawn in one pass per caster: the geometry shader sends each triangle to the faces
+// the caster's bounding sphere reaches, and of those to the ones it is inside of.
+//
+// With UpdateSchedule, a light FullRateDistance or more from the eye is only drawn every few
+// frames, one more for every FullRateDistance, up to MaxInterval; a light keeps its slot as long
+// as it stays among the nearest, so the cube it has stays good until then. Without it, every cube
+// is drawn every frame.
+//
+// A frame: Update, then for each of DueCount BeginLight and the casters (UseCaster before each
+// draw), then End
+class PointShadows
+{
+public:
+    int MaxLights = 4;
+    int Resolution = 512;
+    float NearPlane = 0.05f;
+    bool UpdateSchedule = true;
+    float FullRateDistance = 8.0f;
+    int MaxInterval = 8;
+    PointShadowStats Stats;
+
+    PointShadows()
+        : casterShaders("shaders/vshader.txt", "shaders/pointshadowfshader.txt", true, "shaders/pointshadowgshader.txt")
+    {
+        casterShaders.Request(0);
+        casterShaders.Request(SHADER_INSTANCED);
+        glGenFramebuffers(2, framebuffers);
+        // +x, -x, +y, -y, +z, -z, looking out of the light
+        const glm::vec3 forward[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+        const glm::vec3 up[6] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+        for (int face = 0; face < 6; face++)
+            faceViews[face] = glm::lookAt(glm::vec3(0.0f), forward[face], up[face]);
+    }
+
+    ~PointShadows()
+    {
+        release();
+        glDeleteFramebuffers(2, framebuffers);
+    }
+
+    PointShadows(const PointShadows&) = delete;
+    PointShadows& operator=(const PointShadows&) = delete;
+
+    void Reload(const std::string& path)
+    {
+        casterShaders.Reload(path);
+    }
+
+    // gives the nearest lights a slot and picks the ones to draw this frame. (Re)allocates the
+    // cubes when the light count or resolution changed
+    void Update(std::vector<PointShadowLight>& lights)
+    {
+        GLint maxLayers = 256;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        MaxLights = std::max(1, std::min(MaxLights, (int)maxLayers / 6));
+        if (Resolution != allocatedResolution || MaxLights != (int)slots.size())
+            allocate();
+        Stats = PointShadowStats();
+        frame++;
+
+        std::vector<int> order(lights.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&lights](int a, int b) {
+            return glm::dot(lights[a].Position, lights[a].Position) < glm::dot(lights[b].Position, lights[b].Position);
+        });
+        int kept = std::min((int)order.size(), MaxLights);
+
+        // lights that had a slot keep it, the others take what is left
+        std::vector<bool> taken(slots.size(), false);
+        for (int i = 0; i < (int)lights.size(); i++)
+            lights[i].Slot = -1;
+        for (int k = 0; k < kept; k++)
+        {
+            PointShadowLight& light = lights[order[k]];
+            for (int s = 0; s < (int)slots.size(); s++)
+            {
+                if (slots[s].Valid && slots[s].Id == light.Id)
+                {
+                    light.Slot = s;
+                    taken[s] = true;
+                    break;
+                }
+            }
+        }
+        for (int k = 0; k < kept; k++)
+        {
+            PointShadowLight& light = lights[order[k]];
+            if (light.Slot >= 0)
+                continue;
+            light.Slot = (int)(std::find(taken.begin(), taken.end(), false) - taken.begin());
+            taken[light.Slot] = true;
+            slots[light.Slot].Id = light.Id;
+            slots[light.Slot].Valid = false;
+        }
+
+        due.clear();
+        for (int k = 0; k < kept; k++)
+        {
+            const PointShadowLight& light = lights[order[k]];
+            Slot& slot = slots[light.Slot];
+            int interval = 1;
+            if (UpdateSchedule)
+                interval = std::min(MaxInterval, 1 + (int)(glm::length(light.Position) / FullRateDistance));
+            if (!slot.Valid || frame - slot.LastUpdate >= interval)
+            {
+                slot.Position = light.Position;
+                slot.Radius = light.Radius;
+                slot.LastUpdate = frame;
+                slot.Valid = true;
+                due.push_back(light.Slot);
+            }
+        }
+        Stats.Lights = kept;
+        Stats.Updated = (int)due.size();
+    }
+
+    // cubes to draw this frame
+    int DueCount() const
+    {
+        return (int)due.size();
+    }
+
+    // starts drawing the cube of the k-th due light: clears its six layers and targets all of them
+    void BeginLight(int k)
+    {
+        if (!passActive)
+        {
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+            glGetIntegerv(GL_VIEWPORT, savedViewport);
+            glViewport(0, 0, Resolution, Resolution);
+            passActive = true;
+        }
+        current = due[k];
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1]);
+        for (int face = 0; face < 6; face++)
+        {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, current * 6 + face);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+
+        const Slot& slot = slots[current];
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, NearPlane, slot.Radius);
+        for (int face = 0; face < 6; face++)
+            faceMatrices[face] = projection * faceViews[face];
+    }
+
+    // program for a caster of the current light, with its model matrix and bounding sphere
+    // (relative to the eye); false if it is out of reach or can't be drawn yet
+    bool UseCaster(bool instanced, const glm::mat4& model, const glm::vec3& center, float radius)
+    {
+        const Slot& slot = slots[current];
+        glm::vec3 fromLight = center - slot.Position;
+        int mask = faceMask(fromLight, radius, slot.Radius);
+        if (!mask)
+        {
+            Stats.Culled++;
+            return false;
+        }
+        Shader& shader = casterShaders.Get(instanced ? SHADER_INSTANCED : 0);
+        if (!shader.use())
+            return false;
+        glm::mat4 identity(1.0f), relative = model;
+        shader.setMat4("projection", identity);
+        shader.setMat4("view", identity);
+        shader.setMat4("model", relative);
+        for (int face = 0; face < 6; face++)
+            shader.setMat4("faceMatrices[" + std::to_string(face) + "]", faceMatrices[face]);
+        shader.setVec3("lightPosition", slot.Position.x, slot.Position.y, slot.Position.z);
+        shader.setFloat("lightRadius", slot.Radius);
+        shader.setInt("faceMask", mask);
+        shader.setInt("firstLayer", current * 6);
+        Stats.Draws++;
+        for (int face = 0; face < 6; face++)
+            Stats.Faces += (mask >> face) & 1;
+        return true;
+    }
+
+    // back to the framebuffer and viewport that were bound before the first BeginLight
+    void End()
+    {
+        if (!passActive)
+            return;
+        glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        passActive = false;
+    }
+
+    // binds the cubes and sets what shaders/point_shadows.txt reads
+    void Bind(const Shader& shader, int unit = POINT_SHADOW_TEXTURE_UNIT) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("pointShadowMap", unit);
+        // only x and y over w are used, which don't depend on the depth range
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, NearPlane, 1.0f);
+        for (int face = 0; face < 6; face++)
+        {
+            glm::mat4 matrix = projection * faceViews[face];
+            shader.setMat4("pointShadowFaces[" + std::to_string(face) + "]", matrix);
+        }
+    }
+
+    uint64_t Bytes() const
+    {
+        return (uint64_t)allocatedResolution * allocatedResolution * 4 * 6 * slots.size();
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t Id = 0;
+        glm::vec3 Position = glm::vec3(0.0f);   // of the light when its cube was drawn
+        float Radius = 1.0f;
+        int64_t LastUpdate = 0;
+        bool Valid = false;
+    };
+
+    ShaderCache casterShaders;
+    std::vector<Slot> slots;
+    std::vector<int> due;
+    glm::mat4 faceViews[6];
+    glm::mat4 faceMatrices[6];
+    unsigned int framebuffers[2];                       // all layers, one layer for clearing
+    unsigned int texture = 0;
+    int allocatedResolution = 0;
+    int64_t frame = 0;
+    int current = 0;
+    bool passActive = false;
+    GLint savedFramebuffer = 0;
+    GLint savedViewport[4];
+
+    // faces whose 90 degree frustum a sphere at fromLight reaches, as a bit each; 0 when it is
+    // out of the light's reach
+    static int faceMask(const glm::vec3& fromLight, float radius, float lightRadius)
+    {
+        if (glm::length(fromLight) - radius > lightRadius)
+            return 0;
+        const float inverseRoot2 = 0.70710678f;
+        int mask = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int b = (axis + 1) % 3, c = (axis + 2) % 3;
+            for (int side = 0; side < 2; side++)
+            {
+                // inside where sign * v[axis] >= |v[b]| and |v[c]|: four planes through the light
+                float along = side ? -fromLight[axis] : fromLight[axis];
+                float limit = -radius / inverseRoot2;
+                if (along - std::fabs(fromLight[b]) >= limit && along - std::fabs(fromLight[c]) >= limit)
+                    mask |= 1 << (axis * 2 + side);
+            }
+        }
+        return mask;
+    }
+
+    void allocate()
+    {
+        GLint drawingTo = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &drawingTo);
+        release();
+        slots.assign(MaxLights, Slot());
+        allocatedResolution = Resolution;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, Resolution, Resolution, MaxLights * 6, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        // every layer at once for drawing, through the geometry shader's gl_Layer
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::POINT_SHADOWS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, drawingTo);
+    }
+
+    void release()
+    {
+        if (!texture)
+            return;
+        glDeleteTextures(1, &texture);
+        texture = 0;
+    }
+};
+
+#endif
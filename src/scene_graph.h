@@ -0,0 +1,284 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "job_pool.h"
+
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+// Work done by the last Update
+struct SceneGraphStats
+{
+    int Nodes = 0;
+    int UpdatedNodes = 0;       // world matrices recomputed
+    int DirtySubtrees = 0;      // dirty nodes with no dirty ancestor, each updated as one range
+    bool Parallel = false;
+    double Milliseconds = 0.0;
+};
+
+// Transform hierarchy kept in one flat array in depth-first order, so every subtree is the
+// contiguous range of slots starting at its root and each parent comes before its children.
+// Setting a local transform only queues the node; Update recomputes the world matrices of the
+// queued subtrees and nothing else, so static nodes cost nothing per frame. Subtrees never
+// overlap, so once there is enough work they are spread over the JobPool. Nodes are referred to by
+// the id Add returns, which stays valid when the array is reordered
+class SceneGraph
+{
+public:
+    SceneGraphStats Stats;
+    int ParallelThreshold = 4096;   // dirty nodes below which Update stays on the calling thread
+
+    // returns the id of the new node; parent -1 makes it a root
+    int Add(int parent = -1, const glm::vec3& position = glm::vec3(0.0f), const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f))
+    {
+        int id = (int)slotOf.size();
+        slotOf.push_back((int)ids.size());
+        ids.push_back(id);
+        parentIds.push_back(parent);
+        parents.push_back(-1);
+        ends.push_back((int)ids.size());
+        positions.push_back(position);
+        rotations.push_back(rotation);
+        scales.push_back(scale);
+        locals.push_back(compose(position, rotation, scale));
+        worlds.push_back(glm::mat4(1.0f));
+        dirty.push_back(0);
+        markDirty(id);
+        needsSort = true;
+        return id;
+    }
+
+    void SetParent(int id, int parent)
+    {
+        parentIds[id] = parent;
+        markDirty(id);
+        needsSort = true;
+    }
+
+    void SetPosition(int id, const glm::vec3& position)
+    {
+        positions[slotOf[id]] = position;
+        updateLocal(id);
+    }
+
+    void SetRotation(int id, const glm::quat& rotation)
+    {
+        rotations[slotOf[id]] = rotation;
+        updateLocal(id);
+    }
+
+    void SetScale(int id, const glm::vec3& scale)
+    {
+        scales[slotOf[id]] = scale;
+        updateLocal(id);
+    }
+
+    int Parent(int id) const { return parentIds[id]; }
+    const glm::vec3& Position(int id) const { return positions[slotOf[id]]; }
+    size_t Count() const { return ids.size(); }
+
+    // as of the last Update
+    const glm::mat4& World(int id) const { return worlds[slotOf[id]]; }
+    glm::vec3 WorldPosition(int id) const { return glm::vec3(worlds[slotOf[id]][3]); }
+
+    void Update()
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (needsSort)
+            sort();
+
+        // dirty nodes in array order; one inside a range already queued is covered by it
+        std::vector<int> queued;
+        queued.reserve(dirtyIds.size());
+        for (int id : dirtyIds)
+            queued.push_back(slotOf[id]);
+        dirtyIds.clear();
+        std::sort(queued.begin(), queued.end());
+        roots.clear();
+        int covered = 0, work = 0;
+        for (int slot : queued)
+        {
+            if (slot < covered)
+                continue;
+            roots.push_back(slot);
+            covered = ends[slot];
+            work += ends[slot] - slot;
+        }
+
+        Stats.Nodes = (int)ids.size();
+        Stats.UpdatedNodes = work;
+        Stats.DirtySubtrees = (int)roots.size();
+        Stats.Parallel = work >= ParallelThreshold && roots.size() > 1 && JobPool::Instance().WorkerCount() > 1;
+        if (Stats.Parallel)
+        {
+            // about four batches of equal node count per thread
+            int batches = std::min((int)roots.size(), (int)(JobPool::Instance().WorkerCount() + 1) * 4);
+            std::vector<size_t> batchStart(1, 0);
+            int perBatch = (work + batches - 1) / batches, filled = 0;
+            for (size_t i = 0; i < roots.size(); i++)
+            {
+                filled += ends[roots[i]] - roots[i];
+                if (filled >= perBatch && i + 1 < roots.size())
+                {
+                    batchStart.push_back(i + 1);
+                    filled = 0;
+                }
+            }
+            batchStart.push_back(roots.size());
+            JobPool::Instance().ParallelFor((int)batchStart.size() - 1, [this, &batchStart](int batch)
+            {
+                for (size_t i = batchStart[batch]; i < batchStart[batch + 1]; i++)
+                    updateSubtree(roots[i]);
+            });
+        }
+        else
+        {
+            for (int slot : roots)
+                updateSubtree(slot);
+        }
+        Stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    // by id
+    std::vector<int> slotOf;
+    std::vector<int> parentIds;
+    std::vector<int> dirtyIds;
+    // by slot, depth-first
+    std::vector<int> ids;
+    std::vector<int> parents;       // slot of the parent, -1 for roots
+    std::vector<int> ends;          // one past the last slot of the subtree
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<char> dirty;
+    std::vector<int> roots;         // scratch for Update
+    bool needsSort = false;
+
+    static glm::mat4 compose(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+    {
+        return glm::translate(glm::mat4(1.0f), position) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+    }
+
+    void updateLocal(int id)
+    {
+        int slot = slotOf[id];
+        locals[slot] = compose(positions[slot], rotations[slot], scales[slot]);
+        markDirty(id);
+    }
+
+    void markDirty(int id)
+    {
+        char& flag = dirty[slotOf[id]];
+        if (!flag)
+        {
+            flag = 1;
+            dirtyIds.push_back(id);
+        }
+    }
+
+    void updateSubtree(int root)
+    {
+        int parent = parents[root];
+        worlds[root] = parent >= 0 ? worlds[parent] * locals[root] : locals[root];
+        dirty[root] = 0;
+        for (int slot = root + 1; slot < ends[root]; slot++)
+        {
+            worlds[slot] = worlds[parents[slot]] * locals[slot];
+            dirty[slot] = 0;
+        }
+    }
+
+    // rebuilds the depth-first order after nodes were added or moved to another parent. A parent
+    // that would make a cycle, or that does not exist, makes the node a root
+    void sort()
+    {
+        size_t count = ids.size();
+        std::vector<std::vector<int>> children(count);
+        std::vector<int> rootIds;
+        for (int id = 0; id < (int)count; id++)
+        {
+            int parent = parentIds[id];
+            if (parent < 0 || parent >= (int)count || parent == id)
+            {
+                parentIds[id] = -1;
+                rootIds.push_back(id);
+            }
+            else
+                children[parent].push_back(id);
+        }
+
+        std::vector<int> order, orderParents, orderEnds(count);
+        order.reserve(count);
+        orderParents.reserve(count);
+        std::vector<int> newSlot(count, -1);
+        std::vector<std::pair<int, size_t>> stack;  // slot, next child
+        for (int root : rootIds)
+        {
+            newSlot[root] = (int)order.size();
+            order.push_back(root);
+            orderParents.push_back(-1);
+            stack.push_back({ newSlot[root], 0 });
+            while (!stack.empty())
+            {
+                int slot = stack.back().first;
+                const std::vector<int>& kids = children[order[slot]];
+                if (stack.back().second == kids.size())
+                {
+                    orderEnds[slot] = (int)order.size();
+                    stack.pop_back();
+                    continue;
+                }
+                int child = kids[stack.back().second++];
+                newSlot[child] = (int)order.size();
+                order.push_back(child);
+                orderParents.push_back(slot);
+                stack.push_back({ newSlot[child], 0 });
+            }
+        }
+        // whatever was not reached is part of a cycle or hangs off one; cut it and sort again
+        if (order.size() != count)
+        {
+            int id = (int)(std::find(newSlot.begin(), newSlot.end(), -1) - newSlot.begin());
+            std::cout << "ERROR::SCENE_GRAPH::CYCLE: node " << id << " made a root" << std::endl;
+            parentIds[id] = -1;
+            markDirty(id);
+            sort();
+            return;
+        }
+
+        permute(positions, order);
+        permute(rotations, order);
+        permute(scales, order);
+        permute(locals, order);
+        permute(worlds, order);
+        permute(dirty, order);
+        ids = order;
+        parents = orderParents;
+        ends = orderEnds;
+        for (size_t slot = 0; slot < count; slot++)
+            slotOf[ids[slot]] = (int)slot;
+        needsSort = false;
+    }
+
+    template <typename T>
+    void permute(std::vector<T>& values, const std::vector<int>& order)
+    {
+        // order holds ids; values are still laid out by the old slots
+        std::vector<T> sorted;
+        sorted.reserve(values.size());
+        for (int id : order)
+            sorted.push_back(values[slotOf[id]]);
+        values.swap(sorted);
+    }
+};
+
+#endif
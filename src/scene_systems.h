@@ -0,0 +1,486 @@
+#ifndef SCENE_SYSTEMS_H
+#define SCENE_SYSTEMS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "ecs.h"
+#include "shader_cache.h"
+#include "scene_graph.h"
+#include "transform_store.h"
+#include "camera.h"
+#include "world_origin.h"
+#include "light_cluster_buffers.h"
+#include "shadow_cascades.h"
+#include "point_shadows.h"
+#include "ssao.h"
+#include "deferred_renderer.h"
+
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+
+// Components of the scene objects and the systems that run over them once a frame, in order:
+// CameraSystem, SceneNodeSystem, BoundsSystem, LightSystem, CullingSystem, ShadowSystem,
+// PointShadowSystem, SsaoSystem, then either
+// LightClusterSystem and RenderSystem (forward), or RenderSystem for the G-buffer,
+// DeferredLightingSystem and RenderSystem for what is not lit (deferred).
+// Positions that the systems share are double world positions. Culling and drawing happen
+// relative to the eye (world_origin.h)
+
+// Value places the object relative to Origin, a double world position, so the float part only
+// holds offsets of the size of the object however far out it is
+struct LocalToWorld
+{
+    glm::mat4 Value = glm::mat4(1.0f);
+    glm::dvec3 Origin = glm::dvec3(0.0);
+};
+
+// bounding sphere in the object's own space; BoundsSystem moves it into WorldBounds
+struct LocalBounds
+{
+    glm::vec3 Center = glm::vec3(0.0f);
+    float Radius = 1.0f;
+};
+
+struct WorldBounds
+{
+    glm::dvec3 Center = glm::dvec3(0.0);
+    float Radius = 1.0f;
+};
+
+// written by CullingSystem
+struct Visible
+{
+    int Value = 1;
+};
+
+// LocalToWorld follows a SceneGraph node
+struct SceneNode
+{
+    int Id = -1;
+};
+
+struct PointLight
+{
+    glm::vec3 Color = glm::vec3(1.0f);
+    float Radius = 30.0f;                   // reach, for clustered lighting
+    bool CastsShadows = false;
+    glm::dvec3 Position = glm::dvec3(0.0);  // written by LightSystem
+    int ShadowSlot = -1;                    // written by PointShadowSystem
+};
+
+// the sun: lights everything from Direction, with cascaded shadows. Only the first one made is used
+struct DirectionalLight
+{
+    glm::vec3 Direction = glm::normalize(glm::vec3(-0.4f, -1.0f, -0.3f));   // the light travels along it
+    glm::vec3 Color = glm::vec3(1.0f);
+};
+
+// the MeshRenderer is drawn into the shadow maps and cubes, whether it is in view or not. Static casters
+// never move, so they are drawn into the cascades' caches and only again when a cascade moves
+struct ShadowCaster
+{
+    bool Static = false;
+};
+
+// one draw: a VAO with its vertex count, drawn instanced when InstanceCount > 0 (the instance
+// attributes live in the VAO). The program is a permutation of Shaders when set, Program otherwise;
+// Material indexes the bind callbacks RenderSystem is given and is -1 for none
+struct MeshRenderer
+{
+    unsigned int VAO = 0;
+    int VertexCount = 0;
+    int InstanceCount = 0;
+    const TransformStore* Instances = NULL;  // the instances' transforms, for drawing them one by one with a fallback program
+    ShaderCache* Shaders = NULL;
+    unsigned int ShaderKey = 0;
+    Shader* Program = NULL;
+    int Material = -1;
+    bool Lit = true;                // gets the light and view position uniforms
+    bool Blend = false;
+};
+
+// written by CameraSystem from the camera's cached matrices. The matrices and planes are those
+// of the camera-relative space: View only rotates, and the eye is at Position
+struct CameraView
+{
+    float Aspect = 16.0f / 9.0f;
+    float Near = 0.1f;
+    float Far = 100.0f;
+    int Width = 0;                  // of the viewport, in pixels
+    int Height = 0;
+    glm::dvec3 Position = glm::dvec3(0.0);
+    glm::mat4 Projection = glm::mat4(1.0f);
+    glm::mat4 View = glm::mat4(1.0f);
+    glm::mat4 ViewProjection = glm::mat4(1.0f);
+    glm::vec4 Planes[6];            // frustum, normals pointing in, normalized
+};
+
+// which renderers a RenderSystem run draws: all of them lit forward, or for the deferred path
+// the lit ones into the G-buffer and then the unlit ones on top
+enum Render_Pass {
+    RENDER_FORWARD,
+    RENDER_GBUFFER,
+    RENDER_UNLIT
+};
+
+// Draws, culled objects and instances of the last RenderSystem/CullingSystem run
+struct RenderStats
+{
+    int Draws = 0;
+    int Instances = 0;
+    int Culled = 0;
+};
+
+// matrices and frustum planes of every camera entity from the fly camera
+inline void CameraSystem(EcsWorld& world, const Camera& camera)
+{
+    world.ForEach<CameraView>([&](Entity, CameraView& cameraView)
+    {
+        cameraView.Aspect = camera.Aspect;
+        cameraView.Near = camera.Near;
+        cameraView.Far = camera.Far;
+        cameraView.Width = camera.ViewportWidth;
+        cameraView.Height = camera.ViewportHeight;
+        cameraView.Position = camera.Position;
+        cameraView.View = camera.GetViewMatrix();
+        cameraView.Projection = camera.GetProjectionMatrix();
+        cameraView.ViewProjection = camera.GetViewProjectionMatrix();
+        // rows of the view-projection added to or taken from the w row (Gribb and Hartmann)
+        const glm::mat4& m = cameraView.ViewProjection;
+        glm::vec4 rowX(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 rowY(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 rowZ(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 rowW(m[0][3], m[1][3], m[2][3], m[3][3]);
+        glm::vec4 planes[6] = { rowW + rowX, rowW - rowX, rowW + rowY, rowW - rowY, rowW + rowZ, rowW - rowZ };
+        for (int i = 0; i < 6; i++)
+            cameraView.Planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+    });
+}
+
+inline void SceneNodeSystem(EcsWorld& world, const SceneGraph& graph)
+{
+    world.ForEachChunk<SceneNode, LocalToWorld>([&](int count, Entity*, SceneNode* nodes, LocalToWorld* transforms)
+    {
+        for (int i = 0; i < count; i++)
+            transforms[i].Value = graph.World(nodes[i].Id);
+    });
+}
+
+inline void BoundsSystem(EcsWorld& world)
+{
+    world.ParallelForEachChunk<LocalBounds, LocalToWorld, WorldBounds>([](int count, Entity*, LocalBounds* local, LocalToWorld* transforms, WorldBounds* bounds)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const glm::mat4& m = transforms[i].Value;
+            float scale = std::sqrt(std::max(glm::dot(glm::vec3(m[0]), glm::vec3(m[0])), std::max(glm::dot(glm::vec3(m[1]), glm::vec3(m[1])), glm::dot(glm::vec3(m[2]), glm::vec3(m[2])))));
+            bounds[i].Center = transforms[i].Origin + glm::dvec3(glm::vec3(m * glm::vec4(local[i].Center, 1.0f)));
+            bounds[i].Radius = local[i].Radius * scale;
+        }
+    });
+}
+
+inline void LightSystem(EcsWorld& world)
+{
+    world.ForEachChunk<PointLight, LocalToWorld>([](int count, Entity*, PointLight* lights, LocalToWorld* transforms)
+    {
+        for (int i = 0; i < count; i++)
+            lights[i].Position = transforms[i].Origin + glm::dvec3(glm::vec3(transforms[i].Value[3]));
+    });
+}
+
+// sphere against the six planes, moved relative to the eye first; the loop is branch free so it
+// vectorizes
+inline void CullingSystem(EcsWorld& world, const CameraView& cameraView, RenderStats& stats)
+{
+    glm::vec4 planes[6];
+    std::copy(cameraView.Planes, cameraView.Planes + 6, planes);
+    glm::dvec3 eye = cameraView.Position;
+    std::atomic<int> culled{ 0 };
+    world.ParallelForEachChunk<WorldBounds, Visible>([&planes, &eye, &culled](int count, Entity*, WorldBounds* bounds, Visible* visible)
+    {
+        int hidden = 0;
+        for (int i = 0; i < count; i++)
+        {
+            glm::vec3 center = CameraRelative(bounds[i].Center, eye);
+            int inside = 1;
+            for (int p = 0; p < 6; p++)
+                inside &= glm::dot(glm::vec3(planes[p]), center) + planes[p].w >= -bounds[i].Radius;
+            visible[i].Value = inside;
+            hidden += 1 - inside;
+        }
+        culled += hidden;
+    });
+    stats.Culled = culled;
+}
+
+// every point light, relative to the eye, listed in the clusters of the camera's frustum and
+// uploaded
+inline void LightClusterSystem(EcsWorld& world, const CameraView& cameraView, LightClusterBuffers& clusters)
+{
+    clusters.Lights.clear();
+    world.ForEachChunk<PointLight>([&](int count, Entity*, PointLight* lights)
+    {
+        for (int i = 0; i < count; i++)
+            clusters.Lights.push_back({ CameraRelative(lights[i].Position, cameraView.Position), lights[i].Radius, lights[i].Color, lights[i].ShadowSlot });
+    });
+    clusters.Assign(cameraView.View, cameraView.Projection, cameraView.Near, cameraView.Far);
+    clusters.Upload();
+}
+
+// the cascades of the first directional light, fitted to the camera, and the shadow casters drawn
+// into them. Each cascade only gets the casters whose bounds reach its box; static casters are
+// left to its cache unless that is out of date
+inline void ShadowSystem(EcsWorld& world, const CameraView& cameraView, ShadowCascades& shadows)
+{
+    bool firstLight = true;
+    world.ForEach<DirectionalLight>([&](Entity, DirectionalLight& light)
+    {
+        if (!firstLight)
+            return;
+        shadows.Direction = glm::normalize(light.Direction);
+        shadows.Color = light.Color;
+        firstLight = false;
+    });
+    shadows.Update(cameraView.View, cameraView.Projection, cameraView.Near, cameraView.Far, cameraView.Position);
+
+    glm::dvec3 eye = cameraView.Position;
+    auto drawCasters = [&](int cascade, bool statics)
+    {
+        world.ForEachChunk<MeshRenderer, LocalToWorld, WorldBounds, ShadowCaster>([&](int count, Entity*, MeshRenderer* renderers, LocalToWorld* transforms, WorldBounds* bounds, ShadowCaster* casters)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                if (casters[i].Static != statics)
+                    continue;
+                if (!shadows.Reaches(cascade, CameraRelative(bounds[i].Center, eye), bounds[i].Radius))
+                {
+                    shadows.Stats.Culled++;
+                    continue;
+                }
+                const MeshRenderer& renderer = renderers[i];
+                if (!shadows.UseCaster(renderer.InstanceCount > 0, CameraRelative(transforms[i].Value, transforms[i].Origin, eye)))
+                    continue;
+                glBindVertexArray(renderer.VAO);
+                if (renderer.InstanceCount > 0)
+                    glDrawArraysInstanced(GL_TRIANGLES, 0, renderer.VertexCount, renderer.InstanceCount);
+                else
+                    glDrawArrays(GL_TRIANGLES, 0, renderer.VertexCount);
+            }
+        });
+    };
+    for (int i = 0; i < shadows.Count(); i++)
+    {
+        bool staticDrawn = shadows.NeedsStatic(i);
+        if (staticDrawn)
+        {
+            shadows.BeginStatic(i);
+            drawCasters(i, true);
+        }
+        shadows.BeginCascade(i, staticDrawn);
+        drawCasters(i, false);
+    }
+    glBindVertexArray(0);
+    shadows.End();
+}
+
+// shadow cubes for the nearest point lights that cast shadows, for the ones pointShadows picks to
+// draw this frame; every shadow caster within a light's reach is drawn once into all the faces it
+// touches. Writes the lights' ShadowSlot
+inline void PointShadowSystem(EcsWorld& world, const CameraView& cameraView, PointShadows& pointShadows)
+{
+    glm::dvec3 eye = cameraView.Position;
+    std::vector<PointShadowLight> shadowed;
+    std::vector<PointLight*> owners;
+    world.ForEachChunk<PointLight>([&](int count, Entity* entities, PointLight* lights)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            lights[i].ShadowSlot = -1;
+            if (!lights[i].CastsShadows)
+                continue;
+            uint64_t id = ((uint64_t)entities[i].Generation << 32) | entities[i].Index;
+            shadowed.push_back({ id, CameraRelative(lights[i].Position, eye), lights[i].Radius });
+            owners.push_back(&lights[i]);
+        }
+    });
+    pointShadows.Update(shadowed);
+    for (size_t i = 0; i < shadowed.size(); i++)
+        owners[i]->ShadowSlot = shadowed[i].Slot;
+
+    for (int k = 0; k < pointShadows.DueCount(); k++)
+    {
+        pointShadows.BeginLight(k);
+        world.ForEachChunk<MeshRenderer, LocalToWorld, WorldBounds, ShadowCaster>([&](int count, Entity*, MeshRenderer* renderers, LocalToWorld* transforms, WorldBounds* bounds, ShadowCaster*)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                const MeshRenderer& renderer = renderers[i];
+                if (!pointShadows.UseCaster(renderer.InstanceCount > 0, CameraRelative(transforms[i].Value, transforms[i].Origin, eye),
+                                            CameraRelative(bounds[i].Center, eye), bounds[i].Radius))
+                    continue;
+                glBindVertexArray(renderer.VAO);
+                if (renderer.InstanceCount > 0)
+                    glDrawArraysInstanced(GL_TRIANGLES, 0, renderer.VertexCount, renderer.InstanceCount);
+                else
+                    glDrawArrays(GL_TRIANGLES, 0, renderer.VertexCount);
+            }
+        });
+    }
+    glBindVertexArray(0);
+    pointShadows.End();
+}
+
+// the deferred path's lighting over the G-buffer: the ambient of the first light made, then the
+// point lights. Tiled through clusters when given, which LightClusterSystem fills; otherwise as a
+// volume each, for those whose sphere reaches the frustum. The sun comes with shadows, after
+// ShadowSystem, point lights with pointShadows, after PointShadowSystem, and the ambient is
+// occluded with ssao, after SsaoSystem
+inline void DeferredLightingSystem(EcsWorld& world, const CameraView& cameraView, DeferredRenderer& deferred, LightClusterBuffers* clusters = NULL,
+                                   const ShadowCascades* shadows = NULL, const PointShadows* pointShadows = NULL, const Ssao* ssao = NULL)
+{
+    glm::vec3 ambientColor(1.0f);
+    bool firstLight = true;
+    deferred.Lights.clear();
+    world.ForEachChunk<PointLight>([&](int count, Entity*, PointLight* lights)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (firstLight)
+                ambientColor = lights[i].Color;
+            firstLight = false;
+            if (clusters)
+                continue;
+            glm::vec3 center = CameraRelative(lights[i].Position, cameraView.Position);
+            bool inside = true;
+            for (int p = 0; p < 6; p++)
+                inside = inside && glm::dot(glm::vec3(cameraView.Planes[p]), center) + cameraView.Planes[p].w >= -lights[i].Radius;
+            if (inside)
+                deferred.Lights.push_back({ center, lights[i].Radius, lights[i].Color, lights[i].ShadowSlot });
+        }
+    });
+    if (clusters)
+        LightClusterSystem(world, cameraView, *clusters);
+    deferred.DrawLights(ambientColor, cameraView.View, cameraView.Projection, clusters, shadows, pointShadows, ssao);
+}
+
+// draws every visible renderer; materials[renderer.Material] binds what the draw samples. Model
+// matrices, the light and the eye are handed to the shaders relative to the eye, so the eye is at
+// zero and lighting works as before. Instanced draws put the entity's model matrix in front of
+// the per-instance ones. Lit shaders get the light clusters, the shadows and the point light
+// shadows too, when there are any. A RENDER_GBUFFER pass draws the lit renderers with the GBUFFER
+// variant of their shaders and without blending; the RENDER_UNLIT pass after it adds its draws to
+// the stats of that one. With ssao (after SsaoSystem) the lit shaders are the SSAO variants
+inline void RenderSystem(EcsWorld& world, const CameraView& cameraView, const std::vector<std::function<void(Shader&)>>& materials, RenderStats& stats, const LightClusterBuffers* clusters = NULL, Render_Pass pass = RENDER_FORWARD,
+                         const ShadowCascades* shadows = NULL, const PointShadows* pointShadows = NULL, const Ssao* ssao = NULL)
+{
+    glm::dvec3 eye = cameraView.Position;
+    // shaders without clusters take one light, the first one made
+    glm::vec3 lightPosition(0.0f), lightColor(1.0f);
+    bool firstLight = true;
+    world.ForEach<PointLight>([&](Entity, PointLight& light)
+    {
+        if (!firstLight)
+            return;
+        lightPosition = CameraRelative(light.Position, eye);
+        lightColor = light.Color;
+        firstLight = false;
+    });
+
+    glm::mat4 projection = cameraView.Projection, view = cameraView.View;
+    glm::vec3 viewPosition(0.0f);
+    if (pass != RENDER_UNLIT)
+    {
+        stats.Draws = 0;
+        stats.Instances = 0;
+    }
+    world.ForEachChunk<MeshRenderer, LocalToWorld, Visible>([&](int count, Entity*, MeshRenderer* renderers, LocalToWorld* transforms, Visible* visible)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (!visible[i].Value)
+                continue;
+            const MeshRenderer& renderer = renderers[i];
+            bool gBuffer = pass == RENDER_GBUFFER;
+            if ((gBuffer && (!renderer.Lit || !renderer.Shaders)) || (pass == RENDER_UNLIT && renderer.Lit))
+                continue;
+            unsigned int key = gBuffer ? (renderer.ShaderKey & ~(SHADER_CLUSTERED_LIGHTS | SHADER_SHADOWS | SHADER_POINT_SHADOWS | SHADER_SSAO)) | SHADER_GBUFFER : renderer.ShaderKey;
+            if (ssao && renderer.Lit && renderer.Shaders && !gBuffer)
+                key |= SHADER_SSAO;
+            Shader& shader = renderer.Shaders ? renderer.Shaders->Get(key) : *renderer.Program;
+            if (!shader.use())
+                continue;
+            shader.setMat4("projection", projection);
+            shader.setMat4("view", view);
+            glm::mat4 model = CameraRelative(transforms[i].Value, transforms[i].Origin, eye);
+            shader.setMat4("model", model);
+            if (renderer.Lit && !gBuffer)
+            {
+                shader.setVec3("lightColor", lightColor);
+                shader.setVec3("lightPos", lightPosition);
+                shader.setVec3("viewPos", viewPosition);
+                if (clusters)
+                    clusters->Bind(shader, cameraView.Width, cameraView.Height);
+                if (shadows)
+                    shadows->Bind(shader);
+                if (pointShadows)
+                    pointShadows->Bind(shader);
+                if (ssao && renderer.Shaders)
+                    ssao->Bind(shader);
+            }
+            if (renderer.Material >= 0)
+                materials[renderer.Material](shader);
+            bool blend = renderer.Blend && !gBuffer;
+            if (blend)
+            {
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            }
+            glBindVertexArray(renderer.VAO);
+            if (renderer.InstanceCount > 0 && shader.UsingFallback())
+            {
+                // the fallback has no per-instance attributes, so each instance is its own draw
+                std::vector<glm::mat4> instances(renderer.Instances ? renderer.Instances->Count() : 0);
+                if (renderer.Instances)
+                    renderer.Instances->ComposeWorld(instances.data());
+                for (const glm::mat4& instance : instances)
+                {
+                    glm::mat4 instanceModel = model * instance;
+                    shader.setMat4("model", instanceModel);
+                    glDrawArrays(GL_TRIANGLES, 0, renderer.VertexCount);
+                }
+            }
+            else if (renderer.InstanceCount > 0)
+                glDrawArraysInstanced(GL_TRIANGLES, 0, renderer.VertexCount, renderer.InstanceCount);
+            else
+                glDrawArrays(GL_TRIANGLES, 0, renderer.VertexCount);
+            glBindVertexArray(0);
+            if (blend)
+                glDisable(GL_BLEND);
+            stats.Draws++;
+            stats.Instances += std::max(1, renderer.InstanceCount);
+        }
+    });
+}
+
+// the depth and normal prepass of ssao, with the GBUFFER variants of the lit renderers' shaders,
+// and the occlusion from it. Nothing happens with its tier off. targetWidth x targetHeight is
+// what the camera's viewport is drawn within, which the targets are allocated for
+inline void SsaoSystem(EcsWorld& world, const CameraView& cameraView, const std::vector<std::function<void(Shader&)>>& materials, Ssao& ssao,
+                       int targetWidth = 0, int targetHeight = 0)
+{
+    if (!ssao.Enabled())
+        return;
+    RenderStats prepass;
+    ssao.BeginPrepass(cameraView.Width, cameraView.Height, targetWidth, targetHeight);
+    RenderSystem(world, cameraView, materials, prepass, NULL, RENDER_GBUFFER);
+    ssao.Compute(cameraView.View, cameraView.Projection, cameraView.Near, cameraView.Far, cameraView.Position);
+    ssao.Stats.Draws = prepass.Draws;
+}
+
+#endif
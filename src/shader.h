@@ -2,110 +2,201 @@
 #define SHADER_H
 
 #include <glad/glad.h> // include glad to get all the required OpenGL headers
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
   
+#include "vfs.h"
+
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <iostream>
+#include <cstring>
+#include <memory>
+#include <filesystem>
+
+// KHR_parallel_shader_compile is not part of the 3.3 core glad build, so it is loaded by hand
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
 
 class Shader
 {
     public:
         // the program ID
         unsigned int ID;
-    
-        // constructor reads and builds the shader
-        Shader(const char* vertexPath, const char* fragmentPath)
+        // program to draw with while this one is still compiling (may be NULL)
+        Shader* Fallback = NULL;
+        // files the program was read from (empty when built from source), matched against hot-reload events
+        std::string VertexPath;
+        std::string FragmentPath;
+
+        // constructor reads and builds the shader. with async set, compiles and links are only
+        // kicked off here and the status is not queried until the program is actually needed
+        Shader(const char* vertexPath, const char* fragmentPath, bool async = false)
+            : VertexPath(vertexPath), FragmentPath(fragmentPath)
         {
-            // 1. retrieve the vertex/fragment source code from filePath
             std::string vertexCode;
             std::string fragmentCode;
-            std::ifstream vShaderFile;
-            std::ifstream fShaderFile;
+            readSources(vertexPath, fragmentPath, vertexCode, fragmentCode);
+            build(vertexCode, fragmentCode, async);
+        }
+
+        // builds a program from source that has already been loaded, e.g. by ShaderPreprocessor. A
+        // geometry stage is only added when its source is given
+        static std::unique_ptr<Shader> FromSource(const std::string& vertexCode, const std::string& fragmentCode, bool async = false,
+                                                  const std::string& geometryCode = std::string())
+        {
+            std::unique_ptr<Shader> shader(new Shader());
+            shader->build(vertexCode, fragmentCode, async, geometryCode);
+            return shader;
+        }
+
+        // 2. compile the vertex/fragment (and geometry) source and link them into a program
+        void build(const std::string& vertexCode, const std::string& fragmentCode, bool async, const std::string& geometryCode = std::string())
+        {
+            compile(vertexCode, fragmentCode, geometryCode, ID, vertexShader, fragmentShader, geometryShader);
+            active = ID;
+            if (!async)
+                Finish();
+        }
 
-            // ensure ifstream objects can throw exceptions:
-            vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-            fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-            try 
+        // call once after gladLoadGLLoader so async shaders can poll GL_COMPLETION_STATUS_KHR
+        static void LoadParallelCompile(GLADloadproc load)
+        {
+            int count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (int i = 0; i < count; i++)
             {
-                // open files
-                vShaderFile.open(vertexPath);
-                fShaderFile.open(fragmentPath);
-                std::stringstream vShaderStream, fShaderStream;
-                // read file's buffer contents into streams
-                vShaderStream << vShaderFile.rdbuf();
-                fShaderStream << fShaderFile.rdbuf();		
-                // close file handlers
-                vShaderFile.close();
-                fShaderFile.close();
-                // convert stream into string
-                vertexCode   = vShaderStream.str();
-                fragmentCode = fShaderStream.str();		
+                if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_KHR_parallel_shader_compile") == 0)
+                {
+                    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+                    if (maxThreads)
+                        maxThreads(0xFFFFFFFF);                                       // let the driver pick how many compiler threads to use
+                    parallelCompile = true;
+                    return;
+                }
             }
-            catch(std::ifstream::failure e)
+        }
+
+        // returns true once the program has linked successfully; never blocks when the driver
+        // supports parallel compiles. A program that failed to link is never ready
+        bool IsReady()
+        {
+            if (finished)
+                return ready;
+            if (parallelCompile)
             {
-                std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << e.what() << std::endl;
+                int done = 0;
+                glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+                if (!done)
+                    return false;
             }
+            Finish();
+            return ready;
+        }
 
-            const char* vShaderCode = vertexCode.c_str();
-            const char* fShaderCode = fragmentCode.c_str();
+        // blocks until the program is linked, reports errors and frees the shader objects
+        void Finish()
+        {
+            if (finished)
+                return;
+            checkCompileErrors(vertexShader, "VERTEX");
+            checkCompileErrors(fragmentShader, "FRAGMENT");
+            if (geometryShader)
+                checkCompileErrors(geometryShader, "GEOMETRY");
+            ready = checkCompileErrors(ID, "PROGRAM");
 
-            unsigned int vertex, fragment;
+            glDeleteShader(vertexShader);                                             // delete now obsolete shader objects
+            glDeleteShader(fragmentShader);
+            glDeleteShader(geometryShader);
+            finished = true;
+        }
 
-            vertex = glCreateShader(GL_VERTEX_SHADER);              
-            glShaderSource(vertex, 1, &vShaderCode, NULL);                   
-            glCompileShader(vertex);
-            checkCompileErrors(vertex, "VERTEX");
+        // hot reload: the new source is compiled next to the current program and only swapped in
+        // once it links, so a broken edit keeps drawing with the last good program
+        void Reload(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode = std::string())
+        {
+            Finish();
+            if (pendingProgram)
+                discardPending();
+            compile(vertexCode, fragmentCode, geometryCode, pendingProgram, pendingVertex, pendingFragment, pendingGeometry);
+        }
 
-            fragment = glCreateShader(GL_FRAGMENT_SHADER);             
-            glShaderSource(fragment, 1, &fShaderCode, NULL);
-            glCompileShader(fragment);
-            checkCompileErrors(fragment,"FRAGMENT");
+        // re-reads the source files if changedPath is one of them; returns whether a reload started
+        bool Reload(const std::string& changedPath)
+        {
+            if (VertexPath.empty() || (!samePath(changedPath, VertexPath) && !samePath(changedPath, FragmentPath)))
+                return false;
+            std::string vertexCode;
+            std::string fragmentCode;
+            readSources(VertexPath.c_str(), FragmentPath.c_str(), vertexCode, fragmentCode);
+            Reload(vertexCode, fragmentCode);
+            return true;
+        }
 
-            ID = glCreateProgram();                                 // shader Program object
-            glAttachShader(ID, vertex);                                    // attach the shaders to the SPO and then link them together
-            glAttachShader(ID, fragment);
-            glLinkProgram(ID);
-            checkCompileErrors(ID, "PROGRAM");
+        bool IsReloading() const
+        {
+            return pendingProgram != 0;
+        }
 
-            glDeleteShader(vertex);                                                   // delete now obsolete shader objects
-            glDeleteShader(fragment);  
+        // use/activate the shader, or its fallback while it is still compiling.
+        // returns false if neither program can be drawn with yet
+        bool use()
+        {
+            if (pendingProgram)
+                pollReload();
+            if (IsReady())
+                active = ID;
+            else if (Fallback && Fallback->IsReady())
+                active = Fallback->ID;
+            else
+                return false;
+            glUseProgram(active);
+            return true;
         }
 
-        // use/activate the shader
-        void use()
+        // whether the last use() bound the fallback instead of this program
+        bool UsingFallback() const
         {
-            glUseProgram(ID);
+            return active != ID;
         }
 
         // utility uniform functions
         void setBool(const std::string &name, bool value) const
         {
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+            glUniform1i(glGetUniformLocation(active, name.c_str()), (int)value); 
         }
         void setInt(const std::string &name, int value) const
         {
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+            glUniform1i(glGetUniformLocation(active, name.c_str()), value); 
         }   
         void setFloat(const std::string &name, float value) const
         {
-            glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+            glUniform1f(glGetUniformLocation(active, name.c_str()), value); 
         }
         void setMat4(const std::string &name, glm::mat4 &value) const
         {
-            glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+            glUniformMatrix4fv(glGetUniformLocation(active, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+        }
+        void setVec2(const std::string& name, float x, float y) const
+        {
+            glUniform2f(glGetUniformLocation(active, name.c_str()), x, y);
         }
         void setVec3(const std::string& name, glm::vec3& value) const
         {
-            glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+            glUniform3fv(glGetUniformLocation(active, name.c_str()), 1, &value[0]);
         }
         void setVec3(const std::string& name, float x, float y, float z) const
         {
-            glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+            glUniform3f(glGetUniformLocation(active, name.c_str()), x, y, z);
+        }
+        void setVec4(const std::string& name, float x, float y, float z, float w) const
+        {
+            glUniform4f(glGetUniformLocation(active, name.c_str()), x, y, z, w);
         }
 
         // utility compile checker
-        void checkCompileErrors(unsigned int shader, std::string type)
+        bool checkCompileErrors(unsigned int shader, std::string type)
         {
             int success;
             char infoLog[1024];
@@ -127,6 +218,108 @@ class Shader
                     std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
                 }
             }
+            return success != 0;
+        }
+
+    private:
+        inline static bool parallelCompile = false;
+        unsigned int vertexShader, fragmentShader;
+        unsigned int geometryShader = 0;                            // 0 without a geometry stage
+        unsigned int active;                                        // program the uniform setters write to
+        bool finished = false;                                      // link status has been queried
+        bool ready = false;                                         // and the link succeeded
+        unsigned int pendingProgram = 0;                            // reload still compiling, 0 if none
+        unsigned int pendingVertex, pendingFragment;
+        unsigned int pendingGeometry = 0;
+
+        Shader() {}
+
+        static void readSources(const char* vertexPath, const char* fragmentPath, std::string& vertexCode, std::string& fragmentCode)
+        {
+            // 1. retrieve the vertex/fragment source code through the asset file system
+            VfsFile vShaderFile = Vfs::Instance().Read(vertexPath);
+            VfsFile fShaderFile = Vfs::Instance().Read(fragmentPath);
+            if (!vShaderFile || !fShaderFile)
+                std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            vertexCode   = vShaderFile.String();
+            fragmentCode = fShaderFile.String();
+        }
+
+        static void compile(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode,
+                            unsigned int& program, unsigned int& vertex, unsigned int& fragment, unsigned int& geometry)
+        {
+            const char* vShaderCode = vertexCode.c_str();
+            const char* fShaderCode = fragmentCode.c_str();
+
+            vertex = glCreateShader(GL_VERTEX_SHADER);              
+            glShaderSource(vertex, 1, &vShaderCode, NULL);                   
+            glCompileShader(vertex);
+
+            fragment = glCreateShader(GL_FRAGMENT_SHADER);             
+            glShaderSource(fragment, 1, &fShaderCode, NULL);
+            glCompileShader(fragment);
+
+            geometry = 0;
+            if (!geometryCode.empty())
+            {
+                const char* gShaderCode = geometryCode.c_str();
+                geometry = glCreateShader(GL_GEOMETRY_SHADER);
+                glShaderSource(geometry, 1, &gShaderCode, NULL);
+                glCompileShader(geometry);
+            }
+
+            program = glCreateProgram();                            // shader Program object
+            glAttachShader(program, vertex);                               // attach the shaders to the SPO and then link them together
+            glAttachShader(program, fragment);
+            if (geometry)
+                glAttachShader(program, geometry);
+            glLinkProgram(program);
+        }
+
+        // swaps the reloaded program in once it has finished linking, or drops it if it failed
+        void pollReload()
+        {
+            if (parallelCompile)
+            {
+                int done = 0;
+                glGetProgramiv(pendingProgram, GL_COMPLETION_STATUS_KHR, &done);
+                if (!done)
+                    return;
+            }
+            bool ok = checkCompileErrors(pendingVertex, "VERTEX");
+            ok = checkCompileErrors(pendingFragment, "FRAGMENT") && ok;
+            if (pendingGeometry)
+                ok = checkCompileErrors(pendingGeometry, "GEOMETRY") && ok;
+            ok = checkCompileErrors(pendingProgram, "PROGRAM") && ok;
+            if (ok)
+            {
+                glDeleteProgram(ID);
+                ID = pendingProgram;
+                ready = true;
+                glDeleteShader(pendingVertex);
+                glDeleteShader(pendingFragment);
+                glDeleteShader(pendingGeometry);
+                pendingProgram = 0;
+            }
+            else
+            {
+                std::cout << "Shader reload failed, keeping the last good program" << std::endl;
+                discardPending();
+            }
+        }
+
+        void discardPending()
+        {
+            glDeleteShader(pendingVertex);
+            glDeleteShader(pendingFragment);
+            glDeleteShader(pendingGeometry);
+            glDeleteProgram(pendingProgram);
+            pendingProgram = 0;
+        }
+
+        static bool samePath(const std::string& a, const std::string& b)
+        {
+            return std::filesystem::path(a).lexically_normal() == std::filesystem::path(b).lexically_normal();
         }
 };
 
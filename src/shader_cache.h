@@ -0,0 +1,202 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include "shader.h"
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <filesystem>
+
+// Feature keys a shader can be specialised on. Each set bit becomes a #define in the source,
+// so a permutation key is just the OR of the features a draw needs
+enum Shader_Feature {
+    SHADER_NORMAL_MAP       = 1 << 0,
+    SHADER_INSTANCED        = 1 << 1,
+    SHADER_VIRTUAL_TEXTURE  = 1 << 2,
+    SHADER_TEXTURE_ARRAY    = 1 << 3,
+    SHADER_CLUSTERED_LIGHTS = 1 << 4,
+    SHADER_GBUFFER          = 1 << 5,
+    SHADER_SHADOWS          = 1 << 6,
+    SHADER_POINT_SHADOWS    = 1 << 7,
+    SHADER_SSAO             = 1 << 8
+};
+
+const char* const SHADER_FEATURE_NAMES[] = {
+    "NORMAL_MAP",
+    "INSTANCED",
+    "VIRTUAL_TEXTURE",
+    "TEXTURE_ARRAY",
+    "CLUSTERED_LIGHTS",
+    "GBUFFER",
+    "SHADOWS",
+    "POINT_SHADOWS",
+    "SSAO"
+};
+const int SHADER_FEATURE_COUNT = sizeof(SHADER_FEATURE_NAMES) / sizeof(SHADER_FEATURE_NAMES[0]);
+
+// Reads a shader through the Vfs, expands #include "file" directives (relative to the including
+// file, each file at most once) and injects the #defines for a permutation key right after the
+// #version line. Every file that went into the result is added to dependencies, if given, so hot
+// reload knows what to rebuild
+class ShaderPreprocessor
+{
+public:
+    static std::string Process(const std::string& path, unsigned int key, std::set<std::string>* dependencies = NULL)
+    {
+        std::set<std::string> included;
+        std::string source = expand(path, included);
+        if (dependencies)
+            dependencies->insert(included.begin(), included.end());
+
+        std::string defines;
+        for (int i = 0; i < SHADER_FEATURE_COUNT; i++)
+        {
+            if (key & (1u << i))
+                defines += std::string("#define ") + SHADER_FEATURE_NAMES[i] + "\n";
+        }
+
+        // #version has to stay the first statement, so the defines go on the line after it
+        size_t version = source.find("#version");
+        size_t insertAt = version == std::string::npos ? 0 : source.find('\n', version);
+        if (insertAt == std::string::npos)
+            insertAt = source.size();
+        else if (version != std::string::npos)
+            insertAt++;
+        std::string line = version == std::string::npos ? "#line 1\n" : "#line 2\n";
+        return source.substr(0, insertAt) + defines + line + source.substr(insertAt);
+    }
+
+private:
+    static std::string expand(const std::string& path, std::set<std::string>& included)
+    {
+        if (!included.insert(std::filesystem::path(path).lexically_normal().string()).second)
+            return "";
+
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+        std::istringstream in(Vfs::Instance().Read(path).String());
+        std::string out, line;
+        int lineNumber = 0;
+        while (std::getline(in, line))
+        {
+            lineNumber++;
+            size_t directive = line.find_first_not_of(" \t");
+            if (directive != std::string::npos && line.compare(directive, 8, "#include") == 0)
+            {
+                size_t open = line.find('"', directive);
+                size_t close = line.find('"', open + 1);
+                if (open == std::string::npos || close == std::string::npos)
+                {
+                    std::cout << "ERROR::SHADER::BAD_INCLUDE in " << path << ": " << line << std::endl;
+                    continue;
+                }
+                // error line numbers count from the top of the included file inside it, and pick
+                // up this file's numbering after it
+                std::string child = expand(directory + line.substr(open + 1, close - open - 1), included);
+                if (!child.empty())
+                    out += "#line 1\n" + child;
+                out += "#line " + std::to_string(lineNumber + 1) + "\n";
+                continue;
+            }
+            out += line + "\n";
+        }
+        return out;
+    }
+};
+
+// Holds every permutation of one vertex/fragment pair (and geometry shader, if given). A variant
+// is preprocessed and compiled the first time a draw asks for its key and reused after that, so
+// only the variants a scene actually uses are ever built and each is built exactly once
+class ShaderCache
+{
+public:
+    // program to draw with while a variant is still compiling (may be NULL)
+    Shader* Fallback = NULL;
+
+    ShaderCache(const char* vertexPath, const char* fragmentPath, bool async = true, const char* geometryPath = NULL)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), geometryPath(geometryPath ? geometryPath : ""), async(async)
+    {
+    }
+
+    // returns the program for a permutation key, kicking off its compile on first use
+    Shader& Get(unsigned int key)
+    {
+        auto it = programs.find(key);
+        if (it != programs.end())
+            return *it->second.shader;
+
+        Variant variant;
+        variant.shader = Shader::FromSource(
+            ShaderPreprocessor::Process(vertexPath, key, &variant.dependencies),
+            ShaderPreprocessor::Process(fragmentPath, key, &variant.dependencies), async, geometrySource(key, variant.dependencies));
+        variant.shader->Fallback = Fallback;
+        Shader& result = *variant.shader;
+        programs.emplace(key, std::move(variant));
+        return result;
+    }
+
+    // recompiles every variant that includes changedPath; each keeps its last good program until
+    // the new one links. returns the number of variants being rebuilt
+    int Reload(const std::string& changedPath)
+    {
+        std::string path = std::filesystem::path(changedPath).lexically_normal().string();
+        int count = 0;
+        for (auto& program : programs)
+        {
+            Variant& variant = program.second;
+            if (variant.dependencies.count(path) == 0)
+                continue;
+            variant.dependencies.clear();
+            variant.shader->Reload(
+                ShaderPreprocessor::Process(vertexPath, program.first, &variant.dependencies),
+                ShaderPreprocessor::Process(fragmentPath, program.first, &variant.dependencies),
+                geometrySource(program.first, variant.dependencies));
+            count++;
+        }
+        return count;
+    }
+
+    // starts compiling a variant ahead of time so it is ready by the time it is drawn
+    void Request(unsigned int key)
+    {
+        Get(key);
+    }
+
+    bool IsReady()
+    {
+        for (auto& program : programs)
+        {
+            if (!program.second.shader->IsReady())
+                return false;
+        }
+        return true;
+    }
+
+    size_t Count() const
+    {
+        return programs.size();
+    }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string geometryPath;                               // empty for none
+    bool async;
+
+    struct Variant
+    {
+        std::unique_ptr<Shader> shader;
+        std::set<std::string> dependencies;                 // normalized paths of every file in its source
+    };
+    std::unordered_map<unsigned int, Variant> programs;
+
+    std::string geometrySource(unsigned int key, std::set<std::string>& dependencies) const
+    {
+        return geometryPath.empty() ? std::string() : ShaderPreprocessor::Process(geometryPath, key, &dependencies);
+    }
+};
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader_cache.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// texture unit the cascades are bound to, after the light clusters
+const int SHADOW_TEXTURE_UNIT = 7;
+const int MAX_SHADOW_CASCADES = 4;
+
+// Work of the last shadow pass
+struct ShadowStats
+{
+    int Draws = 0;                  // caster draws over all cascades
+    int StaticDraws = 0;            // of those, into the static caches
+    int CachesRefreshed = 0;        // cascades whose static casters were drawn again
+    int Culled = 0;                 // caster draws a cascade's box left out
+};
+
+// Cascaded shadow maps for one directional light. The view frustum up to Distance is split into
+// CascadeCount slices, closer together near the eye (a blend of logarithmic and even splits,
+// SplitBlend). Each slice gets an orthographic map of Resolution texels a side, in one layer of a
+// depth texture array.
+//
+// A cascade covers the bounding sphere of its slice, so its size does not change as the camera
+// turns. Its centre only moves on a grid of whole texels in light space, taken in double world
+// coordinates, so edges don't crawl as the camera moves. The grid step is 1/SNAP_STEPS of the box
+// (a whole number of texels) and the box is made that much larger than the sphere, so a cascade
+// stays where it is until the camera has moved a fair way.
+//
+// Casters are static or dynamic. With CacheStatic, the static ones go into a second texture
+// array only when their cascade moves (or InvalidateStatic is called); every frame that is
+// copied into the shadow map and only the dynamic casters are drawn on top. Without it,
+// everything is drawn every frame. Both give the same maps, up to rounding.
+//
+// A frame: Update, then per cascade BeginStatic and the static casters if NeedsStatic, and
+// BeginCascade and the casters it asks for (UseCaster before each draw), then End
+class ShadowCascades
+{
+public:
+    int CascadeCount = 3;           // 1 to MAX_SHADOW_CASCADES
+    int Resolution = 2048;
+    float Distance = 60.0f;         // shadows end here, or at the camera's far plane
+    float SplitBlend = 0.75f;       // 0 even splits, 1 logarithmic
+    float CasterReach = 50.0f;      // how far towards the light casters outside a cascade are kept
+    bool CacheStatic = true;
+    glm::vec3 Direction = glm::normalize(glm::vec3(-0.4f, -1.0f, -0.3f));   // the light travels along it
+    glm::vec3 Color = glm::vec3(1.0f);
+    ShadowStats Stats;
+
+    ShadowCascades()
+        : casterShaders("shaders/vshader.txt", "shaders/shadowfshader.txt")
+    {
+        casterShaders.Request(0);
+        casterShaders.Request(SHADER_INSTANCED);
+        glGenFramebuffers(2, framebuffers);
+    }
+
+    ~ShadowCascades()
+    {
+        release();
+        glDeleteFramebuffers(2, framebuffers);
+    }
+
+    ShadowCascades(const ShadowCascades&) = delete;
+    ShadowCascades& operator=(const ShadowCascades&) = delete;
+
+    void Reload(const std::string& path)
+    {
+        casterShaders.Reload(path);
+    }
+
+    void InvalidateStatic()
+    {
+        for (Cascade& cascade : cascades)
+            cascade.StaticValid = false;
+    }
+
+    // fits the cascades to the camera's frustum. view and projection are the camera-relative ones,
+    // eye the camera's world position. (Re)allocates the maps when the count or resolution changed
+    void Update(const glm::mat4& view, const glm::mat4& projection, float near, float far, const glm::dvec3& eye)
+    {
+        CascadeCount = std::max(1, std::min(CascadeCount, MAX_SHADOW_CASCADES));
+        if (Resolution != allocatedResolution || CascadeCount != (int)cascades.size())
+            allocate();
+        Stats = ShadowStats();
+        forward = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+
+        // light space: the light looks down -z
+        glm::vec3 up = std::fabs(Direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat3 toLight = glm::mat3(glm::lookAt(glm::vec3(0.0f), Direction, up));
+        if (toLight != lightRotation)
+            InvalidateStatic();
+        lightRotation = toLight;
+        glm::dvec3 eyeInLight = glm::dmat3(toLight) * eye;
+
+        float end = std::min(Distance, far);
+        glm::mat3 toWorld = glm::transpose(glm::mat3(view));
+        float tanX = 1.0f / projection[0][0], tanY = 1.0f / projection[1][1];
+        float sliceNear = near;
+        for (int i = 0; i < CascadeCount; i++)
+        {
+            float t = (float)(i + 1) / CascadeCount;
+            float sliceFar = SplitBlend * near * std::pow(end / near, t) + (1.0f - SplitBlend) * (near + (end - near) * t);
+            Cascade& cascade = cascades[i];
+            cascade.Split = sliceFar;
+
+            // bounding sphere of the slice, about the middle of its corners; the radius only
+            // depends on the split depths and the field of view, and is rounded up so it holds still
+            glm::vec3 center(0.0f);
+            glm::vec3 corners[8];
+            for (int c = 0; c < 8; c++)
+            {
+                float depth = c < 4 ? sliceNear : sliceFar;
+                corners[c] = glm::vec3((c & 1 ? 1.0f : -1.0f) * tanX * depth, (c & 2 ? 1.0f : -1.0f) * tanY * depth, -depth);
+                center += corners[c] / 8.0f;
+            }
+            float radius = 0.0f;
+            for (int c = 0; c < 8; c++)
+                radius = std::max(radius, glm::length(corners[c] - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+            float extent = radius / (1.0f - 1.5f / SNAP_STEPS);
+            float step = 2.0f * extent / SNAP_STEPS;
+
+            // the centre on the light space grid, in world coordinates
+            glm::dvec3 centerInLight = glm::dmat3(toLight) * (eye + glm::dvec3(toWorld * center));
+            glm::dvec3 snapped = glm::floor(centerInLight / (double)step + 0.5) * (double)step;
+            if (snapped != cascade.Center || extent != cascade.Extent)
+                cascade.StaticValid = false;
+            cascade.Center = snapped;
+            cascade.Extent = extent;
+            cascade.TexelSize = 2.0f * extent / Resolution;
+
+            // relative to the eye, like everything that is drawn
+            glm::vec3 offset = glm::vec3(snapped - eyeInLight);
+            cascade.ViewProjection = glm::ortho(-extent, extent, -extent, extent, -(extent + CasterReach), extent)
+                                   * glm::translate(glm::mat4(1.0f), -offset) * glm::mat4(toLight);
+            sliceNear = sliceFar;
+        }
+    }
+
+    int Count() const
+    {
+        return (int)cascades.size();
+    }
+
+    // whether cascade i needs its static casters drawn this frame: always without CacheStatic
+    bool NeedsStatic(int i) const
+    {
+        return !CacheStatic || !cascades[i].StaticValid;
+    }
+
+    // sphere (relative to the eye) against the box of cascade i, stretched towards the light
+    bool Reaches(int i, const glm::vec3& center, float radius) const
+    {
+        const Cascade& cascade = cascades[i];
+        glm::vec3 clip = glm::vec3(cascade.ViewProjection * glm::vec4(center, 1.0f));
+        float scale = 1.0f / cascade.Extent;
+        return std::fabs(clip.x) <= 1.0f + radius * scale && std::fabs(clip.y) <= 1.0f + radius * scale
+            && std::fabs(clip.z) <= 1.0f + radius * 2.0f / (2.0f * cascade.Extent + CasterReach);
+    }
+
+    // starts drawing the static casters of cascade i into its cache; with CacheStatic off they go
+    // straight into the shadow map, followed by the dynamic ones. The cache only counts as valid
+    // once BeginCascade (or End) follows with every static caster drawn
+    void BeginStatic(int i)
+    {
+        beginPass();
+        bindLayer(CacheStatic ? 1 : 0, i);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        cascades[i].StaticValid = false;
+        Stats.CachesRefreshed++;
+        drawingStatic = true;
+        staticComplete = true;
+    }
+
+    // starts drawing the dynamic casters of cascade i, over its static ones
+    void BeginCascade(int i, bool staticDrawn)
+    {
+        beginPass();
+        endStatic();
+        if (!CacheStatic)
+        {
+            bindLayer(0, i);
+            if (!staticDrawn)
+                glClear(GL_DEPTH_BUFFER_BIT);
+            return;
+        }
+        // the cached static casters are the starting point
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[1]);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[1], 0, i);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[0]);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[0], 0, i);
+        glBlitFramebuffer(0, 0, Resolution, Resolution, 0, 0, Resolution, Resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+        currentCascade = i;
+    }
+
+    // program for a caster of cascade currentCascade, with its model matrix (relative to the eye)
+    // set; false if it can't be drawn yet
+    bool UseCaster(bool instanced, const glm::mat4& model)
+    {
+        Shader& shader = casterShaders.Get(instanced ? SHADER_INSTANCED : 0);
+        if (!shader.use())
+        {
+            // a static caster missing from the cache; it is drawn again next frame
+            if (drawingStatic)
+                staticComplete = false;
+            return false;
+        }
+        glm::mat4 identity(1.0f), relative = model;
+        shader.setMat4("projection", cascades[currentCascade].ViewProjection);
+        shader.setMat4("view", identity);
+        shader.setMat4("model", relative);
+        Stats.Draws++;
+        if (drawingStatic)
+            Stats.StaticDraws++;
+        return true;
+    }
+
+    // back to the framebuffer and viewport that were bound before the first Begin
+    void End()
+    {
+        if (!passActive)
+            return;
+        endStatic();
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        passActive = false;
+    }
+
+    // binds the shadow map and sets what shaders/shadows.txt reads
+    void Bind(const Shader& shader, int unit = SHADOW_TEXTURE_UNIT) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[0]);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("shadowMap", unit);
+        shader.setInt("cascadeCount", (int)cascades.size());
+        float splits[MAX_SHADOW_CASCADES] = { 0.0f, 0.0f, 0.0f, 0.0f }, texels[MAX_SHADOW_CASCADES] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        // from clip space to texture coordinates and depth
+        glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+        for (size_t i = 0; i < cascades.size(); i++)
+        {
+            splits[i] = cascades[i].Split;
+            texels[i] = cascades[i].TexelSize;
+            glm::mat4 toShadow = bias * cascades[i].ViewProjection;
+            shader.setMat4("cascadeMatrices[" + std::to_string(i) + "]", toShadow);
+        }
+        shader.setVec4("cascadeSplits", splits[0], splits[1], splits[2], splits[3]);
+        shader.setVec4("cascadeTexels", texels[0], texels[1], texels[2], texels[3]);
+        shader.setVec3("shadowForward", forward.x, forward.y, forward.z);
+        glm::vec3 toLight = -Direction;
+        shader.setVec3("sunDirection", toLight.x, toLight.y, toLight.z);
+        shader.setVec3("sunColor", Color.x, Color.y, Color.z);
+    }
+
+    // of the shadow maps and the static caches
+    uint64_t Bytes() const
+    {
+        return (uint64_t)allocatedResolution * allocatedResolution * 4 * cascades.size() * 2;
+    }
+
+private:
+    // grid steps of the cascade centres across a box; divides every resolution
+    static const int SNAP_STEPS = 16;
+
+    struct Cascade
+    {
+        glm::mat4 ViewProjection = glm::mat4(1.0f);     // from eye-relative world space
+        glm::dvec3 Center = glm::dvec3(0.0);            // in light space, world coordinates
+        float Extent = 0.0f;                            // half the side of the box
+        float Split = 0.0f;                             // view depth the cascade ends at
+        float TexelSize = 0.0f;
+        bool StaticValid = false;
+    };
+
+    ShaderCache casterShaders;
+    std::vector<Cascade> cascades;
+    unsigned int framebuffers[2];                       // shadow maps, static caches
+    unsigned int textures[2] = { 0, 0 };
+    int allocatedResolution = 0;
+    glm::mat3 lightRotation = glm::mat3(0.0f);
+    glm::vec3 forward = glm::vec3(0.0f, 0.0f, -1.0f);
+    int currentCascade = 0;
+    bool drawingStatic = false;
+    bool staticComplete = false;   // no static caster of currentCascade was skipped
+    bool passActive = false;
+    GLint savedFramebuffer = 0;
+    GLint savedViewport[4];
+
+    void beginPass()
+    {
+        if (passActive)
+            return;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glViewport(0, 0, Resolution, Resolution);
+        // slope-scaled bias against acne; the receivers add a normal offset on top
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+        passActive = true;
+    }
+
+    void endStatic()
+    {
+        if (drawingStatic)
+            cascades[currentCascade].StaticValid = CacheStatic && staticComplete;
+        drawingStatic = false;
+    }
+
+    void bindLayer(int target, int i)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[target]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[target], 0, i);
+        currentCascade = i;
+    }
+
+    void allocate()
+    {
+        // the scene may be drawn to a target of its own, which has to stay bound
+        GLint drawingTo = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &drawingTo);
+        release();
+        cascades.assign(CascadeCount, Cascade());
+        allocatedResolution = Resolution;
+        glGenTextures(2, textures);
+        for (int target = 0; target < 2; target++)
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textures[target]);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, Resolution, Resolution, CascadeCount, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            // hardware depth comparison, bilinear between the four results
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[target]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[target], 0, 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::SHADOWS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, drawingTo);
+    }
+
+    void release()
+    {
+        if (!textures[0])
+            return;
+        glDeleteTextures(2, textures);
+        textures[0] = textures[1] = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+// Monotonic time since construction in integer nanoseconds. An int64 holds nearly 300 years of
+// them, so frame deltas stay exact however long the process runs; a float of seconds can no
+// longer tell 16 ms frames apart from each other once it passes a few days
+class SimClock
+{
+public:
+    SimClock() : start(std::chrono::steady_clock::now()), last(start) {}
+
+    int64_t Nanoseconds() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double Seconds() const
+    {
+        return Nanoseconds() * 1e-9;
+    }
+
+    // nanoseconds since the previous Tick (or construction)
+    int64_t Tick()
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        last = now;
+        return elapsed;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last;
+};
+
+// Fixed-rate simulation steps from variable frame times. Frame time goes into an integer
+// accumulator kept in nanoseconds times Rate, so one step is exactly 1e9 units and no rounding
+// builds up between frames; Advance says how many steps of StepSeconds to run and Alpha how far
+// the frame is into the next one, for interpolating what is drawn between the last two states.
+// The simulation only ever sees StepSeconds and Steps, so its results do not depend on the
+// render rate
+class FixedTimestep
+{
+public:
+    int Rate;                       // steps per second
+    int MaxSteps = 8;               // per frame; time beyond that is dropped so a stall cannot snowball
+    uint64_t Steps = 0;             // taken since start
+    int DroppedFrames = 0;          // frames that hit MaxSteps
+
+    explicit FixedTimestep(int rate = 120) : Rate(rate < 1 ? 1 : rate) {}
+
+    float StepSeconds() const
+    {
+        return 1.0f / (float)Rate;
+    }
+
+    // simulated time of the latest step; exact, since it is derived from the step count
+    double Time() const
+    {
+        return (double)Steps / (double)Rate;
+    }
+
+    // adds elapsed frame time and returns the number of steps to run now
+    int Advance(int64_t elapsedNanoseconds)
+    {
+        if (elapsedNanoseconds < 0)
+            elapsedNanoseconds = 0;
+        // a frame longer than a second (a breakpoint, a dragged window) counts as MaxSteps
+        if (elapsedNanoseconds > NANOSECONDS)
+            elapsedNanoseconds = NANOSECONDS;
+        accumulator += elapsedNanoseconds * Rate;
+        int steps = (int)(accumulator / NANOSECONDS);
+        if (steps > MaxSteps)
+        {
+            steps = MaxSteps;
+            accumulator = NANOSECONDS * MaxSteps;
+            DroppedFrames++;
+        }
+        accumulator -= NANOSECONDS * steps;
+        Steps += steps;
+        return steps;
+    }
+
+    // fraction of a step left in the accumulator, in [0, 1)
+    float Alpha() const
+    {
+        return (float)((double)accumulator / (double)NANOSECONDS);
+    }
+
+private:
+    static const int64_t NANOSECONDS = 1000000000;
+    int64_t accumulator = 0;
+};
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef SSAO_H
+#define SSAO_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader_cache.h"
+#include "gpu_timer.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <iostream>
+
+// texture unit the occlusion is bound to, after the point light shadows
+const int SSAO_TEXTURE_UNIT = 9;
+const int MAX_SSAO_SAMPLES = 32;
+
+// resolution the occlusion is worked out at, as a fraction of the viewport
+enum Ssao_Tier {
+    SSAO_OFF,
+    SSAO_QUARTER,
+    SSAO_HALF,
+    SSAO_FULL,
+    SSAO_TIER_COUNT
+};
+const char* const SSAO_TIER_NAMES[] = { "off", "quarter", "half", "full" };
+
+// Size and cost of the last frame's occlusion
+struct SsaoStats
+{
+    int Width = 0;                  // of the occlusion drawn this frame
+    int Height = 0;
+    uint64_t Bytes = 0;             // of its targets, as allocated
+    int Draws = 0;                  // of the prepass
+    double Milliseconds = -1.0;     // GPU time of the prepass, the occlusion and the blur, a few frames late
+};
+
+// Screen space ambient occlusion at a fraction of the resolution (Tier).
+//  - a depth and normal prepass draws the lit scene at that resolution, with the GBUFFER variants
+//    of their shaders (only the normal is kept);
+//  - SampleCount points in the hemisphere over each pixel's normal, Radius across, are checked
+//    against the depth they land on. With Temporal, the pattern turns every frame and each
+//    result is blended with the last ones where they reproject onto the same surface;
+//  - a separable blur that leaves out texels of a different depth smooths the noise out.
+// The occlusion keeps its view depth next to it, so the lit shaders (shaders/ssao.txt) take the
+// nearest four texels weighted by how close their depth is to the pixel's when they scale
+// their ambient by it.
+//
+// A frame: BeginPrepass, draw the lit scene with the GBUFFER shaders, Compute
+class Ssao
+{
+public:
+    Ssao_Tier Tier = SSAO_HALF;
+    int SampleCount = 12;           // up to MAX_SSAO_SAMPLES
+    float Radius = 0.8f;
+    float Intensity = 1.2f;
+    bool Temporal = false;
+    float TemporalBlend = 0.85f;    // weight of the history where it is kept
+    SsaoStats Stats;
+
+    Ssao()
+        : occlusionShaders("shaders/fullscreenvshader.txt", "shaders/ssaofshader.txt"),
+          blurShaders("shaders/fullscreenvshader.txt", "shaders/ssaoblurfshader.txt")
+    {
+        occlusionShaders.Request(0);
+        blurShaders.Request(0);
+        glGenVertexArrays(1, &emptyVAO);
+
+        // more of the samples close to the middle, where occluders matter most
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (int i = 0; i < MAX_SSAO_SAMPLES; i++)
+        {
+            // none too close to the surface, which would only find the surface itself
+            glm::vec3 sample(unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f, 0.15f + 0.85f * unit(random));
+            // the first ones of the kernel, which every sample count uses, spread over all lengths
+            float t = (float)((i * 7) % MAX_SSAO_SAMPLES + 1) / MAX_SSAO_SAMPLES;
+            kernel[i] = glm::normalize(sample) * (0.1f + 0.9f * t * t);
+        }
+    }
+
+    ~Ssao()
+    {
+        release();
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    Ssao(const Ssao&) = delete;
+    Ssao& operator=(const Ssao&) = delete;
+
+    void Reload(const std::string& path)
+    {
+        occlusionShaders.Reload(path);
+        blurShaders.Reload(path);
+    }
+
+    bool Enabled() const
+    {
+        return Tier != SSAO_OFF;
+    }
+
+    // starts the prepass for a viewport of width x height: binds and clears the prepass target at
+    // the tier's resolution. Like the G-buffer, the targets are allocated for targetWidth x
+    // targetHeight, the window's size under dynamic resolution, and drawn in their corner
+    void BeginPrepass(int width, int height, int targetWidth = 0, int targetHeight = 0)
+    {
+        int divisor = Tier == SSAO_QUARTER ? 4 : Tier == SSAO_HALF ? 2 : 1;
+        int allocateWidth = std::max(1, std::max(width, targetWidth) / divisor);
+        int allocateHeight = std::max(1, std::max(height, targetHeight) / divisor);
+        if (allocateWidth != allocatedWidth || allocateHeight != allocatedHeight)
+            resize(allocateWidth, allocateHeight);
+        historyWidth = Stats.Width;
+        historyHeight = Stats.Height;
+        Stats.Width = std::min(allocatedWidth, std::max(1, width / divisor));
+        Stats.Height = std::min(allocatedHeight, std::max(1, height / divisor));
+        viewportWidth = width;
+        viewportHeight = height;
+
+        timer.Begin();
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[PREPASS_NORMAL]);
+        glViewport(0, 0, Stats.Width, Stats.Height);
+        glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, 0, Stats.Width, Stats.Height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+    }
+
+    // the occlusion and its blur from the prepass, then back to the framebuffer and viewport from
+    // before BeginPrepass. view and projection are the camera-relative ones the prepass was drawn
+    // with, eye the camera's world position
+    void Compute(const glm::mat4& view, const glm::mat4& projection, float near, float far, const glm::dvec3& eye)
+    {
+        Shader& occlusionShader = occlusionShaders.Get(0);
+        Shader& blurShader = blurShaders.Get(0);
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(emptyVAO);
+        forward = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+
+        int current = (int)(frame & 1);
+        if (occlusionShader.use() && blurShader.IsReady())
+        {
+            // occlusion, with the history blended in, into the history target of this frame
+            glm::mat4 viewProjection = projection * view, inverseViewProjection = glm::inverse(viewProjection);
+            // the previous frame's eye-relative space is this one's moved by the eye's motion
+            glm::mat4 previous = previousViewProjection * glm::translate(glm::mat4(1.0f), glm::vec3(eye - previousEye));
+            bool useHistory = Temporal && historyValid;
+            bindTexture(0, textures[PREPASS_DEPTH]);
+            bindTexture(1, textures[PREPASS_NORMAL]);
+            bindTexture(2, textures[HISTORY + 1 - current]);
+            occlusionShader.setInt("gDepth", 0);
+            occlusionShader.setInt("gNormal", 1);
+            occlusionShader.setInt("history", 2);
+            occlusionShader.setMat4("viewProjection", viewProjection);
+            occlusionShader.setMat4("inverseViewProjection", inverseViewProjection);
+            occlusionShader.setMat4("previousViewProjection", previous);
+            occlusionShader.setVec2("viewportSize", (float)Stats.Width, (float)Stats.Height);
+            occlusionShader.setVec2("historySize", (float)historyWidth, (float)historyHeight);
+            occlusionShader.setVec2("depthRange", near, far);
+            occlusionShader.setVec3("aoForward", forward.x, forward.y, forward.z);
+            occlusionShader.setInt("sampleCount", std::max(1, std::min(SampleCount, MAX_SSAO_SAMPLES)));
+            occlusionShader.setFloat("radius", Radius);
+            occlusionShader.setFloat("intensity", Intensity);
+            occlusionShader.setInt("frame", Temporal ? (int)(frame % 64) : 0);
+            occlusionShader.setFloat("historyBlend", useHistory ? TemporalBlend : 0.0f);
+            for (int i = 0; i < MAX_SSAO_SAMPLES; i++)
+                occlusionShader.setVec3("kernel[" + std::to_string(i) + "]", kernel[i].x, kernel[i].y, kernel[i].z);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[HISTORY + current]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            // blurred across, then down into the result
+            blurShader.use();
+            blurShader.setInt("occlusion", 0);
+            blurShader.setVec2("occlusionSize", (float)Stats.Width, (float)Stats.Height);
+            bindTexture(0, textures[HISTORY + current]);
+            blurShader.setVec2("direction", 1.0f, 0.0f);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[BLURRED_ACROSS]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            bindTexture(0, textures[BLURRED_ACROSS]);
+            blurShader.setVec2("direction", 0.0f, 1.0f);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[RESULT]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            historyValid = true;
+            frame++;
+        }
+        else
+        {
+            // nothing occluded until the programs are ready
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[RESULT]);
+            glClearColor(1.0f, far, 0.0f, 0.0f);
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(0, 0, Stats.Width, Stats.Height);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glDisable(GL_SCISSOR_TEST);
+        }
+        previousViewProjection = projection * view;
+        previousEye = eye;
+
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        timer.End();
+        Stats.Milliseconds = timer.Milliseconds();
+    }
+
+    // binds the occlusion and sets what shaders/ssao.txt reads
+    void Bind(const Shader& shader, int unit = SSAO_TEXTURE_UNIT) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, textures[RESULT]);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("ambientOcclusionMap", unit);
+        shader.setVec2("aoScale", (float)Stats.Width / std::max(viewportWidth, 1), (float)Stats.Height / std::max(viewportHeight, 1));
+        shader.setVec2("aoSize", (float)Stats.Width, (float)Stats.Height);
+        shader.setVec3("aoForward", forward.x, forward.y, forward.z);
+    }
+
+private:
+    // targets, each drawn through a framebuffer of its own; the prepass depth goes with its normal
+    enum Target { PREPASS_NORMAL, PREPASS_DEPTH, HISTORY, HISTORY_NEXT, BLURRED_ACROSS, RESULT, TARGET_COUNT };
+
+    ShaderCache occlusionShaders;
+    ShaderCache blurShaders;
+    GpuTimer timer;
+    glm::vec3 kernel[MAX_SSAO_SAMPLES];
+    unsigned int framebuffers[TARGET_COUNT] = {};
+    unsigned int textures[TARGET_COUNT] = {};
+    unsigned int emptyVAO = 0;
+    int viewportWidth = 0;
+    int viewportHeight = 0;
+    int allocatedWidth = 0;
+    int allocatedHeight = 0;
+    int historyWidth = 0;           // of the occlusion last frame, which the history covers
+    int historyHeight = 0;
+    glm::vec3 forward = glm::vec3(0.0f, 0.0f, -1.0f);
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);
+    glm::dvec3 previousEye = glm::dvec3(0.0);
+    bool historyValid = false;
+    uint64_t frame = 0;
+    GLint savedFramebuffer = 0;
+    GLint savedViewport[4];
+
+    static void bindTexture(int unit, unsigned int texture)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+
+    void resize(int width, int height)
+    {
+        // BeginPrepass saves the binding after this, to go back to it
+        GLint drawingTo = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &drawingTo);
+        release();
+        allocatedWidth = width;
+        allocatedHeight = height;
+
+        struct Format { GLenum internal, format, type; };
+        static const Format formats[TARGET_COUNT] = {
+            { GL_RG16, GL_RG, GL_UNSIGNED_SHORT },                  // normal, as the G-buffer has it
+            { GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT },
+            { GL_RG16F, GL_RG, GL_FLOAT },                          // occlusion and view depth from here on
+            { GL_RG16F, GL_RG, GL_FLOAT },
+            { GL_RG16F, GL_RG, GL_FLOAT },
+            { GL_RG16F, GL_RG, GL_FLOAT }
+        };
+        glGenTextures(TARGET_COUNT, textures);
+        glGenFramebuffers(TARGET_COUNT, framebuffers);
+        Stats.Bytes = (uint64_t)width * height * 4 * TARGET_COUNT;
+        for (int i = 0; i < TARGET_COUNT; i++)
+        {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, formats[i].internal, width, height, 0, formats[i].format, formats[i].type, NULL);
+            // the history is read where the surface was last frame, between texels
+            GLenum filter = i == HISTORY || i == HISTORY_NEXT ? GL_LINEAR : GL_NEAREST;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        for (int i = 0; i < TARGET_COUNT; i++)
+        {
+            if (i == PREPASS_DEPTH)
+                continue;
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+            if (i == PREPASS_NORMAL)
+            {
+                // the GBUFFER shaders write the normal to location 2
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[PREPASS_DEPTH], 0);
+                const GLenum buffers[3] = { GL_NONE, GL_NONE, GL_COLOR_ATTACHMENT0 };
+                glDrawBuffers(3, buffers);
+            }
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::SSAO::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, drawingTo);
+        historyValid = false;
+    }
+
+    void release()
+    {
+        if (!textures[0])
+            return;
+        glDeleteFramebuffers(TARGET_COUNT, framebuffers);
+        glDeleteTextures(TARGET_COUNT, textures);
+        std::fill(textures, textures + TARGET_COUNT, 0u);
+        std::fill(framebuffers, framebuffers + TARGET_COUNT, 0u);
+    }
+};
+
+#endif
@@ -0,0 +1,445 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "vfs.h"
+#include "lz4.h"
+#include "shader.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+
+// Packed texture set (.tpack), written by tools/pack_textures:
+//   TpackHeader
+//   TpackEntry[]   one per texture
+//   names          entry.nameLength bytes each, in entry order
+//   TpackPage[]    one per array layer
+//   page data      pageSize^2 RGBA8 texels per layer, LZ4 compressed unless TPACK_PAGE_RAW is set
+const char TPACK_MAGIC[4] = { 'T', 'P', 'K', '1' };
+const uint32_t TPACK_VERSION = 1;
+const uint32_t TPACK_PAGE_RAW = 0x80000000u;
+
+struct TpackHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t pageSize;      // texels on a side of every layer
+    uint32_t padding;       // texels around every texture, also the mip levels that stay bleed free
+    uint32_t pages;
+    uint32_t entries;
+};
+
+struct TpackEntry
+{
+    uint32_t layer;
+    uint32_t x, y, width, height;   // texels, without the padding
+    uint32_t nameLength;
+};
+
+struct TpackPage
+{
+    uint64_t offset;        // from the start of the file
+    uint32_t storedSize;    // TPACK_PAGE_RAW set if stored uncompressed
+    uint32_t reserved;
+};
+
+struct SkylineRect
+{
+    int X = 0, Y = 0, Width = 0, Height = 0;
+};
+
+// Bottom-left skyline bin packer: the packed area is kept as a list of horizontal segments and
+// each rectangle goes where its top edge ends up lowest
+class SkylinePacker
+{
+public:
+    SkylinePacker(int width, int height)
+        : width(width), height(height)
+    {
+        skyline.push_back({ 0, 0, width });
+    }
+
+    bool Insert(int rectWidth, int rectHeight, SkylineRect& rect)
+    {
+        int bestTop = height + 1, bestWidth = width + 1;
+        size_t best = skyline.size();
+        int bestY = 0;
+        for (size_t i = 0; i < skyline.size(); i++)
+        {
+            int y;
+            if (!fits(i, rectWidth, rectHeight, y))
+                continue;
+            if (y + rectHeight < bestTop || (y + rectHeight == bestTop && skyline[i].width < bestWidth))
+            {
+                best = i;
+                bestTop = y + rectHeight;
+                bestWidth = skyline[i].width;
+                bestY = y;
+            }
+        }
+        if (best == skyline.size())
+            return false;
+
+        rect.X = skyline[best].x;
+        rect.Y = bestY;
+        rect.Width = rectWidth;
+        rect.Height = rectHeight;
+        used += (uint64_t)rectWidth * rectHeight;
+
+        // the new segment covers the rectangle; the ones it overlaps are cut back or dropped
+        skyline.insert(skyline.begin() + best, { rect.X, bestY + rectHeight, rectWidth });
+        for (size_t i = best + 1; i < skyline.size();)
+        {
+            int right = skyline[i - 1].x + skyline[i - 1].width;
+            if (skyline[i].x >= right)
+                break;
+            int shrink = right - skyline[i].x;
+            skyline[i].x += shrink;
+            skyline[i].width -= shrink;
+            if (skyline[i].width > 0)
+                break;
+            skyline.erase(skyline.begin() + i);
+        }
+        for (size_t i = 0; i + 1 < skyline.size();)
+        {
+            if (skyline[i].y == skyline[i + 1].y)
+            {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.erase(skyline.begin() + i + 1);
+            }
+            else
+                i++;
+        }
+        return true;
+    }
+
+    float Occupancy() const { return (float)used / ((float)width * height); }
+
+private:
+    struct Segment { int x, y, width; };
+
+    int width, height;
+    uint64_t used = 0;
+    std::vector<Segment> skyline;
+
+    // the height a rectangle would sit at with its left edge on segment i
+    bool fits(size_t i, int rectWidth, int rectHeight, int& y) const
+    {
+        if (skyline[i].x + rectWidth > width)
+            return false;
+        y = 0;
+        int remaining = rectWidth;
+        for (size_t j = i; remaining > 0; j++)
+        {
+            if (j == skyline.size())
+                return false;
+            y = std::max(y, skyline[j].y);
+            if (y + rectHeight > height)
+                return false;
+            remaining -= skyline[j].width;
+        }
+        return true;
+    }
+};
+
+// Where a texture ended up: the array layer, and the part of the layer it covers in UV space
+// (offset in xy, scale in zw), which is what the instance attributes carry
+struct PackedTexture
+{
+    std::string Name;
+    int Layer = 0;
+    int X = 0, Y = 0, Width = 0, Height = 0;
+    glm::vec4 Rect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+};
+
+// Packs RGBA8 textures into the layers of a texture array, several to a layer as an atlas when
+// they are smaller than a layer. Every texture is surrounded by padding texels that repeat its
+// edge and starts on a multiple of the padding, so the first log2(padding) mips of a layer never
+// blend neighbours into each other. Textures bigger than a layer are halved until they fit. Used
+// offline by tools/pack_textures and at runtime for textures that are only known then
+class TexturePacker
+{
+public:
+    int PageSize;
+    int Padding;
+    std::vector<PackedTexture> Entries;
+    std::vector<std::vector<unsigned char>> Pages;  // PageSize^2 RGBA8 each, after Pack
+    std::vector<float> Occupancy;                   // of every page, padding included
+
+    explicit TexturePacker(int pageSize = 2048, int padding = 8)
+        : PageSize(pageSize), Padding(std::max(1, padding))
+    {
+    }
+
+    // returns the index of the texture in Entries; pixels are RGBA8 and copied
+    int Add(const std::string& name, const unsigned char* pixels, int width, int height)
+    {
+        Source source;
+        source.width = width;
+        source.height = height;
+        source.pixels.assign(pixels, pixels + (size_t)width * height * 4);
+        int limit = PageSize - 2 * Padding;
+        while (source.width > limit || source.height > limit)
+            halve(source);
+        if (source.width != width || source.height != height)
+            std::cout << "Texture packer: " << name << " downscaled to " << source.width << "x" << source.height << " to fit a layer" << std::endl;
+        sources.push_back(std::move(source));
+        PackedTexture entry;
+        entry.Name = name;
+        Entries.push_back(entry);
+        return (int)Entries.size() - 1;
+    }
+
+    // tallest first onto the first layer with room, opening a new layer when none has
+    void Pack()
+    {
+        std::vector<size_t> order(sources.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b)
+        {
+            return sources[a].height != sources[b].height ? sources[a].height > sources[b].height : sources[a].width > sources[b].width;
+        });
+
+        std::vector<SkylinePacker> packers;
+        Pages.clear();
+        for (size_t index : order)
+        {
+            const Source& source = sources[index];
+            int rectWidth = alignUp(source.width) + 2 * Padding;
+            int rectHeight = alignUp(source.height) + 2 * Padding;
+            SkylineRect rect;
+            size_t page = 0;
+            while (page < packers.size() && !packers[page].Insert(rectWidth, rectHeight, rect))
+                page++;
+            if (page == packers.size())
+            {
+                packers.emplace_back(PageSize, PageSize);
+                Pages.emplace_back((size_t)PageSize * PageSize * 4, 0);
+                packers.back().Insert(rectWidth, rectHeight, rect);
+            }
+
+            PackedTexture& entry = Entries[index];
+            entry.Layer = (int)page;
+            entry.X = rect.X + Padding;
+            entry.Y = rect.Y + Padding;
+            entry.Width = source.width;
+            entry.Height = source.height;
+            entry.Rect = glm::vec4((float)entry.X, (float)entry.Y, (float)entry.Width, (float)entry.Height) / (float)PageSize;
+            blit(Pages[page], source, rect);
+        }
+        Occupancy.clear();
+        for (const SkylinePacker& packer : packers)
+            Occupancy.push_back(packer.Occupancy());
+    }
+
+private:
+    struct Source
+    {
+        int width = 0, height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    std::vector<Source> sources;
+
+    int alignUp(int value) const
+    {
+        return (value + Padding - 1) / Padding * Padding;
+    }
+
+    static void halve(Source& source)
+    {
+        int width = std::max(1, source.width / 2), height = std::max(1, source.height / 2);
+        std::vector<unsigned char> pixels((size_t)width * height * 4);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                int x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+                int y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+                for (int c = 0; c < 4; c++)
+                {
+                    int sum = source.pixels[((size_t)y0 * source.width + x0) * 4 + c] + source.pixels[((size_t)y0 * source.width + x1) * 4 + c] +
+                              source.pixels[((size_t)y1 * source.width + x0) * 4 + c] + source.pixels[((size_t)y1 * source.width + x1) * 4 + c];
+                    pixels[((size_t)y * width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        source.width = width;
+        source.height = height;
+        source.pixels.swap(pixels);
+    }
+
+    // copies the texture into its rectangle with the edge texels repeated out to the rectangle's
+    // border, which is what clamp to edge would have sampled
+    void blit(std::vector<unsigned char>& page, const Source& source, const SkylineRect& rect) const
+    {
+        for (int y = 0; y < rect.Height; y++)
+        {
+            int sy = std::max(0, std::min(source.height - 1, y - Padding));
+            for (int x = 0; x < rect.Width; x++)
+            {
+                int sx = std::max(0, std::min(source.width - 1, x - Padding));
+                memcpy(&page[((size_t)(rect.Y + y) * PageSize + rect.X + x) * 4], &source.pixels[((size_t)sy * source.width + sx) * 4], 4);
+            }
+        }
+    }
+};
+
+// A GL_TEXTURE_2D_ARRAY of packed layers. Everything packed into it is drawn with one bind: the
+// layer index and UV rect of a texture go in as per-instance attributes (see TEXTURE_ARRAY in
+// the lighting shaders) instead of a glBindTexture per material
+class TextureArray
+{
+public:
+    unsigned int ID = 0;
+    int PageSize = 0;
+    int Layers = 0;
+    std::vector<PackedTexture> Entries;
+
+    // uploads what a runtime packer holds; Pack has to have run
+    explicit TextureArray(const TexturePacker& packer)
+    {
+        PageSize = packer.PageSize;
+        Entries = packer.Entries;
+        create((int)packer.Pages.size(), packer.Padding);
+        for (size_t i = 0; i < packer.Pages.size(); i++)
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, PageSize, PageSize, 1, GL_RGBA, GL_UNSIGNED_BYTE, packer.Pages[i].data());
+        finish();
+    }
+
+    // loads a .tpack written by tools/pack_textures
+    explicit TextureArray(const std::string& path)
+    {
+        VfsFile file = Vfs::Instance().Read(path);
+        const TpackHeader* header = (const TpackHeader*)file.Data;
+        if (!file || file.Size < sizeof(TpackHeader) || memcmp(header->magic, TPACK_MAGIC, 4) != 0 || header->version != TPACK_VERSION ||
+            header->pageSize == 0)
+        {
+            std::cout << "ERROR::TEXTURE_ARRAY::BAD_FILE: " << path << std::endl;
+            return;
+        }
+        PageSize = header->pageSize;
+        size_t at = sizeof(TpackHeader);
+        const TpackEntry* entries = (const TpackEntry*)(file.Data + at);
+        at += header->entries * sizeof(TpackEntry);
+        if (at > file.Size)
+        {
+            std::cout << "ERROR::TEXTURE_ARRAY::BAD_FILE: " << path << std::endl;
+            return;
+        }
+        for (uint32_t i = 0; i < header->entries; i++)
+        {
+            const TpackEntry& stored = entries[i];
+            if (at + stored.nameLength > file.Size || stored.layer >= header->pages)
+            {
+                std::cout << "ERROR::TEXTURE_ARRAY::BAD_FILE: " << path << std::endl;
+                Entries.clear();
+                return;
+            }
+            PackedTexture entry;
+            entry.Name.assign((const char*)file.Data + at, stored.nameLength);
+            at += stored.nameLength;
+            entry.Layer = stored.layer;
+            entry.X = stored.x;
+            entry.Y = stored.y;
+            entry.Width = stored.width;
+            entry.Height = stored.height;
+            entry.Rect = glm::vec4((float)entry.X, (float)entry.Y, (float)entry.Width, (float)entry.Height) / (float)PageSize;
+            Entries.push_back(entry);
+        }
+        const TpackPage* pages = (const TpackPage*)(file.Data + at);
+        if (at + header->pages * sizeof(TpackPage) > file.Size)
+        {
+            std::cout << "ERROR::TEXTURE_ARRAY::BAD_FILE: " << path << std::endl;
+            Entries.clear();
+            return;
+        }
+
+        create(header->pages, header->padding);
+        std::vector<unsigned char> texels((size_t)PageSize * PageSize * 4);
+        for (uint32_t i = 0; i < header->pages; i++)
+        {
+            const TpackPage& page = pages[i];
+            uint32_t storedSize = page.storedSize & ~TPACK_PAGE_RAW;
+            bool ok = page.offset + storedSize <= file.Size;
+            if (ok && (page.storedSize & TPACK_PAGE_RAW))
+            {
+                ok = storedSize == texels.size();
+                if (ok)
+                    memcpy(texels.data(), file.Data + page.offset, texels.size());
+            }
+            else if (ok)
+                ok = Lz4Decompress(file.Data + page.offset, (int)storedSize, texels.data(), (int)texels.size()) == (int)texels.size();
+            if (!ok)
+            {
+                std::cout << "ERROR::TEXTURE_ARRAY::BAD_PAGE: " << path << " layer " << i << std::endl;
+                continue;
+            }
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, PageSize, PageSize, 1, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+        }
+        finish();
+        std::cout << "Texture array " << path << ": " << Entries.size() << " textures in " << Layers << " layers of " << PageSize << "x" << PageSize
+                  << " (" << (uint64_t)PageSize * PageSize * 4 * Layers * 4 / 3 / (1024 * 1024) << " MB with mips)" << std::endl;
+    }
+
+    TextureArray(const TextureArray&) = delete;
+    TextureArray& operator=(const TextureArray&) = delete;
+
+    bool IsValid() const { return ID != 0; }
+
+    // NULL when nothing of that name was packed
+    const PackedTexture* Find(const std::string& name) const
+    {
+        for (const PackedTexture& entry : Entries)
+        {
+            if (entry.Name == name)
+                return &entry;
+        }
+        return NULL;
+    }
+
+    void Bind(Shader& shader, int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("textureArray", unit);
+    }
+
+private:
+    void create(int layers, int padding)
+    {
+        Layers = layers;
+        glGenTextures(1, &ID);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+        // mips stop where the padding runs out, one texel of it left at the last level
+        int maxLevel = 0;
+        while ((2 << maxLevel) <= padding && (PageSize >> (maxLevel + 1)) > 0)
+            maxLevel++;
+        for (int level = 0; level <= maxLevel; level++)
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, PageSize >> level, PageSize >> level, Layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, maxLevel);
+        // unfiltered, as the materials are on their own textures; the mips are there for a
+        // mipmapped filter
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    void finish()
+    {
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+};
+
+#endif
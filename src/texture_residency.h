@@ -0,0 +1,136 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include "texture_streamer.h"
+
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+// Residency since startup
+struct ResidencyStats
+{
+    uint64_t ResidentBytes = 0;     // after the last Update
+    uint64_t PeakResidentBytes = 0;
+    int Evictions = 0;              // top mips and whole textures dropped
+    int TextureEvictions = 0;       // times a texture was dropped completely
+    uint64_t EvictedBytes = 0;
+    int Reloads = 0;                // textures decoded again to bring evicted levels back
+};
+
+// Keeps the textures of a TextureStreamer within a byte budget. Textures are touched when they are
+// drawn; once resident bytes go over the budget, the least recently used texture gives up its top
+// mip, then the next one, down to its mip tail and finally the whole texture. Textures drawn this
+// frame are only ever cut back to their tail, and only when nothing older is left. Evicted levels
+// of a texture that is drawn again stream back in through the streamer, one level per frame while
+// the budget has room for them
+class TextureResidency
+{
+public:
+    ResidencyStats Stats;
+    uint64_t Budget;
+
+    // has to be created before the streamer loads anything
+    TextureResidency(TextureStreamer& streamer, uint64_t budget)
+        : Budget(budget), streamer(streamer)
+    {
+        streamer.ImmutableStorage = false;
+    }
+
+    // marks a texture as drawn this frame; one that was evicted completely starts loading again
+    void Touch(StreamedTexture* texture)
+    {
+        texture->LastUsedFrame = frame;
+        if (texture->Levels > 0 && texture->MinLevel >= texture->Levels)
+        {
+            texture->MinLevel = texture->TailLevel;
+            if (streamer.Reload(*texture))
+                Stats.Reloads++;
+        }
+    }
+
+    // call once per frame after drawing
+    void Update()
+    {
+        std::vector<StreamedTexture*> textures = streamer.Textures();
+        uint64_t resident = 0;
+        for (StreamedTexture* texture : textures)
+            resident += texture->ResidentBytes;
+
+        if (resident > Budget)
+        {
+            // least recently used first, the bigger texture first among equals
+            std::vector<StreamedTexture*> lru;
+            for (StreamedTexture* texture : textures)
+            {
+                if (texture->Resident())
+                    lru.push_back(texture);
+            }
+            std::sort(lru.begin(), lru.end(), [](const StreamedTexture* a, const StreamedTexture* b)
+            {
+                return a->LastUsedFrame != b->LastUsedFrame ? a->LastUsedFrame < b->LastUsedFrame : a->ResidentBytes > b->ResidentBytes;
+            });
+            for (size_t i = 0; i < lru.size() && resident > Budget; i++)
+            {
+                StreamedTexture& texture = *lru[i];
+                bool used = texture.LastUsedFrame == frame;
+                while (resident > Budget && texture.Resident())
+                {
+                    int level = texture.ResidentLevel + 1;
+                    if (texture.ResidentLevel >= texture.TailLevel)
+                    {
+                        if (used)
+                            break;
+                        level = texture.Levels;
+                        Stats.TextureEvictions++;
+                    }
+                    uint64_t freed = streamer.Evict(texture, level);
+                    resident -= freed;
+                    Stats.EvictedBytes += freed;
+                    Stats.Evictions++;
+                }
+            }
+        }
+
+        // textures drawn this frame that were cut back get one level back per frame, as long as
+        // it fits once the textures that were not drawn give up what they hold
+        uint64_t reclaimable = 0;
+        for (StreamedTexture* texture : textures)
+        {
+            if (texture->LastUsedFrame != frame)
+                reclaimable += texture->ResidentBytes;
+        }
+        for (StreamedTexture* texture : textures)
+        {
+            if (texture->LastUsedFrame != frame || !texture->Resident() || texture->MinLevel == 0 || texture->ResidentLevel > texture->MinLevel)
+                continue;
+            uint64_t size = texture->LevelBytes(texture->MinLevel - 1);
+            if (resident + size > Budget + reclaimable)
+                continue;
+            texture->MinLevel--;
+            resident += size;
+            if (streamer.Reload(*texture))
+                Stats.Reloads++;
+        }
+
+        Stats.ResidentBytes = 0;
+        for (StreamedTexture* texture : textures)
+            Stats.ResidentBytes += texture->ResidentBytes;
+        Stats.PeakResidentBytes = std::max(Stats.PeakResidentBytes, Stats.ResidentBytes);
+        frame++;
+    }
+
+    void PrintStats(const char* label) const
+    {
+        std::cout << label << ": " << Stats.ResidentBytes / 1024 << " KB resident (peak " << Stats.PeakResidentBytes / 1024 << " KB, budget "
+                  << Budget / 1024 << " KB), " << Stats.Evictions << " evictions (" << Stats.TextureEvictions << " whole textures, "
+                  << Stats.EvictedBytes / 1024 << " KB), " << Stats.Reloads << " reloads" << std::endl;
+    }
+
+private:
+    TextureStreamer& streamer;
+    uint64_t frame = 1;
+};
+
+#endif
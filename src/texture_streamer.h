@@ -0,0 +1,440 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "vfs.h"
+#include "job_pool.h"
+#include "camera.h"
+#include "stb_image.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+// ARB_texture_storage (core in 4.2) is not part of the 3.3 core glad build, so it is loaded by hand
+typedef void (APIENTRYP PFNGLTEXSTORAGE2DPROC)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+
+// Upload traffic of the streamer, reset at the start of every Update
+struct StreamStats
+{
+    uint64_t FrameBytes = 0;        // uploaded by the last Update
+    int FrameLevels = 0;
+    uint64_t PeakFrameBytes = 0;
+    uint64_t TotalBytes = 0;
+    int StreamingFrames = 0;        // frames that uploaded anything
+};
+
+// A texture that becomes usable as soon as its smallest mips are on the GPU. ID is valid right
+// away; until the first pixel lands it samples as incomplete (black)
+struct StreamedTexture
+{
+    unsigned int ID = 0;
+    std::string Path;
+    int Width = 0;
+    int Height = 0;
+    int Levels = 0;
+    int Channels = 0;
+    int ResidentLevel = 0;          // finest level on the GPU (GL_TEXTURE_BASE_LEVEL), Levels while nothing is
+    int MinLevel = 0;               // finest level the streamer may upload, raised by eviction; Levels for none
+    int TailLevel = 0;              // finest level of the mip tail, which always goes up in one piece
+    uint64_t ResidentBytes = 0;     // GPU storage held by the texture, as uploaded (drivers may pad RGB)
+    uint64_t LastUsedFrame = 0;     // set by TextureResidency::Touch
+    glm::vec3 Center;               // world-space bounds of what the texture is drawn on, for priority
+    float Radius = 1.0f;
+    double FirstPixelMs = -1.0;     // from Load to the mip tail being uploaded
+    double FullResolutionMs = -1.0;
+    bool Failed = false;
+
+    bool FullyResident() const { return Levels > 0 && ResidentLevel == 0; }
+    bool Resident() const { return Levels > 0 && ResidentLevel < Levels; }
+    uint64_t LevelBytes(int level) const { return (uint64_t)std::max(1, Width >> level) * std::max(1, Height >> level) * Channels; }
+};
+
+// Streams textures in mip tail first: every level up to tailSize is uploaded the frame the image
+// finishes decoding, then one finer level at a time under a per-frame byte budget. Which texture
+// gets the next level follows how large it is on screen from the current camera, so whatever is
+// close sharpens first. Decoding and mip generation run on the JobPool; all GL calls stay on the
+// thread calling Update
+class TextureStreamer
+{
+public:
+    StreamStats Stats;
+    uint64_t FrameBudget;           // bytes per Update, at least one level always goes through
+    int TailSize;                   // levels at or below this many texels on a side make up the first upload
+    // immutable storage cannot give back single levels, so TextureResidency turns this off before
+    // any Load; levels are then defined as they stream in and freed again by Evict
+    bool ImmutableStorage = true;
+
+    explicit TextureStreamer(uint64_t frameBudget = 4 * 1024 * 1024, int tailSize = 64)
+        : FrameBudget(frameBudget), TailSize(tailSize)
+    {
+    }
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // uses glTexStorage2D for immutable storage when the driver has it, otherwise every level is
+    // allocated up front with glTexImage2D
+    static void LoadTextureStorage(GLADloadproc load)
+    {
+        int count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (int i = 0; i < count; i++)
+        {
+            if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_texture_storage") == 0)
+            {
+                texStorage2D = (PFNGLTEXSTORAGE2DPROC)load("glTexStorage2D");
+                return;
+            }
+        }
+    }
+
+    // starts loading path and returns its texture straight away. center/radius bound the geometry
+    // it is drawn on. Sampler state (wrap, filters) can be set on ID immediately
+    StreamedTexture* Load(const std::string& path, glm::vec3 center, float radius)
+    {
+        Entry entry;
+        entry.texture = std::make_unique<StreamedTexture>();
+        entry.texture->Path = path;
+        entry.texture->Center = center;
+        entry.texture->Radius = radius;
+        glGenTextures(1, &entry.texture->ID);
+        entry.start = std::chrono::steady_clock::now();
+        startDecode(entry);
+        entries.push_back(std::move(entry));
+        return entries.back().texture.get();
+    }
+
+    // decodes a texture again after Evict dropped the levels it needs; they then stream back in
+    // like on the first load, down to its MinLevel. Returns false if its mips are still in memory
+    bool Reload(StreamedTexture& texture)
+    {
+        Entry* entry = find(texture);
+        if (!entry || texture.Failed || !entry->decoded->done.load(std::memory_order_acquire) || !entry->decoded->mips.empty())
+            return false;
+        startDecode(*entry);
+        return true;
+    }
+
+    // frees every level finer than level (all of them when level is Levels) and returns the bytes
+    // given back. The decoded mips are kept for a partial eviction, so the levels can come back
+    // without another decode while they last; a whole texture drops them too
+    uint64_t Evict(StreamedTexture& texture, int level)
+    {
+        Entry* entry = find(texture);
+        if (!entry || ImmutableStorage || !texture.Resident() || level <= texture.ResidentLevel)
+            return 0;
+        level = std::min(level, texture.Levels);
+        uint64_t freed = 0;
+        glBindTexture(GL_TEXTURE_2D, texture.ID);
+        for (int i = texture.ResidentLevel; i < level; i++)
+        {
+            glTexImage2D(GL_TEXTURE_2D, i, internalFormat(texture.Channels), 0, 0, 0, format(texture.Channels), GL_UNSIGNED_BYTE, NULL);
+            freed += texture.LevelBytes(i);
+        }
+        texture.ResidentLevel = level;
+        texture.MinLevel = std::max(texture.MinLevel, level);
+        texture.ResidentBytes -= freed;
+        if (level < texture.Levels)
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        else if (entry->decoded->done.load(std::memory_order_acquire))
+        {
+            entry->decoded->mips.clear();
+            entry->decoded->mips.shrink_to_fit();
+        }
+        return freed;
+    }
+
+    std::vector<StreamedTexture*> Textures() const
+    {
+        std::vector<StreamedTexture*> textures;
+        for (const Entry& entry : entries)
+            textures.push_back(entry.texture.get());
+        return textures;
+    }
+
+    // true once nothing is left to stream: every texture is down to its MinLevel (or failed)
+    bool Idle() const
+    {
+        for (const Entry& entry : entries)
+        {
+            const StreamedTexture& texture = *entry.texture;
+            if (!texture.Failed && (texture.Levels == 0 || texture.ResidentLevel > texture.MinLevel))
+                return false;
+        }
+        return true;
+    }
+
+    // call once per frame before drawing. viewportHeight is in pixels
+    void Update(const Camera& camera, float viewportHeight)
+    {
+        Stats.FrameBytes = 0;
+        Stats.FrameLevels = 0;
+        GLint alignment = 4;
+        bool uploaded = false;
+        auto beginUpload = [&]()
+        {
+            if (uploaded)
+                return;
+            uploaded = true;
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);                                  // rows of RGB mips are not 4 byte aligned
+        };
+
+        // the tail of anything that finished decoding goes up regardless of the budget, so every
+        // texture shows something the frame after it is decoded
+        for (Entry& entry : entries)
+        {
+            StreamedTexture& texture = *entry.texture;
+            if (texture.Resident() || texture.Failed || !entry.decoded->done.load(std::memory_order_acquire) ||
+                (texture.Levels > 0 && texture.MinLevel >= texture.Levels))
+                continue;
+            if (entry.decoded->mips.empty())
+            {
+                if (texture.Levels == 0)
+                {
+                    texture.Failed = true;
+                    std::cout << "ERROR::TEXTURE_STREAMER::LOAD_FAILED: " << texture.Path << std::endl;
+                }
+                continue;
+            }
+            beginUpload();
+            if (texture.Levels == 0)
+                allocate(entry);
+            for (int level = texture.Levels - 1; level >= texture.TailLevel; level--)
+                uploadLevel(entry, level);
+            if (texture.FirstPixelMs < 0.0)
+            {
+                texture.FirstPixelMs = elapsedMs(entry);
+                std::cout << "Streaming " << texture.Path << " (" << texture.Width << "x" << texture.Height << "): first pixel after "
+                          << texture.FirstPixelMs << " ms" << std::endl;
+            }
+        }
+
+        // then finer levels, biggest on screen relative to its next level first, until the budget is spent
+        float pixelsPerUnit = viewportHeight / (2.0f * tanf(glm::radians(camera.Zoom) * 0.5f));
+        while (true)
+        {
+            Entry* best = NULL;
+            float bestPriority = 0.0f;
+            for (Entry& entry : entries)
+            {
+                const StreamedTexture& texture = *entry.texture;
+                // a reload may still be decoding into mips
+                if (!texture.Resident() || texture.ResidentLevel <= texture.MinLevel || !entry.decoded->done.load(std::memory_order_acquire) ||
+                    entry.decoded->mips.empty())
+                    continue;
+                float distance = std::max((float)glm::length(glm::dvec3(texture.Center) - camera.Position), 0.1f);
+                float screenSize = 2.0f * texture.Radius / distance * pixelsPerUnit;
+                int next = texture.ResidentLevel - 1;
+                float priority = screenSize / (float)std::max(levelWidth(texture, next), levelHeight(texture, next));
+                if (!best || priority > bestPriority)
+                {
+                    best = &entry;
+                    bestPriority = priority;
+                }
+            }
+            if (!best)
+                break;
+            uint64_t size = best->decoded->mips[best->texture->ResidentLevel - 1].size();
+            if (Stats.FrameLevels > 0 && Stats.FrameBytes + size > FrameBudget)
+                break;
+            beginUpload();
+            uploadLevel(*best, best->texture->ResidentLevel - 1);
+            if (best->texture->FullyResident())
+            {
+                best->decoded->mips.clear();                                        // nothing left to stream
+                best->decoded->mips.shrink_to_fit();
+                if (best->texture->FullResolutionMs < 0.0)
+                {
+                    best->texture->FullResolutionMs = elapsedMs(*best);
+                    std::cout << "Streaming " << best->texture->Path << ": full resolution after " << best->texture->FullResolutionMs << " ms" << std::endl;
+                }
+            }
+        }
+
+        if (uploaded)
+        {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+            Stats.StreamingFrames++;
+            Stats.PeakFrameBytes = std::max(Stats.PeakFrameBytes, Stats.FrameBytes);
+        }
+    }
+
+    void PrintStats(const char* label) const
+    {
+        std::cout << label << ": " << Stats.TotalBytes / 1024 << " KB over " << Stats.StreamingFrames << " frames, peak "
+                  << Stats.PeakFrameBytes / 1024 << " KB/frame (budget " << FrameBudget / 1024 << " KB)" << std::endl;
+    }
+
+private:
+    // CPU side of a texture: every mip level, finest first, filled in by a JobPool worker
+    struct Decoded
+    {
+        std::atomic<bool> done{ false };
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        std::vector<std::vector<unsigned char>> mips;
+    };
+
+    struct Entry
+    {
+        std::unique_ptr<StreamedTexture> texture;
+        std::shared_ptr<Decoded> decoded;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    std::vector<Entry> entries;
+    inline static PFNGLTEXSTORAGE2DPROC texStorage2D = NULL;
+
+    static int levelWidth(const StreamedTexture& texture, int level) { return std::max(1, texture.Width >> level); }
+    static int levelHeight(const StreamedTexture& texture, int level) { return std::max(1, texture.Height >> level); }
+
+    Entry* find(const StreamedTexture& texture)
+    {
+        for (Entry& entry : entries)
+        {
+            if (entry.texture.get() == &texture)
+                return &entry;
+        }
+        return NULL;
+    }
+
+    // the bytes are read here (mapped archive or one small file) and decoded on a worker; a
+    // fresh Decoded each time so a job still running for an older one never races the new one
+    void startDecode(Entry& entry)
+    {
+        entry.decoded = std::make_shared<Decoded>();
+        std::shared_ptr<VfsFile> file = std::make_shared<VfsFile>(Vfs::Instance().Read(entry.texture->Path));
+        std::shared_ptr<Decoded> decoded = entry.decoded;
+        JobPool::Instance().Submit([file, decoded]()
+        {
+            if (*file)
+                decode(*file, *decoded);
+            decoded->done.store(true, std::memory_order_release);
+        });
+    }
+
+    static double elapsedMs(const Entry& entry)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - entry.start).count();
+    }
+
+    static GLenum format(int channels)
+    {
+        return channels == 1 ? GL_RED : channels == 2 ? GL_RG : channels == 3 ? GL_RGB : GL_RGBA;
+    }
+
+    static GLenum internalFormat(int channels)
+    {
+        return channels == 1 ? GL_R8 : channels == 2 ? GL_RG8 : channels == 3 ? GL_RGB8 : GL_RGBA8;
+    }
+
+    // decodes the image and builds its whole mip chain with a 2x2 box filter
+    static void decode(const VfsFile& file, Decoded& decoded)
+    {
+        int width, height, channels;
+        unsigned char* pixels = stbi_load_from_memory(file.Data, (int)file.Size, &width, &height, &channels, 0);
+        if (!pixels)
+            return;
+        decoded.width = width;
+        decoded.height = height;
+        decoded.channels = channels;
+        decoded.mips.emplace_back(pixels, pixels + (size_t)width * height * channels);
+        stbi_image_free(pixels);
+
+        while (width > 1 || height > 1)
+        {
+            const std::vector<unsigned char>& source = decoded.mips.back();
+            int nextWidth = std::max(1, width / 2);
+            int nextHeight = std::max(1, height / 2);
+            std::vector<unsigned char> mip((size_t)nextWidth * nextHeight * channels);
+            for (int y = 0; y < nextHeight; y++)
+            {
+                int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+                for (int x = 0; x < nextWidth; x++)
+                {
+                    int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                    for (int c = 0; c < channels; c++)
+                    {
+                        int sum = source[((size_t)y0 * width + x0) * channels + c] + source[((size_t)y0 * width + x1) * channels + c] +
+                                  source[((size_t)y1 * width + x0) * channels + c] + source[((size_t)y1 * width + x1) * channels + c];
+                        mip[((size_t)y * nextWidth + x) * channels + c] = (unsigned char)((sum + 2) / 4);
+                    }
+                }
+            }
+            decoded.mips.push_back(std::move(mip));
+            width = nextWidth;
+            height = nextHeight;
+        }
+    }
+
+    // with ImmutableStorage every level is allocated once, so streaming in a level never
+    // reallocates; otherwise each level is defined by its own upload
+    void allocate(Entry& entry)
+    {
+        StreamedTexture& texture = *entry.texture;
+        const Decoded& decoded = *entry.decoded;
+        texture.Width = decoded.width;
+        texture.Height = decoded.height;
+        texture.Levels = (int)decoded.mips.size();
+        texture.ResidentLevel = texture.Levels;
+        texture.TailLevel = texture.Levels - 1;
+        while (texture.TailLevel > 0 && std::max(levelWidth(texture, texture.TailLevel - 1), levelHeight(texture, texture.TailLevel - 1)) <= TailSize)
+            texture.TailLevel--;
+        texture.Channels = decoded.channels;
+        glBindTexture(GL_TEXTURE_2D, texture.ID);
+        if (ImmutableStorage)
+        {
+            if (texStorage2D)
+                texStorage2D(GL_TEXTURE_2D, texture.Levels, internalFormat(decoded.channels), texture.Width, texture.Height);
+            else
+            {
+                for (int level = 0; level < texture.Levels; level++)
+                    glTexImage2D(GL_TEXTURE_2D, level, internalFormat(decoded.channels), levelWidth(texture, level), levelHeight(texture, level), 0,
+                                 format(decoded.channels), GL_UNSIGNED_BYTE, NULL);
+            }
+            for (int level = 0; level < texture.Levels; level++)
+                texture.ResidentBytes += texture.LevelBytes(level);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.Levels - 1);
+    }
+
+    // uploads one level and moves the base level down to it. The base level alone keeps sampling
+    // off levels that hold no data yet and the texture complete; MIN_LOD is relative to the base
+    // level, so it stays at its default
+    void uploadLevel(Entry& entry, int level)
+    {
+        StreamedTexture& texture = *entry.texture;
+        const std::vector<unsigned char>& pixels = entry.decoded->mips[level];
+        glBindTexture(GL_TEXTURE_2D, texture.ID);
+        if (ImmutableStorage)
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelWidth(texture, level), levelHeight(texture, level),
+                            format(texture.Channels), GL_UNSIGNED_BYTE, pixels.data());
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, internalFormat(texture.Channels), levelWidth(texture, level), levelHeight(texture, level), 0,
+                         format(texture.Channels), GL_UNSIGNED_BYTE, pixels.data());
+            texture.ResidentBytes += pixels.size();
+        }
+        if (level < texture.ResidentLevel)
+        {
+            texture.ResidentLevel = level;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        }
+        Stats.FrameBytes += pixels.size();
+        Stats.FrameLevels++;
+        Stats.TotalBytes += pixels.size();
+    }
+};
+
+#endif
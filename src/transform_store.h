@@ -0,0 +1,383 @@
+#ifndef TRANSFORM_STORE_H
+#define TRANSFORM_STORE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TRANSFORM_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// the AVX2 kernel is compiled for AVX2/FMA on its own and only called when the CPU has them, so
+// the rest of the build needs no extra compiler flags
+#if defined(TRANSFORM_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TRANSFORM_AVX2_TARGET __attribute__((target("avx2,fma")))
+#else
+#define TRANSFORM_AVX2_TARGET
+#endif
+
+// Code path Compose* runs on. SSE is the x86-64 baseline, AVX2 is picked when the CPU has it
+enum Transform_Simd {
+    TRANSFORM_SCALAR,
+    TRANSFORM_SSE,
+    TRANSFORM_AVX2
+};
+
+// Positions, rotations and scales of many objects kept as structure of arrays, one array per
+// component, so model matrices (translate * rotate * scale) and model-view-projection matrices
+// can be built 8 objects at a time with AVX2 or 4 at a time with SSE. The matrices are written
+// column major exactly like glm::mat4, straight into whatever memory is passed, which is meant to
+// be a mapped instance buffer (see Upload)
+class TransformStore
+{
+public:
+    Transform_Simd Path;
+
+    TransformStore()
+        : Path(BestSimd())
+    {
+    }
+
+    static Transform_Simd BestSimd()
+    {
+#ifdef TRANSFORM_SIMD_X86
+#if defined(__GNUC__) || defined(__clang__)
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return TRANSFORM_AVX2;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            bool avx2 = (info[1] & (1 << 5)) != 0;
+            __cpuid(info, 1);
+            bool fma = (info[2] & (1 << 12)) != 0, osxsave = (info[2] & (1 << 27)) != 0;
+            if (avx2 && fma && osxsave && (_xgetbv(0) & 6) == 6)
+                return TRANSFORM_AVX2;
+        }
+#endif
+        return TRANSFORM_SSE;
+#else
+        return TRANSFORM_SCALAR;
+#endif
+    }
+
+    static const char* SimdName(Transform_Simd path)
+    {
+        return path == TRANSFORM_AVX2 ? "AVX2" : path == TRANSFORM_SSE ? "SSE" : "scalar";
+    }
+
+    size_t Count() const { return posX.size(); }
+
+    void Reserve(size_t count)
+    {
+        for (std::vector<float>* component : components())
+            component->reserve(count);
+    }
+
+    // returns the index of the new transform
+    size_t Add(const glm::vec3& position, const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f))
+    {
+        for (std::vector<float>* component : components())
+            component->push_back(0.0f);
+        size_t index = Count() - 1;
+        SetPosition(index, position);
+        SetRotation(index, rotation);
+        SetScale(index, scale);
+        return index;
+    }
+
+    void SetPosition(size_t i, const glm::vec3& position)
+    {
+        posX[i] = position.x;
+        posY[i] = position.y;
+        posZ[i] = position.z;
+    }
+
+    // stored normalized; the kernels rely on it
+    void SetRotation(size_t i, const glm::quat& rotation)
+    {
+        glm::quat q = glm::normalize(rotation);
+        rotX[i] = q.x;
+        rotY[i] = q.y;
+        rotZ[i] = q.z;
+        rotW[i] = q.w;
+    }
+
+    void SetScale(size_t i, const glm::vec3& scale)
+    {
+        scaleX[i] = scale.x;
+        scaleY[i] = scale.y;
+        scaleZ[i] = scale.z;
+    }
+
+    glm::vec3 Position(size_t i) const { return glm::vec3(posX[i], posY[i], posZ[i]); }
+    glm::quat Rotation(size_t i) const { return glm::quat(rotW[i], rotX[i], rotY[i], rotZ[i]); }
+    glm::vec3 Scale(size_t i) const { return glm::vec3(scaleX[i], scaleY[i], scaleZ[i]); }
+
+    // model matrices of transforms [first, first + count) into out[0, count)
+    void ComposeWorld(glm::mat4* out, size_t first = 0, size_t count = SIZE_MAX) const
+    {
+        compose(NULL, out, first, count);
+    }
+
+    // viewProjection * model of transforms [first, first + count) into out[0, count)
+    void ComposeMvp(const glm::mat4& viewProjection, glm::mat4* out, size_t first = 0, size_t count = SIZE_MAX) const
+    {
+        compose(&viewProjection, out, first, count);
+    }
+
+    // composes every transform into an instance buffer, one mat4 per instance, through a write-only
+    // mapping so the matrices go to the driver's memory without a staging copy. The buffer is
+    // reallocated when the count or usage changed; GL_STATIC_DRAW for transforms uploaded once,
+    // GL_DYNAMIC_DRAW for ones uploaded every frame. returns false if the mapping failed
+    bool Upload(unsigned int buffer, GLenum usage = GL_DYNAMIC_DRAW, const glm::mat4* viewProjection = NULL)
+    {
+        GLsizeiptr size = (GLsizeiptr)(Count() * sizeof(glm::mat4));
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (size != uploadedSize || usage != uploadedUsage)
+        {
+            glBufferData(GL_ARRAY_BUFFER, size, NULL, usage);
+            uploadedSize = size;
+            uploadedUsage = usage;
+        }
+        if (size == 0)
+            return true;
+        glm::mat4* mapped = (glm::mat4*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!mapped)
+            return false;
+        compose(viewProjection, mapped, 0, Count());
+        return glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+    }
+
+private:
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> rotX, rotY, rotZ, rotW;
+    std::vector<float> scaleX, scaleY, scaleZ;
+    GLsizeiptr uploadedSize = -1;
+    GLenum uploadedUsage = 0;
+
+    std::array<std::vector<float>*, 10> components()
+    {
+        return { &posX, &posY, &posZ, &rotX, &rotY, &rotZ, &rotW, &scaleX, &scaleY, &scaleZ };
+    }
+
+    void compose(const glm::mat4* viewProjection, glm::mat4* out, size_t first, size_t count) const
+    {
+        if (first >= Count())
+            return;
+        count = std::min(count, Count() - first);
+        float* dst = glm::value_ptr(out[0]);
+        size_t done = 0;
+#ifdef TRANSFORM_SIMD_X86
+        if (Path == TRANSFORM_AVX2)
+            done = composeAvx2(viewProjection, dst, first, count);
+        else if (Path == TRANSFORM_SSE)
+            done = composeSse(viewProjection, dst, first, count);
+#endif
+        for (size_t i = done; i < count; i++)
+            composeScalar(viewProjection, dst + i * 16, first + i);
+    }
+
+    // the rotation part of the model matrix is the quaternion's rotation matrix with its columns
+    // scaled; with a view-projection every output column is a combination of its columns
+    void composeScalar(const glm::mat4* viewProjection, float* m, size_t i) const
+    {
+        float x = rotX[i], y = rotY[i], z = rotZ[i], w = rotW[i];
+        float c0[3] = { (1.0f - 2.0f * (y * y + z * z)) * scaleX[i], 2.0f * (x * y + w * z) * scaleX[i], 2.0f * (x * z - w * y) * scaleX[i] };
+        float c1[3] = { 2.0f * (x * y - w * z) * scaleY[i], (1.0f - 2.0f * (x * x + z * z)) * scaleY[i], 2.0f * (y * z + w * x) * scaleY[i] };
+        float c2[3] = { 2.0f * (x * z + w * y) * scaleZ[i], 2.0f * (y * z - w * x) * scaleZ[i], (1.0f - 2.0f * (x * x + y * y)) * scaleZ[i] };
+        float c3[3] = { posX[i], posY[i], posZ[i] };
+        const float* columns[4] = { c0, c1, c2, c3 };
+        for (int c = 0; c < 4; c++)
+        {
+            const float* column = columns[c];
+            for (int r = 0; r < 4; r++)
+            {
+                if (!viewProjection)
+                    m[c * 4 + r] = r < 3 ? column[r] : (c == 3 ? 1.0f : 0.0f);
+                else
+                {
+                    const glm::mat4& vp = *viewProjection;
+                    m[c * 4 + r] = vp[0][r] * column[0] + vp[1][r] * column[1] + vp[2][r] * column[2] + (c == 3 ? vp[3][r] : 0.0f);
+                }
+            }
+        }
+    }
+
+#ifdef TRANSFORM_SIMD_X86
+    // 8 transforms per iteration. The 16 matrix elements are computed as 16 registers of 8 objects
+    // each, then transposed two 8x8 blocks at a time into 8 consecutive matrices
+    TRANSFORM_AVX2_TARGET size_t composeAvx2(const glm::mat4* viewProjection, float* dst, size_t first, size_t count) const
+    {
+        size_t batches = count / 8;
+        __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f), zero = _mm256_setzero_ps();
+        __m256 vp[16];
+        for (int e = 0; e < 16; e++)
+            vp[e] = _mm256_set1_ps(viewProjection ? glm::value_ptr(*viewProjection)[e] : 0.0f);
+        bool aligned = ((uintptr_t)dst & 31) == 0;
+
+        for (size_t b = 0; b < batches; b++)
+        {
+            size_t i = first + b * 8;
+            __m256 x = _mm256_loadu_ps(&rotX[i]), y = _mm256_loadu_ps(&rotY[i]), z = _mm256_loadu_ps(&rotZ[i]), w = _mm256_loadu_ps(&rotW[i]);
+            __m256 sx = _mm256_loadu_ps(&scaleX[i]), sy = _mm256_loadu_ps(&scaleY[i]), sz = _mm256_loadu_ps(&scaleZ[i]);
+            __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+            __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+            __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+            __m256 m[16];
+            m[0] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), sx);
+            m[1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+            m[2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+            m[4] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+            m[5] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), sy);
+            m[6] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+            m[8] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+            m[9] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+            m[10] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), sz);
+            m[12] = _mm256_loadu_ps(&posX[i]);
+            m[13] = _mm256_loadu_ps(&posY[i]);
+            m[14] = _mm256_loadu_ps(&posZ[i]);
+            m[3] = m[7] = m[11] = zero;
+            m[15] = one;
+
+            if (viewProjection)
+            {
+                __m256 r[16];
+                for (int c = 0; c < 4; c++)
+                {
+                    for (int row = 0; row < 4; row++)
+                    {
+                        __m256 sum = c == 3 ? vp[12 + row] : zero;
+                        sum = _mm256_fmadd_ps(vp[row], m[c * 4], sum);
+                        sum = _mm256_fmadd_ps(vp[4 + row], m[c * 4 + 1], sum);
+                        r[c * 4 + row] = _mm256_fmadd_ps(vp[8 + row], m[c * 4 + 2], sum);
+                    }
+                }
+                for (int e = 0; e < 16; e++)
+                    m[e] = r[e];
+            }
+
+            transpose8(m);
+            transpose8(m + 8);
+            float* batch = dst + b * 8 * 16;
+            for (int o = 0; o < 8; o++)
+            {
+                if (aligned)
+                {
+                    _mm256_stream_ps(batch + o * 16, m[o]);
+                    _mm256_stream_ps(batch + o * 16 + 8, m[8 + o]);
+                }
+                else
+                {
+                    _mm256_storeu_ps(batch + o * 16, m[o]);
+                    _mm256_storeu_ps(batch + o * 16 + 8, m[8 + o]);
+                }
+            }
+        }
+        if (aligned)
+            _mm_sfence();
+        return batches * 8;
+    }
+
+    TRANSFORM_AVX2_TARGET static void transpose8(__m256* r)
+    {
+        __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+        __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+        __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+        __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+        __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+        r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+        r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+        r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+        r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+        r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+        r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+        r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+        r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    }
+
+    // the same with 4 transforms per iteration, without FMA
+    size_t composeSse(const glm::mat4* viewProjection, float* dst, size_t first, size_t count) const
+    {
+        size_t batches = count / 4;
+        __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+        __m128 vp[16];
+        for (int e = 0; e < 16; e++)
+            vp[e] = _mm_set1_ps(viewProjection ? glm::value_ptr(*viewProjection)[e] : 0.0f);
+
+        for (size_t b = 0; b < batches; b++)
+        {
+            size_t i = first + b * 4;
+            __m128 x = _mm_loadu_ps(&rotX[i]), y = _mm_loadu_ps(&rotY[i]), z = _mm_loadu_ps(&rotZ[i]), w = _mm_loadu_ps(&rotW[i]);
+            __m128 sx = _mm_loadu_ps(&scaleX[i]), sy = _mm_loadu_ps(&scaleY[i]), sz = _mm_loadu_ps(&scaleZ[i]);
+            __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+            __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+            __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+            __m128 m[16];
+            m[0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+            m[1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+            m[2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+            m[4] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+            m[5] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+            m[6] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+            m[8] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+            m[9] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+            m[10] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+            m[12] = _mm_loadu_ps(&posX[i]);
+            m[13] = _mm_loadu_ps(&posY[i]);
+            m[14] = _mm_loadu_ps(&posZ[i]);
+            m[3] = m[7] = m[11] = zero;
+            m[15] = one;
+
+            if (viewProjection)
+            {
+                __m128 r[16];
+                for (int c = 0; c < 4; c++)
+                {
+                    for (int row = 0; row < 4; row++)
+                    {
+                        __m128 sum = c == 3 ? vp[12 + row] : zero;
+                        sum = _mm_add_ps(sum, _mm_mul_ps(vp[row], m[c * 4]));
+                        sum = _mm_add_ps(sum, _mm_mul_ps(vp[4 + row], m[c * 4 + 1]));
+                        r[c * 4 + row] = _mm_add_ps(sum, _mm_mul_ps(vp[8 + row], m[c * 4 + 2]));
+                    }
+                }
+                for (int e = 0; e < 16; e++)
+                    m[e] = r[e];
+            }
+
+            // each column of 4 elements is a 4x4 block to transpose
+            float* batch = dst + b * 4 * 16;
+            for (int c = 0; c < 4; c++)
+            {
+                __m128* column = m + c * 4;
+                _MM_TRANSPOSE4_PS(column[0], column[1], column[2], column[3]);
+                for (int o = 0; o < 4; o++)
+                    _mm_storeu_ps(batch + o * 16 + c * 4, column[o]);
+            }
+        }
+        return batches * 4;
+    }
+#endif
+};
+
+#endif
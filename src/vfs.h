@@ -0,0 +1,570 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <atomic>
+#include <functional>
+
+#include "lz4.h"
+#include "job_pool.h"
+#include "async_reader.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Packed asset archive (.pak) layout:
+//   PakHeader
+//   PakEntry[entryCount]       sorted by hash so lookups are a binary search
+//   char names[namesSize]      logical paths, not null terminated
+//   entry data                 each entry starts on a PAK_ALIGNMENT boundary so it can be mapped directly
+//
+// A compressed entry (codec != PAK_CODEC_NONE) is split into blockSize chunks that are compressed
+// independently so they can be decoded in parallel. Its data starts with a uint32 per block giving
+// the stored size of that block (PAK_BLOCK_RAW set if the block was kept uncompressed), followed
+// by the blocks back to back
+const char PAK_MAGIC[4] = { 'P', 'A', 'K', '1' };
+const uint32_t PAK_VERSION = 2;
+const uint64_t PAK_ALIGNMENT = 4096;
+const uint32_t PAK_CODEC_NONE = 0;
+const uint32_t PAK_CODEC_LZ4 = 1;
+const uint32_t PAK_BLOCK_RAW = 0x80000000u;
+
+struct PakHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t namesSize;
+};
+
+struct PakEntry
+{
+    uint64_t hash;          // PakHash of the logical path
+    uint64_t offset;        // from the start of the archive, PAK_ALIGNMENT aligned
+    uint64_t size;          // uncompressed
+    uint64_t storedSize;    // bytes in the archive, including the block table
+    uint32_t nameOffset;    // into the names block
+    uint32_t nameLength;
+    uint32_t codec;
+    uint32_t blockSize;     // uncompressed bytes per block, 0 when not compressed
+};
+
+inline uint32_t PakBlockCount(const PakEntry& entry)
+{
+    return entry.codec == PAK_CODEC_NONE ? 0 : (uint32_t)((entry.size + entry.blockSize - 1) / entry.blockSize);
+}
+
+// FNV-1a over the logical path ("textures/dirt.jpg")
+inline uint64_t PakHash(const std::string& path)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : path)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// File contents handed out by the Vfs. Archive entries point straight into the mapped archive
+// (no copy); loose files own their bytes. Either way Data stays valid while the VfsFile lives
+struct VfsFile
+{
+    const unsigned char* Data = NULL;
+    size_t Size = 0;
+    std::vector<unsigned char> Owned;
+
+    explicit operator bool() const { return Data != NULL; }
+    std::string String() const { return Data ? std::string((const char*)Data, Size) : std::string(); }
+
+    // hands out Owned; an empty file still points Data somewhere so it reads as found
+    void UseOwned()
+    {
+        static const unsigned char empty = 0;
+        Data = Owned.empty() ? &empty : Owned.data();
+        Size = Owned.size();
+    }
+};
+
+// I/O done by the Vfs since startup, to compare the packed archive against loose files
+struct VfsStats
+{
+    int Files = 0;
+    int ArchiveFiles = 0;       // of Files, how many were served from the mapped archive
+    uint64_t Bytes = 0;
+    int Syscalls = 0;           // open/fstat/read/mmap/close calls issued by the Vfs itself, not counted on Windows
+    double Seconds = 0.0;
+    uint64_t DecompressedBytes = 0;
+    double DecompressSeconds = 0.0;     // wall time spent decompressing
+    double DecompressCpuSeconds = 0.0;  // summed over every worker
+};
+
+// Virtual file system over one mounted archive plus an optional override directory. Files in the
+// override directory win over the archive, so during development edited assets are picked up
+// without repacking. Paths are logical and relative to the asset root, e.g. "shaders/fshader.txt"
+class Vfs
+{
+public:
+    VfsStats Stats;
+
+    static Vfs& Instance()
+    {
+        static Vfs vfs;
+        return vfs;
+    }
+
+    ~Vfs()
+    {
+        Unmount();
+    }
+
+    // maps an archive built by pack_assets; returns false if it is missing or invalid
+    bool Mount(const std::string& archivePath)
+    {
+        Unmount();
+        auto start = std::chrono::steady_clock::now();
+        bool mapped = mapArchive(archivePath);
+        Stats.Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!mapped)
+            return false;
+
+        const PakHeader* header = (const PakHeader*)archive;
+        if (archiveSize < sizeof(PakHeader) || memcmp(header->magic, PAK_MAGIC, 4) != 0 || header->version != PAK_VERSION ||
+            archiveSize < sizeof(PakHeader) + header->entryCount * sizeof(PakEntry) + header->namesSize)
+        {
+            std::cout << "ERROR::VFS::BAD_ARCHIVE: " << archivePath << std::endl;
+            Unmount();
+            return false;
+        }
+        entries = (const PakEntry*)(archive + sizeof(PakHeader));
+        entryCount = header->entryCount;
+        names = (const char*)(entries + entryCount);
+        for (uint32_t i = 0; i < entryCount; i++)
+        {
+            if (!validEntry(entries[i], header->namesSize))
+            {
+                std::cout << "ERROR::VFS::BAD_ARCHIVE_ENTRY: " << archivePath << " entry " << i << std::endl;
+                Unmount();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // files under directory take priority over the archive. The directory is listed once here so
+    // lookups for files that only live in the archive never touch the disk
+    void SetOverrideDirectory(const std::string& directory)
+    {
+        overrideDirectory = directory;
+        overrides.clear();
+        std::error_code error;
+        for (auto it = std::filesystem::recursive_directory_iterator(directory, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+        {
+            if (it->is_regular_file(error))
+                overrides.insert(std::filesystem::relative(it->path(), directory, error).generic_string());
+        }
+    }
+
+    // converts a path inside the override directory back to its logical path (used by hot reload)
+    std::string ToLogical(const std::string& diskPath) const
+    {
+        return std::filesystem::path(diskPath).lexically_normal().lexically_relative(std::filesystem::path(overrideDirectory).lexically_normal()).generic_string();
+    }
+
+    bool Exists(const std::string& path) const
+    {
+        return overrides.count(normalize(path)) || find(normalize(path)) != NULL;
+    }
+
+    VfsFile Read(const std::string& path)
+    {
+        std::string logical = normalize(path);
+        auto start = std::chrono::steady_clock::now();
+        VfsFile file;
+        if (overrides.count(logical))
+            readLoose(overrideDirectory + "/" + logical, file);
+        else if (const PakEntry* entry = find(logical))
+            readArchive(*entry, file);
+
+        if (file)
+        {
+            Stats.Files++;
+            Stats.Bytes += file.Size;
+        }
+        else
+            std::cout << "ERROR::VFS::FILE_NOT_FOUND: " << path << std::endl;
+        Stats.Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return file;
+    }
+
+    // loads a batch of files and calls onLoaded(index, file) for each one on a JobPool worker, so
+    // decoding overlaps the remaining reads. Loose files are read together through AsyncReader
+    // (io_uring on Linux) with up to queueDepth in flight; archive entries are already mapped and
+    // go straight to their jobs. Returns once every callback has run; onLoaded must be thread safe
+    void ReadBatch(const std::vector<std::string>& paths, const std::function<void(size_t, VfsFile&)>& onLoaded, unsigned int queueDepth = 64)
+    {
+        auto start = std::chrono::steady_clock::now();
+        AsyncReader reader(queueDepth);
+        std::vector<size_t> archived;
+        std::vector<VfsFile> archivedFiles;
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            std::string logical = normalize(paths[i]);
+            if (overrides.count(logical))
+            {
+                reader.ReadFile(overrideDirectory + "/" + logical, [i, &onLoaded](std::vector<unsigned char>&& data, bool ok)
+                {
+                    VfsFile file;
+                    if (ok)
+                    {
+                        file.Owned = std::move(data);
+                        file.UseOwned();
+                    }
+                    onLoaded(i, file);
+                });
+                continue;
+            }
+            VfsFile file;
+            if (const PakEntry* entry = find(logical))
+            {
+                readArchive(*entry, file);
+                Stats.Files++;
+                Stats.Bytes += file.Size;
+            }
+            else
+                std::cout << "ERROR::VFS::FILE_NOT_FOUND: " << paths[i] << std::endl;
+            archived.push_back(i);
+            archivedFiles.push_back(std::move(file));
+        }
+
+        reader.Flush();
+        JobPool::Instance().ParallelFor((int)archived.size(), [&](int i) { onLoaded(archived[i], archivedFiles[i]); });
+
+        Stats.Files += reader.Stats.Reads;
+        Stats.Bytes += reader.Stats.Bytes;
+        Stats.Syscalls += reader.Stats.Syscalls;
+        Stats.Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // reads size bytes at offset without the rest of the file: uncompressed archive entries point
+    // into the mapping, compressed ones decode only the blocks the range touches and loose files
+    // are read with pread. Fails (returns an empty VfsFile) if the range runs past the end
+    VfsFile ReadRange(const std::string& path, uint64_t offset, size_t size)
+    {
+        std::string logical = normalize(path);
+        auto start = std::chrono::steady_clock::now();
+        VfsFile file;
+        if (overrides.count(logical))
+            readLooseRange(overrideDirectory + "/" + logical, offset, size, file);
+        else if (const PakEntry* entry = find(logical))
+        {
+            if (offset <= entry->size && size <= entry->size - offset)
+            {
+                if (entry->codec == PAK_CODEC_NONE)
+                {
+                    file.Data = archive + entry->offset + offset;
+                    file.Size = size;
+                }
+                else if (size == 0)
+                    file.UseOwned();
+                else
+                {
+                    uint32_t first = (uint32_t)(offset / entry->blockSize);
+                    uint32_t last = (uint32_t)((offset + size - 1) / entry->blockSize);
+                    std::vector<unsigned char> blocks((size_t)std::min<uint64_t>((uint64_t)(last - first + 1) * entry->blockSize, entry->size - (uint64_t)first * entry->blockSize));
+                    if (decompress(*entry, blocks.data(), first, last - first + 1))
+                    {
+                        const unsigned char* begin = blocks.data() + (offset - (uint64_t)first * entry->blockSize);
+                        file.Owned.assign(begin, begin + size);
+                        file.UseOwned();
+                    }
+                }
+            }
+            Stats.ArchiveFiles++;
+        }
+
+        if (file)
+        {
+            Stats.Files++;
+            Stats.Bytes += file.Size;
+        }
+        else
+            std::cout << "ERROR::VFS::BAD_RANGE: " << path << " " << offset << "+" << size << std::endl;
+        Stats.Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return file;
+    }
+
+    void Unmount()
+    {
+#ifdef _WIN32
+        if (archive)
+            UnmapViewOfFile(archive);
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+        mappingHandle = NULL;
+#else
+        if (archive)
+            munmap((void*)archive, archiveSize);
+#endif
+        archive = NULL;
+        archiveSize = 0;
+        entries = NULL;
+        entryCount = 0;
+    }
+
+    void PrintStats(const char* label) const
+    {
+        std::cout << label << ": " << Stats.Files << " files (" << Stats.ArchiveFiles << " from archive), "
+                  << Stats.Bytes / 1024 << " KB, " << Stats.Seconds * 1000.0 << " ms in I/O, "
+                  << Stats.Syscalls << " syscalls" << std::endl;
+        if (Stats.DecompressedBytes > 0)
+        {
+            std::cout << "  decompressed " << Stats.DecompressedBytes / 1024 << " KB at "
+                      << Stats.DecompressedBytes / (1024.0 * 1024.0) / Stats.DecompressSeconds << " MB/s, "
+                      << Stats.DecompressCpuSeconds * 1000.0 << " ms CPU over " << JobPool::Instance().WorkerCount() + 1 << " threads" << std::endl;
+        }
+    }
+
+private:
+    const unsigned char* archive = NULL;
+    size_t archiveSize = 0;
+    const PakEntry* entries = NULL;
+    uint32_t entryCount = 0;
+    const char* names = NULL;
+    std::string overrideDirectory;
+    std::set<std::string> overrides;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = NULL;
+#endif
+
+    Vfs() {}
+
+    static std::string normalize(const std::string& path)
+    {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+
+    const PakEntry* find(const std::string& logical) const
+    {
+        if (!entries)
+            return NULL;
+        uint64_t hash = PakHash(logical);
+        const PakEntry* end = entries + entryCount;
+        const PakEntry* it = std::lower_bound(entries, end, hash, [](const PakEntry& entry, uint64_t value) { return entry.hash < value; });
+        for (; it != end && it->hash == hash; ++it)
+        {
+            if (it->nameLength == logical.size() && memcmp(names + it->nameOffset, logical.data(), logical.size()) == 0)
+                return it;
+        }
+        return NULL;
+    }
+
+    // whether an entry's name and data lie inside the archive, so a truncated or tampered pak is
+    // turned away at Mount instead of read out of bounds later. Sums are checked as subtractions
+    // so huge offsets can't wrap around
+    bool validEntry(const PakEntry& entry, uint32_t namesSize) const
+    {
+        if (entry.nameOffset > namesSize || entry.nameLength > namesSize - entry.nameOffset)
+            return false;
+        uint64_t stored = entry.codec == PAK_CODEC_NONE ? entry.size : entry.storedSize;
+        if (entry.offset > archiveSize || stored > archiveSize - entry.offset)
+            return false;
+        if (entry.codec == PAK_CODEC_NONE)
+            return true;
+        if (entry.codec != PAK_CODEC_LZ4 || entry.blockSize == 0)
+            return false;
+        return PakBlockCount(entry) <= stored / sizeof(uint32_t);
+    }
+
+    void readArchive(const PakEntry& entry, VfsFile& file)
+    {
+        if (entry.codec == PAK_CODEC_NONE)
+        {
+            file.Data = archive + entry.offset;
+            file.Size = (size_t)entry.size;
+        }
+        else
+        {
+            file.Owned.resize((size_t)entry.size);
+            if (decompress(entry, file.Owned.data()))
+                file.UseOwned();
+        }
+        Stats.ArchiveFiles++;
+    }
+
+    // decodes blocks [first, first + count) of a compressed entry, every block by default, into
+    // destination in parallel on the job pool
+    bool decompress(const PakEntry& entry, unsigned char* destination, uint32_t first = 0, uint32_t count = UINT32_MAX)
+    {
+        uint32_t blockCount = PakBlockCount(entry);
+        first = std::min(first, blockCount);
+        count = std::min(count, blockCount - first);
+        const uint32_t* blockSizes = (const uint32_t*)(archive + entry.offset);
+        std::vector<uint64_t> blockOffsets(blockCount);
+        uint64_t offset = entry.offset + blockCount * sizeof(uint32_t);
+        for (uint32_t i = 0; i < blockCount; i++)
+        {
+            blockOffsets[i] = offset;
+            offset += blockSizes[i] & ~PAK_BLOCK_RAW;
+        }
+        if (offset > entry.offset + entry.storedSize || offset > archiveSize)
+            return false;
+
+        std::atomic<bool> ok{ true };
+        std::atomic<int64_t> cpuNanoseconds{ 0 };
+        auto start = std::chrono::steady_clock::now();
+        JobPool::Instance().ParallelFor((int)count, [&](int local)
+        {
+            auto blockStart = std::chrono::steady_clock::now();
+            uint32_t i = first + (uint32_t)local;
+            uint64_t rawOffset = (uint64_t)i * entry.blockSize;
+            int rawSize = (int)std::min<uint64_t>(entry.blockSize, entry.size - rawOffset);
+            int storedSize = (int)(blockSizes[i] & ~PAK_BLOCK_RAW);
+            const unsigned char* source = archive + blockOffsets[i];
+            unsigned char* target = destination + (uint64_t)local * entry.blockSize;
+            if (blockSizes[i] & PAK_BLOCK_RAW)
+            {
+                if (storedSize == rawSize)
+                    memcpy(target, source, rawSize);
+                else
+                    ok = false;
+            }
+            else if (Lz4Decompress(source, storedSize, target, rawSize) != rawSize)
+                ok = false;
+            cpuNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - blockStart).count();
+        });
+        Stats.DecompressSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Stats.DecompressCpuSeconds += cpuNanoseconds.load() * 1e-9;
+        Stats.DecompressedBytes += std::min<uint64_t>((uint64_t)count * entry.blockSize, entry.size - (uint64_t)first * entry.blockSize);
+        if (!ok)
+            std::cout << "ERROR::VFS::CORRUPT_ENTRY: " << std::string(names + entry.nameOffset, entry.nameLength) << std::endl;
+        return ok;
+    }
+
+    bool mapArchive(const std::string& path)
+    {
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        GetFileSizeEx(fileHandle, &size);
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        archive = mappingHandle ? (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : NULL;
+        archiveSize = (size_t)size.QuadPart;
+        return archive != NULL;
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        Stats.Syscalls++;
+        if (fd < 0)
+            return false;
+        struct stat info;
+        Stats.Syscalls += 2;                                                        // fstat, close
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        Stats.Syscalls++;
+        void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);                                                                  // the mapping keeps the file alive
+        if (mapping == MAP_FAILED)
+            return false;
+        archive = (const unsigned char*)mapping;
+        archiveSize = (size_t)info.st_size;
+        return true;
+#endif
+    }
+
+    void readLoose(const std::string& path, VfsFile& file)
+    {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            return;
+        file.Owned.resize((size_t)in.tellg());
+        in.seekg(0);
+        in.read((char*)file.Owned.data(), file.Owned.size());
+        if (in || file.Owned.empty())
+            file.UseOwned();
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        Stats.Syscalls++;
+        if (fd < 0)
+            return;
+        struct stat info;
+        Stats.Syscalls += 2;                                                        // fstat, close
+        if (fstat(fd, &info) == 0)
+        {
+            file.Owned.resize((size_t)info.st_size);
+            size_t done = 0;
+            while (done < file.Owned.size())
+            {
+                ssize_t got = read(fd, file.Owned.data() + done, file.Owned.size() - done);
+                Stats.Syscalls++;
+                if (got <= 0)
+                    break;
+                done += (size_t)got;
+            }
+            if (done == file.Owned.size())
+                file.UseOwned();
+        }
+        close(fd);
+#endif
+    }
+
+    void readLooseRange(const std::string& path, uint64_t offset, size_t size, VfsFile& file)
+    {
+        file.Owned.resize(size);
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in || offset > (uint64_t)in.tellg() || size > (uint64_t)in.tellg() - offset)
+            return;
+        in.seekg((std::streamoff)offset);
+        in.read((char*)file.Owned.data(), file.Owned.size());
+        if (in || size == 0)
+            file.UseOwned();
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        Stats.Syscalls++;
+        if (fd < 0)
+            return;
+        size_t done = 0;
+        while (done < size)
+        {
+            ssize_t got = pread(fd, file.Owned.data() + done, size - done, (off_t)(offset + done));
+            Stats.Syscalls++;
+            if (got <= 0)
+                break;
+            done += (size_t)got;
+        }
+        if (done == size)
+            file.UseOwned();
+        close(fd);
+        Stats.Syscalls++;
+#endif
+    }
+};
+
+#endif
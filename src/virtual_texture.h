@@ -0,0 +1,561 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "vfs.h"
+#include "lz4.h"
+#include "job_pool.h"
+#include "shader.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+// Tiled virtual texture file (.vtex), written by tools/make_vtex:
+//   VtexHeader
+//   VtexTile[]     one per page, level 0 first, each level row major; identical tiles share data
+//   tile data      (tileSize + 2 * border)^2 RGBA8 texels per tile, LZ4 compressed unless
+//                  VTEX_TILE_RAW is set in storedSize, with a VtexChecksum of the stored bytes in
+//                  its table entry
+// The texture is square with a power of two size. Level L has (size / tileSize) >> L pages on a
+// side, down to a single page covering the whole texture. The border repeats the neighbouring
+// texels so bilinear filtering inside the page cache never reads into another page
+const char VTEX_MAGIC[4] = { 'V', 'T', 'X', '1' };
+const uint32_t VTEX_VERSION = 2;
+const uint32_t VTEX_TILE_RAW = 0x80000000u;
+
+struct VtexHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t size;          // texels on a side at level 0
+    uint32_t tileSize;      // texels on a side of a page, without the border
+    uint32_t border;
+    uint32_t levels;        // page levels
+};
+
+struct VtexTile
+{
+    uint64_t offset;        // from the start of the file
+    uint32_t storedSize;    // VTEX_TILE_RAW set if stored uncompressed
+    uint32_t checksum;      // VtexChecksum of the stored bytes
+};
+
+// 32 bit FNV-1a over a tile's stored bytes
+inline uint32_t VtexChecksum(const unsigned char* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Page traffic since startup
+struct VirtualTextureStats
+{
+    int Requests = 0;           // missing pages handed to the decoders
+    int Uploads = 0;
+    int CorruptPages = 0;       // failed to decode or to match their checksum, left to their parents
+    int Evictions = 0;
+    int ResidentPages = 0;
+    int FramePages = 0;         // distinct pages the last feedback readback saw
+};
+
+// Sparse virtual texture over a .vtex file. Pages live in a fixed-size physical cache texture and
+// an indirection texture (one mip per page level) maps every virtual page to its cache slot, or to
+// the closest coarser page that is resident, so GPU memory does not depend on the virtual size.
+// Each frame the scene is drawn into a small integer feedback target that records the page every
+// pixel wants; the readback goes through a pixel buffer a frame later so it never stalls. Missing
+// pages are decoded on the JobPool, coarsest first, and a few are uploaded per frame, evicting the
+// least recently seen. Only core GL 3.3 is used
+//
+// The shader side lives in shaders/virtual_texture.txt. Only the header and the tile table are
+// read up front; every tile is read by its offset when it is asked for, from the archive or a
+// loose file alike. A tile that fails to decode or to match its checksum is never uploaded, and
+// the page keeps showing the closest coarser one
+class VirtualTexture
+{
+public:
+    VirtualTextureStats Stats;
+    int UploadsPerFrame = 8;
+    int MaxInFlight = 32;       // decode jobs queued on the JobPool at once
+    int FeedbackDivisor = 8;    // feedback target is the framebuffer size divided by this
+
+    // physicalSlots pages on a side in the cache texture
+    VirtualTexture(const std::string& path, int physicalSlots = 16)
+        : path(path), slotsPerSide(physicalSlots), loader(std::make_shared<Loader>())
+    {
+        VfsFile headerData = Vfs::Instance().ReadRange(path, 0, sizeof(VtexHeader));
+        const VtexHeader* header = (const VtexHeader*)headerData.Data;
+        if (!headerData || memcmp(header->magic, VTEX_MAGIC, 4) != 0 || header->version != VTEX_VERSION ||
+            header->levels == 0 || header->tileSize == 0 || (header->size >> (header->levels - 1)) != header->tileSize)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_FILE: " << path << std::endl;
+            return;
+        }
+        size = header->size;
+        tileSize = header->tileSize;
+        border = header->border;
+        levels = header->levels;
+        uint64_t tileCount = 0;
+        for (int level = 0; level < levels; level++)
+        {
+            pageOffsets.push_back(tileCount);
+            tileCount += (uint64_t)pagesAt(level) * pagesAt(level);
+        }
+        VfsFile table = Vfs::Instance().ReadRange(path, sizeof(VtexHeader), (size_t)tileCount * sizeof(VtexTile));
+        if (!table)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_FILE: " << path << std::endl;
+            return;
+        }
+        loader->tiles.assign((const VtexTile*)table.Data, (const VtexTile*)table.Data + tileCount);
+        loader->tileBytes = (size_t)slotSize() * slotSize() * 4;
+        pages.assign(tileCount, Page());
+        slots.assign(slotsPerSide * slotsPerSide, Slot());
+        pageTable.resize(tileCount);
+
+        // the physical cache has no mips: the page table already picks the level
+        glGenTextures(1, &physicalTexture);
+        glBindTexture(GL_TEXTURE_2D, physicalTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, physicalSize(), physicalSize(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // one texel per page: cache slot x, slot y, the level the slot holds, 255
+        glGenTextures(1, &pageTableTexture);
+        glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+        for (int level = 0; level < levels; level++)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, pagesAt(level), pagesAt(level), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+        glGenFramebuffers(1, &feedbackFramebuffer);
+        glGenRenderbuffers(1, &feedbackColor);
+        glGenRenderbuffers(1, &feedbackDepth);
+        glGenBuffers(2, feedbackBuffers);
+
+        // the single page at the coarsest level is loaded up front and never evicted, so every
+        // lookup has something to fall back to
+        int root = pageIndex(levels - 1, 0, 0);
+        requestPage(root);
+        loader->wait(1);
+        valid = true;
+        Update();
+        if (pages[root].slot < 0)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_FILE: " << path << " has no usable root page" << std::endl;
+            valid = false;
+            return;
+        }
+        slots[pages[root].slot].pinned = true;
+
+        std::cout << "Virtual texture " << path << ": " << size << "x" << size << " virtual, " << physicalSize() << "x" << physicalSize()
+                  << " page cache (" << (uint64_t)physicalSize() * physicalSize() * 4 / (1024 * 1024) << " MB), page table "
+                  << tileCount * 4 / 1024 << " KB" << std::endl;
+    }
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    bool IsValid() const { return valid; }
+
+    // binds the page table and the page cache to two texture units and sets the uniforms
+    // shaders/virtual_texture.txt reads
+    void Bind(Shader& shader, int pageTableUnit, int physicalUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+        glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+        glActiveTexture(GL_TEXTURE0 + physicalUnit);
+        glBindTexture(GL_TEXTURE_2D, physicalTexture);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("vtPageTable", pageTableUnit);
+        shader.setInt("vtPhysical", physicalUnit);
+        shader.setVec4("vtParams", (float)size, (float)tileSize, (float)border, (float)levels);
+    }
+
+    // redirects drawing into the feedback target; draw everything that samples this texture with
+    // the feedback shader (FeedbackBias() as its vtFeedbackBias), then call EndFeedback
+    void BeginFeedback(int framebufferWidth, int framebufferHeight)
+    {
+        int width = std::max(1, framebufferWidth / FeedbackDivisor);
+        int height = std::max(1, framebufferHeight / FeedbackDivisor);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        if (width != feedbackWidth || height != feedbackHeight)
+            resizeFeedback(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, feedbackWidth, feedbackHeight);
+        const GLuint clear[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, clear);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // the feedback target is smaller than the screen, so its derivatives are too and the level
+    // has to be pushed back to what the full resolution pass will pick
+    float FeedbackBias() const
+    {
+        return -log2f((float)FeedbackDivisor);
+    }
+
+    void EndFeedback()
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[feedbackFrame % 2]);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        feedbackPending[feedbackFrame % 2] = true;
+        feedbackFrame++;
+    }
+
+    // call once per frame: reads last frame's feedback, queues missing pages, uploads finished ones
+    void Update()
+    {
+        if (!valid)
+            return;
+        frame++;
+        readFeedback();
+        pumpRequests();
+
+        std::vector<Loader::Tile> finished = loader->take(UploadsPerFrame);
+        if (!finished.empty())
+        {
+            glBindTexture(GL_TEXTURE_2D, physicalTexture);
+            for (Loader::Tile& tile : finished)
+                upload(tile);
+        }
+        if (pageTableDirty)
+            rebuildPageTable();
+    }
+
+    void PrintStats(const char* label) const
+    {
+        std::cout << label << ": " << Stats.ResidentPages << "/" << slots.size() << " cache slots, " << Stats.FramePages
+                  << " pages in view, " << Stats.Requests << " requests, " << Stats.Uploads << " uploads, " << Stats.Evictions
+                  << " evictions, " << Stats.CorruptPages << " corrupt pages" << std::endl;
+    }
+
+private:
+    struct Page
+    {
+        int slot = -1;
+        bool pending = false;
+        bool corrupt = false;       // never asked for again
+    };
+
+    struct Slot
+    {
+        int page = -1;              // index into pages
+        uint64_t lastSeen = 0;      // frame the feedback last asked for the page (or a finer one)
+        bool pinned = false;
+    };
+
+    // decode jobs hold on to this, so they can finish after the VirtualTexture is gone
+    struct Loader
+    {
+        struct Tile
+        {
+            int page;
+            bool ok;
+            std::vector<unsigned char> texels;
+        };
+
+        std::vector<VtexTile> tiles;
+        size_t tileBytes = 0;
+        std::mutex mutex;
+        std::condition_variable finishedOne;
+        std::vector<Tile> finished;
+
+        // data is the tile's stored bytes, read by requestPage
+        void decode(int page, const VfsFile& data)
+        {
+            Tile tile;
+            tile.page = page;
+            tile.texels.resize(tileBytes);
+            const VtexTile& entry = tiles[page];
+            uint32_t stored = entry.storedSize & ~VTEX_TILE_RAW;
+            tile.ok = data && data.Size == stored && VtexChecksum(data.Data, data.Size) == entry.checksum;
+            if (tile.ok && (entry.storedSize & VTEX_TILE_RAW))
+            {
+                tile.ok = stored == tileBytes;
+                if (tile.ok)
+                    memcpy(tile.texels.data(), data.Data, tileBytes);
+            }
+            else if (tile.ok)
+                tile.ok = Lz4Decompress(data.Data, (int)stored, tile.texels.data(), (int)tileBytes) == (int)tileBytes;
+            if (!tile.ok)
+            {
+                std::cout << "ERROR::VIRTUAL_TEXTURE::CORRUPT_TILE: " << page << std::endl;
+                tile.texels.clear();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(std::move(tile));
+            finishedOne.notify_all();
+        }
+
+        std::vector<Tile> take(int count)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            count = std::min(count, (int)finished.size());
+            std::vector<Tile> taken(std::make_move_iterator(finished.begin()), std::make_move_iterator(finished.begin() + count));
+            finished.erase(finished.begin(), finished.begin() + count);
+            return taken;
+        }
+
+        void wait(size_t count)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            finishedOne.wait(lock, [&] { return finished.size() >= count; });
+        }
+    };
+
+    // a page the feedback asked for, ordered coarsest first and then by how many pixels want it
+    struct Request
+    {
+        int page;
+        int level;
+        int pixels;
+    };
+
+    bool valid = false;
+    std::string path;
+    int size = 0;
+    int tileSize = 0;
+    int border = 0;
+    int levels = 0;
+    int slotsPerSide;
+    std::vector<uint64_t> pageOffsets;      // first page of every level
+    std::vector<Page> pages;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> pageTable;        // RGBA8 page table texels, laid out like pages
+    bool pageTableDirty = true;
+    std::vector<Request> requests;
+    int inFlight = 0;
+    uint64_t frame = 0;
+    std::shared_ptr<Loader> loader;
+
+    unsigned int physicalTexture = 0;
+    unsigned int pageTableTexture = 0;
+    unsigned int feedbackFramebuffer = 0;
+    unsigned int feedbackColor = 0;
+    unsigned int feedbackDepth = 0;
+    unsigned int feedbackBuffers[2] = { 0, 0 };
+    bool feedbackPending[2] = { false, false };
+    uint64_t feedbackFrame = 0;
+    int feedbackWidth = 0;
+    int feedbackHeight = 0;
+    GLint savedFramebuffer = 0;
+    GLint savedViewport[4] = { 0, 0, 0, 0 };
+
+    int pagesAt(int level) const { return std::max(1, (size / tileSize) >> level); }
+    int slotSize() const { return tileSize + 2 * border; }
+    int physicalSize() const { return slotsPerSide * slotSize(); }
+    int pageIndex(int level, int x, int y) const { return (int)pageOffsets[level] + y * pagesAt(level) + x; }
+
+    void resizeFeedback(int width, int height)
+    {
+        feedbackWidth = width;
+        feedbackHeight = height;
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        for (int i = 0; i < 2; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4 * sizeof(uint16_t), NULL, GL_STREAM_READ);
+            feedbackPending[i] = false;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // maps the readback issued the frame before last's EndFeedback, so the copy has long finished
+    void readFeedback()
+    {
+        int index = feedbackFrame % 2;
+        if (!feedbackPending[index])
+            return;
+        feedbackPending[index] = false;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[index]);
+        const uint16_t* texels = (const uint16_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)feedbackWidth * feedbackHeight * 4 * sizeof(uint16_t), GL_MAP_READ_BIT);
+        if (texels)
+        {
+            std::unordered_map<int, int> pixels;
+            for (int i = 0; i < feedbackWidth * feedbackHeight; i++)
+            {
+                const uint16_t* texel = texels + i * 4;
+                if (texel[3] == 0 || texel[2] >= levels || texel[0] >= pagesAt(texel[2]) || texel[1] >= pagesAt(texel[2]))
+                    continue;                                       // nothing virtual textured under this pixel
+                pixels[pageIndex(texel[2], texel[0], texel[1])]++;
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+            // queued requests that did not reach a decoder yet are replaced by what is in view now
+            for (const Request& request : requests)
+                pages[request.page].pending = false;
+            requests.clear();
+            Stats.FramePages = (int)pixels.size();
+            for (const auto& page : pixels)
+                usePage(page.first, page.second);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // marks a page and every coarser page above it as seen, and requests whichever are missing
+    void usePage(int page, int pixels)
+    {
+        int level = 0;
+        while (level + 1 < levels && (uint64_t)page >= pageOffsets[level + 1])
+            level++;
+        int local = page - (int)pageOffsets[level];
+        int x = local % pagesAt(level);
+        int y = local / pagesAt(level);
+        for (; level < levels; level++, x /= 2, y /= 2)
+        {
+            Page& state = pages[pageIndex(level, x, y)];
+            if (state.slot >= 0)
+                slots[state.slot].lastSeen = frame;
+            else if (!state.pending && !state.corrupt)
+            {
+                requests.push_back({ pageIndex(level, x, y), level, pixels });
+                state.pending = true;
+            }
+        }
+    }
+
+    void requestPage(int page)
+    {
+        pages[page].pending = true;
+        inFlight++;
+        Stats.Requests++;
+        const VtexTile& tile = loader->tiles[page];
+        std::shared_ptr<VfsFile> data = std::make_shared<VfsFile>(Vfs::Instance().ReadRange(path, tile.offset, tile.storedSize & ~VTEX_TILE_RAW));
+        std::shared_ptr<Loader> shared = loader;
+        JobPool::Instance().Submit([shared, page, data]() { shared->decode(page, *data); });
+    }
+
+    // hands queued pages to the decoders, coarsest and most wanted first. No more are decoded
+    // than there are slots to put them in, so a cache full of pages in view does not churn
+    void pumpRequests()
+    {
+        if (requests.empty() || inFlight >= MaxInFlight)
+            return;
+        int freeSlots = 0;
+        for (const Slot& slot : slots)
+        {
+            if (slot.page < 0 || (!slot.pinned && slot.lastSeen < frame))
+                freeSlots++;
+        }
+        std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b)
+        {
+            return a.level != b.level ? a.level > b.level : a.pixels > b.pixels;
+        });
+        size_t submitted = 0;
+        for (; submitted < requests.size() && inFlight < MaxInFlight && inFlight < freeSlots; submitted++)
+            requestPage(requests[submitted].page);
+        requests.erase(requests.begin(), requests.begin() + submitted);
+    }
+
+    // a free slot, or the one seen longest ago; -1 if everything was seen this frame
+    int allocateSlot()
+    {
+        int best = -1;
+        for (int i = 0; i < (int)slots.size(); i++)
+        {
+            const Slot& slot = slots[i];
+            if (slot.page < 0)
+                return i;
+            if (!slot.pinned && slot.lastSeen < frame && (best < 0 || slot.lastSeen < slots[best].lastSeen))
+                best = i;
+        }
+        if (best >= 0)
+        {
+            pages[slots[best].page].slot = -1;
+            slots[best].page = -1;
+            Stats.Evictions++;
+            Stats.ResidentPages--;
+        }
+        return best;
+    }
+
+    void upload(Loader::Tile& tile)
+    {
+        inFlight--;
+        Page& page = pages[tile.page];
+        page.pending = false;
+        if (!tile.ok)
+        {
+            page.corrupt = true;
+            Stats.CorruptPages++;
+            return;
+        }
+        int slot = allocateSlot();
+        if (slot < 0)
+            return;                                                 // the cache is full of pages in view; asked for again next frame
+        int x = slot % slotsPerSide;
+        int y = slot / slotsPerSide;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x * slotSize(), y * slotSize(), slotSize(), slotSize(), GL_RGBA, GL_UNSIGNED_BYTE, tile.texels.data());
+        slots[slot].page = tile.page;
+        slots[slot].lastSeen = frame;
+        page.slot = slot;
+        pageTableDirty = true;
+        Stats.Uploads++;
+        Stats.ResidentPages++;
+    }
+
+    // every page points at its own slot, or inherits the entry of its parent when not resident
+    void rebuildPageTable()
+    {
+        pageTableDirty = false;
+        glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+        for (int level = levels - 1; level >= 0; level--)
+        {
+            int count = pagesAt(level);
+            uint32_t* row = pageTable.data() + pageOffsets[level];
+            for (int y = 0; y < count; y++)
+            {
+                for (int x = 0; x < count; x++)
+                {
+                    const Page& page = pages[pageIndex(level, x, y)];
+                    if (page.slot >= 0)
+                    {
+                        uint32_t slotX = page.slot % slotsPerSide, slotY = page.slot / slotsPerSide;
+                        row[y * count + x] = slotX | slotY << 8 | (uint32_t)level << 16 | 0xFFu << 24;
+                    }
+                    else if (level + 1 < levels)
+                        row[y * count + x] = pageTable[pageIndex(level + 1, x / 2, y / 2)];
+                    else
+                        row[y * count + x] = 0;
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, count, count, GL_RGBA, GL_UNSIGNED_BYTE, row);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef WORLD_ORIGIN_H
+#define WORLD_ORIGIN_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <functional>
+#include <cmath>
+#include <algorithm>
+
+// Large worlds. Positions that have to stay exact tens of kilometres out, like the camera and the
+// places scene objects are anchored, are kept in double. Float data is always relative to
+// something nearby. The float data covers the simulation, the scene graph and the vertex and
+// instance buffers. A float at a million units is only good to 6 cm, which shows up as jitter.
+// For drawing, each model matrix is moved relative to the eye on the CPU in double before it is
+// cast to float (CameraRelative). The GPU then only sees small offsets, however far out the scene
+// is, and nothing has to be re-uploaded when the camera moves
+
+// model, placed relative to the double world position origin, as seen from eye: the eye ends up
+// at zero, which the view matrix of Camera assumes
+inline glm::mat4 CameraRelative(const glm::mat4& model, const glm::dvec3& origin, const glm::dvec3& eye)
+{
+    glm::mat4 relative = model;
+    relative[3] = glm::vec4(glm::vec3(origin - eye + glm::dvec3(glm::vec3(model[3]))), model[3].w);
+    return relative;
+}
+
+inline glm::vec3 CameraRelative(const glm::dvec3& position, const glm::dvec3& eye)
+{
+    return glm::vec3(position - eye);
+}
+
+// Floating origin for the float simulation. Physics and collision work in coordinates relative to
+// Origin. Once the focus (the player) is more than RebaseDistance from it along any axis, Origin
+// jumps to the grid point nearest the focus. Every listener is then told the shift, and must take
+// it off the positions it keeps. Origins are whole multiples of RebaseDistance, a power of two, so
+// the shift is exact in float and rebasing never moves anything by a rounding error. Rebasing is
+// optional: drawing does not depend on it, and without it the simulation just loses precision far
+// from Origin
+class WorldOrigin
+{
+public:
+    typedef std::function<void(const glm::vec3& shift)> Listener;
+
+    glm::dvec3 Origin = glm::dvec3(0.0);
+    double RebaseDistance = 1024.0;
+    bool Enabled = true;
+    int Rebases = 0;
+
+    // called with how far Origin moved whenever it does
+    void OnRebase(Listener listener)
+    {
+        listeners.push_back(std::move(listener));
+    }
+
+    glm::vec3 ToLocal(const glm::dvec3& world) const
+    {
+        return glm::vec3(world - Origin);
+    }
+
+    glm::dvec3 ToWorld(const glm::vec3& local) const
+    {
+        return Origin + glm::dvec3(local);
+    }
+
+    // rebases around focus if it has drifted too far; returns whether it did
+    bool Update(const glm::dvec3& focus)
+    {
+        if (!Enabled)
+            return false;
+        glm::dvec3 offset = glm::abs(focus - Origin);
+        if (std::max(offset.x, std::max(offset.y, offset.z)) <= RebaseDistance)
+            return false;
+        glm::dvec3 next = glm::floor(focus / RebaseDistance + 0.5) * RebaseDistance;
+        glm::vec3 shift = glm::vec3(next - Origin);
+        Origin = next;
+        Rebases++;
+        for (Listener& listener : listeners)
+            listener(shift);
+        return true;
+    }
+
+private:
+    std::vector<Listener> listeners;
+};
+
+#endif
@@ -0,0 +1,54 @@
+// Light to cluster assignment cost against light count, from 1 to 4096 point lights, with the
+// JobPool and on one thread.
+// usage: bench_clusters [max lights] [frames]
+//
+// The lights are scattered over a 20 m square floor the camera looks across from its edge, the
+// way the renderer's scene does with its extra lights, so most of them are in view and they
+// crowd together more the more there are. The time covers what the CPU does each frame: the
+// sphere tests, the count, the prefix sum and the fill; the upload is left out
+#include "../src/light_clusters.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <chrono>
+
+int main(int argc, char** argv)
+{
+    int maxLights = argc > 1 ? atoi(argv[1]) : 4096;
+    int frames = argc > 2 ? atoi(argv[2]) : 200;
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, -0.35f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(80.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+    JobPool single(0);
+
+    std::cout << "16x9x24 clusters, " << frames << " frames per count, " << JobPool::Instance().WorkerCount() + 1 << " threads with the pool" << std::endl;
+    for (int count = 1; count <= maxLights; count *= 2)
+    {
+        LightClusters clusters;
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (int i = 0; i < count; i++)
+        {
+            // camera 3 m above the floor at its near edge
+            glm::vec3 position(unit(random) * 20.0f - 10.0f, unit(random) * 3.0f - 3.0f, -unit(random) * 20.0f);
+            clusters.Lights.push_back({ position, 1.5f + 2.5f * unit(random), glm::vec3(1.0f) });
+        }
+
+        double pooledMs = 0.0, singleMs = 0.0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            clusters.Assign(view, projection, 0.1f, 100.0f);
+            pooledMs += clusters.Stats.Milliseconds;
+            clusters.Assign(view, projection, 0.1f, 100.0f, single);
+            singleMs += clusters.Stats.Milliseconds;
+        }
+        const ClusterStats& stats = clusters.Stats;
+        std::cout << "  " << count << " lights: " << pooledMs / frames << " ms, " << singleMs / frames << " ms on one thread; "
+                  << stats.Lights << " in view, " << stats.References << " references, at most " << stats.MaxPerCluster << " per cluster, "
+                  << clusters.Bytes() / 1024 << " KB to upload" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,158 @@
+// Collision queries per second against a growing number of boxes: swept character moves through
+// the spatial hash, against sweeping every box in the world.
+// usage: bench_collision [max boxes] [queries]
+//
+// The boxes are scattered over a floor that grows with their count, so the crowding around any
+// query stays the same; that is the case the hash is meant to keep flat. Each query is one
+// CharacterController::Move of up to half a metre, the distance of a sprint step at 120 Hz many
+// times over.
+//
+// Then a thousand of the boxes start moving, like the physics crates: each 120 Hz step moves all
+// of them through CollisionWorld::Move and runs a thousand character moves, which should cost
+// the same whatever the size of the world. The hits are checked against sweeping every box
+#include "../src/collision.h"
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <chrono>
+
+int main(int argc, char** argv)
+{
+    int maxBoxes = argc > 1 ? atoi(argv[1]) : 100000;
+    int queries = argc > 2 ? atoi(argv[2]) : 200000;
+
+    // one sweep against every box in the world
+    auto bruteSweep = [](const CollisionWorld& world, const Aabb& body, const glm::vec3& delta)
+    {
+        float earliest = 1.0f, time;
+        glm::vec3 normal;
+        bool hit = false;
+        for (size_t id = 0; id < world.Count(); id++)
+        {
+            if (SweepAabb(body, delta, world.Box((int)id), time, normal) && time <= earliest)
+            {
+                earliest = time;
+                hit = true;
+            }
+        }
+        return hit;
+    };
+
+    bool mismatch = false;
+    for (int count = 1000; count <= maxBoxes; count *= 10)
+    {
+        // about one box per 16 square metres, between 0.5 and 3 metres wide
+        float side = std::sqrt((float)count * 16.0f);
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> coordinate(0.0f, side), size(0.25f, 1.5f), unit(-1.0f, 1.0f);
+        CollisionWorld world;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++)
+        {
+            glm::vec3 center(coordinate(random), size(random), coordinate(random));
+            world.Add(Aabb::FromCenter(center, glm::vec3(size(random), center.y, size(random))));
+        }
+        std::vector<int> nearby;
+        world.Query(Aabb(), nearby);    // builds the table
+        double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // characters at random free spots, each trying a random move
+        CharacterController controller;
+        std::vector<glm::vec3> positions, targets;
+        while ((int)positions.size() < 1000)
+        {
+            glm::vec3 position(coordinate(random), 1.5f, coordinate(random));
+            Aabb body = Aabb::FromCenter(position + controller.Offset, controller.HalfExtents);
+            world.Query(body, nearby);
+            bool free = true;
+            for (int id : nearby)
+                free &= !body.Overlaps(world.Box(id));
+            if (!free)
+                continue;
+            positions.push_back(position);
+            targets.push_back(position + glm::vec3(unit(random), 0.0f, unit(random)) * 0.5f);
+        }
+
+        start = std::chrono::steady_clock::now();
+        int blocked = 0;
+        glm::vec3 sum(0.0f);
+        for (int q = 0; q < queries; q++)
+        {
+            size_t i = q % positions.size();
+            glm::vec3 moved = controller.Move(world, positions[i], targets[i]);
+            blocked += glm::length(moved - targets[i]) > 1e-4f;
+            sum += moved;
+        }
+        double hashSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // the same sweep against every box, on fewer queries so the big worlds finish
+        int bruteQueries = std::max(100, queries / (count / 100));
+        start = std::chrono::steady_clock::now();
+        int bruteHits = 0, hashHits = 0;
+        for (int q = 0; q < bruteQueries; q++)
+        {
+            size_t i = q % positions.size();
+            Aabb body = Aabb::FromCenter(positions[i] + controller.Offset, controller.HalfExtents);
+            glm::vec3 delta = targets[i] - positions[i];
+            float time;
+            glm::vec3 normal;
+            bruteHits += bruteSweep(world, body, delta);
+            hashHits += world.Sweep(body, delta, time, normal);
+        }
+        double bruteSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << count << " boxes (built in " << buildMs << " ms): spatial hash " << queries / hashSeconds / 1e6 << " M moves/s ("
+                  << blocked * 100.0 / queries << "% blocked), every box " << bruteQueries / bruteSeconds / 1e3 << " K sweeps/s, "
+                  << (bruteHits == hashHits ? "same hits" : "HIT MISMATCH") << std::endl;
+        mismatch |= bruteHits != hashHits;
+
+        // the first thousand boxes drift at up to 3 m/s, turning back at the edges of the floor
+        const int MOVING = std::min(1000, count), STEPS = 240;
+        const float STEP_SECONDS = 1.0f / 120.0f;
+        std::vector<glm::vec3> velocities;
+        for (int i = 0; i < MOVING; i++)
+            velocities.push_back(glm::vec3(unit(random), 0.0f, unit(random)) * 3.0f);
+        start = std::chrono::steady_clock::now();
+        for (int step = 0; step < STEPS; step++)
+        {
+            for (int i = 0; i < MOVING; i++)
+            {
+                Aabb box = world.Box(i);
+                glm::vec3 center = box.Center() + velocities[i] * STEP_SECONDS;
+                for (int axis = 0; axis < 3; axis += 2)
+                {
+                    if (center[axis] < 0.0f || center[axis] > side)
+                        velocities[i][axis] = -velocities[i][axis];
+                }
+                world.Move(i, Aabb::FromCenter(center, box.HalfExtents()));
+            }
+            for (size_t i = 0; i < positions.size(); i++)
+                sum += controller.Move(world, positions[i], targets[i]);
+        }
+        double movingMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / STEPS;
+        double staticMs = hashSeconds / queries * positions.size() * 1e3;
+        int movedBrute = 0, movedHash = 0;
+        for (size_t i = 0; i < std::min<size_t>(positions.size(), 200); i++)
+        {
+            Aabb body = Aabb::FromCenter(positions[i] + controller.Offset, controller.HalfExtents);
+            glm::vec3 delta = targets[i] - positions[i];
+            float time;
+            glm::vec3 normal;
+            movedBrute += bruteSweep(world, body, delta);
+            movedHash += world.Sweep(body, delta, time, normal);
+        }
+        std::cout << "  " << MOVING << " moving: " << movingMs << " ms per step for the moves and " << positions.size()
+                  << " character moves, against " << staticMs << " ms for the character moves alone, "
+                  << (movedBrute == movedHash ? "same hits" : "HIT MISMATCH") << std::endl;
+        mismatch |= movedBrute != movedHash;
+        if (sum.x != sum.x)
+            std::cout << "ERROR::BENCH_COLLISION::NAN" << std::endl;
+    }
+    if (mismatch)
+    {
+        std::cout << "ERROR::BENCH_COLLISION::MISMATCH: the spatial hash missed or invented hits" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+// Times component queries over the archetype ECS, serially and over the job pool, against the same
+// work done on one array of objects that carry every field and a flag per feature.
+// usage: bench_ecs [entities] [frames]
+//
+// 40% of the entities move and are drawn, 40% are drawn and static, 20% move and are not drawn.
+// The health query destroys entities through the command buffer, which is played back each frame
+#include "../src/ecs.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <atomic>
+
+struct Position { glm::vec3 Value; };
+struct Velocity { glm::vec3 Value; };
+struct Bounds { glm::vec3 Center; float Radius; };
+struct Visible { int Value; };
+struct Health { float Value; };
+
+// what the scene objects used to look like: everything in one struct, flags for what applies
+struct FatObject
+{
+    glm::vec3 position, velocity;
+    glm::vec3 center;
+    float radius;
+    float health;
+    int visible;
+    bool moves, drawn, alive;
+    char padding[64];   // the rest of a typical object: names, pointers, materials
+};
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    int frames = argc > 2 ? atoi(argv[2]) : 20;
+    const float dt = 1.0f / 60.0f;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f), speed(-1.0f, 1.0f), life(0.0f, 1000.0f);
+    EcsWorld world;
+    std::vector<FatObject> objects(count);
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec3 position(coordinate(random), coordinate(random), coordinate(random));
+        glm::vec3 velocity(speed(random), speed(random), speed(random));
+        float health = life(random);
+        FatObject& object = objects[i];
+        object = FatObject();
+        object.position = position;
+        object.velocity = velocity;
+        object.center = position;
+        object.radius = 1.0f;
+        object.health = health;
+        object.alive = true;
+        int kind = i % 5;
+        if (kind < 2)
+        {
+            world.Create(Position{ position }, Velocity{ velocity }, Bounds{ position, 1.0f }, Visible{ 1 });
+            object.moves = object.drawn = true;
+        }
+        else if (kind < 4)
+        {
+            world.Create(Position{ position }, Bounds{ position, 1.0f }, Visible{ 1 });
+            object.drawn = true;
+        }
+        else
+        {
+            world.Create(Position{ position }, Velocity{ velocity }, Health{ health });
+            object.moves = true;
+        }
+    }
+    std::cout << world.Count() << " entities in " << world.ArchetypeCount() << " archetypes, " << frames << " frames, "
+              << JobPool::Instance().WorkerCount() << " job pool workers" << std::endl;
+
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 400.0f) * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::vec4 planes[6];
+    for (int i = 0; i < 3; i++)
+    {
+        glm::vec4 row(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        planes[i * 2] = w + row;
+        planes[i * 2 + 1] = w - row;
+    }
+
+    // the queries, each as a chunk body so the serial and parallel runs share them
+    auto move = [dt](int n, Entity*, Position* position, Velocity* velocity)
+    {
+        for (int i = 0; i < n; i++)
+            position[i].Value += velocity[i].Value * dt;
+    };
+    auto follow = [](int n, Entity*, Position* position, Bounds* bounds)
+    {
+        for (int i = 0; i < n; i++)
+            bounds[i].Center = position[i].Value;
+    };
+    std::atomic<int> visibleCount{ 0 };
+    auto cull = [&planes, &visibleCount](int n, Entity*, Bounds* bounds, Visible* visible)
+    {
+        int seen = 0;
+        for (int i = 0; i < n; i++)
+        {
+            int inside = 1;
+            for (int p = 0; p < 6; p++)
+                inside &= glm::dot(glm::vec3(planes[p]), bounds[i].Center) + planes[p].w >= -bounds[i].Radius;
+            visible[i].Value = inside;
+            seen += inside;
+        }
+        visibleCount += seen;
+    };
+    auto decay = [&world](int n, Entity* entities, Health* health)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            health[i].Value -= 1.0f;
+            if (health[i].Value <= 0.0f)
+                world.Commands.Destroy(entities[i]);
+        }
+    };
+
+    for (bool parallel : { false, true })
+    {
+        double times[5] = {};
+        for (int frame = 0; frame < frames; frame++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (parallel)
+                world.ParallelForEachChunk<Position, Velocity>(move);
+            else
+                world.ForEachChunk<Position, Velocity>(move);
+            times[0] += millisecondsSince(start);
+            start = std::chrono::steady_clock::now();
+            if (parallel)
+                world.ParallelForEachChunk<Position, Bounds>(follow);
+            else
+                world.ForEachChunk<Position, Bounds>(follow);
+            times[1] += millisecondsSince(start);
+            start = std::chrono::steady_clock::now();
+            visibleCount = 0;
+            if (parallel)
+                world.ParallelForEachChunk<Bounds, Visible>(cull);
+            else
+                world.ForEachChunk<Bounds, Visible>(cull);
+            times[2] += millisecondsSince(start);
+            start = std::chrono::steady_clock::now();
+            if (parallel)
+                world.ParallelForEachChunk<Health>(decay);
+            else
+                world.ForEachChunk<Health>(decay);
+            times[3] += millisecondsSince(start);
+            start = std::chrono::steady_clock::now();
+            world.Playback();
+            times[4] += millisecondsSince(start);
+        }
+        std::cout << (parallel ? "ecs parallel: " : "ecs serial:   ") << "move " << times[0] / frames << " ms, bounds " << times[1] / frames << " ms, cull "
+                  << times[2] / frames << " ms (" << visibleCount << " visible), health " << times[3] / frames << " ms, playback " << times[4] / frames
+                  << " ms; " << world.Count() << " entities left" << std::endl;
+    }
+
+    double times[4] = {};
+    int visible = 0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (FatObject& object : objects)
+        {
+            if (object.alive && object.moves)
+                object.position += object.velocity * dt;
+        }
+        times[0] += millisecondsSince(start);
+        start = std::chrono::steady_clock::now();
+        for (FatObject& object : objects)
+        {
+            if (object.alive && object.drawn)
+                object.center = object.position;
+        }
+        times[1] += millisecondsSince(start);
+        start = std::chrono::steady_clock::now();
+        visible = 0;
+        for (FatObject& object : objects)
+        {
+            if (!object.alive || !object.drawn)
+                continue;
+            int inside = 1;
+            for (int p = 0; p < 6; p++)
+                inside &= glm::dot(glm::vec3(planes[p]), object.center) + planes[p].w >= -object.radius;
+            object.visible = inside;
+            visible += inside;
+        }
+        times[2] += millisecondsSince(start);
+        start = std::chrono::steady_clock::now();
+        for (FatObject& object : objects)
+        {
+            if (object.alive && !object.drawn)
+            {
+                object.health -= 1.0f;
+                object.alive = object.health > 0.0f;
+            }
+        }
+        times[3] += millisecondsSince(start);
+    }
+    std::cout << "fat objects:  move " << times[0] / frames << " ms, bounds " << times[1] / frames << " ms, cull " << times[2] / frames << " ms ("
+              << visible << " visible), health " << times[3] / frames << " ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,174 @@
+// Scaling of the job pool from 1 to N threads on a synthetic frame: transforms, skeletal
+// animation, frustum culling and render queue building, wired together with job counters.
+// usage: bench_jobs [max threads] [objects] [frames]
+//
+// Transforms and animation are independent; culling waits for the transforms and the render
+// queue for culling. Each frame's queue is checksummed so every thread count is checked against
+// the single-threaded result
+#include "../src/job_pool.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+struct FrameData
+{
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::mat4> worlds;
+    std::vector<int> visible;
+    std::vector<glm::mat4> bonesLocal, bonesWorld;
+    std::vector<int> boneParents;
+    std::vector<std::vector<uint64_t>> batchQueues;
+    std::vector<uint64_t> queue;
+};
+
+static const int BONES = 64;
+static const int QUEUE_BATCHES = 64;
+
+static uint64_t runFrame(JobPool& pool, FrameData& data, const glm::vec4* planes, float time)
+{
+    int objects = (int)data.positions.size();
+    int skeletons = (int)data.bonesLocal.size() / BONES;
+    JobCounter transformsDone, cullingDone, frameDone;
+
+    pool.Submit([&]()
+    {
+        pool.ParallelFor(objects, [&](int i)
+        {
+            glm::quat spin = glm::angleAxis(time, glm::vec3(0.0f, 1.0f, 0.0f)) * data.rotations[i];
+            data.worlds[i] = glm::translate(glm::mat4(1.0f), data.positions[i]) * glm::mat4_cast(spin);
+        });
+    }, &transformsDone);
+
+    pool.Submit([&]()
+    {
+        pool.ParallelFor(skeletons, [&](int s)
+        {
+            glm::mat4* local = &data.bonesLocal[(size_t)s * BONES];
+            glm::mat4* world = &data.bonesWorld[(size_t)s * BONES];
+            glm::mat4 sway = glm::rotate(glm::mat4(1.0f), 0.1f * std::sin(time + s), glm::vec3(1.0f, 0.0f, 0.0f));
+            world[0] = local[0] * sway;
+            for (int b = 1; b < BONES; b++)
+                world[b] = world[data.boneParents[b]] * local[b] * sway;
+        });
+    }, &frameDone);
+
+    pool.Submit([&]()
+    {
+        pool.ParallelFor(objects, [&](int i)
+        {
+            glm::vec3 center(data.worlds[i][3]);
+            int inside = 1;
+            for (int p = 0; p < 6; p++)
+                inside &= glm::dot(glm::vec3(planes[p]), center) + planes[p].w >= -1.0f;
+            data.visible[i] = inside;
+        });
+    }, &cullingDone, &transformsDone);
+
+    // sort keys of the visible objects, depth in the high bits; each batch sorts its own range and
+    // the batches are merged on the way out
+    pool.Submit([&]()
+    {
+        pool.ParallelFor(QUEUE_BATCHES, [&](int batch)
+        {
+            std::vector<uint64_t>& keys = data.batchQueues[batch];
+            keys.clear();
+            int begin = (int)((int64_t)objects * batch / QUEUE_BATCHES), end = (int)((int64_t)objects * (batch + 1) / QUEUE_BATCHES);
+            for (int i = begin; i < end; i++)
+            {
+                if (!data.visible[i])
+                    continue;
+                uint32_t depth = (uint32_t)std::min(65535.0f, std::max(0.0f, -data.worlds[i][3].z * 100.0f));
+                keys.push_back((uint64_t)depth << 32 | (uint32_t)i);
+            }
+            std::sort(keys.begin(), keys.end());
+        }, 1);
+        data.queue.clear();
+        for (const std::vector<uint64_t>& keys : data.batchQueues)
+        {
+            size_t middle = data.queue.size();
+            data.queue.insert(data.queue.end(), keys.begin(), keys.end());
+            std::inplace_merge(data.queue.begin(), data.queue.begin() + middle, data.queue.end());
+        }
+    }, &frameDone, &cullingDone);
+
+    pool.Wait(transformsDone);
+    pool.Wait(cullingDone);
+    pool.Wait(frameDone);
+
+    uint64_t checksum = data.queue.size();
+    for (size_t i = 0; i < data.queue.size(); i += 97)
+        checksum = checksum * 31 + data.queue[i];
+    return checksum;
+}
+
+int main(int argc, char** argv)
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int)std::max(4u, std::thread::hardware_concurrency());
+    int objects = argc > 2 ? atoi(argv[2]) : 200000;
+    int frames = argc > 3 ? atoi(argv[3]) : 30;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> coordinate(-200.0f, 200.0f), angle(0.0f, 6.28f);
+    FrameData data;
+    for (int i = 0; i < objects; i++)
+    {
+        data.positions.push_back(glm::vec3(coordinate(random), coordinate(random), coordinate(random)));
+        data.rotations.push_back(glm::angleAxis(angle(random), glm::vec3(0.0f, 1.0f, 0.0f)));
+    }
+    data.worlds.resize(objects);
+    data.visible.resize(objects);
+    int skeletons = std::max(1, objects / 100);
+    for (int b = 0; b < BONES; b++)
+        data.boneParents.push_back(b == 0 ? -1 : (b - 1) / 2);
+    for (int i = 0; i < skeletons * BONES; i++)
+        data.bonesLocal.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.1f, 0.0f)) * glm::mat4_cast(glm::angleAxis(angle(random) * 0.1f, glm::vec3(0.0f, 0.0f, 1.0f))));
+    data.bonesWorld.resize(data.bonesLocal.size());
+    data.batchQueues.resize(QUEUE_BATCHES);
+
+    glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    glm::vec4 planes[6];
+    for (int i = 0; i < 3; i++)
+    {
+        glm::vec4 row(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        planes[i * 2] = w + row;
+        planes[i * 2 + 1] = w - row;
+    }
+
+    std::cout << objects << " objects, " << skeletons << " skeletons of " << BONES << " bones, " << frames << " frames, "
+              << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    double baseline = 0.0;
+    std::vector<uint64_t> expected;
+    for (int threads = 1; threads <= maxThreads; threads++)
+    {
+        // the calling thread works too, so N threads is N - 1 workers
+        JobPool pool((unsigned int)(threads - 1));
+        runFrame(pool, data, planes, 0.0f);
+        std::vector<uint64_t> checksums;
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; frame++)
+            checksums.push_back(runFrame(pool, data, planes, frame * 0.016f));
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        if (threads == 1)
+        {
+            baseline = ms;
+            expected = checksums;
+        }
+        bool same = checksums == expected;
+        std::cout << threads << " threads: " << ms << " ms/frame, " << baseline / ms << "x" << (same ? "" : ", render queue MISMATCH") << std::endl;
+        if (!same)
+        {
+            std::cout << "ERROR::BENCH_JOBS::MISMATCH: the render queue differs from the single-threaded one" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+// Precision far from the origin: where a vertex ends up in view space with float world
+// coordinates against camera-relative matrices, and how far a crate slides with the physics in
+// world coordinates against rebased ones, from 1 to 10 million units out. Also times composing
+// camera-relative model matrices. Exits with 1 if either camera-relative path is off at a
+// million units.
+// usage: bench_large_world [frames]
+//
+// Each frame the camera walks a millimetre and looks at a cube corner two metres ahead. The
+// reference is the same transform done in double. Float world coordinates have a step of 6 cm
+// at a million units, which is the jitter this is about
+#include "../src/camera.h"
+#include "../src/world_origin.h"
+#include "../src/physics.h"
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+
+// largest view space error in millimetres over frames of a camera walking past an object
+static double viewError(double distance, int frames, bool cameraRelative)
+{
+    Camera camera(glm::dvec3(distance, 1.7, distance));
+    camera.ProcessMouseMovement(1234.0f, -567.0f);
+    camera.UpdateOrientation();
+    glm::dvec3 objectOrigin = camera.Position + glm::dvec3(0.3, -0.2, -2.0);
+    glm::mat4 model = glm::mat4(1.0f);
+    glm::vec4 corner(0.5f, 0.5f, 0.5f, 1.0f);
+    glm::dmat3 rotation = glm::transpose(glm::dmat3(glm::mat3_cast(glm::dquat(camera.Orientation))));
+
+    double worst = 0.0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        camera.Position += glm::dvec3(0.001, 0.0, 0.0007);
+        glm::dvec3 exact = rotation * (objectOrigin + glm::dvec3(corner) - camera.Position);
+        glm::vec3 result;
+        if (cameraRelative)
+            result = glm::vec3(camera.GetViewMatrix() * CameraRelative(model, objectOrigin, camera.Position) * corner);
+        else
+        {
+            // the usual float pipeline: world model matrix and a view matrix with the translation in it
+            glm::mat4 worldModel = glm::translate(glm::mat4(1.0f), glm::vec3(objectOrigin));
+            glm::mat4 view = camera.GetViewMatrix() * glm::translate(glm::mat4(1.0f), -glm::vec3(camera.Position));
+            result = glm::vec3(view * worldModel * corner);
+        }
+        worst = std::max(worst, glm::length(glm::dvec3(result) - exact) * 1000.0);
+    }
+    return worst;
+}
+
+// how far a crate pushed at 2 m/s over a floor slides before friction stops it. With rebase the
+// physics runs around a WorldOrigin rebased onto the crate, otherwise in world coordinates
+static double slideDistance(double distance, bool rebase)
+{
+    JobPool pool(0);
+    PhysicsWorld physics(pool);
+    WorldOrigin origin;
+    origin.OnRebase([&](const glm::vec3& shift) { physics.ShiftOrigin(shift); });
+    glm::dvec3 start(distance, 0.4, distance);
+    physics.AddBody(origin.ToLocal(glm::dvec3(distance, -0.5, distance)), glm::vec3(50.0f, 0.5f, 50.0f), 0.0f);
+    int crate = physics.AddBody(origin.ToLocal(start), glm::vec3(0.4f));
+    physics.SetVelocity(crate, glm::vec3(2.0f, 0.0f, 0.0f));
+    if (rebase)
+        origin.Update(start);
+    for (int step = 0; step < 240; step++)
+        physics.Step(1.0f / 120.0f);
+    return origin.ToWorld(physics.Position(crate)).x - start.x;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 1000;
+    bool failed = false;
+
+    std::cout << "View space error of a cube corner 2 m ahead, worst of " << frames << " frames of 1 mm camera steps" << std::endl;
+    for (double distance = 1.0; distance <= 1e7; distance *= 10.0)
+    {
+        double floatError = viewError(distance, frames, false);
+        double relativeError = viewError(distance, frames, true);
+        std::cout << "  " << distance << " units out: float world " << floatError << " mm, camera-relative " << relativeError << " mm" << std::endl;
+        if (distance == 1e6 && relativeError > 0.01)
+            failed = true;
+    }
+
+    double reference = slideDistance(0.0, false);
+    std::cout << "Crate slide at 2 m/s, " << reference << " m at the origin" << std::endl;
+    for (double distance = 1e3; distance <= 1e7; distance *= 10.0)
+    {
+        double world = slideDistance(distance, false);
+        double rebased = slideDistance(distance, true);
+        std::cout << "  " << distance << " units out: world coordinates " << world << " m, rebased " << rebased << " m" << std::endl;
+        if (distance == 1e6 && std::fabs(rebased - reference) > 0.001)
+            failed = true;
+    }
+
+    // the cost drawing pays for it, per object per frame
+    const int objects = 1000000;
+    std::vector<glm::mat4> models(objects), relative(objects);
+    std::vector<glm::dvec3> origins(objects);
+    for (int i = 0; i < objects; i++)
+    {
+        models[i] = glm::translate(glm::mat4(1.0f), glm::vec3((float)(i % 100), 0.0f, (float)(i / 100 % 100)));
+        origins[i] = glm::dvec3(1e6 + (i / 10000) * 100.0, 0.0, 1e6);
+    }
+    glm::dvec3 eye(1e6 + 12.345, 1.7, 1e6 - 6.789);
+    double ms = 0.0;
+    for (int repeat = 0; repeat < 5; repeat++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < objects; i++)
+            relative[i] = CameraRelative(models[i], origins[i], eye);
+        ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / 5.0;
+    }
+    std::cout << "CameraRelative: " << ms << " ms for " << objects << " model matrices (" << relative[objects / 2][3].x << ")" << std::endl;
+
+    if (failed)
+        std::cout << "ERROR::LARGE_WORLD::PRECISION: camera-relative paths are off at 1e6 units" << std::endl;
+    return failed ? 1 : 0;
+}
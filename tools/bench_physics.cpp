@@ -0,0 +1,67 @@
+// Rigid body step cost against body count and thread count, and the most bodies each thread count
+// keeps within the 8.3 ms of a 120 Hz step.
+// usage: bench_physics [max threads] [steps]
+//
+// The bodies are unit cubes dropped in columns ten high over a floor that grows with their
+// count, so the run covers the fall, the impacts and the piles settling; nothing sleeps, so a
+// settled pile costs as much as a moving one
+#include "../src/physics.h"
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <cmath>
+
+static double runScene(JobPool& pool, int bodies, int steps, double& worstMs, PhysicsStats& stats)
+{
+    PhysicsWorld world(pool);
+    int columns = std::max(1, (int)std::sqrt(bodies / 10.0));
+    world.AddBody(glm::vec3(0.0f, -10.0f, 0.0f), glm::vec3(columns * 2.0f + 10.0f, 10.0f, columns * 2.0f + 10.0f), 0.0f);
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> jitter(-0.2f, 0.2f);
+    for (int i = 0; i < bodies; i++)
+    {
+        int column = i / 10, level = i % 10;
+        float x = (column % columns) * 1.6f - columns * 0.8f, z = (column / columns) * 1.6f - columns * 0.8f;
+        world.AddBody(glm::vec3(x + jitter(random), 1.0f + level * 1.5f, z + jitter(random)), glm::vec3(0.5f));
+    }
+
+    double totalMs = 0.0;
+    worstMs = 0.0;
+    for (int step = 0; step < steps; step++)
+    {
+        world.Step(1.0f / 120.0f);
+        totalMs += world.Stats.Milliseconds;
+        worstMs = std::max(worstMs, world.Stats.Milliseconds);
+    }
+    stats = world.Stats;
+    return totalMs / steps;
+}
+
+int main(int argc, char** argv)
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int)std::max(4u, std::thread::hardware_concurrency());
+    int steps = argc > 2 ? atoi(argv[2]) : 360;
+    const double budgetMs = 1000.0 / 120.0;
+
+    std::cout << steps << " steps at 120 Hz, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    for (int threads = 1; threads <= maxThreads; threads++)
+    {
+        JobPool pool((unsigned int)(threads - 1));
+        int sustained = 0;
+        for (int bodies = 1000; bodies <= 256000; bodies *= 2)
+        {
+            double worstMs;
+            PhysicsStats stats;
+            double averageMs = runScene(pool, bodies, steps, worstMs, stats);
+            std::cout << "  " << threads << " threads, " << bodies << " bodies: " << averageMs << " ms average, " << worstMs << " ms worst, "
+                      << stats.Contacts << " contacts and " << stats.Swaps << " sort swaps in the last step" << std::endl;
+            if (averageMs > budgetMs)
+                break;
+            sustained = bodies;
+        }
+        std::cout << threads << " threads: " << sustained << " bodies within " << budgetMs << " ms per step" << std::endl;
+    }
+    return 0;
+}
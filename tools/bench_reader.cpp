@@ -0,0 +1,96 @@
+// Compares loading many small assets through the blocking Vfs path against the batched
+// AsyncReader (io_uring, and its thread pool pread fallback) with a cold page cache.
+// usage: bench_reader [file count] [queue depth] [directory]
+// The files are generated in the directory (default ./bench_assets) and dropped from the page
+// cache with posix_fadvise before every run, which needs no root but leaves dentries cached
+#include "../src/vfs.h"
+#include "../src/async_reader.h"
+
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <filesystem>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static void dropCache(const std::vector<std::string>& paths)
+{
+#ifdef __linux__
+    for (const std::string& path : paths)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+static void report(const char* label, double seconds, size_t files, uint64_t bytes, int syscalls)
+{
+    std::cout << label << ": " << seconds * 1000.0 << " ms, " << files / seconds << " files/s, "
+              << bytes / (1024.0 * 1024.0) / seconds << " MB/s, " << syscalls << " syscalls" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 4000;
+    unsigned int queueDepth = argc > 2 ? (unsigned int)atoi(argv[2]) : 64;
+    std::string directory = argc > 3 ? argv[3] : "bench_assets";
+
+    // 1-16 KB files, roughly the size of shaders and small icons
+    std::filesystem::create_directories(directory);
+    std::vector<std::string> names, paths;
+    std::mt19937 random(42);
+    for (int i = 0; i < count; i++)
+    {
+        std::string name = "asset" + std::to_string(i) + ".bin";
+        std::string path = directory + "/" + name;
+        if (!std::filesystem::exists(path))
+        {
+            std::vector<char> data(1024 + random() % (15 * 1024));
+            for (char& c : data)
+                c = (char)random();
+            std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+        }
+        names.push_back(name);
+        paths.push_back(path);
+    }
+    std::cout << count << " files, queue depth " << queueDepth << std::endl;
+
+    // blocking: one Vfs::Read (open, fstat, read, close) after another
+    dropCache(paths);
+    Vfs& vfs = Vfs::Instance();
+    vfs.SetOverrideDirectory(directory);
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& name : names)
+        vfs.Read(name);
+    report("blocking", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), count, vfs.Stats.Bytes, vfs.Stats.Syscalls);
+
+    for (bool ioUring : { true, false })
+    {
+        dropCache(paths);
+        AsyncReader reader(queueDepth, ioUring);
+        if (ioUring && !reader.UsesIoUring())
+        {
+            std::cout << "io_uring: not available" << std::endl;
+            continue;
+        }
+        std::atomic<uint64_t> decoded{ 0 };
+        start = std::chrono::steady_clock::now();
+        for (const std::string& path : paths)
+            reader.ReadFile(path, [&decoded](std::vector<unsigned char>&& data, bool ok) { decoded += ok ? data.size() : 0; });
+        reader.Flush();
+        report(ioUring ? "io_uring" : "pread pool", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), count, decoded.load(), reader.Stats.Syscalls);
+    }
+    return 0;
+}
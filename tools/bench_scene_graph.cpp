@@ -0,0 +1,94 @@
+// Per-frame cost of the scene graph when a small part of it moves, against recomputing every
+// world matrix the way absolute transforms were handled before.
+// usage: bench_scene_graph [node count] [moving percent] [frames]
+// The scene is a forest of 100 node trees (a root, 9 children, 90 grandchildren); the moving
+// nodes are picked at random at every depth each frame
+#include "../src/scene_graph.h"
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <cmath>
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    double movingPercent = argc > 2 ? atof(argv[2]) : 1.0;
+    int frames = argc > 3 ? atoi(argv[3]) : 200;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> offset(-5.0f, 5.0f);
+    SceneGraph graph;
+    while ((int)graph.Count() < count)
+    {
+        int root = graph.Add(-1, glm::vec3(offset(random) * 100.0f, 0.0f, offset(random) * 100.0f));
+        for (int i = 0; i < 9 && (int)graph.Count() < count; i++)
+        {
+            int child = graph.Add(root, glm::vec3(offset(random), offset(random), offset(random)), glm::angleAxis(offset(random), glm::vec3(0.0f, 1.0f, 0.0f)));
+            for (int j = 0; j < 10 && (int)graph.Count() < count; j++)
+                graph.Add(child, glm::vec3(offset(random), offset(random), offset(random)), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.5f));
+        }
+    }
+    graph.Update();
+    std::cout << graph.Count() << " nodes, first update (sort and every world matrix) " << graph.Stats.Milliseconds << " ms, "
+              << JobPool::Instance().WorkerCount() << " job pool workers" << std::endl;
+
+    int moving = std::max(1, (int)(graph.Count() * movingPercent / 100.0));
+    std::uniform_int_distribution<int> pick(0, (int)graph.Count() - 1);
+    double total = 0.0, worst = 0.0;
+    long long updated = 0;
+    int parallelFrames = 0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        for (int i = 0; i < moving; i++)
+        {
+            int id = pick(random);
+            graph.SetPosition(id, graph.Position(id) + glm::vec3(0.01f, 0.0f, 0.0f));
+        }
+        graph.Update();
+        total += graph.Stats.Milliseconds;
+        worst = std::max(worst, graph.Stats.Milliseconds);
+        updated += graph.Stats.UpdatedNodes;
+        parallelFrames += graph.Stats.Parallel;
+    }
+    std::cout << movingPercent << "% moving (" << moving << " nodes set per frame): " << updated / frames << " world matrices per frame, "
+              << total / frames << " ms average, " << worst << " ms worst, " << parallelFrames << "/" << frames << " frames parallel" << std::endl;
+
+    // nothing moves
+    total = 0.0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        graph.Update();
+        total += graph.Stats.Milliseconds;
+    }
+    std::cout << "static: " << graph.Stats.UpdatedNodes << " world matrices per frame, " << total / frames * 1000.0 << " us average" << std::endl;
+
+    // every node recomputed each frame, what absolute transforms cost
+    total = 0.0;
+    std::vector<glm::mat4> worlds(graph.Count());
+    for (int frame = 0; frame < frames; frame++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int id = 0; id < (int)graph.Count(); id++)
+        {
+            int parent = graph.Parent(id);
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), graph.Position(id));
+            worlds[id] = parent >= 0 ? worlds[parent] * local : local;
+        }
+        total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::cout << "everything every frame: " << graph.Count() << " world matrices per frame, " << total / frames << " ms average" << std::endl;
+
+    // the incremental result has to match a full recompute
+    float error = 0.0f;
+    for (int id = 0; id < (int)graph.Count(); id++)
+    {
+        glm::mat4 expected = graph.Parent(id) >= 0 ? graph.World(graph.Parent(id)) : glm::mat4(1.0f);
+        glm::mat4 world = graph.World(id);
+        glm::vec3 local = glm::vec3(glm::inverse(expected) * world[3]);
+        error = std::max(error, glm::length(local - graph.Position(id)));
+    }
+    std::cout << "max local position error against the parents: " << error << std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Measures building model and model-view-projection matrices for many objects: glm one object at a
+// time, as the render loop used to, against TransformStore's scalar, SSE and AVX2 batch paths.
+// usage: bench_transforms [object count] [repeats]
+// Every path writes into the same output array, standing in for a mapped instance buffer, and
+// is checked against glm
+#include "../src/transform_store.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+static float maxError(const std::vector<glm::mat4>& a, const std::vector<glm::mat4>& b)
+{
+    float error = 0.0f;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            for (int r = 0; r < 4; r++)
+                error = std::max(error, std::fabs(a[i][c][r] - b[i][c][r]) / std::max(1.0f, std::fabs(a[i][c][r])));
+        }
+    }
+    return error;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? (size_t)atoll(argv[1]) : 1000000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 10;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f), unit(-1.0f, 1.0f), scale(0.5f, 2.0f);
+    TransformStore store;
+    store.Reserve(count);
+    std::vector<glm::vec3> positions, scales;
+    std::vector<glm::quat> rotations;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t index = store.Add(glm::vec3(position(random), position(random), position(random)),
+                                 glm::quat(unit(random), unit(random), unit(random), unit(random)),
+                                 glm::vec3(scale(random), scale(random), scale(random)));
+        positions.push_back(store.Position(index));
+        rotations.push_back(store.Rotation(index));
+        scales.push_back(store.Scale(index));
+    }
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f) *
+                               glm::lookAt(glm::vec3(0.0f, 10.0f, 30.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    std::cout << count << " objects, best of " << repeats << " runs, CPU: " << TransformStore::SimdName(TransformStore::BestSimd()) << std::endl;
+
+    std::vector<glm::mat4> out(count), reference(count);
+    for (bool mvp : { false, true })
+    {
+        // naive glm, one object at a time
+        double best = 1e30;
+        for (int run = 0; run < repeats; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < count; i++)
+            {
+                glm::mat4 model = glm::translate(glm::mat4(1.0f), positions[i]) * glm::mat4_cast(rotations[i]) * glm::scale(glm::mat4(1.0f), scales[i]);
+                reference[i] = mvp ? viewProjection * model : model;
+            }
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        const char* label = mvp ? "mvp  " : "world";
+        std::cout << label << " glm:    " << best * 1000.0 << " ms, " << count / best / 1e6 << " M transforms/s" << std::endl;
+        double glmSeconds = best;
+
+        for (Transform_Simd path : { TRANSFORM_SCALAR, TRANSFORM_SSE, TRANSFORM_AVX2 })
+        {
+            if (path > TransformStore::BestSimd())
+                continue;
+            store.Path = path;
+            best = 1e30;
+            for (int run = 0; run < repeats; run++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if (mvp)
+                    store.ComposeMvp(viewProjection, out.data());
+                else
+                    store.ComposeWorld(out.data());
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            std::cout << label << " " << TransformStore::SimdName(path) << (path == TRANSFORM_SSE ? ":    " : ": ") << best * 1000.0 << " ms, "
+                      << count / best / 1e6 << " M transforms/s (" << glmSeconds / best << "x), max error " << maxError(reference, out) << std::endl;
+        }
+    }
+    return 0;
+}
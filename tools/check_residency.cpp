@@ -0,0 +1,167 @@
+// Checks TextureResidency against a real driver: with a small budget the textures the driver holds
+// have to stay under it, and textures evicted whole have to come back with the same texels.
+// usage: check_residency [budget KB] [asset root]
+// e.g.   check_residency 2048 src      (headless, needs EGL with surfaceless Mesa, e.g. llvmpipe)
+//
+// Two groups of textures take turns being drawn: the skybox faces, then the others, then the
+// skybox again. Every frame the storage each level really has (glGetTexLevelParameteriv) is added
+// up and compared with the budget and with what the residency thinks it holds. The first group's
+// levels are read back before it is evicted and again once it has streamed back in. Exits with 1
+// if anything does not match
+#include "../src/texture_residency.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <thread>
+#include <chrono>
+
+static bool createContext()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API))
+        return false;
+    const EGLint attributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                  EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+// bytes the driver has for every level of the texture, which Evict frees by defining them as 0x0
+static uint64_t driverBytes(const StreamedTexture& texture)
+{
+    uint64_t bytes = 0;
+    glBindTexture(GL_TEXTURE_2D, texture.ID);
+    for (int level = 0; level < texture.Levels; level++)
+    {
+        GLint width = 0, height = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+        bytes += (uint64_t)width * height * texture.Channels;
+    }
+    return bytes;
+}
+
+// FNV-1a over one level read back from the driver
+static uint64_t levelHash(const StreamedTexture& texture, int level)
+{
+    std::vector<unsigned char> texels((size_t)texture.LevelBytes(level));
+    glBindTexture(GL_TEXTURE_2D, texture.ID);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, level, texture.Channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : texels)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t budget = (uint64_t)(argc > 1 ? std::max(64, atoi(argv[1])) : 2048) * 1024;
+    std::string root = argc > 2 ? argv[2] : "src";
+    if (!createContext() || !gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        std::cout << "ERROR::CHECK_RESIDENCY::NO_CONTEXT" << std::endl;
+        return 1;
+    }
+    std::cout << "GL " << glGetString(GL_VERSION) << " on " << glGetString(GL_RENDERER) << ", budget " << budget / 1024 << " KB" << std::endl;
+    Vfs::Instance().SetOverrideDirectory(root);
+
+    TextureStreamer streamer;
+    TextureResidency residency(streamer, budget);
+    std::vector<StreamedTexture*> sky, others;
+    for (const char* face : { "right", "left", "top", "bottom", "front", "back" })
+        sky.push_back(streamer.Load(std::string("textures/skybox/") + face + ".png", glm::vec3(0.0f), 50.0f));
+    for (const char* path : { "textures/awesomeface.png", "textures/container.jpg", "textures/dirt.jpg", "textures/image.png" })
+        others.push_back(streamer.Load(path, glm::vec3(0.0f), 5.0f));
+    std::vector<StreamedTexture*> all = streamer.Textures();
+    Camera camera(glm::dvec3(0.0, 0.0, 10.0));
+
+    int failures = 0;
+    auto check = [&](bool ok, const std::string& what)
+    {
+        if (!ok)
+        {
+            std::cout << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    };
+
+    // draws group until nothing is left to stream, checking the budget every frame
+    auto drawUntilIdle = [&](const std::vector<StreamedTexture*>& group, const char* label)
+    {
+        uint64_t peak = 0;
+        int frame = 0;
+        for (; frame < 5000; frame++)
+        {
+            streamer.Update(camera, 1080.0f);
+            for (StreamedTexture* texture : group)
+                residency.Touch(texture);
+            residency.Update();
+            uint64_t bytes = 0;
+            for (StreamedTexture* texture : all)
+                bytes += driverBytes(*texture);
+            peak = std::max(peak, bytes);
+            if (bytes != residency.Stats.ResidentBytes || bytes > budget)
+            {
+                check(false, std::string(label) + ": frame " + std::to_string(frame) + " driver holds " + std::to_string(bytes) +
+                      " bytes, residency counts " + std::to_string(residency.Stats.ResidentBytes));
+                break;
+            }
+            bool loaded = true;
+            for (StreamedTexture* texture : group)
+                loaded = loaded && texture->Resident();
+            if (loaded && streamer.Idle())
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        check(frame < 5000, std::string(label) + ": still streaming after 5000 frames");
+        std::cout << label << ": " << frame + 1 << " frames, driver peak " << peak / 1024 << " KB" << std::endl;
+        residency.PrintStats("  residency");
+    };
+
+    drawUntilIdle(sky, "skybox");
+    std::map<std::pair<StreamedTexture*, int>, uint64_t> hashes;
+    for (StreamedTexture* texture : sky)
+    {
+        check(texture->Resident(), texture->Path + " is not resident");
+        for (int level = texture->ResidentLevel; level < texture->Levels; level++)
+            hashes[{ texture, level }] = levelHash(*texture, level);
+    }
+
+    int evictionsBefore = residency.Stats.TextureEvictions;
+    drawUntilIdle(others, "others");
+    int evicted = 0;
+    for (StreamedTexture* texture : sky)
+        evicted += texture->Resident() ? 0 : 1;
+    check(residency.Stats.TextureEvictions > evictionsBefore && evicted > 0, "no skybox face was evicted whole; lower the budget");
+
+    int reloadsBefore = residency.Stats.Reloads;
+    drawUntilIdle(sky, "skybox again");
+    check(residency.Stats.Reloads > reloadsBefore, "nothing was reloaded");
+    int compared = 0;
+    for (StreamedTexture* texture : sky)
+    {
+        check(texture->Resident(), texture->Path + " did not come back");
+        for (int level = texture->ResidentLevel; level < texture->Levels; level++)
+        {
+            auto it = hashes.find({ texture, level });
+            if (it == hashes.end())
+                continue;
+            check(levelHash(*texture, level) == it->second, texture->Path + " level " + std::to_string(level) + " came back different");
+            compared++;
+        }
+    }
+    std::cout << evicted << " skybox faces evicted whole and reloaded, " << compared << " levels compared" << std::endl;
+
+    std::cout << (failures ? "FAILED" : "OK") << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+// Checks that the fixed timestep keeps the simulation independent of the frame rate: a pile of
+// rigid boxes is stepped through FixedTimestep with frame times of 30, 60, 144 and 240 Hz, each
+// jittered by up to a quarter of a frame, and after the same number of steps every body has to be
+// where a plain loop of Step calls put it, bit for bit.
+// usage: check_timestep [steps] [bodies]
+//
+// Exits with 1 if a position or velocity differs, or if the frames did not add up to the steps
+#include "../src/sim_clock.h"
+#include "../src/physics.h"
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+
+static const int RATE = 120;
+
+static void buildScene(PhysicsWorld& world, int bodies)
+{
+    int columns = std::max(1, (int)std::sqrt(bodies / 10.0));
+    world.AddBody(glm::vec3(0.0f, -10.0f, 0.0f), glm::vec3(columns * 2.0f + 10.0f, 10.0f, columns * 2.0f + 10.0f), 0.0f);
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> jitter(-0.2f, 0.2f);
+    for (int i = 0; i < bodies; i++)
+    {
+        int column = i / 10, level = i % 10;
+        float x = (column % columns) * 1.6f - columns * 0.8f, z = (column / columns) * 1.6f - columns * 0.8f;
+        int body = world.AddBody(glm::vec3(x + jitter(random), 1.0f + level * 1.5f, z + jitter(random)), glm::vec3(0.5f));
+        world.SetVelocity(body, glm::vec3(jitter(random), 0.0f, jitter(random)) * 10.0f);
+    }
+}
+
+// bodies whose position or velocity is not bit for bit the same in both worlds
+static int differences(const PhysicsWorld& a, const PhysicsWorld& b)
+{
+    int different = 0;
+    for (int i = 0; i < (int)a.Count(); i++)
+        different += std::memcmp(&a.Position(i), &b.Position(i), sizeof(glm::vec3)) != 0
+                  || std::memcmp(&a.Velocity(i), &b.Velocity(i), sizeof(glm::vec3)) != 0;
+    return different;
+}
+
+int main(int argc, char** argv)
+{
+    int steps = argc > 1 ? std::max(1, atoi(argv[1])) : 1200;
+    int bodies = argc > 2 ? std::max(1, atoi(argv[2])) : 500;
+    JobPool pool(0);
+
+    PhysicsWorld reference(pool);
+    buildScene(reference, bodies);
+    for (int step = 0; step < steps; step++)
+        reference.Step(1.0f / (float)RATE);
+    std::cout << bodies << " bodies, " << steps << " steps at " << RATE << " Hz" << std::endl;
+
+    int failures = 0;
+    std::mt19937 random(1);
+    for (int frameRate : { 30, 60, 144, 240 })
+    {
+        PhysicsWorld world(pool);
+        buildScene(world, bodies);
+        FixedTimestep simulation(RATE);
+        int64_t frame = 1000000000 / frameRate;
+        std::uniform_int_distribution<int64_t> jitter(-frame / 4, frame / 4);
+        int frames = 0, taken = 0;
+        while (taken < steps)
+        {
+            int due = simulation.Advance(frame + jitter(random));
+            frames++;
+            for (int i = 0; i < due && taken < steps; i++, taken++)
+                world.Step(simulation.StepSeconds());
+        }
+        int different = differences(reference, world);
+        bool ok = different == 0 && simulation.DroppedFrames == 0;
+        std::cout << "  " << frameRate << " Hz: " << frames << " frames, " << simulation.DroppedFrames << " dropped, "
+                  << different << " bodies differ" << (ok ? "" : "  FAILED") << std::endl;
+        failures += !ok;
+    }
+    std::cout << (failures ? "FAILED" : "OK") << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+// Builds a tiled virtual texture (.vtex) for VirtualTexture from an image.
+// usage: make_vtex [--repeat <n>] [--tile <texels>] [--border <texels>] [--lz4 <level>] <image> <output.vtex>
+// e.g.   make_vtex --repeat 32 src/textures/dirt.jpg src/textures/terrain.vtex   (a 16384x16384 terrain)
+//
+// The image is resampled to the largest power of two square that fits in it and, with --repeat,
+// tiled n x n times (n a power of two) to make a large terrain out of a small texture. Every page
+// of every level is written with its border; identical pages are stored once, so a repeated
+// texture stays small on disk
+#include "../src/virtual_texture.h"
+#include "../src/stb_image.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+// FNV-1a, to find identical pages
+static uint64_t hashBytes(const std::vector<unsigned char>& bytes)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : bytes)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool isPowerOfTwo(int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    int repeat = 1;
+    int tileSize = 128;
+    int border = 4;
+    int level = 4;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (arg == "--tile" && i + 1 < argc)
+            tileSize = atoi(argv[++i]);
+        else if (arg == "--border" && i + 1 < argc)
+            border = atoi(argv[++i]);
+        else if (arg == "--lz4" && i + 1 < argc)
+            level = std::max(1, std::min(LZ4_MAX_LEVEL, atoi(argv[++i])));
+        else
+            positional.push_back(arg);
+    }
+    if (positional.size() < 2 || !isPowerOfTwo(repeat) || !isPowerOfTwo(tileSize) || border < 0 || border > tileSize / 2)
+    {
+        std::cout << "usage: make_vtex [--repeat <n>] [--tile <texels>] [--border <texels>] [--lz4 <level>] <image> <output.vtex>" << std::endl;
+        std::cout << "       repeat and tile have to be powers of two" << std::endl;
+        return 1;
+    }
+
+    int width, height, channels;
+    unsigned char* pixels = stbi_load(positional[0].c_str(), &width, &height, &channels, 4);
+    if (!pixels)
+    {
+        std::cout << "ERROR::MAKE_VTEX::CANNOT_READ: " << positional[0] << std::endl;
+        return 1;
+    }
+
+    // source mip chain, nearest resampled to a power of two square first
+    int sourceSize = 1;
+    while (sourceSize * 2 <= std::min(width, height))
+        sourceSize *= 2;
+    std::vector<std::vector<unsigned char>> source(1, std::vector<unsigned char>((size_t)sourceSize * sourceSize * 4));
+    for (int y = 0; y < sourceSize; y++)
+    {
+        for (int x = 0; x < sourceSize; x++)
+            memcpy(&source[0][((size_t)y * sourceSize + x) * 4], pixels + ((size_t)(y * height / sourceSize) * width + x * width / sourceSize) * 4, 4);
+    }
+    stbi_image_free(pixels);
+    for (int size = sourceSize / 2; size >= 1; size /= 2)
+    {
+        const std::vector<unsigned char>& above = source.back();
+        std::vector<unsigned char> mip((size_t)size * size * 4);
+        for (int y = 0; y < size; y++)
+        {
+            for (int x = 0; x < size; x++)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    int sum = above[((size_t)(y * 2) * size * 2 + x * 2) * 4 + c] + above[((size_t)(y * 2) * size * 2 + x * 2 + 1) * 4 + c] +
+                              above[((size_t)(y * 2 + 1) * size * 2 + x * 2) * 4 + c] + above[((size_t)(y * 2 + 1) * size * 2 + x * 2 + 1) * 4 + c];
+                    mip[((size_t)y * size + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        source.push_back(std::move(mip));
+    }
+
+    int virtualSize = sourceSize * repeat;
+    if (virtualSize < tileSize)
+    {
+        std::cout << "ERROR::MAKE_VTEX::TOO_SMALL: " << virtualSize << " texels is less than one " << tileSize << " texel page" << std::endl;
+        return 1;
+    }
+    int levels = 1;
+    while ((virtualSize >> (levels - 1)) > tileSize)
+        levels++;
+
+    // a level of the repeated texture is the same level of the source repeated, until the source
+    // is down to a single texel
+    int slotSize = tileSize + 2 * border;
+    std::vector<VtexTile> uniqueTiles;                     // table entry of every unique page
+    std::vector<std::vector<unsigned char>> stored;        // unique pages, as written
+    std::unordered_map<uint64_t, std::vector<size_t>> unique;
+    std::vector<size_t> tileData;                          // index into stored for every page
+    std::vector<unsigned char> page((size_t)slotSize * slotSize * 4);
+    std::vector<unsigned char> compressed(Lz4CompressBound((int)page.size()));
+    std::vector<unsigned char> check(page.size());
+    for (int l = 0; l < levels; l++)
+    {
+        const std::vector<unsigned char>& mip = source[std::min(l, (int)source.size() - 1)];
+        int mipSize = std::max(1, sourceSize >> l);
+        int levelSize = virtualSize >> l;
+        int pages = levelSize / tileSize;
+        for (int py = 0; py < pages; py++)
+        {
+            for (int px = 0; px < pages; px++)
+            {
+                for (int y = 0; y < slotSize; y++)
+                {
+                    int vy = std::max(0, std::min(levelSize - 1, py * tileSize + y - border)) % mipSize;
+                    for (int x = 0; x < slotSize; x++)
+                    {
+                        int vx = std::max(0, std::min(levelSize - 1, px * tileSize + x - border)) % mipSize;
+                        memcpy(&page[((size_t)y * slotSize + x) * 4], &mip[((size_t)vy * mipSize + vx) * 4], 4);
+                    }
+                }
+
+                uint64_t hash = hashBytes(page);
+                size_t match = stored.size();
+                for (size_t candidate : unique[hash])
+                {
+                    const std::vector<unsigned char>& data = stored[candidate];
+                    bool same = uniqueTiles[candidate].storedSize & VTEX_TILE_RAW ? memcmp(data.data(), page.data(), page.size()) == 0 :
+                        Lz4Decompress(data.data(), (int)data.size(), check.data(), (int)check.size()) == (int)check.size() && check == page;
+                    if (same)
+                    {
+                        match = candidate;
+                        break;
+                    }
+                }
+                if (match == stored.size())
+                {
+                    VtexTile tile = {};
+                    int size = Lz4Compress(page.data(), (int)page.size(), compressed.data(), (int)compressed.size(), level);
+                    if (size == 0 || size >= (int)page.size())
+                    {
+                        stored.push_back(page);
+                        tile.storedSize = (uint32_t)page.size() | VTEX_TILE_RAW;
+                    }
+                    else
+                    {
+                        stored.emplace_back(compressed.begin(), compressed.begin() + size);
+                        tile.storedSize = (uint32_t)size;
+                    }
+                    tile.checksum = VtexChecksum(stored.back().data(), stored.back().size());
+                    unique[hash].push_back(stored.size() - 1);
+                    uniqueTiles.push_back(tile);
+                }
+                tileData.push_back(match);
+            }
+        }
+    }
+
+    // header, one table entry per page pointing at its unique data, then the data
+    VtexHeader header;
+    memcpy(header.magic, VTEX_MAGIC, 4);
+    header.version = VTEX_VERSION;
+    header.size = (uint32_t)virtualSize;
+    header.tileSize = (uint32_t)tileSize;
+    header.border = (uint32_t)border;
+    header.levels = (uint32_t)levels;
+    uint64_t offset = sizeof(VtexHeader) + tileData.size() * sizeof(VtexTile);
+    for (VtexTile& tile : uniqueTiles)
+    {
+        tile.offset = offset;
+        offset += tile.storedSize & ~VTEX_TILE_RAW;
+    }
+
+    std::ofstream out(positional[1], std::ios::binary);
+    if (!out)
+    {
+        std::cout << "ERROR::MAKE_VTEX::CANNOT_WRITE: " << positional[1] << std::endl;
+        return 1;
+    }
+    out.write((const char*)&header, sizeof(header));
+    for (size_t index : tileData)
+        out.write((const char*)&uniqueTiles[index], sizeof(VtexTile));
+    for (const std::vector<unsigned char>& data : stored)
+        out.write((const char*)data.data(), data.size());
+
+    std::cout << "Wrote " << positional[1] << ": " << virtualSize << "x" << virtualSize << ", " << levels << " levels, " << tileData.size()
+              << " pages (" << stored.size() << " unique), " << offset / 1024 << " KB" << std::endl;
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Packs every file under an asset directory into a single .pak archive for the Vfs.
+// usage: pack_assets [--lz4 <level>] [--block <KB>] [--bench] <asset root> <output.pak> [subdirectory...]
+// e.g.   pack_assets --lz4 4 src assets.pak shaders textures   (logical paths become "shaders/...", "textures/...")
+//
+// --lz4    compress entries in independent blocks (level 1-12, higher packs slower but smaller)
+// --block  uncompressed block size in KB, 64-256 (default 128)
+// --bench  report ratio, packing time and decode bandwidth/CPU cost for every codec level first
+#include "../src/vfs.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+
+struct PackedFile
+{
+    std::string logical;
+    std::filesystem::path path;
+    std::vector<unsigned char> raw;
+    std::vector<unsigned char> stored;     // what goes in the archive, block table included
+    PakEntry entry;
+};
+
+static uint64_t alignUp(uint64_t value)
+{
+    return (value + PAK_ALIGNMENT - 1) & ~(PAK_ALIGNMENT - 1);
+}
+
+// splits raw into blocks and compresses each on its own; returns false if it didn't pay off
+static bool compressBlocks(const std::vector<unsigned char>& raw, uint32_t blockSize, int level, std::vector<unsigned char>& stored)
+{
+    uint32_t blockCount = (uint32_t)((raw.size() + blockSize - 1) / blockSize);
+    std::vector<uint32_t> sizes(blockCount);
+    std::vector<unsigned char> blocks;
+    std::vector<unsigned char> scratch(Lz4CompressBound((int)blockSize));
+    for (uint32_t i = 0; i < blockCount; i++)
+    {
+        const unsigned char* block = raw.data() + (size_t)i * blockSize;
+        int rawSize = (int)std::min<size_t>(blockSize, raw.size() - (size_t)i * blockSize);
+        int size = Lz4Compress(block, rawSize, scratch.data(), (int)scratch.size(), level);
+        if (size == 0 || size >= rawSize)
+        {
+            sizes[i] = (uint32_t)rawSize | PAK_BLOCK_RAW;                          // incompressible, e.g. png data
+            blocks.insert(blocks.end(), block, block + rawSize);
+        }
+        else
+        {
+            sizes[i] = (uint32_t)size;
+            blocks.insert(blocks.end(), scratch.begin(), scratch.begin() + size);
+        }
+    }
+    stored.resize(blockCount * sizeof(uint32_t));
+    memcpy(stored.data(), sizes.data(), stored.size());
+    stored.insert(stored.end(), blocks.begin(), blocks.end());
+    // keep entries that barely shrink uncompressed so they stay zero-copy
+    return stored.size() < raw.size() - raw.size() / 16;
+}
+
+static void bench(std::vector<PackedFile>& files, uint32_t blockSize)
+{
+    uint64_t rawBytes = 0;
+    for (const PackedFile& file : files)
+        rawBytes += file.raw.size();
+    std::cout << "level  ratio  pack ms  decode MB/s (1 thread)  decode MB/s (" << JobPool::Instance().WorkerCount() + 1 << " threads)  decode CPU ms" << std::endl;
+
+    for (int level : { 1, 2, 4, 6, 9, 12 })
+    {
+        struct Block { const unsigned char* data; int size; int rawSize; };
+        std::vector<std::vector<unsigned char>> compressed;
+        std::vector<Block> blocks;
+        uint64_t storedBytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const PackedFile& file : files)
+        {
+            for (size_t offset = 0; offset < file.raw.size(); offset += blockSize)
+            {
+                int rawSize = (int)std::min<size_t>(blockSize, file.raw.size() - offset);
+                std::vector<unsigned char> out(Lz4CompressBound(rawSize));
+                out.resize(Lz4Compress(file.raw.data() + offset, rawSize, out.data(), (int)out.size(), level));
+                storedBytes += out.size();
+                compressed.push_back(std::move(out));
+            }
+        }
+        double packSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (const std::vector<unsigned char>& out : compressed)
+            blocks.push_back({ out.data(), (int)out.size(), 0 });
+        size_t b = 0;
+        for (const PackedFile& file : files)
+            for (size_t offset = 0; offset < file.raw.size(); offset += blockSize)
+                blocks[b++].rawSize = (int)std::min<size_t>(blockSize, file.raw.size() - offset);
+
+        std::vector<unsigned char> destination((size_t)blockSize * blocks.size());
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < blocks.size(); i++)
+            Lz4Decompress(blocks[i].data, blocks[i].size, destination.data() + i * blockSize, blocks[i].rawSize);
+        double serialSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::atomic<int64_t> cpuNanoseconds{ 0 };
+        start = std::chrono::steady_clock::now();
+        JobPool::Instance().ParallelFor((int)blocks.size(), [&](int i)
+        {
+            auto blockStart = std::chrono::steady_clock::now();
+            Lz4Decompress(blocks[i].data, blocks[i].size, destination.data() + (size_t)i * blockSize, blocks[i].rawSize);
+            cpuNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - blockStart).count();
+        });
+        double parallelSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double megabytes = rawBytes / (1024.0 * 1024.0);
+        std::cout << level << "      " << (double)storedBytes / rawBytes << "  " << packSeconds * 1000.0 << "  "
+                  << megabytes / serialSeconds << "  " << megabytes / parallelSeconds << "  " << cpuNanoseconds.load() * 1e-6 << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int level = 0;
+    uint32_t blockSize = 128 * 1024;
+    bool runBench = false;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--lz4" && i + 1 < argc)
+            level = std::max(1, std::min(LZ4_MAX_LEVEL, atoi(argv[++i])));
+        else if (arg == "--block" && i + 1 < argc)
+            blockSize = (uint32_t)std::max(64, std::min(256, atoi(argv[++i]))) * 1024;
+        else if (arg == "--bench")
+            runBench = true;
+        else
+            positional.push_back(arg);
+    }
+    if (positional.size() < 2)
+    {
+        std::cout << "usage: pack_assets [--lz4 <level>] [--block <KB>] [--bench] <asset root> <output.pak> [subdirectory...]" << std::endl;
+        return 1;
+    }
+    std::filesystem::path root = positional[0];
+    std::vector<std::filesystem::path> directories;
+    for (size_t i = 2; i < positional.size(); i++)
+        directories.push_back(root / positional[i]);
+    if (directories.empty())
+        directories.push_back(root);
+
+    std::vector<PackedFile> files;
+    for (const std::filesystem::path& directory : directories)
+    {
+        for (const auto& item : std::filesystem::recursive_directory_iterator(directory))
+        {
+            if (!item.is_regular_file())
+                continue;
+            PackedFile file;
+            file.path = item.path();
+            file.logical = std::filesystem::relative(item.path(), root).generic_string();
+            std::ifstream in(file.path, std::ios::binary);
+            file.raw.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            file.entry = PakEntry();
+            file.entry.hash = PakHash(file.logical);
+            file.entry.size = file.raw.size();
+            files.push_back(std::move(file));
+        }
+    }
+    std::sort(files.begin(), files.end(), [](const PackedFile& a, const PackedFile& b) { return a.entry.hash < b.entry.hash; });
+
+    if (runBench)
+        bench(files, blockSize);
+
+    for (PackedFile& file : files)
+    {
+        file.entry.codec = PAK_CODEC_NONE;
+        file.entry.blockSize = 0;
+        if (level > 0 && !file.raw.empty() && compressBlocks(file.raw, blockSize, level, file.stored))
+        {
+            file.entry.codec = PAK_CODEC_LZ4;
+            file.entry.blockSize = blockSize;
+        }
+        else
+            file.stored.swap(file.raw);
+        file.entry.storedSize = file.stored.size();
+    }
+
+    // names block, then every entry's data on its own aligned offset
+    std::string names;
+    for (PackedFile& file : files)
+    {
+        file.entry.nameOffset = (uint32_t)names.size();
+        file.entry.nameLength = (uint32_t)file.logical.size();
+        names += file.logical;
+    }
+    uint64_t offset = alignUp(sizeof(PakHeader) + files.size() * sizeof(PakEntry) + names.size());
+    uint64_t rawBytes = 0;
+    for (PackedFile& file : files)
+    {
+        file.entry.offset = offset;
+        offset = alignUp(offset + file.entry.storedSize);
+        rawBytes += file.entry.size;
+    }
+
+    std::ofstream out(positional[1], std::ios::binary);
+    if (!out)
+    {
+        std::cout << "ERROR::PACK_ASSETS::CANNOT_WRITE: " << positional[1] << std::endl;
+        return 1;
+    }
+    PakHeader header;
+    memcpy(header.magic, PAK_MAGIC, 4);
+    header.version = PAK_VERSION;
+    header.entryCount = (uint32_t)files.size();
+    header.namesSize = (uint32_t)names.size();
+    out.write((const char*)&header, sizeof(header));
+    for (const PackedFile& file : files)
+        out.write((const char*)&file.entry, sizeof(PakEntry));
+    out.write(names.data(), names.size());
+
+    for (const PackedFile& file : files)
+    {
+        out.seekp((std::streamoff)file.entry.offset);
+        out.write((const char*)file.stored.data(), file.stored.size());
+    }
+    // pad the last entry out so the archive size is aligned too
+    out.seekp((std::streamoff)offset - 1);
+    out.put(0);
+
+    std::cout << "Packed " << files.size() << " files into " << positional[1] << " (" << rawBytes / 1024 << " KB -> "
+              << offset / 1024 << " KB)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,232 @@
+// Packs textures into the layers of a texture array (.tpack) for TextureArray.
+// usage: pack_textures [--page <texels>] [--padding <texels>] [--lz4 <level>] <asset root> <output.tpack> <texture...>
+// e.g.   pack_textures src src/textures/materials.tpack textures/image.png textures/dirt.jpg
+//        pack_textures --scene 500    (report on a generated scene instead of writing anything)
+//
+// Textures are named by their logical path, which is what TextureArray::Find takes. --scene packs
+// that many generated materials of mixed sizes, gives each 4 objects spread over a few shared
+// meshes, and counts the texture binds and draw calls of drawing them with a texture per
+// material against drawing them from the array
+#include "../src/texture_array.h"
+#include "../src/stb_image.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+// layers one array can be counted on to hold; GL 3.3 only promises 256
+const int ARRAY_LAYERS = 256;
+const int SCENE_MESHES = 16;
+
+struct SceneObject
+{
+    int Material;
+    int Mesh;
+};
+
+struct DrawCount
+{
+    int Binds = 0;
+    int Draws = 0;
+};
+
+// binds and draws of drawing objects in order: a bind whenever textureOf changes, and a draw for
+// every run of objects with the same mesh and texture, which one instanced draw covers
+template <typename F>
+static DrawCount countDraws(const std::vector<SceneObject>& objects, const F& textureOf)
+{
+    DrawCount count;
+    int boundTexture = -1, lastMesh = -1;
+    for (const SceneObject& object : objects)
+    {
+        int texture = textureOf(object);
+        if (texture != boundTexture)
+        {
+            count.Binds++;
+            boundTexture = texture;
+            lastMesh = -1;
+        }
+        if (object.Mesh != lastMesh)
+        {
+            count.Draws++;
+            lastMesh = object.Mesh;
+        }
+    }
+    return count;
+}
+
+static int reportScene(int materials, int pageSize, int padding)
+{
+    // sizes a material library tends to have: mostly powers of two, some odd ones from atlased UI
+    // and decals
+    std::mt19937 random(42);
+    const int sizes[] = { 64, 128, 128, 256, 256, 256, 512, 512, 1024 };
+    TexturePacker packer(pageSize, padding);
+    uint64_t separateBytes = 0;
+    for (int i = 0; i < materials; i++)
+    {
+        int width = sizes[random() % 9], height = sizes[random() % 9];
+        if (random() % 5 == 0)
+        {
+            width = 48 + random() % 400;
+            height = 48 + random() % 400;
+        }
+        std::vector<unsigned char> pixels((size_t)width * height * 4, (unsigned char)i);
+        packer.Add("material" + std::to_string(i), pixels.data(), width, height);
+        separateBytes += (uint64_t)width * height * 4 * 4 / 3;
+    }
+    auto start = std::chrono::steady_clock::now();
+    packer.Pack();
+    double packMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // 4 objects per material on random meshes, in the order a scene walk would reach them
+    std::vector<SceneObject> objects;
+    for (int i = 0; i < materials; i++)
+        for (int j = 0; j < 4; j++)
+            objects.push_back({ i, (int)(random() % SCENE_MESHES) });
+    std::shuffle(objects.begin(), objects.end(), random);
+
+    // a texture per material, as walked and sorted by material then mesh
+    auto materialOf = [](const SceneObject& object) { return object.Material; };
+    DrawCount unsorted = countDraws(objects, materialOf);
+    std::vector<SceneObject> sorted = objects;
+    std::sort(sorted.begin(), sorted.end(), [](const SceneObject& a, const SceneObject& b)
+    {
+        return a.Material != b.Material ? a.Material < b.Material : a.Mesh < b.Mesh;
+    });
+    DrawCount bySeparateMaterial = countDraws(sorted, materialOf);
+
+    // the array: the renderer keeps one instance buffer per mesh with each instance's layer and
+    // rect, so objects are grouped by the array their layer is in and then by mesh
+    auto arrayOf = [&](const SceneObject& object) { return packer.Entries[object.Material].Layer / ARRAY_LAYERS; };
+    std::vector<SceneObject> grouped = objects;
+    std::stable_sort(grouped.begin(), grouped.end(), [&](const SceneObject& a, const SceneObject& b)
+    {
+        return arrayOf(a) != arrayOf(b) ? arrayOf(a) < arrayOf(b) : a.Mesh < b.Mesh;
+    });
+    DrawCount array = countDraws(grouped, arrayOf);
+
+    float occupancy = 0.0f;
+    for (float page : packer.Occupancy)
+        occupancy += page;
+    uint64_t arrayBytes = (uint64_t)pageSize * pageSize * 4 * packer.Pages.size() * 4 / 3;
+    std::cout << materials << " materials, " << objects.size() << " objects: packed into " << packer.Pages.size() << " layers of " << pageSize << "x" << pageSize
+              << " in " << packMs << " ms, " << occupancy / packer.Pages.size() * 100.0f << "% occupied" << std::endl;
+    std::cout << "  one texture per material:  " << unsorted.Binds << " binds and " << unsorted.Draws << " draws in scene order, "
+              << bySeparateMaterial.Binds << " binds and " << bySeparateMaterial.Draws << " draws sorted by material, " << separateBytes / (1024 * 1024) << " MB" << std::endl;
+    std::cout << "  texture array:             " << array.Binds << " binds and " << array.Draws << " instanced draws over " << SCENE_MESHES << " meshes, "
+              << arrayBytes / (1024 * 1024) << " MB" << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int pageSize = 2048;
+    int padding = 8;
+    int level = 4;
+    int scene = 0;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--page" && i + 1 < argc)
+            pageSize = atoi(argv[++i]);
+        else if (arg == "--padding" && i + 1 < argc)
+            padding = atoi(argv[++i]);
+        else if (arg == "--lz4" && i + 1 < argc)
+            level = std::max(1, std::min(LZ4_MAX_LEVEL, atoi(argv[++i])));
+        else if (arg == "--scene" && i + 1 < argc)
+            scene = atoi(argv[++i]);
+        else
+            positional.push_back(arg);
+    }
+    if (pageSize <= 0 || (pageSize & (pageSize - 1)) != 0 || padding < 1 || padding * 4 > pageSize)
+    {
+        std::cout << "ERROR::PACK_TEXTURES::BAD_PAGE: the page has to be a power of two, padding at least 1 and under a quarter of the page" << std::endl;
+        return 1;
+    }
+    if (scene > 0)
+        return reportScene(scene, pageSize, padding);
+    if (positional.size() < 3)
+    {
+        std::cout << "usage: pack_textures [--page <texels>] [--padding <texels>] [--lz4 <level>] <asset root> <output.tpack> <texture...>" << std::endl;
+        std::cout << "       pack_textures --scene <materials>" << std::endl;
+        return 1;
+    }
+
+    TexturePacker packer(pageSize, padding);
+    for (size_t i = 2; i < positional.size(); i++)
+    {
+        std::string path = positional[0] + "/" + positional[i];
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        if (!pixels)
+        {
+            std::cout << "ERROR::PACK_TEXTURES::CANNOT_READ: " << path << std::endl;
+            return 1;
+        }
+        packer.Add(positional[i], pixels, width, height);
+        stbi_image_free(pixels);
+    }
+    packer.Pack();
+
+    // header, entries, names, page table, then the pages
+    TpackHeader header;
+    memcpy(header.magic, TPACK_MAGIC, 4);
+    header.version = TPACK_VERSION;
+    header.pageSize = (uint32_t)pageSize;
+    header.padding = (uint32_t)padding;
+    header.pages = (uint32_t)packer.Pages.size();
+    header.entries = (uint32_t)packer.Entries.size();
+    std::vector<TpackEntry> entries;
+    uint64_t offset = sizeof(TpackHeader) + packer.Entries.size() * sizeof(TpackEntry) + packer.Pages.size() * sizeof(TpackPage);
+    for (const PackedTexture& packed : packer.Entries)
+    {
+        entries.push_back({ (uint32_t)packed.Layer, (uint32_t)packed.X, (uint32_t)packed.Y, (uint32_t)packed.Width, (uint32_t)packed.Height, (uint32_t)packed.Name.size() });
+        offset += packed.Name.size();
+    }
+    std::vector<TpackPage> pages;
+    std::vector<std::vector<unsigned char>> stored;
+    std::vector<unsigned char> compressed(Lz4CompressBound((int)packer.Pages[0].size()));
+    for (const std::vector<unsigned char>& texels : packer.Pages)
+    {
+        TpackPage page = {};
+        page.offset = offset;
+        int size = Lz4Compress(texels.data(), (int)texels.size(), compressed.data(), (int)compressed.size(), level);
+        if (size == 0 || size >= (int)texels.size())
+        {
+            stored.push_back(texels);
+            page.storedSize = (uint32_t)texels.size() | TPACK_PAGE_RAW;
+        }
+        else
+        {
+            stored.emplace_back(compressed.begin(), compressed.begin() + size);
+            page.storedSize = (uint32_t)size;
+        }
+        offset += stored.back().size();
+        pages.push_back(page);
+    }
+
+    std::ofstream out(positional[1], std::ios::binary);
+    if (!out)
+    {
+        std::cout << "ERROR::PACK_TEXTURES::CANNOT_WRITE: " << positional[1] << std::endl;
+        return 1;
+    }
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)entries.data(), entries.size() * sizeof(TpackEntry));
+    for (const PackedTexture& packed : packer.Entries)
+        out.write(packed.Name.data(), packed.Name.size());
+    out.write((const char*)pages.data(), pages.size() * sizeof(TpackPage));
+    for (const std::vector<unsigned char>& data : stored)
+        out.write((const char*)data.data(), data.size());
+
+    for (const PackedTexture& packed : packer.Entries)
+        std::cout << "  " << packed.Name << ": layer " << packed.Layer << " at " << packed.X << "," << packed.Y << " (" << packed.Width << "x" << packed.Height << ")" << std::endl;
+    std::cout << "Wrote " << positional[1] << ": " << packer.Entries.size() << " textures in " << packer.Pages.size() << " layers, " << offset / 1024 << " KB" << std::endl;
+    return 0;
+}
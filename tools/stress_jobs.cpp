@@ -0,0 +1,160 @@
+// Stress test of the job pool, built with ThreadSanitizer so data races in the scheduler and in
+// the happens-before edges it promises are reported even when the results come out right.
+// usage: stress_jobs [workers] [rounds]
+//
+// Each round runs, on a pool of its own that is destroyed at the end of the round:
+// - ParallelFor over plain ints, each index written by exactly one job
+// - jobs that submit jobs and wait on them, and ParallelFor from inside a job
+// - dependency chains where every link appends to a plain vector after the one before it
+// - Submit and Wait from threads the pool does not own, all at once
+// and at the end a pool is destroyed with jobs left in it
+// A job submitted after a counter has to see everything the jobs of that counter wrote, so the
+// vectors are deliberately not atomic. Exits with 1 if a result is wrong; races are reported by
+// TSan (and fail the run with halt_on_error=1 in TSAN_OPTIONS)
+#include "../src/job_pool.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cout << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+static void parallelFor(JobPool& pool)
+{
+    for (int count : { 1, 7, 64, 1000, 100000 })
+    {
+        std::vector<int> hits(count, 0);
+        pool.ParallelFor(count, [&](int i) { hits[i]++; });
+        int wrong = 0;
+        for (int hit : hits)
+            wrong += hit != 1;
+        check(wrong == 0, "ParallelFor(" + std::to_string(count) + ") ran " + std::to_string(wrong) + " indices other than once");
+    }
+}
+
+// a binary tree of jobs, each waiting on its two children from inside the pool
+static int64_t nestedSum(JobPool& pool, int depth)
+{
+    if (depth == 0)
+        return 1;
+    int64_t left = 0, right = 0;
+    JobCounter children;
+    pool.Submit([&]() { left = nestedSum(pool, depth - 1); }, &children);
+    pool.Submit([&]() { right = nestedSum(pool, depth - 1); }, &children);
+    pool.Wait(children);
+    return left + right;
+}
+
+static void nested(JobPool& pool)
+{
+    check(nestedSum(pool, 10) == 1024, "nested jobs lost a leaf");
+
+    std::vector<std::vector<int>> rows(64, std::vector<int>(256, 0));
+    pool.ParallelFor((int)rows.size(), [&](int row)
+    {
+        pool.ParallelFor((int)rows[row].size(), [&](int i) { rows[row][i] = row + i; }, 16);
+    }, 1);
+    int wrong = 0;
+    for (int row = 0; row < (int)rows.size(); row++)
+        for (int i = 0; i < (int)rows[row].size(); i++)
+            wrong += rows[row][i] != row + i;
+    check(wrong == 0, "ParallelFor inside ParallelFor missed " + std::to_string(wrong) + " elements");
+}
+
+static void chains(JobPool& pool)
+{
+    const int CHAINS = 16, LINKS = 64;
+    std::vector<std::vector<int>> order(CHAINS);
+    std::vector<std::unique_ptr<JobCounter>> links;
+    for (int i = 0; i < CHAINS * LINKS; i++)
+        links.emplace_back(new JobCounter());
+    // submitted link by link across the chains, so later links are mostly parked when submitted
+    for (int link = 0; link < LINKS; link++)
+        for (int chain = 0; chain < CHAINS; chain++)
+        {
+            JobCounter* after = link > 0 ? links[chain * LINKS + link - 1].get() : NULL;
+            pool.Submit([&order, chain, link]() { order[chain].push_back(link); }, links[chain * LINKS + link].get(), after);
+        }
+    for (std::unique_ptr<JobCounter>& counter : links)
+        pool.Wait(*counter);
+    for (int chain = 0; chain < CHAINS; chain++)
+    {
+        bool inOrder = (int)order[chain].size() == LINKS;
+        for (int link = 0; inOrder && link < LINKS; link++)
+            inOrder = order[chain][link] == link;
+        check(inOrder, "chain " + std::to_string(chain) + " ran out of order");
+    }
+}
+
+static void outsideThreads(JobPool& pool)
+{
+    const int THREADS = 4, JOBS = 500;
+    std::vector<std::vector<int>> results(THREADS, std::vector<int>(JOBS, 0));
+    std::vector<std::thread> submitters;
+    for (int t = 0; t < THREADS; t++)
+        submitters.emplace_back([&pool, &results, t]()
+        {
+            JobCounter counter;
+            for (int i = 0; i < JOBS; i++)
+                pool.Submit([&results, t, i]() { results[t][i] = i * 3; }, &counter);
+            pool.Wait(counter);
+            pool.ParallelFor(JOBS, [&](int i) { results[t][i] += 1; });
+        });
+    for (std::thread& submitter : submitters)
+        submitter.join();
+    int wrong = 0;
+    for (int t = 0; t < THREADS; t++)
+        for (int i = 0; i < JOBS; i++)
+            wrong += results[t][i] != i * 3 + 1;
+    check(wrong == 0, "jobs from outside threads: " + std::to_string(wrong) + " wrong results");
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int workers = argc > 1 ? (unsigned int)std::max(1, atoi(argv[1])) : std::max(3u, std::thread::hardware_concurrency());
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    std::cout << workers << " workers, " << rounds << " rounds" << std::endl;
+    for (int round = 0; round < rounds && failures == 0; round++)
+    {
+        JobPool pool(workers);
+        parallelFor(pool);
+        nested(pool);
+        chains(pool);
+        outsideThreads(pool);
+    }
+    {
+        // jobs still queued when the pool goes away are run before it does
+        std::atomic<int> ran{ 0 };
+        {
+            JobPool pool(workers);
+            for (int i = 0; i < 1000; i++)
+                pool.Submit([&ran]() { ran.fetch_add(1); });
+        }
+        check(ran.load() == 1000, "the pool went away with " + std::to_string(1000 - ran.load()) + " jobs unrun");
+    }
+    {
+        // a pool without workers that is never waited on drops its jobs, and the counters they
+        // signal, and the jobs parked behind them, still finish
+        JobCounter first, second;
+        {
+            JobPool pool(0);
+            pool.Submit([]() {}, &first);
+            pool.Submit([]() {}, &second, &first);
+        }
+        check(first.Done() && second.Done(), "dropped jobs left their counters unfinished");
+    }
+    std::cout << (failures ? "FAILED" : "OK") << std::endl;
+    return failures ? 1 : 0;
+}